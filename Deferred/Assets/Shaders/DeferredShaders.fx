@@ -52,6 +52,31 @@ VertexOutput VS_Geometry(VertexInput input)
     return output;
 }
 
+// Draws sharing a mesh and material batched into one instanced draw, each
+// instance's PerDrawCB read from the instances buffer by SV_InstanceID.
+cbuffer InstanceBatchCB : register(b7)
+{
+	uint firstInstance; // start of this draw's range in instances.
+};
+
+struct InstanceData
+{
+	matrix matInstanceMVP;
+};
+
+StructuredBuffer<InstanceData> instances : register(t9);
+
+VertexOutput VS_GeometryInstanced(VertexInput input, uint instanceId : SV_InstanceID)
+{
+    VertexOutput output;
+    output.vpos  = mul(float4(input.pos, 1.0f), instances[firstInstance + instanceId].matInstanceMVP);
+    output.color = input.color;
+    output.normal = input.normal;
+    output.uv = input.uv;
+
+    return output;
+}
+
 //geometry rendering
 struct GBufferOut {
 	float4 vColourSpec : SV_TARGET0;
@@ -160,11 +185,12 @@ float4 PS_GBufferDebug_Depth(VertexOutput input) : SV_TARGET
 ///////////////////////////////////////////////////////////////////////////////
 cbuffer LightInfo : register(b2)
 {
-	float4 vLightPosition; // w == 0 then directional
-	float4 vLightDirection; // for directional and spot , w == 0 then point.
-	float4 vLightColour; // all types
-	float4 vLightAtt; // light attenuation factors spot and point.
-	// various spot params... to be added.
+	float4 vLightPosition; // w : 0 directional, 1 point, 2 spot.
+	float4 vLightDirection; // for directional and spot, cosine of the spot outer angle in w.
+	float4 vLightColour; // all types, cosine of the spot inner angle in w.
+	float4 vLightAtt; // light attenuation factors spot and point, radius in w.
+	uint lightShadow; // first shadow view, 0xffffffff without one.
+	uint3 lightPadding;
 };
 
 
@@ -186,10 +212,34 @@ float4 PS_DirectionalLight(VertexOutput input) : SV_TARGET
  	return float4(diffuseColour, 1.f);
 }
 
+// Post projection depth range of a light's bounding sphere, clamped to [0, 1].
+// D3D11 has no depth bounds test, so the light shaders compare the G-buffer
+// depth against this before fetching anything else.
+// Mirrors light_depth_bounds in LightVolumes.cpp.
+float2 LightDepthBounds(float3 centre, float radius)
+{
+	float viewZ = mul(float4(centre, 1.0f), matView).z;
+	float4 nearClip = mul(float4(0, 0, viewZ - radius, 1.0f), matProjection);
+	float4 farClip = mul(float4(0, 0, viewZ + radius, 1.0f), matProjection);
+
+	// An end behind the eye means the sphere reaches the near plane.
+	float2 depths = float2(nearClip.w > 0 ? nearClip.z / nearClip.w : 0, farClip.w > 0 ? farClip.z / farClip.w : 0);
+	return saturate(float2(min(depths.x, depths.y), max(depths.x, depths.y)));
+}
+
+// True for sky pixels and pixels outside the light's depth range.
+// The light shaders return black for these rather than discard, a discarded
+// pixel would skip the stencil op that clears the volume's mark.
+bool OutsideDepthBounds(float fDepth, float2 depthBounds)
+{
+	return fDepth >= 0.99999f || fDepth < depthBounds.x || fDepth > depthBounds.y;
+}
+
 struct LightVolumeVertexOutput
 {
     float4 vpos  : SV_POSITION;
     float4 vScreenPos : TEXCOORD0;
+    nointerpolation float2 depthBounds : DEPTHBOUNDS;
 };
 
 LightVolumeVertexOutput VS_LightVolume(VertexInput input)
@@ -197,19 +247,22 @@ LightVolumeVertexOutput VS_LightVolume(VertexInput input)
     LightVolumeVertexOutput output;
     output.vpos  = mul(float4(input.pos.xyz, 1.0f), matMVP);
     output.vScreenPos = output.vpos;
+    output.depthBounds = LightDepthBounds(vLightPosition.xyz, vLightAtt.w);
     return output;
 }
 
 float4 PS_PointLight(LightVolumeVertexOutput input) : SV_TARGET
 {
+ 	// depth bounds first, fragments we didn't write in the Geometry pass fail it too.
+ 	float fDepth = gBufferDepth.Load(int3(input.vpos.xy, 0)).r;
+ 	[branch]
+ 	if (OutsideDepthBounds(fDepth, input.depthBounds))
+ 		return float4(0, 0, 0, 1.f);
+
 	float2 ScreenUV = (input.vScreenPos.xy / input.vScreenPos.w * 0.5 + 0.5) * float2(1, -1) + float2(0, 1);
 
  	float4 vColourSpec = gBufferColourSpec.Sample(linearMipSampler, ScreenUV);
  	float4 vNormalPow = gBufferNormalPow.Sample(linearMipSampler, ScreenUV);
- 	float fDepth = gBufferDepth.Sample(linearMipSampler, ScreenUV).r;
- 	 
- 	// discard fragments we didn't write in the Geometry pass.
- 	clip(0.99999f - fDepth);
 
  	// decode the gbuffer.
  	float3 materialColour = vColourSpec.xyz;
@@ -228,11 +281,9 @@ float4 PS_PointLight(LightVolumeVertexOutput input) : SV_TARGET
 
  	//Compute light attenuation
 	float kAtt = 1.0 / (vLightAtt.x + vLightAtt.y*lightDistance + vLightAtt.z*lightDistance*lightDistance);
+	// falls to zero at the volume radius.
 	kAtt *= 1.0f - smoothstep(vLightAtt.w - 0.25f, vLightAtt.w, lightDistance);
 
-	// clip outside of volume radius.
-	clip(vLightAtt.w - lightDistance);
-
 	float kDiffuse = max(dot(lightDir, N),0) * kAtt; 
 
  	float3 diffuseColour = kDiffuse * materialColour * vLightColour.rgb;
@@ -244,3 +295,518 @@ float4 PS_PointLight(LightVolumeVertexOutput input) : SV_TARGET
 
 ///////////////////////////////////////////////////////////////////////////////
 
+///////////////////////////////////////////////////////////////////////////////
+// Tiled Deferred Lighting
+// CS_TileLightCulling bins every light into 16x16 screen tiles using the
+// depth range of each tile, PS_TiledLighting then shades each pixel against
+// its tile's list in a single full screen pass.
+// Mirrors bin_lights_tiled in TiledLightCulling.cpp, keep the two in step.
+///////////////////////////////////////////////////////////////////////////////
+
+#define LIGHT_TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 255
+#define TILE_LIST_STRIDE (MAX_LIGHTS_PER_TILE + 1) // count then indices.
+
+#define LIGHT_TYPE_SPOT 2.0f
+
+// 80 bytes, laid out as GPULight in LightSystem.h which checks the offsets.
+struct Light
+{
+	float4 vPosition; // w : 0 directional, 1 point, 2 spot.
+	float4 vDirection; // cosine of the spot outer angle in w.
+	float4 vColour; // cosine of the spot inner angle in w.
+	float4 vAtt; // attenuation factors, radius in w.
+	uint shadow; // first shadow view, cascades or cube faces follow.
+	uint3 padding;
+};
+
+// True when a cone is entirely behind a plane, matches cone_behind_plane in TiledLightCulling.h.
+bool ConeBehindPlane(float3 n, float apexDistance, float3 axis, float length, float capRadius)
+{
+	float axisDot = dot(n, axis);
+	float capDistance = apexDistance + length * axisDot + capRadius * sqrt(max(1.0f - axisDot * axisDot, 0.0f));
+	return apexDistance < 0.0f && capDistance < 0.0f;
+}
+
+// Radius of a spot light's end cap, range * tan(outer angle).
+float SpotCapRadius(Light light)
+{
+	float cosOuter = light.vDirection.w;
+	return light.vAtt.w * sqrt(1.0f - cosOuter * cosOuter) / cosOuter;
+}
+
+cbuffer TileCullingCB : register(b3)
+{
+	uint2 screenSize;
+	uint2 tileCount;
+	uint lightCount;
+};
+
+StructuredBuffer<Light> lights : register(t3);
+StructuredBuffer<uint> tileLights : register(t4);
+RWStructuredBuffer<uint> tileLightsRW : register(u0);
+
+groupshared uint tileMinDepth;
+groupshared uint tileMaxDepth;
+groupshared uint tileLightCount;
+
+float3 UnprojectToView(float2 ndc, float depth)
+{
+	float4 viewPos = mul(float4(ndc, depth, 1.0f), matInverseProjection);
+	return viewPos.xyz / viewPos.w;
+}
+
+[numthreads(LIGHT_TILE_SIZE, LIGHT_TILE_SIZE, 1)]
+void CS_TileLightCulling(uint3 groupId : SV_GroupID, uint3 dispatchId : SV_DispatchThreadID, uint groupIndex : SV_GroupIndex)
+{
+	if (groupIndex == 0)
+	{
+		tileMinDepth = 0x7f7fffff;
+		tileMaxDepth = 0;
+		tileLightCount = 0;
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	// Depth range of the tile, positive floats order the same as their bits.
+	if (all(dispatchId.xy < screenSize))
+	{
+		float fDepth = gBufferDepth.Load(int3(dispatchId.xy, 0)).r;
+		if (fDepth < 1.0f)
+		{
+			InterlockedMin(tileMinDepth, asuint(fDepth));
+			InterlockedMax(tileMaxDepth, asuint(fDepth));
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	uint tileIndex = groupId.y * tileCount.x + groupId.x;
+	float minDepth = asfloat(tileMinDepth);
+	float maxDepth = asfloat(tileMaxDepth);
+
+	// Empty tiles keep a zero count.
+	if (minDepth <= maxDepth)
+	{
+		float x0 = float(groupId.x * LIGHT_TILE_SIZE) / screenSize.x * 2.0f - 1.0f;
+		float x1 = float(min((groupId.x + 1) * LIGHT_TILE_SIZE, screenSize.x)) / screenSize.x * 2.0f - 1.0f;
+		float y0 = 1.0f - float(groupId.y * LIGHT_TILE_SIZE) / screenSize.y * 2.0f;
+		float y1 = 1.0f - float(min((groupId.y + 1) * LIGHT_TILE_SIZE, screenSize.y)) / screenSize.y * 2.0f;
+		float2 centre = float2(x0 + x1, y0 + y1) * 0.5f;
+
+		float3 corners[4] =
+		{
+			UnprojectToView(float2(x0, y0), 1.0f),
+			UnprojectToView(float2(x1, y0), 1.0f),
+			UnprojectToView(float2(x1, y1), 1.0f),
+			UnprojectToView(float2(x0, y1), 1.0f)
+		};
+		float3 centreRay = UnprojectToView(centre, 1.0f);
+
+		// Side planes through the eye, facing into the tile.
+		float3 planes[4];
+		[unroll]
+		for (uint p = 0; p < 4; ++p)
+		{
+			float3 n = normalize(cross(corners[p], corners[(p + 1) & 3]));
+			planes[p] = dot(n, centreRay) < 0.0f ? -n : n;
+		}
+
+		float zA = UnprojectToView(centre, minDepth).z;
+		float zB = UnprojectToView(centre, maxDepth).z;
+		float minZ = min(zA, zB);
+		float maxZ = max(zA, zB);
+
+		for (uint i = groupIndex; i < lightCount; i += LIGHT_TILE_SIZE * LIGHT_TILE_SIZE)
+		{
+			Light light = lights[i];
+
+			bool bVisible = true;
+			if (light.vPosition.w != 0.0f)
+			{
+				float3 c = mul(float4(light.vPosition.xyz, 1.0f), matView).xyz;
+				float r = light.vAtt.w;
+
+				bVisible = c.z + r >= minZ && c.z - r <= maxZ;
+				[unroll]
+				for (uint p = 0; p < 4; ++p)
+				{
+					bVisible = bVisible && dot(planes[p], c) >= -r;
+				}
+
+				// Spots also need their cone inside the tile.
+				if (bVisible && light.vPosition.w == LIGHT_TYPE_SPOT)
+				{
+					float3 axis = mul(float4(light.vDirection.xyz, 0.0f), matView).xyz;
+					float capRadius = SpotCapRadius(light);
+
+					bVisible = !ConeBehindPlane(float3(0, 0, 1), c.z - minZ, axis, r, capRadius)
+						&& !ConeBehindPlane(float3(0, 0, -1), maxZ - c.z, axis, r, capRadius);
+					[unroll]
+					for (uint q = 0; q < 4; ++q)
+					{
+						bVisible = bVisible && !ConeBehindPlane(planes[q], dot(planes[q], c), axis, r, capRadius);
+					}
+				}
+			}
+
+			if (bVisible)
+			{
+				uint slot;
+				InterlockedAdd(tileLightCount, 1, slot);
+				if (slot < MAX_LIGHTS_PER_TILE)
+				{
+					tileLightsRW[tileIndex * TILE_LIST_STRIDE + 1 + slot] = i;
+				}
+			}
+		}
+	}
+	GroupMemoryBarrierWithGroupSync();
+
+	if (groupIndex == 0)
+	{
+		tileLightsRW[tileIndex * TILE_LIST_STRIDE] = min(tileLightCount, MAX_LIGHTS_PER_TILE);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Shadows
+// Every shadow map is a tile of one depth atlas. A light's shadow field is
+// its first view, a directional light's cascades and a point light's cube
+// faces (+X -X +Y -Y +Z -Z) follow it in shadowViews.
+///////////////////////////////////////////////////////////////////////////////
+
+#define NO_SHADOW 0xffffffff
+#define MAX_SHADOW_CASCADES 4
+
+struct ShadowView
+{
+	float4x4 matViewProjection;
+	float4 atlasRect; // uv scale in xy, offset in zw.
+	float4 params; // depth bias in x.
+};
+
+cbuffer ShadowCB : register(b6)
+{
+	float4 cascadeEnds; // view distance where each cascade stops.
+	uint cascadeCount;
+	float atlasTexelSize;
+};
+
+StructuredBuffer<ShadowView> shadowViews : register(t7);
+Texture2D<float> shadowAtlas : register(t8);
+SamplerComparisonState shadowSampler : register(s1);
+
+VertexOutput VS_ShadowCaster(VertexInput input)
+{
+	VertexOutput output;
+	output.vpos = mul(float4(input.pos.xyz, 1.0f), matMVP);
+	output.color = input.color;
+	output.normal = input.normal;
+	output.uv = input.uv;
+	return output;
+}
+
+// Full screen quad at the far plane, clears one tile without touching the cached ones around it.
+VertexOutput VS_ShadowClear(VertexInput input)
+{
+	VertexOutput output;
+	output.vpos = float4(input.pos.xy, 1.0f, 1.0f);
+	output.color = input.color;
+	output.normal = input.normal;
+	output.uv = input.uv;
+	return output;
+}
+
+// Fraction of the light reaching worldPos, one bilinear comparison tap.
+float LightShadow(Light light, float3 worldPos)
+{
+	if (light.shadow == NO_SHADOW)
+	{
+		return 1.0f;
+	}
+
+	uint viewIndex = light.shadow;
+	if (light.vPosition.w == 0.0f)
+	{
+		float viewDistance = -mul(float4(worldPos, 1.0f), matView).z;
+		if (viewDistance > cascadeEnds[cascadeCount - 1])
+		{
+			return 1.0f;
+		}
+
+		[unroll]
+		for (uint i = 0; i < MAX_SHADOW_CASCADES - 1; ++i)
+		{
+			viewIndex += (i + 1 < cascadeCount && viewDistance > cascadeEnds[i]) ? 1 : 0;
+		}
+	}
+	else if (light.vPosition.w != LIGHT_TYPE_SPOT)
+	{
+		// Cube face by the major axis of the direction from the light.
+		float3 d = worldPos - light.vPosition.xyz;
+		float3 a = abs(d);
+		viewIndex += a.x >= a.y && a.x >= a.z ? (d.x > 0 ? 0 : 1) : (a.y >= a.z ? (d.y > 0 ? 2 : 3) : (d.z > 0 ? 4 : 5));
+	}
+
+	ShadowView view = shadowViews[viewIndex];
+	float4 shadowPos = mul(float4(worldPos, 1.0f), view.matViewProjection);
+	shadowPos.xyz /= shadowPos.w;
+	if (shadowPos.z >= 1.0f)
+	{
+		return 1.0f;
+	}
+
+	// Keep the filter footprint inside the tile.
+	float2 inset = atlasTexelSize * 0.5f / view.atlasRect.xy;
+	float2 uv = clamp(shadowPos.xy * float2(0.5f, -0.5f) + 0.5f, inset, 1.0f - inset);
+	return shadowAtlas.SampleCmpLevelZero(shadowSampler, uv * view.atlasRect.xy + view.atlasRect.zw, shadowPos.z - view.params.x);
+}
+
+float3 ShadeLight(Light light, float3 worldPos, float3 N, float3 materialColour)
+{
+	// Directional.
+	if (light.vPosition.w == 0.0f)
+	{
+		float kDiffuse = max(dot(light.vDirection.xyz, N), 0);
+		[branch]
+		if (kDiffuse > 0)
+		{
+			kDiffuse *= LightShadow(light, worldPos);
+		}
+		return kDiffuse * materialColour * light.vColour.rgb;
+	}
+
+	// Point, same falloff as PS_PointLight.
+	float3 vToLight = light.vPosition.xyz - worldPos;
+	float lightDistance = length(vToLight);
+	if (lightDistance >= light.vAtt.w)
+	{
+		return 0;
+	}
+
+	float kAtt = 1.0 / (light.vAtt.x + light.vAtt.y*lightDistance + light.vAtt.z*lightDistance*lightDistance);
+	kAtt *= 1.0f - smoothstep(light.vAtt.w - 0.25f, light.vAtt.w, lightDistance);
+
+	// Spot, fade from the inner to the outer angle.
+	if (light.vPosition.w == LIGHT_TYPE_SPOT)
+	{
+		float cosAngle = dot(-vToLight / lightDistance, light.vDirection.xyz);
+		kAtt *= smoothstep(light.vDirection.w, light.vColour.w, cosAngle);
+	}
+
+	float kDiffuse = max(dot(vToLight / lightDistance, N), 0) * kAtt;
+	[branch]
+	if (kDiffuse > 0)
+	{
+		kDiffuse *= LightShadow(light, worldPos);
+	}
+	return kDiffuse * materialColour * light.vColour.rgb;
+}
+
+float4 PS_TiledLighting(VertexOutput input) : SV_TARGET
+{
+ 	float4 vColourSpec = gBufferColourSpec.Sample(linearMipSampler, input.uv);
+ 	float4 vNormalPow = gBufferNormalPow.Sample(linearMipSampler, input.uv);
+ 	float fDepth = gBufferDepth.Sample(linearMipSampler, input.uv).r;
+
+ 	// discard fragments we didn't write in the Geometry pass.
+ 	clip(0.99999f - fDepth);
+
+ 	float3 materialColour = vColourSpec.rgb;
+	float3 N = vNormalPow.xyz;
+
+	// Decode world position for uv
+ 	float2 flipUV = input.uv.xy * float2(1,-1) + float2(0,1);
+ 	float4 clipPos = float4(flipUV * 2.0f - 1.0f, fDepth, 1.0f);
+ 	float4 viewPos = mul(clipPos, matInverseProjection);
+ 	viewPos /= viewPos.w;
+ 	float3 worldPos = mul(viewPos, matInverseView).xyz;
+
+	uint2 pixel = min(uint2(input.uv * screenSize), screenSize - 1);
+	uint tileIndex = (pixel.y / LIGHT_TILE_SIZE) * tileCount.x + pixel.x / LIGHT_TILE_SIZE;
+	uint listStart = tileIndex * TILE_LIST_STRIDE;
+	uint count = tileLights[listStart];
+
+	float3 colour = 0;
+	for (uint i = 0; i < count; ++i)
+	{
+		colour += ShadeLight(lights[tileLights[listStart + 1 + i]], worldPos, N, materialColour);
+	}
+
+ 	return float4(colour, 1.f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Clustered Deferred Lighting
+// The froxel grid and its light lists are built by LightClusterGrid on the
+// CPU, a pixel finds its cluster from its tile and exponential depth slice.
+///////////////////////////////////////////////////////////////////////////////
+
+struct LightCluster
+{
+	uint offset;
+	uint count;
+};
+
+cbuffer ClusterCB : register(b4)
+{
+	uint3 clusterDims;
+	float clusterNear;
+	float clusterSliceScale; // slices per log unit of depth.
+	float clusterForwardSign; // view space z sign in front of the camera.
+};
+
+StructuredBuffer<LightCluster> clusters : register(t5);
+StructuredBuffer<uint> clusterLightIndices : register(t6);
+
+float4 PS_ClusteredLighting(VertexOutput input) : SV_TARGET
+{
+ 	float4 vColourSpec = gBufferColourSpec.Sample(linearMipSampler, input.uv);
+ 	float4 vNormalPow = gBufferNormalPow.Sample(linearMipSampler, input.uv);
+ 	float fDepth = gBufferDepth.Sample(linearMipSampler, input.uv).r;
+
+ 	// discard fragments we didn't write in the Geometry pass.
+ 	clip(0.99999f - fDepth);
+
+ 	float3 materialColour = vColourSpec.rgb;
+	float3 N = vNormalPow.xyz;
+
+	// Decode world position for uv
+ 	float2 flipUV = input.uv.xy * float2(1,-1) + float2(0,1);
+ 	float4 clipPos = float4(flipUV * 2.0f - 1.0f, fDepth, 1.0f);
+ 	float4 viewPos = mul(clipPos, matInverseProjection);
+ 	viewPos /= viewPos.w;
+ 	float3 worldPos = mul(viewPos, matInverseView).xyz;
+
+	// Same split as LightClusterGrid::depth_slice.
+	float viewDepth = viewPos.z * clusterForwardSign;
+	uint slice = viewDepth <= clusterNear ? 0 : min(uint(log(viewDepth / clusterNear) * clusterSliceScale), clusterDims.z - 1);
+	uint2 tile = min(uint2(input.uv * clusterDims.xy), clusterDims.xy - 1);
+	LightCluster cluster = clusters[(slice * clusterDims.y + tile.y) * clusterDims.x + tile.x];
+
+	float3 colour = 0;
+	for (uint i = 0; i < cluster.count; ++i)
+	{
+		colour += ShadeLight(lights[clusterLightIndices[cluster.offset + i]], worldPos, N, materialColour);
+	}
+
+ 	return float4(colour, 1.f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+// Instanced Light Volumes
+// The visible lights sit in the lights buffer grouped by type, so each type
+// is drawn with one instanced call and SV_InstanceID picks the light.
+///////////////////////////////////////////////////////////////////////////////
+
+cbuffer LightVolumeCB : register(b5)
+{
+	uint firstLight; // start of this draw's range in lights.
+};
+
+struct InstancedLightVertexOutput
+{
+	float4 vpos  : SV_POSITION;
+	float4 vScreenPos : TEXCOORD0;
+	nointerpolation uint lightIndex : LIGHTINDEX;
+	nointerpolation float2 depthBounds : DEPTHBOUNDS;
+};
+
+InstancedLightVertexOutput VS_DirectionalLightInstanced(VertexInput input, uint instanceId : SV_InstanceID)
+{
+	InstancedLightVertexOutput output;
+	output.vpos = float4(input.pos.xyz, 1.0f);
+	output.vScreenPos = output.vpos;
+	output.lightIndex = firstLight + instanceId;
+	output.depthBounds = float2(0, 1);
+	return output;
+}
+
+// Unit cone mesh from the origin along +Z, stretched to the light's range and end cap.
+InstancedLightVertexOutput VS_SpotLightVolumeInstanced(VertexInput input, uint instanceId : SV_InstanceID)
+{
+	Light light = lights[firstLight + instanceId];
+
+	// Any basis around the axis will do, the cone is round.
+	float3 axis = light.vDirection.xyz;
+	float3 side = normalize(cross(axis, abs(axis.y) < 0.99f ? float3(0, 1, 0) : float3(1, 0, 0)));
+	float3 up = cross(side, axis);
+	float capRadius = SpotCapRadius(light);
+
+	float3 worldPos = light.vPosition.xyz + (side * input.pos.x + up * input.pos.y) * capRadius + axis * (input.pos.z * light.vAtt.w);
+
+	InstancedLightVertexOutput output;
+	output.vpos = mul(float4(worldPos, 1.0f), matViewProjection);
+	output.vScreenPos = output.vpos;
+	output.lightIndex = firstLight + instanceId;
+	output.depthBounds = LightDepthBounds(light.vPosition.xyz, light.vAtt.w);
+	return output;
+}
+
+InstancedLightVertexOutput VS_LightVolumeInstanced(VertexInput input, uint instanceId : SV_InstanceID)
+{
+	Light light = lights[firstLight + instanceId];
+
+	InstancedLightVertexOutput output;
+	output.vpos = mul(float4(input.pos.xyz * light.vAtt.w + light.vPosition.xyz, 1.0f), matViewProjection);
+	output.vScreenPos = output.vpos;
+	output.lightIndex = firstLight + instanceId;
+	output.depthBounds = LightDepthBounds(light.vPosition.xyz, light.vAtt.w);
+	return output;
+}
+
+float4 PS_LightInstanced(InstancedLightVertexOutput input) : SV_TARGET
+{
+ 	float fDepth = gBufferDepth.Load(int3(input.vpos.xy, 0)).r;
+ 	[branch]
+ 	if (OutsideDepthBounds(fDepth, input.depthBounds))
+ 		return float4(0, 0, 0, 1.f);
+
+	float2 ScreenUV = (input.vScreenPos.xy / input.vScreenPos.w * 0.5 + 0.5) * float2(1, -1) + float2(0, 1);
+
+ 	float4 vColourSpec = gBufferColourSpec.Sample(linearMipSampler, ScreenUV);
+ 	float4 vNormalPow = gBufferNormalPow.Sample(linearMipSampler, ScreenUV);
+
+ 	// Decode world position for uv
+ 	float4 clipPos = float4(input.vScreenPos.xy / input.vScreenPos.w, fDepth, 1.0f);
+ 	float4 viewPos = mul(clipPos, matInverseProjection);
+ 	viewPos /= viewPos.w;
+ 	float3 worldPos = mul(viewPos, matInverseView).xyz;
+
+ 	return float4(ShadeLight(lights[input.lightIndex], worldPos, vNormalPow.xyz, vColourSpec.rgb), 1.f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+
+// Per light path for spots, the cone mesh is placed by matMVP and the light comes from the LightInfo constants.
+float4 PS_SpotLight(LightVolumeVertexOutput input) : SV_TARGET
+{
+ 	float fDepth = gBufferDepth.Load(int3(input.vpos.xy, 0)).r;
+ 	[branch]
+ 	if (OutsideDepthBounds(fDepth, input.depthBounds))
+ 		return float4(0, 0, 0, 1.f);
+
+	float2 ScreenUV = (input.vScreenPos.xy / input.vScreenPos.w * 0.5 + 0.5) * float2(1, -1) + float2(0, 1);
+
+ 	float4 vColourSpec = gBufferColourSpec.Sample(linearMipSampler, ScreenUV);
+ 	float4 vNormalPow = gBufferNormalPow.Sample(linearMipSampler, ScreenUV);
+
+ 	float4 clipPos = float4(input.vScreenPos.xy / input.vScreenPos.w, fDepth, 1.0f);
+ 	float4 viewPos = mul(clipPos, matInverseProjection);
+ 	viewPos /= viewPos.w;
+ 	float3 worldPos = mul(viewPos, matInverseView).xyz;
+
+	Light light;
+	light.vPosition = vLightPosition;
+	light.vDirection = vLightDirection;
+	light.vColour = vLightColour;
+	light.vAtt = vLightAtt;
+	light.shadow = lightShadow;
+	light.padding = lightPadding;
+ 	return float4(ShadeLight(light, worldPos, vNormalPow.xyz, vColourSpec.rgb), 1.f);
+}
+
+///////////////////////////////////////////////////////////////////////////////
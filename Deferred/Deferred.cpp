@@ -1,63 +1,108 @@
 #include "Framework.h"
+#include "DeferredScene.h"
 
 #include "ShaderSet.h"
 #include "Mesh.h"
 #include "Texture.h"
+#include "TextureCache.h"
+#include "TiledLightCulling.h"
+#include "LightClusters.h"
+#include "LightSystem.h"
+#include "LightBudget.h"
+#include "LightVolumes.h"
+#include "LightSpatialHash.h"
+#include "StereoFrustum.h"
+#include "FrustumCulling.h"
+#include "OcclusionCuller.h"
+#include "CoherentCulling.h"
+#include "CameraPath.h"
+#include "D3D11RenderDevice.h"
+#include "CommandBuffer.h"
+#include "ConstantRing.h"
+#include "StateCache.h"
+#include "GpuTimer.h"
+#include "ShadowAtlas.h"
+#include "ShadowCascades.h"
+#include <atomic>
 #include <vector>
 
 using namespace DirectX;
 
-constexpr float kBlendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-constexpr UINT kSampleMask = 0xffffffff;
-constexpr u32 kLightGridSize = 24;
+constexpr f32 kEyeNearClip = 0.2f;
+constexpr f32 kEyeFarClip = 1000.0f;
+
+// Camera paths.
+constexpr const char* kCameraPathFile = "camera_path.bin";
+
+// Animation time a frame, live, recording and replaying alike.
+constexpr f32 kFrameTimeStep = 0.002f;
+
+// Shadows.
+constexpr u32 kShadowAtlasSize = 4096;
+constexpr u32 kMaxShadowTileSize = 1024;
+constexpr u32 kMaxShadowedLights = 24;		// the directional, the spots and whichever points score best.
+constexpr u32 kMaxShadowViews = 256;
+constexpr f32 kShadowDistance = 60.f;		// cascades stop here.
+constexpr f32 kShadowNearClip = 0.05f;
+constexpr f32 kCascadeCasterDistance = 20.f;
 long long frameIndex = 0;
 
 //================================================================================
 // Deferred Application
-// An example of how to perform simple deferred rendering
+// An example of how to perform simple deferred rendering, the window, D3D and
+// OVR side of it. What the scene draws lives in DeferredScene.
 //================================================================================
-class DeferredApp : public FrameworkApp
+class DeferredApp : public FrameworkApp, public DeferredScene
 {
 public:
 
-	struct PerFrameCBData
+	enum ELightingMode
 	{
-		m4x4 m_matProjection;
-		m4x4 m_matView;
-		m4x4 m_matViewProjection;
-		m4x4 m_matInverseProjection;
-		m4x4 m_matInverseView;
-		f32		m_time;
-		f32     m_padding[3];
+		kLightingMode_Volumes,		// a draw per light.
+		kLightingMode_Tiled,		// GPU binned screen tiles.
+		kLightingMode_Clustered,	// CPU binned froxels.
 	};
 
-	struct PerDrawCBData
+	// Constants for the tiled lighting compute and shading passes.
+	struct TileCullingCBData
 	{
-		m4x4 m_matMVP;
+		u32 m_screenSize[2];
+		u32 m_tileCount[2];
+		u32 m_lightCount;
+		u32 m_padding[3];
 	};
 
-	enum ELightType
+	// Range of the light buffer drawn by one instanced light volume draw.
+	struct LightVolumeCBData
 	{
-		kLightType_Directional,
-		kLightType_Point,
-		kLightType_Spot
+		u32 m_firstLight;
+		u32 m_padding[3];
 	};
 
-	// Light info presented to the shader constant buffer.
-	struct LightInfo
+	// Constants to find a pixel's cluster, matches LightClusterGrid.
+	struct ClusterCBData
 	{
-		v4 m_vPosition; // w == 0 then directional
-		v4 m_vDirection; // for directional and spot , w == 0 then point.
-		v4 m_vColour; // all types
-		v4 m_vAtt; // attenuation factors + spot exponent in w
-		// various spot params... to be added.
+		u32 m_clusterDims[3];
+		f32 m_near;
+		f32 m_sliceScale;
+		f32 m_forwardSign;
+		f32 m_padding[2];
 	};
 
-	// A more general light management structure.
-	struct Light
+	// One shadow map tile, matches ShadowView in DeferredShaders.fx.
+	struct ShadowView
 	{
-		LightInfo m_shaderInfo;
-		ELightType m_type;
+		m4x4 m_matViewProjection;
+		v4 m_vAtlasRect;	// uv scale in xy, offset in zw.
+		v4 m_vParams;		// depth bias in x.
+	};
+
+	struct ShadowCBData
+	{
+		f32 m_cascadeEnds[kMaxShadowCascades];
+		u32 m_cascadeCount;
+		f32 m_atlasTexelSize;
+		f32 m_padding[2];
 	};
 
 	void on_init(SystemsInterface& systems) override
@@ -91,18 +136,16 @@ public:
 		create_mesh_from_obj(systems.pD3DDevice, m_plane, "Assets/Models/plane.obj", 4.f);
 
 		create_mesh_from_obj(systems.pD3DDevice, m_lightVolumeSphere, "Assets/Models/unit_sphere.obj", 1.f);
+		create_mesh_cone(systems.pD3DDevice, m_lightVolumeCone, 24);
 
-		// Initialise some textures;
-		m_textureArray[0].init_from_dds(systems.pD3DDevice, "Assets/Textures/brick.dds");
-		m_textureArray[1].init_from_dds(systems.pD3DDevice, "Assets/Textures/apple_diffuse.dds");
+		// Initialise some textures, shared through the cache so repeated paths load once.
+		m_textureCache.init(systems.pD3DDevice);
+		m_textureArray[0] = m_textureCache.acquire("Assets/Textures/brick.dds");
+		m_textureArray[1] = m_textureCache.acquire("Assets/Textures/apple_diffuse.dds");
 
 		// We need a sampler state to define wrapping and mipmap parameters.
 		m_pSamplerState = create_basic_sampler(systems.pD3DDevice, D3D11_TEXTURE_ADDRESS_WRAP);
 
-		// Setup per-frame data
-		m_perFrameCBData.m_time = 0.0f;
-
-
 		// create additive render states.
 		{
 			// Additive
@@ -123,7 +166,77 @@ public:
 			systems.pD3DDevice->CreateBlendState(&desc, &m_pBlendStates[BlendStates::kOpaque]);
 		}
 
-		create_lights();
+		create_light_volume_states(systems.pD3DDevice);
+
+		init_scene();
+		m_markerCuller.init(CoherentCullerDesc());
+
+		// The visible lights for each eye live in one structured buffer read by every lighting mode.
+		m_pLightBuffer = create_structured_buffer<LightInfo>(systems.pD3DDevice, m_lightSystem.count());
+		m_pLightBufferView = create_structured_buffer_view(systems.pD3DDevice, m_pLightBuffer);
+		m_pTileCullingCB = create_constant_buffer<TileCullingCBData>(systems.pD3DDevice);
+		m_pLightVolumeCB = create_constant_buffer<LightVolumeCBData>(systems.pD3DDevice);
+
+		// Each batched geometry draw's instances, read by the instanced geometry shader from where its constants say.
+		m_pInstanceBatchCB = create_constant_buffer<InstanceBatchConstants>(systems.pD3DDevice);
+		m_pInstanceBuffer = create_structured_buffer<PerDrawCBData>(systems.pD3DDevice, kMaxGeometryInstances);
+		m_pInstanceBufferView = create_structured_buffer_view(systems.pD3DDevice, m_pInstanceBuffer);
+
+		m_frameTimer.init(systems.pD3DDevice);
+		m_commandLists.init(systems.pD3DDevice, systems.pD3DContext);
+		m_pConstantRingBuffer = create_constant_ring_buffer(systems.pD3DDevice, kConstantRingBytes);
+		m_frameFence.init(systems.pD3DDevice);
+
+		create_shadow_atlas(systems.pD3DDevice);
+
+		// Cluster grid buffers, the index list grows on demand.
+		ClusterGridDesc clusterDesc;
+		m_pClusterCB = create_constant_buffer<ClusterCBData>(systems.pD3DDevice);
+		m_pClusterBuffer = create_structured_buffer<LightCluster>(systems.pD3DDevice, clusterDesc.m_tilesX * clusterDesc.m_tilesY * clusterDesc.m_slices);
+		m_pClusterBufferView = create_structured_buffer_view(systems.pD3DDevice, m_pClusterBuffer);
+		reserve_cluster_indices(systems.pD3DDevice, m_lightSystem.count() * 4);
+
+		set_resources(scene_resources());
+	}
+
+	// The scene's view of the D3D objects, as handles.
+	DeferredSceneResources scene_resources() const
+	{
+		DeferredSceneResources r = {};
+		r.m_geometryPassShader = m_geometryPassShader.binding();
+		r.m_geometryPassInstancedShader = m_geometryPassInstancedShader.binding();
+		r.m_directionalLightShader = m_directionalLightShader.binding();
+		r.m_pointLightShader = m_pointLightShader.binding();
+		r.m_spotLightShader = m_spotLightShader.binding();
+
+		for (u32 i = 0; i < kNumModelTypes; ++i)
+		{
+			r.m_models[i] = m_meshArray[i].binding();
+			r.m_vModelBoundsMin[i] = m_meshArray[i].bounds_min();
+			r.m_vModelBoundsMax[i] = m_meshArray[i].bounds_max();
+			r.m_materials[i] = m_textureArray[i]->binding();
+		}
+		r.m_plane = m_plane.binding();
+		r.m_fullScreenQuad = m_fullScreenQuad.binding();
+		r.m_lightVolumeSphere = m_lightVolumeSphere.binding();
+		r.m_lightVolumeCone = m_lightVolumeCone.binding();
+		r.m_pSamplerState = to_handle(m_pSamplerState);
+
+		r.m_pPerFrameCB = to_handle(m_pPerFrameCB);
+		r.m_pPerDrawCB = to_handle(m_pPerDrawCB);
+		r.m_pLightInfoCB = to_handle(m_pLightInfoCB);
+		r.m_pLightBuffer = to_handle(m_pLightBuffer);
+		r.m_pInstanceBatchCB = to_handle(m_pInstanceBatchCB);
+		r.m_pInstanceBuffer = to_handle(m_pInstanceBuffer);
+		r.m_pInstanceBufferView = to_handle(m_pInstanceBufferView);
+		r.m_pConstantRingBuffer = to_handle(m_pConstantRingBuffer);
+
+		r.m_pOpaqueBlendState = to_handle(m_pBlendStates[BlendStates::kOpaque]);
+		for (u32 i = 0; i < kMaxVolumeStates; ++i)
+			r.m_pVolumeDepthStates[i] = to_handle(m_pVolumeDepthStates[i]);
+		for (u32 i = 0; i < kMaxVolumeRasterStates; ++i)
+			r.m_pVolumeRasterizerStates[i] = to_handle(m_pVolumeRasterizerStates[i]);
+		return r;
 	}
 
 	void create_shaders(SystemsInterface &systems)
@@ -133,6 +246,10 @@ public:
 			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_Geometry", "PS_Geometry")
 			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
 		);
+		m_geometryPassInstancedShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_GeometryInstanced", "PS_Geometry")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
 
 		// Lighting pass shaders
 		m_directionalLightShader.init(systems.pD3DDevice
@@ -146,7 +263,49 @@ public:
 			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
 		);
 
+		// Tiled and clustered lighting, shade against per tile or per cluster light lists in one pass.
+		m_directionalLightInstancedShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_DirectionalLightInstanced", "PS_LightInstanced")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+		m_pointLightInstancedShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_LightVolumeInstanced", "PS_LightInstanced")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+
+		m_spotLightShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_LightVolume", "PS_SpotLight")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+		m_spotLightInstancedShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_SpotLightVolumeInstanced", "PS_LightInstanced")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+
+		m_tileCullingShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_CS("Assets/Shaders/DeferredShaders.fx", "CS_TileLightCulling")
+			, { nullptr, 0 }
+		);
+		m_tiledLightingShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_Passthrough", "PS_TiledLighting")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+		m_clusteredLightingShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_Passthrough", "PS_ClusteredLighting")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+
 		// GBuffer Debugging shaders.
+		// Shadow map depth only shaders.
+		m_shadowCasterShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS("Assets/Shaders/DeferredShaders.fx", "VS_ShadowCaster")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+		m_shadowClearShader.init(systems.pD3DDevice
+			, ShaderSetDesc::Create_VS("Assets/Shaders/DeferredShaders.fx", "VS_ShadowClear")
+			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
+		);
+
 		m_GBufferDebugShaders[kGBufferDebug_Albido].init(systems.pD3DDevice
 			, ShaderSetDesc::Create_VS_PS("Assets/Shaders/DeferredShaders.fx", "VS_Passthrough", "PS_GBufferDebug_Albido")
 			, { VertexFormatTraits<MeshVertex>::desc, VertexFormatTraits<MeshVertex>::size }
@@ -169,56 +328,6 @@ public:
 		);
 	}
 
-	void create_lights()
-	{	
-		// A directional light.
-		{
-			Light l = {};
-			l.m_shaderInfo.m_vDirection = v4(0.5773, 0.5773, 0.5773, 0);
-			l.m_shaderInfo.m_vColour = v4(1.f, 0.7f, .6f, 0.f) * 0.2f;
-			l.m_shaderInfo.m_vPosition = v4(0, 0, 0, 0);
-			l.m_type = kLightType_Directional;
-
-			m_lights.push_back(l);
-		}
-
-		// Lots of point lights.
-		v4 colours[] =
-		{
-			v4(1,1,1,0),
-			v4(1,1,0,0),
-			v4(0,1,1,0),
-			v4(1,0,1,0)
-		};
-
-		{				
-			/*Light l = {};
-			l.m_shaderInfo.m_vDirection = v4(0, 0, 0, 0);
-			l.m_shaderInfo.m_vColour = colours[2] * 0.9f;
-			l.m_shaderInfo.m_vPosition = v4(2.0f, 0.5f, 0.0f, 1.0f);
-			l.m_shaderInfo.m_vAtt = v4(0.001f, 0.1f, 5.0f, 2.0f);
-			l.m_type = kLightType_Point;
-
-			m_lights.push_back(l);*/
-		}
-
-
-		for (u32 i = 0; i < kLightGridSize; ++i)
-		{
-			for (u32 j = 0; j < kLightGridSize; ++j)
-			{
-				Light l = {};
-				l.m_shaderInfo.m_vDirection = v4(0, 0, 0, 0);
-				l.m_shaderInfo.m_vColour = colours[j % 5] * 0.9f;
-				l.m_shaderInfo.m_vPosition = v4(i - 5.0, 0.5f, j - 5.0, 1.0f);
-				l.m_shaderInfo.m_vAtt = v4(0.001f, 0.1f, 5.0f, 2.0f);
-				l.m_type = kLightType_Point;
-
-				m_lights.push_back(l);
-			}
-		}
-	}
-
 	void on_update(SystemsInterface& systems) override
 	{
 		//////////////////////////////////////////////////////////////////////////
@@ -233,21 +342,68 @@ public:
 		ImGui::SliderFloat3("Position", (float*)&m_position, -1.f, 1.f);
 		ImGui::SliderFloat("Size", &m_size, 0.1f, 10.f);
 
+		const TextureCache::Stats& texStats = m_textureCache.stats();
+		ImGui::Text("Textures: %u resident, %.2f MB, %u loads", texStats.m_residentTextures, texStats.m_residentBytes / (f32)MB, texStats.m_fileLoads);
 
-
-		// move our lights
-		for (u32 i = 0; i < kLightGridSize; ++i)
+		// Record a run, then replay it with the same camera, head and clock as often as needed.
+		CameraPath& rPath = *systems.pCameraPath;
+		if (rPath.recording())
+		{
+			if (ImGui::Button("Stop recording"))
+			{
+				rPath.stop();
+				if (!rPath.save(kCameraPathFile))
+					debugF("Couldn't save the camera path to %s\n", kCameraPathFile);
+			}
+			ImGui::SameLine();
+			ImGui::Text("Recording frame %u", rPath.frame());
+		}
+		else if (rPath.replaying())
+		{
+			if (ImGui::Button("Stop replay"))
+				rPath.stop();
+			ImGui::SameLine();
+			ImGui::Text("Replaying frame %u / %u", rPath.frame(), rPath.frames());
+		}
+		else
 		{
-			for (u32 j = 0; j < kLightGridSize; ++j)
+			if (ImGui::Button("Record camera path"))
+				rPath.start_recording(kFrameTimeStep);
+			ImGui::SameLine();
+			if (ImGui::Button("Replay camera path") && (rPath.frames() || rPath.load(kCameraPathFile)))
 			{
-				m_lights[i* kLightGridSize + j + 1].m_shaderInfo.m_vPosition = v4(
-					i + sin(i * m_perFrameCBData.m_time) - 5.0
-					, cos(i * j * m_perFrameCBData.m_time) + 1
-					, j + cos(j * m_perFrameCBData.m_time) - 5.0
-					, 1.0f
-				);
+				rPath.start_replay();
+				m_replayStats = {};
 			}
 		}
+		if (m_replayStats.m_frames)
+		{
+			ImGui::Text("Replay: %u frames, CPU render %.3f ms average %.3f ms worst, eye buffers GPU %.3f ms average", m_replayStats.m_frames
+				, m_replayStats.m_cpuMs / m_replayStats.m_frames, m_replayStats.m_worstCpuMs, m_replayStats.m_gpuMs / m_replayStats.m_frames);
+		}
+
+		// Time moves one fixed step a frame. Recordings and replays both take it from the path's frame count,
+		// so a replay animates exactly as its recording did.
+		if (rPath.recording() || rPath.replaying())
+			m_perFrameCBData.m_time = rPath.time();
+		else
+			m_perFrameCBData.m_time += kFrameTimeStep;
+
+		// move our lights
+		const s64 kAnimateStart = getTimeMicroseconds();
+		m_lightSystem.animate(m_perFrameCBData.m_time, &m_jobs);
+		ImGui::Text("Lights: %u, animated in %.3f ms", m_lightSystem.count(), (getTimeMicroseconds() - kAnimateStart) / 1000.0);
+
+		const s64 kHashStart = getTimeMicroseconds();
+		m_lightHash.update(m_lightSystem, &m_jobs);
+		const LightSpatialHash::Stats& hashStats = m_lightHash.stats();
+		ImGui::Text("Light hash: %u cells, %u moved, %u global, updated in %.3f ms", hashStats.m_cells, hashStats.m_moved, hashStats.m_global, (getTimeMicroseconds() - kHashStart) / 1000.0);
+
+		// Lights reaching the debug box, as a transparent at that spot would ask for them.
+		const v3 vHalfSize(m_size * 0.5f);
+		m_boxLights.clear();
+		m_lightHash.query_box(m_position - vHalfSize, m_position + vHalfSize, m_boxLights);
+		ImGui::Text("Lights reaching the box: %u", static_cast<u32>(m_boxLights.size()));
 	}
 	void SetAndClearRenderTarget(ID3D11RenderTargetView * rendertarget, ID3D11DeviceContext* context)
 	{
@@ -265,6 +421,8 @@ public:
 
 	void on_render(SystemsInterface& systems) override
 	{
+		const s64 kRenderStart = getTimeMicroseconds();
+
 		ovrSessionStatus sessionStatus;
 		ovrResult result = ovr_GetSessionStatus(*systems.pOvrSession, &sessionStatus);
 		printf(std::to_string(result).c_str());
@@ -294,9 +452,60 @@ public:
 		}
 
 
-		for (auto& rLight : m_lights)
+		// Only the light markers in view are drawn, culled as a batch against the camera's planes.
+		// Coherently, each marker is bounded by its whole bob so the bounds hold still and only the camera moves them.
+		static bool bCoherentMarkers = true;
+		if (ImGui::Checkbox("Coherent marker culling", &bCoherentMarkers))
+			m_markerCuller.reset();
+
+		const u32 kLightCount = m_lightSystem.count();
+		m_markerBounds.resize(kLightCount * 4);
+		f32* pMarkerX = m_markerBounds.data();
+		f32* pMarkerY = pMarkerX + kLightCount;
+		f32* pMarkerZ = pMarkerY + kLightCount;
+		f32* pMarkerRadius = pMarkerZ + kLightCount;
+		for (u32 i = 0; i < kLightCount; ++i)
+		{
+			// The bob stays within a cube of half size amplitude.
+			const v3 vPosition = bCoherentMarkers ? m_lightSystem.animation_centre(i) : m_lightSystem.position(i);
+			pMarkerX[i] = vPosition.x;
+			pMarkerY[i] = vPosition.y;
+			pMarkerZ[i] = vPosition.z;
+			pMarkerRadius[i] = 0.2f + (bCoherentMarkers ? m_lightSystem.animation_amplitude(i) * 1.7321f : 0.f);
+		}
+
+		CullPlanes cameraPlanes;
+		set_cull_planes(systems.pCamera->planes, 6, cameraPlanes);
+		const SphereBoundsSoA kMarkerBounds = { pMarkerX, pMarkerY, pMarkerZ, pMarkerRadius };
+		if (bCoherentMarkers)
+		{
+			// The lights all sit well inside the far plane, so that is as far as any plane needs watching.
+			m_markerCuller.cull(cameraPlanes, kMarkerBounds, kLightCount, systems.pCamera->frameDelta(systems.pCamera->farClip), nullptr, 0, nullptr);
+			compact_visible(m_markerCuller.mask(), kLightCount, m_markerIndices);
+
+			const CoherentCuller::Stats& rStats = m_markerCuller.stats();
+			ImGui::Text("Markers: %u visible, %u tested%s, %u near the boundary", static_cast<u32>(m_markerIndices.size()), rStats.m_tested
+				, rStats.m_bFullPass ? " (full pass)" : "", rStats.m_boundary);
+		}
+		else
+		{
+			cull_spheres(cameraPlanes, kMarkerBounds, kLightCount, kCullWidth_8, m_markerMask, nullptr);
+			compact_visible(m_markerMask, kLightCount, m_markerIndices);
+		}
+
+		for (const u32 kLight : m_markerIndices)
+		{
+			const v3 vPosition = m_lightSystem.position(kLight);
+			dd::cross(ctx, (const float*)&vPosition, 0.2f);
+		}
+
+		for (const u32 kLight : m_boxLights)
 		{
-			dd::cross(ctx, (const float*)& rLight.m_shaderInfo.m_vPosition, 0.2f);
+			if (m_lightSystem.type(kLight) == kLightType_Directional)
+				continue;
+
+			const v3 vPosition = m_lightSystem.position(kLight);
+			dd::line(ctx, (const float*)&m_position, (const float*)&vPosition, dd::colors::Yellow);
 		}
 
 		//VR Implementation 
@@ -315,36 +524,44 @@ public:
 		double sensorSampleTime;    // sensorSampleTime is fed into the layer later
 		ovr_GetEyePoses(*systems.pOvrSession, frameIndex, ovrTrue, HmdToEyePose, EyeRenderPose, &sensorSampleTime);
 
+		// Record this frame's poses or swap in the replayed ones.
+		const bool kReplaying = systems.pCameraPath->replaying();
+		systems.pCameraPath->eye_poses(*systems.pCamera, EyeRenderPose);
+
 		ovrTimewarpProjectionDesc posTimewarpProjectionDesc = {};
 
-		XMMATRIX finalViewMatrix[2];
+		// Both eyes' cameras are worked out first, the shadow, light cull and occlusion passes need the pair.
+		m4x4 finalViewMatrix[2];
+		m4x4 eyeView[2];
+		m4x4 eyeProjection[2];
+		m4x4 eyeInverseView[2];
+		v3 vEyePosition[2];
+		PerFrameCBData eyeFrameData[2];
+
+		// Cascades are shared by both eyes, fitted to the union of their fields of view.
+		ovrFovPort shadowFov = eyeRenderDesc[0].Fov;
+		shadowFov.UpTan = std::max(shadowFov.UpTan, eyeRenderDesc[1].Fov.UpTan);
+		shadowFov.DownTan = std::max(shadowFov.DownTan, eyeRenderDesc[1].Fov.DownTan);
+		shadowFov.LeftTan = std::max(shadowFov.LeftTan, eyeRenderDesc[1].Fov.LeftTan);
+		shadowFov.RightTan = std::max(shadowFov.RightTan, eyeRenderDesc[1].Fov.RightTan);
 
 		static bool bStereoInstancing = true;
 		ImGui::Checkbox("Enable Stero Rendering: ", &bStereoInstancing);
-		SetAndClearRenderTarget(systems.pEyeRenderTexture->GetRTV(), systems.pD3DContext);
-
-		// Render Scene to Eye Buffers
-		for (int eye = 0; eye < 2; ++eye)
-		{
-			// Bind the G Buffer to the output merger
-			// Here we are binding multiple render targets (MRT)
-			systems.pD3DContext->OMSetRenderTargets(kMaxGBufferColourTargets, m_pGBufferTargetViews[eye], m_pGBufferDepthView[eye]);
-
-			// Clear colour and depth
-			f32 clearValue[] = { 0.f, 0.f, 0.f, 0.f };
-			systems.pD3DContext->ClearRenderTargetView(m_pGBufferTargetViews[eye][kGBufferColourSpec], clearValue);
-			f32 normalClearValue[] = { 0.5f, 0.5f, 0.5f, 0.f };
-			systems.pD3DContext->ClearRenderTargetView(m_pGBufferTargetViews[eye][kGBufferNormalPow], normalClearValue);
-			systems.pD3DContext->ClearDepthStencilView(m_pGBufferDepthView[eye], D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.f, 0);
 
+		static int lightingMode = kLightingMode_Tiled;
+		ImGui::Combo("Lighting", &lightingMode, "Light Volumes\0Tiled\0Clustered\0");
 
-			SetAndClearRenderTarget(systems.pEyeRenderTexture[eye]->GetRTV(), m_pGBufferDepthView[eye], systems.pD3DContext);
-			D3D11_VIEWPORT D3Dvp;
-			D3Dvp.Width = (float)systems.pEyeRenderViewport[eye].Size.w;    D3Dvp.Height = (float)systems.pEyeRenderViewport[eye].Size.h;
-			D3Dvp.MinDepth = 0;   D3Dvp.MaxDepth = 1;
-			D3Dvp.TopLeftX = (float)systems.pEyeRenderViewport[eye].Pos.x; D3Dvp.TopLeftY = (float)systems.pEyeRenderViewport[eye].Pos.y;
-			systems.pD3DContext->RSSetViewports(1, &D3Dvp);
+		// The light budget chases a GPU time target for both eyes.
+		static bool bLightBudget = true;
+		ImGui::Checkbox("Light budget", &bLightBudget);
+		LightBudgetDesc budgetDesc = m_lightBudget.desc();
+		ImGui::SliderFloat("Light budget target (ms)", &budgetDesc.m_targetMs, 1.f, 11.f);
+		m_lightBudget.set_desc(budgetDesc);
+		m_frameTimer.begin(systems.pD3DContext);
+		m_constantRing.begin_frame(m_frameFence.completed(systems.pD3DContext));
 
+		for (int eye = 0; eye < 2; ++eye)
+		{
       //Get the pose information in XM format
 			XMVECTOR eyeQuat = XMVectorSet(EyeRenderPose[eye].Orientation.x, EyeRenderPose[eye].Orientation.y,
 				EyeRenderPose[eye].Orientation.z, EyeRenderPose[eye].Orientation.w);
@@ -362,7 +579,7 @@ public:
 			finalCam.right = XMVector3Rotate(finalCam.right, combinedRot);
 			finalCam.updateMatrices();
 			XMMATRIX view = finalCam.viewMatrix;
-			ovrMatrix4f p = ovrMatrix4f_Projection(eyeRenderDesc[eye].Fov, 0.2f, 1000.0f, ovrProjection_None);
+			ovrMatrix4f p = ovrMatrix4f_Projection(eyeRenderDesc[eye].Fov, kEyeNearClip, kEyeFarClip, ovrProjection_None);
 			posTimewarpProjectionDesc = ovrTimewarpProjectionDesc_FromProjection(p, ovrProjection_None);
 			XMMATRIX proj = XMMatrixSet(p.M[0][0], p.M[1][0], p.M[2][0], p.M[3][0],
 										p.M[0][1], p.M[1][1], p.M[2][1], p.M[3][1],
@@ -382,208 +599,927 @@ public:
 			m_perFrameCBData.m_matInverseProjection = matInverseProj.Transpose();
 			m_perFrameCBData.m_matInverseView = matInverseView.Transpose();
 
-			m_perFrameCBData.m_time += 0.001f;
-			// Push Per Frame Data to GPU
-			D3D11_MAPPED_SUBRESOURCE subresource;
-			if (!FAILED(systems.pD3DContext->Map(m_pPerFrameCB, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+			eyeFrameData[eye] = m_perFrameCBData;
+
+			finalViewMatrix[eye] = prod;
+			eyeView[eye] = finalCam.viewMatrix;
+			eyeProjection[eye] = proj;
+			eyeInverseView[eye] = matInverseView;
+			vEyePosition[eye] = finalCam.eye;
+		}
+
+		{
+			ovrMatrix4f p = ovrMatrix4f_Projection(shadowFov, kEyeNearClip, kEyeFarClip, ovrProjection_None);
+			m4x4 shadowProjection = XMMatrixSet(p.M[0][0], p.M[1][0], p.M[2][0], p.M[3][0],
+												p.M[0][1], p.M[1][1], p.M[2][1], p.M[3][1],
+												p.M[0][2], p.M[1][2], p.M[2][2], p.M[3][2],
+												p.M[0][3], p.M[1][3], p.M[2][3], p.M[3][3]);
+			render_shadows(systems, eyeInverseView, shadowProjection);
+		}
+
+		// Lights are culled once for both eyes then split between them.
+		{
+			v3 vEyeOffsets[2];
+			EyeFov eyeFov[2];
+			for (int eye = 0; eye < 2; ++eye)
+			{
+				const ovrVector3f& rOffset = eyeRenderDesc[eye].HmdToEyePose.Position;
+				const ovrFovPort& rFov = eyeRenderDesc[eye].Fov;
+				vEyeOffsets[eye] = v3(rOffset.x, rOffset.y, rOffset.z);
+				eyeFov[eye] = { rFov.UpTan, rFov.DownTan, rFov.LeftTan, rFov.RightTan };
+			}
+
+			const m4x4 headToWorld = m4x4::CreateTranslation(-vEyeOffsets[0]) * eyeInverseView[0];
+			StereoFrustum frustum;
+			build_stereo_frustum(headToWorld, vEyeOffsets, eyeFov, kEyeNearClip, kEyeFarClip, frustum);
+			cull_stereo_lights(frustum);
+		}
+
+		static bool bOcclusionCulling = true;
+		ImGui::Checkbox("Occlusion culling", &bOcclusionCulling);
+		if (bOcclusionCulling)
+			build_occlusion(finalViewMatrix);
+		u32 occludedDraws = 0;
+
+		// Scene draws go through the render device, which counts what they ask of the API.
+		// The state cache in front of it drops binds of what is already bound.
+		static bool bStateCache = true;
+		ImGui::Checkbox("State cache", &bStateCache);
+		m_renderDevice.set_context(systems.pD3DContext);
+		m_stateCache.set_device(&m_renderDevice);
+		RenderDevice& rDevice = bStateCache ? static_cast<RenderDevice&>(m_stateCache) : m_renderDevice;
+
+		// Or split into chunks recorded on the workers into deferred contexts, each chunk through a state cache of its own.
+		static bool bParallelRecording = false;
+		static int recordingChunks = 4;
+		ImGui::Checkbox("Parallel recording", &bParallelRecording);
+		ImGui::SliderInt("Recording chunks", &recordingChunks, 1, 8);
+		const u32 kRecordingChunks = bParallelRecording ? u32(recordingChunks) : 0;
+
+		// Per draw constants sub-allocated from the constant ring and written in one map ahead of each pass.
+		static bool bConstantRing = true;
+		ImGui::Checkbox("Constant ring", &bConstantRing);
+		const bool kRingConstants = bConstantRing && m_constantRing.enabled();
+
+		// Repeated meshes collapsed into instanced draws, their transforms uploaded to the instance buffer.
+		static bool bInstanceBatching = true;
+		ImGui::Checkbox("Instance batching", &bInstanceBatching);
+
+		static bool bInstancedVolumes = true;
+		if (lightingMode == kLightingMode_Volumes)
+			ImGui::Checkbox("Instanced light volumes", &bInstancedVolumes);
+
+		// Render Scene to Eye Buffers
+		if (bStereoInstancing)
+		{
+			for (int eye = 0; eye < 2; ++eye)
 			{
-				memcpy(subresource.pData, &m_perFrameCBData, sizeof(PerFrameCBData));
-				systems.pD3DContext->Unmap(m_pPerFrameCB, 0);
+				// Bind the G Buffer to the output merger
+				// Here we are binding multiple render targets (MRT)
+				systems.pD3DContext->OMSetRenderTargets(kMaxGBufferColourTargets, m_pGBufferTargetViews[eye], m_pGBufferDepthView[eye]);
+
+				// Clear colour and depth
+				f32 clearValue[] = { 0.f, 0.f, 0.f, 0.f };
+				systems.pD3DContext->ClearRenderTargetView(m_pGBufferTargetViews[eye][kGBufferColourSpec], clearValue);
+				f32 normalClearValue[] = { 0.5f, 0.5f, 0.5f, 0.f };
+				systems.pD3DContext->ClearRenderTargetView(m_pGBufferTargetViews[eye][kGBufferNormalPow], normalClearValue);
+				systems.pD3DContext->ClearDepthStencilView(m_pGBufferDepthView[eye], D3D11_CLEAR_DEPTH | D3D11_CLEAR_STENCIL, 1.f, 0);
+
+				D3D11_VIEWPORT D3Dvp;
+				D3Dvp.Width = (float)systems.pEyeRenderViewport[eye].Size.w;    D3Dvp.Height = (float)systems.pEyeRenderViewport[eye].Size.h;
+				D3Dvp.MinDepth = 0;   D3Dvp.MaxDepth = 1;
+				D3Dvp.TopLeftX = (float)systems.pEyeRenderViewport[eye].Pos.x; D3Dvp.TopLeftY = (float)systems.pEyeRenderViewport[eye].Pos.y;
+				systems.pD3DContext->RSSetViewports(1, &D3Dvp);
+
+				// Push this eye's Per Frame Data to GPU
+				push_constant_buffer(systems.pD3DContext, m_pPerFrameCB, eyeFrameData[eye]);
+
+				// The shadow pass and the other eye set state on the context directly, so the cache starts over.
+				m_renderDevice.reset_stats();
+				m_stateCache.invalidate();
+				m_stateCache.reset_filtered();
+
+				occludedDraws = record_geometry_pass(finalViewMatrix[eye], bOcclusionCulling);
+				if (bInstanceBatching)
+				{
+					const u32 kRecorded = static_cast<u32>(m_commandQueue.packets().size());
+					const u32 kBatched = m_commandQueue.batch_instances(sizeof(PerDrawCBData), kMaxGeometryInstances, to_handle(m_pInstanceBatchCB), kInstanceBatchSlot);
+					const std::vector<u8>& rInstances = m_commandQueue.instance_data();
+					if (!rInstances.empty())
+						m_renderDevice.write_buffer(to_handle(m_pInstanceBuffer), 0, rInstances.data(), static_cast<u32>(rInstances.size()), true);
+					ImGui::Text("Eye %d instance batching: %u draws into %u", eye, kRecorded, kBatched);
+				}
+				if (kRingConstants)
+					m_commandQueue.stage_constants(m_constantRing);
+				m_constantRing.flush(m_renderDevice);
+
+				if (kRecordingChunks)
+				{
+					m_parallelRecorder.record(m_commandLists, static_cast<u32>(m_commandQueue.packets().size()), kRecordingChunks, [this](RenderDevice& rChunkDevice, u32 begin, u32 end)
+					{
+						submit_geometry_pass(rChunkDevice, begin, end);
+					}, &m_jobs);
+					const ParallelRecorder::Stats& rStats = m_parallelRecorder.stats();
+					ImGui::Text("Eye %d geometry pass: %u packets in %u chunks, record %.3f ms, execute %.3f ms", eye, static_cast<u32>(m_commandQueue.packets().size())
+						, rStats.m_chunks, rStats.m_recordMs, rStats.m_executeMs);
+				}
+				else
+				{
+					submit_geometry_pass(rDevice, 0, static_cast<u32>(m_commandQueue.packets().size()));
+					const RenderDeviceStats& rDeviceStats = m_renderDevice.stats();
+					ImGui::Text("Eye %d geometry pass: %u draws, %u state changes, %u maps, %llu bytes", eye, rDeviceStats.m_draws, rDeviceStats.m_stateChanges, rDeviceStats.m_maps, rDeviceStats.m_uploadBytes);
+				}
+				//=======================================================================================
+				// The Lighting
+				// Read the GBuffer textures, and "draw" light volumes for each of our lights.
+				// We use additive blending on the result.
+				//=======================================================================================
+
+				// Bind the swap chain (back buffer) to the render target
+				// Make sure to unbind other gbuffer targets and depth
+				ID3D11RenderTargetView* views[] = { systems.pEyeRenderTexture[eye]->GetRTV(), 0 };
+				systems.pD3DContext->OMSetRenderTargets(2, views, 0);
+				systems.pD3DContext->ClearRenderTargetView(views[0], clearValue);
+
+				// Bind our GBuffer textures as inputs to the pixel shader
+				ID3D11ShaderResourceView* srVs[] = { systems.pEyeRenderTexture[eye]->GetDTV(), 0 };
+				systems.pD3DContext->PSSetShaderResources(0, 2, srVs);
+
+
+				// Only the lights reaching this eye go to the GPU.
+				update_light_buffers(systems, eye, eyeProjection[eye], vEyePosition[eye], bLightBudget);
+
+				// Shadow maps for every lighting mode.
+				ID3D11ShaderResourceView* shadowSRVs[] = { m_pShadowViewBufferView, m_pShadowAtlasView };
+				systems.pD3DContext->PSSetShaderResources(7, 2, shadowSRVs);
+				systems.pD3DContext->PSSetSamplers(1, 1, &m_pShadowSampler);
+				systems.pD3DContext->PSSetConstantBuffers(6, 1, &m_pShadowCB);
+
+				if (lightingMode == kLightingMode_Tiled)
+				{
+					render_tiled_lighting(systems, eye);
+				}
+				else if (lightingMode == kLightingMode_Clustered)
+				{
+					render_clustered_lighting(systems, eye, eyeView[eye], eyeProjection[eye]);
+				}
+				else
+				{
+					// Additive blend so we accumulate
+					systems.pD3DContext->OMSetBlendState(m_pBlendStates[BlendStates::kAdditive], kBlendFactor, kSampleMask);
+
+					// State set on the context since the geometry pass is unknown to the cache.
+					m_stateCache.invalidate();
+					m_stateCache.reset_filtered();
+					const u32 kApiCalls = bInstancedVolumes ? render_instanced_light_volumes(systems, eye) : render_light_volumes(systems, rDevice, eye, finalViewMatrix[eye], kRecordingChunks, kRingConstants);
+					ImGui::Text("Eye %d light volume API calls: %u, %u filtered by the state cache, camera inside %u point %u spot", eye, kApiCalls
+						, bInstancedVolumes ? 0 : m_stateCache.filtered(), m_lightInsideCount[kLightType_Point], m_lightInsideCount[kLightType_Spot]);
+				}
+
+
+
+				// Unbind all the SRVs because we need them as targets next frame
+				ID3D11ShaderResourceView* srvClear[] = { 0,0,0,0,0,0,0,0,0 };
+				systems.pD3DContext->PSSetShaderResources(0, 9, srvClear);
+
+				// re-bind depth for debugging output.
+				systems.pD3DContext->OMSetRenderTargets(2, views, systems.pEyeRenderTexture[eye]->GetDSV());
+				// Commit rendering to the swap chain
+				systems.pEyeRenderTexture[eye]->Commit();
 			}
+		}
 
+		m_frameFence.signal(systems.pD3DContext, m_constantRing.end_frame());
+		m_frameTimer.end(systems.pD3DContext);
+		if (m_constantRing.enabled())
+		{
+			const RingAllocator& rRing = m_constantRing.allocator();
+			ImGui::Text("Constant ring: %u / %u KB held by %u frames in flight, %u wraps", rRing.used() / 1024, rRing.capacity() / 1024
+				, rRing.frames_in_flight(), rRing.wraps());
+		}
+		if (m_frameTimer.last_ms() >= 0.f)
+		{
+			// Readback lags a few frames and some frames get nothing, only a fresh sample moves the budget.
+			if (bLightBudget && m_frameTimer.has_new_sample())
+				m_lightBudget.update(m_frameTimer.last_ms());
+			ImGui::Text("Eye buffers GPU: %.2f ms", m_frameTimer.last_ms());
+		}
 
+		if (kReplaying)
+		{
+			const f64 kCpuMs = (getTimeMicroseconds() - kRenderStart) / 1000.0;
+			++m_replayStats.m_frames;
+			m_replayStats.m_cpuMs += kCpuMs;
+			m_replayStats.m_worstCpuMs = std::max(m_replayStats.m_worstCpuMs, kCpuMs);
+			m_replayStats.m_gpuMs += std::max(m_frameTimer.last_ms(), 0.f);
+		}
 
-			finalViewMatrix[eye] = XMMatrixMultiply(view, proj);
+		if (bOcclusionCulling)
+		{
+			const OcclusionCuller::Stats& rStats = m_occlusion[0].stats();
+			ImGui::Text("Occlusion: %u occluders, %u / %u triangles rasterized in %.3f ms per eye, %u / %u draws culled", rStats.m_occluders
+				, rStats.m_rasterized, rStats.m_triangles, rStats.m_rasterMs, occludedDraws, kNumModelTypes * kNumInstances);
 		}
 
-		if (bStereoInstancing)
+		// Initialize our single full screen Fov layer.
+		ovrLayerEyeFovDepth ld = {};
+		ld.Header.Type = ovrLayerType_EyeFovDepth;
+		ld.Header.Flags = 0;
+		ld.ProjectionDesc = posTimewarpProjectionDesc;
+		ld.SensorSampleTime = sensorSampleTime;
+
+		for (int eye = 0; eye < 2; ++eye)
 		{
-			D3D11_VIEWPORT D3Dvp;
-			D3Dvp.Width = (float)systems.pEyeRenderViewport[0].Size.w + systems.pEyeRenderViewport[1].Size.w;    D3Dvp.Height = (float)systems.pEyeRenderViewport[0].Size.h;
-			D3Dvp.MinDepth = 0;   D3Dvp.MaxDepth = 1;
-			D3Dvp.TopLeftX = 0; D3Dvp.TopLeftY = 0;
-			systems.pD3DContext->RSSetViewports(1, &D3Dvp);
-			// Bind our geometry pass shader.
-			m_geometryPassShader.bind(systems.pD3DContext);
+			ld.ColorTexture[eye] = systems.pEyeRenderTexture[eye]->TextureChain;
+			ld.DepthTexture[eye] = systems.pEyeRenderTexture[eye]->DepthTextureChain;
+			ld.Viewport[eye] = systems.pEyeRenderViewport[eye];
+			ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
+			ld.RenderPose[eye] = EyeRenderPose[eye];
+		}
+
+		ovrLayerHeader* layers = &ld.Header;
+		result = ovr_SubmitFrame(*systems.pOvrSession, 0, nullptr, &layers, 1);
+		// exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
+		if (!OVR_SUCCESS(result))
+			panicF("Fail Rendering Loop!");
 
-			// Bind Constant Buffers, to both PS and VS stages
-			ID3D11Buffer* buffers[] = { m_pPerFrameCB, m_pPerDrawCB };
-			systems.pD3DContext->VSSetConstantBuffers(0, 2, buffers);
-			systems.pD3DContext->PSSetConstantBuffers(0, 2, buffers);
+		//=======================================================================================
 
-			// Bind a sampler state
-			ID3D11SamplerState* samplers[] = { m_pSamplerState };
-			systems.pD3DContext->PSSetSamplers(0, 1, samplers);
 
+	}
 
-			// Opaque blend
-			systems.pD3DContext->OMSetBlendState(m_pBlendStates[BlendStates::kOpaque], kBlendFactor, kSampleMask);
+	void on_resize(SystemsInterface& systems) override
+	{
+		create_gbuffer(systems.pD3DDevice, systems.pD3DContext, systems.width, systems.height);
+	}
 
-			// draw a plane
+	// The original light volume pass, a constant buffer push and a stencil masked draw per light.
+	// With kChunks the lights are split into that many command lists recorded across the job system.
+	// With kRingConstants every light's constants go to the constant ring in one write up front when there is room.
+	// Returns the number of D3D calls asked for, through a state cache fewer reach the context.
+	u32 render_light_volumes(SystemsInterface& systems, RenderDevice& rDevice, int eye, const m4x4& rViewProjection, const u32 kChunks, const bool kRingConstants)
+	{
+		ID3D11DeviceContext* pContext = systems.pD3DContext;
+
+		ID3D11RasterizerState* pPreviousRasterizerState = nullptr;
+		pContext->RSGetState(&pPreviousRasterizerState);
+
+		ID3D11RenderTargetView* pTarget = systems.pEyeRenderTexture[eye]->GetRTV();
+		pContext->OMSetRenderTargets(1, &pTarget, m_pGBufferReadOnlyDepthView[eye]);
+
+		u32 apiCalls = 2;
+		const bool kStaged = kRingConstants && stage_light_constants(rViewProjection);
+		m_constantRing.flush(rDevice);
+
+		if (kChunks)
+		{
+			std::atomic<u32> chunkCalls(0);
+			m_parallelRecorder.record(m_commandLists, static_cast<u32>(m_packedLights.size()), kChunks, [&](RenderDevice& rChunkDevice, u32 begin, u32 end)
 			{
-				m_plane.bind(systems.pD3DContext);
-				m_textureArray[0].bind(systems.pD3DContext, ShaderStage::kPixel, 0);
+				chunkCalls += submit_light_volumes(rChunkDevice, rViewProjection, begin, end, kStaged);
+			}, &m_jobs);
+			apiCalls += chunkCalls;
+		}
+		else
+		{
+			apiCalls += submit_light_volumes(rDevice, rViewProjection, 0, static_cast<u32>(m_packedLights.size()), kStaged);
+		}
 
-				// Compute MVP matrix.
-				m4x4 matModel = m4x4::CreateTranslation(0.f, 0.f, 0.f);
-				m4x4 matMVP = matModel * finalViewMatrix[0];
+		if (kStaged)
+		{
+			// Whole buffers back where the ring blocks were, for whatever draws next.
+			RenderBuffer* pPerDrawCB = to_handle(m_pPerDrawCB);
+			RenderBuffer* pLightInfoCB = to_handle(m_pLightInfoCB);
+			rDevice.set_constant_buffers(ShaderStage::kVertex, 1, 1, &pPerDrawCB);
+			rDevice.set_constant_buffers(ShaderStage::kPixel, 1, 1, &pPerDrawCB);
+			rDevice.set_constant_buffers(ShaderStage::kPixel, 2, 1, &pLightInfoCB);
+			apiCalls += 3;
+		}
 
-				// Update Per Draw Data
-				m_perDrawCBData.m_matMVP = matMVP.Transpose();
+		rDevice.set_depth_stencil_state(nullptr, 0);
+		rDevice.set_rasterizer_state(to_handle(pPreviousRasterizerState));
+		SAFE_RELEASE(pPreviousRasterizerState);
+		return apiCalls + 2;
+	}
 
-				// Push to GPU
-				push_constant_buffer(systems.pD3DContext, m_pPerDrawCB, m_perDrawCBData);
+	// One instanced draw per light type, every light read from the structured buffer by instance id.
+	// Returns the number of D3D calls made.
+	u32 render_instanced_light_volumes(SystemsInterface& systems, int eye)
+	{
+		ID3D11DeviceContext* pContext = systems.pD3DContext;
 
-				// Draw the mesh.
-				m_plane.draw(systems.pD3DContext);
+		ID3D11RasterizerState* pPreviousRasterizerState = nullptr;
+		pContext->RSGetState(&pPreviousRasterizerState);
 
-			}
+		ID3D11RenderTargetView* pTarget = systems.pEyeRenderTexture[eye]->GetRTV();
+		pContext->OMSetRenderTargets(1, &pTarget, m_pGBufferReadOnlyDepthView[eye]);
+
+		ID3D11ShaderResourceView* views[] =
+		{
+			m_pGBufferTextureViews[eye][kGBufferColourSpec],
+			m_pGBufferTextureViews[eye][kGBufferNormalPow],
+			m_pGBufferTextureViews[eye][kGBufferDepth],
+			m_pLightBufferView
+		};
+		pContext->PSSetShaderResources(0, 4, views);
+		pContext->VSSetShaderResources(3, 1, &m_pLightBufferView);
+		pContext->VSSetConstantBuffers(5, 1, &m_pLightVolumeCB);
+		pContext->PSSetConstantBuffers(5, 1, &m_pLightVolumeCB);
+		u32 apiCalls = 6;
+
+		struct Batch
+		{
+			ELightType m_type;
+			const ShaderSet* m_pShader;
+			const Mesh* m_pMesh;
+		};
+		const Batch kBatches[] =
+		{
+			{ kLightType_Directional, &m_directionalLightInstancedShader, &m_fullScreenQuad },
+			{ kLightType_Point, &m_pointLightInstancedShader, &m_lightVolumeSphere },
+			{ kLightType_Spot, &m_spotLightInstancedShader, &m_lightVolumeCone },
+		};
 
-			constexpr f32 kGridSpacing = 1.5f;
-			constexpr u32 kNumInstances = 5;
-			constexpr u32 kNumModelTypes = 2;
+		for (const Batch& rBatch : kBatches)
+		{
+			const u32 kFirst = m_lightTypeStart[rBatch.m_type];
+			const u32 kInside = m_lightInsideCount[rBatch.m_type];
+			const u32 kCount = m_lightTypeStart[rBatch.m_type + 1] - kFirst;
+			if (!kCount)
+				continue;
+
+			rBatch.m_pShader->bind(pContext);
+			rBatch.m_pMesh->bind(pContext);
+			apiCalls += kShaderBindCalls + kMeshBindCalls;
+
+			LightVolumeCBData volumeData = {};
+			if (rBatch.m_type == kLightType_Directional)
+			{
+				pContext->OMSetDepthStencilState(m_pVolumeDepthStates[kVolumeState_FullScreen], 0);
+				pContext->RSSetState(m_pVolumeRasterizerStates[kVolumeRaster_BothFaces]);
+
+				volumeData.m_firstLight = kFirst;
+				push_constant_buffer(pContext, m_pLightVolumeCB, volumeData);
+				rBatch.m_pMesh->draw_instanced(pContext, kCount);
+				apiCalls += 2 + kPushConstantCalls + 1;
+				continue;
+			}
 
-			for (u32 i = 0; i < kNumModelTypes; ++i)
+			// Lights the camera is inside sit at the front of the range, back faces only.
+			if (kInside)
 			{
-				// Bind a mesh and texture.
-				m_meshArray[i].bind(systems.pD3DContext);
-				m_textureArray[i].bind(systems.pD3DContext, ShaderStage::kPixel, 0);
+				pContext->OMSetDepthStencilState(m_pVolumeDepthStates[kVolumeState_CameraInside], 0);
+				pContext->RSSetState(m_pVolumeRasterizerStates[kVolumeRaster_BackFaces]);
 
-				// Draw several instances
-				for (u32 j = 0; j < kNumInstances; ++j)
-				{
-					// Compute MVP matrix.
-					m4x4 matModel = m4x4::CreateTranslation(v3(j * kGridSpacing, i * kGridSpacing, 0.f));
-					m4x4 matMVP = matModel * finalViewMatrix[0];
+				volumeData.m_firstLight = kFirst;
+				push_constant_buffer(pContext, m_pLightVolumeCB, volumeData);
+				rBatch.m_pMesh->draw_instanced(pContext, kInside);
+				apiCalls += 2 + kPushConstantCalls + 1;
+			}
 
-					// Update Per Draw Data
-					m_perDrawCBData.m_matMVP = matMVP.Transpose();
+			// The rest are marked together, overlapping volumes add to the same stencil values so the
+			// light pass keeps them and the mask is cleared once afterwards.
+			if (kCount > kInside)
+			{
+				volumeData.m_firstLight = kFirst + kInside;
+				push_constant_buffer(pContext, m_pLightVolumeCB, volumeData);
 
-					// Push to GPU
-					push_constant_buffer(systems.pD3DContext, m_pPerDrawCB, m_perDrawCBData);
+				pContext->OMSetDepthStencilState(m_pVolumeDepthStates[kVolumeState_StencilMark], 0);
+				pContext->RSSetState(m_pVolumeRasterizerStates[kVolumeRaster_BothFaces]);
+				pContext->PSSetShader(nullptr, nullptr, 0);
+				rBatch.m_pMesh->draw_instanced(pContext, kCount - kInside);
 
-					// Draw the mesh.
-					m_meshArray[i].draw(systems.pD3DContext);
-				}
+				pContext->OMSetDepthStencilState(m_pVolumeDepthStates[kVolumeState_StencilLightBatch], 0);
+				pContext->RSSetState(m_pVolumeRasterizerStates[kVolumeRaster_BackFaces]);
+				pContext->PSSetShader(rBatch.m_pShader->ps.Get(), nullptr, 0);
+				rBatch.m_pMesh->draw_instanced(pContext, kCount - kInside);
+
+				pContext->ClearDepthStencilView(m_pGBufferReadOnlyDepthView[eye], D3D11_CLEAR_STENCIL, 1.f, 0);
+				apiCalls += kPushConstantCalls + 9;
 			}
-			//=======================================================================================
-			// The Lighting
-			// Read the GBuffer textures, and "draw" light volumes for each of our lights.
-			// We use additive blending on the result.
-			//=======================================================================================
+		}
 
-			// Bind the swap chain (back buffer) to the render target
-			// Make sure to unbind other gbuffer targets and depth
-			ID3D11RenderTargetView* views[] = { systems.pEyeRenderTexture[eye]->GetRTV(), 0 };
-			systems.pD3DContext->OMSetRenderTargets(2, views, 0);
+		ID3D11ShaderResourceView* nullView = nullptr;
+		pContext->VSSetShaderResources(3, 1, &nullView);
+		pContext->OMSetDepthStencilState(nullptr, 0);
+		pContext->RSSetState(pPreviousRasterizerState);
+		SAFE_RELEASE(pPreviousRasterizerState);
+		return apiCalls + 3;
+	}
 
-			// Bind our GBuffer textures as inputs to the pixel shader
-			ID3D11ShaderResourceView* srVs[] = { systems.pEyeRenderTexture[eye]->GetDTV(), 0 };
-			systems.pD3DContext->PSSetShaderResources(0, 2, srVs);
+	void create_light_volume_states(ID3D11Device* pDevice)
+	{
+		// Light volume meshes wind counter clockwise seen from outside, as the debug draw state assumes.
+		D3D11_RASTERIZER_DESC rasterDesc = {};
+		rasterDesc.FillMode = D3D11_FILL_SOLID;
+		rasterDesc.FrontCounterClockwise = TRUE;
+		rasterDesc.DepthClipEnable = TRUE;
+
+		rasterDesc.CullMode = D3D11_CULL_NONE;
+		pDevice->CreateRasterizerState(&rasterDesc, &m_pVolumeRasterizerStates[kVolumeRaster_BothFaces]);
+		rasterDesc.CullMode = D3D11_CULL_FRONT;
+		pDevice->CreateRasterizerState(&rasterDesc, &m_pVolumeRasterizerStates[kVolumeRaster_BackFaces]);
+
+		// Mark : count faces behind the scene, back faces up and front faces down, wrapping so face order doesn't matter.
+		// A pixel ends non zero only when its geometry lies between the two.
+		D3D11_DEPTH_STENCIL_DESC desc = {};
+		desc.DepthEnable = TRUE;
+		desc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ZERO;
+		desc.DepthFunc = D3D11_COMPARISON_LESS_EQUAL;
+		desc.StencilEnable = TRUE;
+		desc.StencilReadMask = D3D11_DEFAULT_STENCIL_READ_MASK;
+		desc.StencilWriteMask = D3D11_DEFAULT_STENCIL_WRITE_MASK;
+		desc.FrontFace.StencilFunc = D3D11_COMPARISON_ALWAYS;
+		desc.FrontFace.StencilFailOp = D3D11_STENCIL_OP_KEEP;
+		desc.FrontFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+		desc.FrontFace.StencilDepthFailOp = D3D11_STENCIL_OP_DECR;
+		desc.BackFace = desc.FrontFace;
+		desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_INCR;
+		pDevice->CreateDepthStencilState(&desc, &m_pVolumeDepthStates[kVolumeState_StencilMark]);
+
+		// Light : back faces only where marked, no depth test so the far side of the volume
+		// never hides the geometry inside. The single light pass clears its mark as it goes.
+		desc.DepthEnable = FALSE;
+		desc.BackFace.StencilFunc = D3D11_COMPARISON_NOT_EQUAL;
+		desc.BackFace.StencilDepthFailOp = D3D11_STENCIL_OP_KEEP;
+		desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_ZERO;
+		desc.FrontFace = desc.BackFace;
+		pDevice->CreateDepthStencilState(&desc, &m_pVolumeDepthStates[kVolumeState_StencilLight]);
+
+		desc.BackFace.StencilPassOp = D3D11_STENCIL_OP_KEEP;
+		desc.FrontFace = desc.BackFace;
+		pDevice->CreateDepthStencilState(&desc, &m_pVolumeDepthStates[kVolumeState_StencilLightBatch]);
+
+		// Camera inside : back faces that are not in front of the scene.
+		desc.DepthEnable = TRUE;
+		desc.DepthFunc = D3D11_COMPARISON_GREATER_EQUAL;
+		desc.StencilEnable = FALSE;
+		pDevice->CreateDepthStencilState(&desc, &m_pVolumeDepthStates[kVolumeState_CameraInside]);
+
+		desc.DepthEnable = FALSE;
+		pDevice->CreateDepthStencilState(&desc, &m_pVolumeDepthStates[kVolumeState_FullScreen]);
+	}
 
+	void create_shadow_atlas(ID3D11Device* pDevice)
+	{
+		ShadowAtlas::Desc atlasDesc;
+		atlasDesc.m_size = kShadowAtlasSize;
+		m_shadowAtlas.init(atlasDesc);
+
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = kShadowAtlasSize;
+		desc.Height = kShadowAtlasSize;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_R32_TYPELESS; // Typeless because we are binding as SRV and DepthStencilView
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_DEFAULT;
+		desc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE;
+
+		HRESULT hr = pDevice->CreateTexture2D(&desc, NULL, &m_pShadowAtlasTexture);
+		if (FAILED(hr))
+		{
+			panicF("Failed to create the shadow atlas");
+		}
 
-			// For exploring the GBuffer data we use a shader.
-			// Bind GBuffer Debugging shader.
+		D3D11_DEPTH_STENCIL_VIEW_DESC depthDesc = {};
+		depthDesc.Format = DXGI_FORMAT_D32_FLOAT;
+		depthDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+		hr = pDevice->CreateDepthStencilView(m_pShadowAtlasTexture, &depthDesc, &m_pShadowAtlasDepthView);
+		if (FAILED(hr))
+		{
+			panicF("Failed to create Depth Stencil View for the shadow atlas");
+		}
+
+		D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+		srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = 1;
+		hr = pDevice->CreateShaderResourceView(m_pShadowAtlasTexture, &srvDesc, &m_pShadowAtlasView);
+		if (FAILED(hr))
+		{
+			panicF("Failed to create SRV of the shadow atlas");
+		}
+
+		m_pShadowViewBuffer = create_structured_buffer<ShadowView>(pDevice, kMaxShadowViews);
+		m_pShadowViewBufferView = create_structured_buffer_view(pDevice, m_pShadowViewBuffer);
+		m_pShadowCB = create_constant_buffer<ShadowCBData>(pDevice);
+
+		D3D11_SAMPLER_DESC samplerDesc = {};
+		samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+		samplerDesc.AddressU = samplerDesc.AddressV = samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;
+		samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS_EQUAL;
+		samplerDesc.MaxLOD = D3D11_FLOAT32_MAX;
+		pDevice->CreateSamplerState(&samplerDesc, &m_pShadowSampler);
+
+		// Casters are drawn double sided with a slope scaled bias, the winding of the meshes doesn't matter.
+		D3D11_RASTERIZER_DESC rasterDesc = {};
+		rasterDesc.FillMode = D3D11_FILL_SOLID;
+		rasterDesc.CullMode = D3D11_CULL_NONE;
+		rasterDesc.SlopeScaledDepthBias = 2.f;
+		rasterDesc.DepthClipEnable = TRUE;
+		pDevice->CreateRasterizerState(&rasterDesc, &m_pShadowRasterizerState);
+
+		D3D11_DEPTH_STENCIL_DESC clearDesc = {};
+		clearDesc.DepthEnable = TRUE;
+		clearDesc.DepthWriteMask = D3D11_DEPTH_WRITE_MASK_ALL;
+		clearDesc.DepthFunc = D3D11_COMPARISON_ALWAYS;
+		pDevice->CreateDepthStencilState(&clearDesc, &m_pShadowClearState);
+	}
+
+	// Pick the shadowed lights, place their maps in the atlas and draw the faces the cache can't reuse.
+	// The scene's casters never move, so only lights moving or changing tiles cost a redraw.
+	void render_shadows(SystemsInterface& systems, const m4x4 inverseViews[2], const m4x4& rProjection)
+	{
+		ID3D11DeviceContext* pContext = systems.pD3DContext;
+
+		// Directional lights and spots always win, points compete on the light budget score.
+		const v3 vEye = systems.pCamera->eye;
+		const f32 kPixelsPerUnit = rProjection._22 * systems.height * 0.5f;
+		const f32 kScreenArea = f32(systems.width * systems.height);
+		m_shadowRequests.resize(m_lightSystem.count());
+		for (u32 i = 0; i < m_lightSystem.count(); ++i)
+		{
+			ShadowRequest& rRequest = m_shadowRequests[i];
+			rRequest.m_key = i;
+
+			const ELightType kType = m_lightSystem.type(i);
+			if (kType == kLightType_Directional)
 			{
-				// if we are not debugging the we bind the lighting shader and start accumulating light volumes.
-				// bind the light constant buffer
-				systems.pD3DContext->PSSetConstantBuffers(2, 1, &m_pLightInfoCB);
+				rRequest.m_faces = kMaxShadowCascades;
+				rRequest.m_size = kMaxShadowTileSize;
+				rRequest.m_importance = FLT_MAX;
+				continue;
+			}
 
-				// Additive blend so we accumulate
-				systems.pD3DContext->OMSetBlendState(m_pBlendStates[BlendStates::kAdditive], kBlendFactor, kSampleMask);
+			// A face as large as the light's sphere is on screen.
+			const f32 kRadius = m_lightSystem.radius(i);
+			const f32 kDistance = std::max(v3::Distance(m_lightSystem.position(i), vEye), kRadius);
+			rRequest.m_faces = kType == kLightType_Spot ? 1 : 6;
+			rRequest.m_size = std::min(u32(2.f * kRadius * kPixelsPerUnit / kDistance), kMaxShadowTileSize);
+			rRequest.m_importance = kType == kLightType_Spot ? FLT_MAX : LightBudget::score(m_lightSystem.gpu_light(i), vEye, kPixelsPerUnit, kScreenArea);
+		}
 
-				static int maxLights = m_lights.size();
-				ImGui::SliderInt("Lights", &maxLights, 0, m_lights.size());
+		const u32 kCandidates = std::min(kMaxShadowedLights, m_lightSystem.count());
+		std::nth_element(m_shadowRequests.begin(), m_shadowRequests.begin() + kCandidates, m_shadowRequests.end()
+			, [](const ShadowRequest& a, const ShadowRequest& b) { return a.m_importance > b.m_importance; });
+		m_shadowRequests.resize(kCandidates);
+		m_shadowAtlas.allocate(m_shadowRequests.data(), kCandidates);
+		ASSERT(m_shadowAtlas.validate());
 
-				for (u32 i = 0; i < (u32)maxLights; ++i)
+		// Cascade slices, both eyes' corners go into each fit.
+		f32 splits[kMaxShadowCascades + 1];
+		compute_cascade_splits(kEyeNearClip, kShadowDistance, kMaxShadowCascades, 0.75f, splits);
+
+		ShadowCBData shadowData = {};
+		for (u32 c = 0; c < kMaxShadowCascades; ++c)
+		{
+			shadowData.m_cascadeEnds[c] = splits[c + 1];
+		}
+		shadowData.m_cascadeCount = kMaxShadowCascades;
+		shadowData.m_atlasTexelSize = 1.f / kShadowAtlasSize;
+		push_constant_buffer(pContext, m_pShadowCB, shadowData);
+
+		// Save what the eye passes had bound, the atlas is drawn in between.
+		ID3D11RenderTargetView* pPreviousTarget = nullptr;
+		ID3D11DepthStencilView* pPreviousDepth = nullptr;
+		ID3D11RasterizerState* pPreviousRasterizerState = nullptr;
+		UINT viewportCount = 1;
+		D3D11_VIEWPORT previousViewport = {};
+		pContext->OMGetRenderTargets(1, &pPreviousTarget, &pPreviousDepth);
+		pContext->RSGetState(&pPreviousRasterizerState);
+		pContext->RSGetViewports(&viewportCount, &previousViewport);
+
+		ID3D11ShaderResourceView* nullView = nullptr;
+		pContext->PSSetShaderResources(8, 1, &nullView);
+		pContext->OMSetRenderTargets(0, nullptr, m_pShadowAtlasDepthView);
+		pContext->OMSetBlendState(m_pBlendStates[BlendStates::kOpaque], kBlendFactor, kSampleMask);
+		pContext->RSSetState(m_pShadowRasterizerState);
+		pContext->VSSetConstantBuffers(1, 1, &m_pPerDrawCB);
+
+		m_lightSystem.clear_shadows();
+		m_shadowViews.clear();
+		for (u32 r = 0; r < kCandidates; ++r)
+		{
+			const ShadowAllocation& rAllocation = m_shadowAtlas.allocation(r);
+			if (!rAllocation.m_faces || m_shadowViews.size() + rAllocation.m_faces > kMaxShadowViews)
+				continue;
+
+			const u32 kLight = m_shadowRequests[r].m_key;
+			const ELightType kType = m_lightSystem.type(kLight);
+			const v3 vPosition = m_lightSystem.position(kLight);
+			const v3 vDirection = m_lightSystem.direction(kLight);
+			const f32 kRadius = m_lightSystem.radius(kLight);
+			m_lightSystem.set_shadow(kLight, static_cast<u32>(m_shadowViews.size()));
+
+			for (u32 face = 0; face < rAllocation.m_faces; ++face)
+			{
+				const ShadowRect& rRect = m_shadowAtlas.rects()[rAllocation.m_firstRect + face];
+
+				m4x4 matViewProjection;
+				f32 bias;
+				if (kType == kLightType_Directional)
+				{
+					v3 corners[16];
+					frustum_slice_corners(inverseViews[0], rProjection, splits[face], splits[face + 1], corners);
+					frustum_slice_corners(inverseViews[1], rProjection, splits[face], splits[face + 1], corners + 8);
+					matViewProjection = fit_cascade(corners, 16, vDirection, rRect.m_size, kCascadeCasterDistance);
+					bias = 0.001f;
+				}
+				else if (kType == kLightType_Spot)
+				{
+					const v3 vUp = fabsf(vDirection.y) < 0.99f ? v3(0.f, 1.f, 0.f) : v3(1.f, 0.f, 0.f);
+					const f32 kOuterAngle = acosf(m_lightSystem.gpu_light(kLight).m_vDirection.w);
+					matViewProjection = m4x4::CreateLookAt(vPosition, vPosition + vDirection, vUp)
+						* m4x4::CreatePerspectiveFieldOfView(2.f * kOuterAngle, 1.f, kShadowNearClip, kRadius);
+					bias = 0.0002f;
+				}
+				else
 				{
-					auto& rLight(m_lights[i]);
-					// For drawing a directional light which hits everywhere we draw a full screen quad.
+					// +X -X +Y -Y +Z -Z, matching the face LightShadow picks by major axis.
+					static const v3 kFaceDirections[6] = { v3(1, 0, 0), v3(-1, 0, 0), v3(0, 1, 0), v3(0, -1, 0), v3(0, 0, 1), v3(0, 0, -1) };
+					static const v3 kFaceUps[6] = { v3(0, 1, 0), v3(0, 1, 0), v3(0, 0, -1), v3(0, 0, 1), v3(0, 1, 0), v3(0, 1, 0) };
+					matViewProjection = m4x4::CreateLookAt(vPosition, vPosition + kFaceDirections[face], kFaceUps[face])
+						* m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 1.f, kShadowNearClip, kRadius);
+					bias = 0.0002f;
+				}
 
-					// Update and the light info constants.
-				//	rLight.m_shaderInfo.m_vAtt = tuneAtt;
-					push_constant_buffer(systems.pD3DContext, m_pLightInfoCB, rLight.m_shaderInfo);
+				ShadowView view;
+				view.m_matViewProjection = matViewProjection.Transpose();
+				view.m_vAtlasRect = m_shadowAtlas.uv_scale_offset(rRect);
+				view.m_vParams = v4(bias, 0.f, 0.f, 0.f);
+				m_shadowViews.push_back(view);
 
-					switch (rLight.m_type)
-					{
-					case kLightType_Directional:
-					{
-						m_directionalLightShader.bind(systems.pD3DContext);
-						m_fullScreenQuad.bind(systems.pD3DContext);
-						m_fullScreenQuad.draw(systems.pD3DContext);
-					}
-					break;
-					case kLightType_Point:
-					{
-						m_pointLightShader.bind(systems.pD3DContext);
+				const f32 kReach = kType == kLightType_Directional ? -1.f : kRadius;
+				if (m_shadowCache.needs_draw(kLight, face, rRect, matViewProjection, vPosition, kReach))
+				{
+					draw_shadow_face(pContext, rRect, matViewProjection);
+				}
+			}
+		}
+		m_shadowCache.end_frame();
 
-						// Compute Light MVP matrix.
-						m4x4 matModel = m4x4::CreateScale(rLight.m_shaderInfo.m_vAtt.w);
-						matModel *= m4x4::CreateTranslation(v3(rLight.m_shaderInfo.m_vPosition));
-						m4x4 matMVP = matModel * prod;
+		D3D11_MAPPED_SUBRESOURCE subresource;
+		if (!m_shadowViews.empty() && !FAILED(pContext->Map(m_pShadowViewBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+		{
+			memcpy(subresource.pData, m_shadowViews.data(), m_shadowViews.size() * sizeof(ShadowView));
+			pContext->Unmap(m_pShadowViewBuffer, 0);
+		}
+
+		pContext->OMSetRenderTargets(1, &pPreviousTarget, pPreviousDepth);
+		pContext->OMSetDepthStencilState(nullptr, 0);
+		pContext->RSSetState(pPreviousRasterizerState);
+		pContext->RSSetViewports(viewportCount, &previousViewport);
+		SAFE_RELEASE(pPreviousTarget);
+		SAFE_RELEASE(pPreviousDepth);
+		SAFE_RELEASE(pPreviousRasterizerState);
+
+		const ShadowAtlas::Stats& rAtlasStats = m_shadowAtlas.stats();
+		const ShadowCache::Stats& rCacheStats = m_shadowCache.stats();
+		ImGui::Text("Shadows: %u lights, %u kept, %u downsized, %u dropped, atlas %.0f%% used", rAtlasStats.m_requests - rAtlasStats.m_dropped
+			, rAtlasStats.m_kept, rAtlasStats.m_downsized, rAtlasStats.m_dropped, 100.0 * rAtlasStats.m_usedTexels / (f64(kShadowAtlasSize) * kShadowAtlasSize));
+		ImGui::Text("Shadow faces: %u drawn, %u cached", rCacheStats.m_drawn, rCacheStats.m_cached);
+	}
 
-						// Update Per Draw Data
-						m_perDrawCBData.m_matMVP = matMVP.Transpose();
-						push_constant_buffer(systems.pD3DContext, m_pPerDrawCB, m_perDrawCBData);
+	void draw_shadow_face(ID3D11DeviceContext* pContext, const ShadowRect& rRect, const m4x4& rViewProjection)
+	{
+		D3D11_VIEWPORT viewport = { f32(rRect.m_x), f32(rRect.m_y), f32(rRect.m_size), f32(rRect.m_size), 0.f, 1.f };
+		pContext->RSSetViewports(1, &viewport);
 
-						m_lightVolumeSphere.bind(systems.pD3DContext);
-						m_lightVolumeSphere.draw(systems.pD3DContext);
-					}
-					break;
-					case kLightType_Spot:
-						break;
-					default:
-						break;
+		// Clear only this tile, the rest of the atlas holds cached maps.
+		pContext->OMSetDepthStencilState(m_pShadowClearState, 0);
+		m_shadowClearShader.bind(pContext);
+		m_fullScreenQuad.bind(pContext);
+		m_fullScreenQuad.draw(pContext);
 
-					}
+		pContext->OMSetDepthStencilState(nullptr, 0);
+		m_shadowCasterShader.bind(pContext);
 
+		// Same layout as the geometry pass.
+		m_perDrawCBData.m_matMVP = rViewProjection.Transpose();
+		push_constant_buffer(pContext, m_pPerDrawCB, m_perDrawCBData);
+		m_plane.bind(pContext);
+		m_plane.draw(pContext);
 
-				}
+		for (u32 i = 0; i < kNumModelTypes; ++i)
+		{
+			m_meshArray[i].bind(pContext);
+			for (u32 j = 0; j < kNumInstances; ++j)
+			{
+				const m4x4 matModel = m4x4::CreateTranslation(v3(j * kGridSpacing, i * kGridSpacing, 0.f));
+				m_perDrawCBData.m_matMVP = (matModel * rViewProjection).Transpose();
+				push_constant_buffer(pContext, m_pPerDrawCB, m_perDrawCBData);
+				m_meshArray[i].draw(pContext);
 			}
+		}
+	}
 
+	// Cull the lights against the frustum holding both eyes and tag each survivor with the eyes it reaches.
+	void cull_stereo_lights(const StereoFrustum& rFrustum)
+	{
+		const s64 kStart = getTimeMicroseconds();
+		const u32 kCulledCount = m_lightSystem.cull_and_pack(rFrustum.m_planes, 6, m_stereoLights, &m_jobs);
 
+		for (u32 t = 0; t < kMaxLightTypes; ++t)
+		{
+			m_stereoTypeStart[t] = m_lightSystem.visible_first(static_cast<ELightType>(t));
+		}
+		m_stereoTypeStart[kMaxLightTypes] = kCulledCount;
 
-			// Unbind all the SRVs because we need them as targets next frame
-			ID3D11ShaderResourceView* srvClear[] = { 0,0,0 };
-			systems.pD3DContext->PSSetShaderResources(0, 3, srvClear);
+		m_stereoEyeMasks.resize(kCulledCount);
+		stereo_eye_masks(rFrustum, m_stereoLights.data(), kCulledCount, m_stereoEyeMasks.data());
 
-			// re-bind depth for debugging output.
-			systems.pD3DContext->OMSetRenderTargets(2, views, systems.pEyeRenderTexture[eye]->GetDSV());
-			// Commit rendering to the swap chain
-			systems.pEyeRenderTexture[eye]->Commit();
+		const u32 kBoth = static_cast<u32>(std::count(m_stereoEyeMasks.begin(), m_stereoEyeMasks.end(), u8(kEyeMask_Both)));
+		ImGui::Text("Visible lights: %u / %u, %u in both eyes, culled in %.3f ms", kCulledCount, m_lightSystem.count(), kBoth, (getTimeMicroseconds() - kStart) / 1000.0);
+	}
 
+	// Take the lights reaching one eye, trim them to the light budget, then upload the survivors and the tile constants.
+	void update_light_buffers(SystemsInterface& systems, int eye, const m4x4& rProjection, const v3& vEye, const bool kLightBudget)
+	{
+		const u32 kEyeCount = split_eye_lights(m_stereoLights.data(), m_stereoEyeMasks.data(), m_stereoTypeStart, eye, m_packedLights, m_lightTypeStart);
+		ImGui::Text("Eye %d lights: %u", eye, kEyeCount);
+
+		if (kLightBudget)
+		{
+			const f32 kPixelsPerUnit = rProjection._22 * systems.height * 0.5f;
+			m_lightBudget.apply(vEye, kPixelsPerUnit, f32(systems.width * systems.height), m_packedLights, m_lightTypeStart);
+
+			const LightBudget::Stats& rStats = m_lightBudget.stats();
+			ImGui::Text("Budget %u: %u full, %u merged into %u virtual", m_lightBudget.budget(), rStats.m_full, rStats.m_merged, rStats.m_virtual);
 		}
 
-		// Initialize our single full screen Fov layer.
-		ovrLayerEyeFovDepth ld = {};
-		ld.Header.Type = ovrLayerType_EyeFovDepth;
-		ld.Header.Flags = 0;
-		ld.ProjectionDesc = posTimewarpProjectionDesc;
-		ld.SensorSampleTime = sensorSampleTime;
+		// Volumes the camera is inside go first in their type's range, they can't use the stencil mask.
+		const f32 kNearCornerDistance = near_plane_corner_distance(rProjection, kEyeNearClip);
+		m_lightInsideCount[kLightType_Directional] = 0;
+		for (u32 t = kLightType_Point; t < kMaxLightTypes; ++t)
+		{
+			m_lightInsideCount[t] = partition_camera_inside(m_packedLights.data() + m_lightTypeStart[t]
+				, m_lightTypeStart[t + 1] - m_lightTypeStart[t], vEye, kNearCornerDistance);
+		}
 
-		for (int eye = 0; eye < 2; ++eye)
+		const u32 kVisibleCount = static_cast<u32>(m_packedLights.size());
+		m_lightBounds.resize(kVisibleCount);
+		for (u32 i = 0; i < kVisibleCount; ++i)
 		{
-			ld.ColorTexture[eye] = systems.pEyeRenderTexture[eye]->TextureChain;
-			ld.DepthTexture[eye] = systems.pEyeRenderTexture[eye]->DepthTextureChain;
-			ld.Viewport[eye] = systems.pEyeRenderViewport[eye];
-			ld.Fov[eye] = hmdDesc.DefaultEyeFov[eye];
-			ld.RenderPose[eye] = EyeRenderPose[eye];
+			const LightInfo& rInfo = m_packedLights[i];
+			m_lightBounds[i].m_vCentre = v3(rInfo.m_vPosition);
+			m_lightBounds[i].m_radius = rInfo.m_vPosition.w == 0.f ? kInfiniteLightRadius : rInfo.m_vAtt.w;
+			m_lightBounds[i].m_vDirection = v3(rInfo.m_vDirection);
+			m_lightBounds[i].m_coneRadius = gpu_light_type(rInfo) == kLightType_Spot ? gpu_light_cone_radius(rInfo) : 0.f;
 		}
 
-		ovrLayerHeader* layers = &ld.Header;
-		result = ovr_SubmitFrame(*systems.pOvrSession, 0, nullptr, &layers, 1);
-		// exit the rendering loop if submit returns an error, will retry on ovrError_DisplayLost
-		if (!OVR_SUCCESS(result))
-			panicF("Fail Rendering Loop!");
+		D3D11_MAPPED_SUBRESOURCE subresource;
+		if (kVisibleCount && !FAILED(systems.pD3DContext->Map(m_pLightBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+		{
+			memcpy(subresource.pData, m_packedLights.data(), kVisibleCount * sizeof(LightInfo));
+			systems.pD3DContext->Unmap(m_pLightBuffer, 0);
+		}
 
-		//=======================================================================================
+		TileCullingCBData tileData = {};
+		tileData.m_screenSize[0] = systems.width;
+		tileData.m_screenSize[1] = systems.height;
+		tileData.m_tileCount[0] = light_tile_count(systems.width);
+		tileData.m_tileCount[1] = light_tile_count(systems.height);
+		tileData.m_lightCount = kVisibleCount;
+		push_constant_buffer(systems.pD3DContext, m_pTileCullingCB, tileData);
+	}
+
+	// Bin the lights into screen tiles against this eye's depth, then shade every pixel in one pass.
+	void render_tiled_lighting(SystemsInterface& systems, int eye)
+	{
+		ID3D11DeviceContext* pContext = systems.pD3DContext;
+
+		// Culling.
+		{
+			ID3D11Buffer* buffers[] = { m_pPerFrameCB };
+			pContext->CSSetConstantBuffers(0, 1, buffers);
+			pContext->CSSetConstantBuffers(3, 1, &m_pTileCullingCB);
+
+			ID3D11ShaderResourceView* views[] = { m_pGBufferTextureViews[eye][kGBufferDepth], m_pLightBufferView };
+			pContext->CSSetShaderResources(2, 2, views);
+			pContext->CSSetUnorderedAccessViews(0, 1, &m_pTileLightsUAV, nullptr);
+
+			m_tileCullingShader.bind(pContext);
+			pContext->Dispatch(light_tile_count(systems.width), light_tile_count(systems.height), 1);
+
+			// The tile lists are read by the pixel shader next.
+			ID3D11ShaderResourceView* nullViews[] = { nullptr, nullptr };
+			ID3D11UnorderedAccessView* nullUAV = nullptr;
+			pContext->CSSetShaderResources(2, 2, nullViews);
+			pContext->CSSetUnorderedAccessViews(0, 1, &nullUAV, nullptr);
+		}
 
+		// Shading.
+		{
+			ID3D11ShaderResourceView* views[] =
+			{
+				m_pGBufferTextureViews[eye][kGBufferColourSpec],
+				m_pGBufferTextureViews[eye][kGBufferNormalPow],
+				m_pGBufferTextureViews[eye][kGBufferDepth],
+				m_pLightBufferView,
+				m_pTileLightsView
+			};
+			pContext->PSSetShaderResources(0, 5, views);
+			pContext->PSSetConstantBuffers(3, 1, &m_pTileCullingCB);
+
+			pContext->OMSetBlendState(m_pBlendStates[BlendStates::kOpaque], kBlendFactor, kSampleMask);
+
+			m_tiledLightingShader.bind(pContext);
+			m_fullScreenQuad.bind(pContext);
+			m_fullScreenQuad.draw(pContext);
+		}
+	}
 
+	// Bin the lights into this eye's froxels on the CPU, upload the lists and shade in one pass.
+	void render_clustered_lighting(SystemsInterface& systems, int eye, const m4x4& rView, const m4x4& rProjection)
+	{
+		ID3D11DeviceContext* pContext = systems.pD3DContext;
+
+		ClusterGridDesc desc;
+		desc.m_near = kEyeNearClip;
+		desc.m_far = kEyeFarClip;
+
+		LightClusterGrid& rGrid = m_clusterGrid[eye];
+		rGrid.set_projection(rProjection, desc);
+
+		const s64 kStart = getTimeMicroseconds();
+		rGrid.build(m_lightBounds.data(), static_cast<u32>(m_lightBounds.size()), rView, &m_jobs);
+		ImGui::Text("Eye %d clusters: %.3f ms, %u indices", eye, (getTimeMicroseconds() - kStart) / 1000.0, static_cast<u32>(rGrid.indices().size()));
+
+		// Upload.
+		{
+			reserve_cluster_indices(systems.pD3DDevice, static_cast<u32>(rGrid.indices().size()));
+
+			D3D11_MAPPED_SUBRESOURCE subresource;
+			if (!FAILED(pContext->Map(m_pClusterBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+			{
+				memcpy(subresource.pData, rGrid.clusters().data(), rGrid.clusters().size() * sizeof(LightCluster));
+				pContext->Unmap(m_pClusterBuffer, 0);
+			}
+			if (!rGrid.indices().empty() && !FAILED(pContext->Map(m_pClusterIndexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+			{
+				memcpy(subresource.pData, rGrid.indices().data(), rGrid.indices().size() * sizeof(u32));
+				pContext->Unmap(m_pClusterIndexBuffer, 0);
+			}
+
+			ClusterCBData clusterData = {};
+			clusterData.m_clusterDims[0] = desc.m_tilesX;
+			clusterData.m_clusterDims[1] = desc.m_tilesY;
+			clusterData.m_clusterDims[2] = desc.m_slices;
+			clusterData.m_near = desc.m_near;
+			clusterData.m_sliceScale = rGrid.slice_scale();
+			clusterData.m_forwardSign = rGrid.forward_sign();
+			push_constant_buffer(pContext, m_pClusterCB, clusterData);
+		}
+
+		// Shading.
+		{
+			ID3D11ShaderResourceView* views[] =
+			{
+				m_pGBufferTextureViews[eye][kGBufferColourSpec],
+				m_pGBufferTextureViews[eye][kGBufferNormalPow],
+				m_pGBufferTextureViews[eye][kGBufferDepth],
+				m_pLightBufferView,
+				nullptr,
+				m_pClusterBufferView,
+				m_pClusterIndexView
+			};
+			pContext->PSSetShaderResources(0, 7, views);
+			pContext->PSSetConstantBuffers(4, 1, &m_pClusterCB);
+
+			pContext->OMSetBlendState(m_pBlendStates[BlendStates::kOpaque], kBlendFactor, kSampleMask);
+
+			m_clusteredLightingShader.bind(pContext);
+			m_fullScreenQuad.bind(pContext);
+			m_fullScreenQuad.draw(pContext);
+		}
 	}
 
-	void on_resize(SystemsInterface& systems) override
+	// Grow the cluster index list buffer to hold at least kCount indices.
+	void reserve_cluster_indices(ID3D11Device* pD3DDevice, u32 kCount)
 	{
-		create_gbuffer(systems.pD3DDevice, systems.pD3DContext, systems.width, systems.height);
+		if (kCount <= m_clusterIndexCapacity)
+			return;
+
+		SAFE_RELEASE(m_pClusterIndexView);
+		SAFE_RELEASE(m_pClusterIndexBuffer);
+
+		m_clusterIndexCapacity = std::max(kCount, m_clusterIndexCapacity * 2);
+		m_pClusterIndexBuffer = create_structured_buffer<u32>(pD3DDevice, m_clusterIndexCapacity);
+		m_pClusterIndexView = create_structured_buffer_view(pD3DDevice, m_pClusterIndexBuffer);
+	}
+
+	// Per tile light lists written by CS_TileLightCulling, sized to the screen.
+	void create_tile_buffers(ID3D11Device* pD3DDevice, u32 width, u32 height)
+	{
+		SAFE_RELEASE(m_pTileLightsView);
+		SAFE_RELEASE(m_pTileLightsUAV);
+		SAFE_RELEASE(m_pTileLightsBuffer);
+
+		const u32 kTiles = light_tile_count(width) * light_tile_count(height);
+		m_pTileLightsBuffer = create_rw_structured_buffer<u32>(pD3DDevice, kTiles * (kMaxLightsPerTile + 1));
+		m_pTileLightsUAV = create_structured_buffer_uav(pD3DDevice, m_pTileLightsBuffer);
+		m_pTileLightsView = create_structured_buffer_view(pD3DDevice, m_pTileLightsBuffer);
 	}
 
 private:
@@ -610,6 +1546,8 @@ private:
 
 	void create_gbuffer(ID3D11Device* pD3DDevice, ID3D11DeviceContext* pD3DContext, u32 width, u32 height)
 	{
+		create_tile_buffers(pD3DDevice, width, height);
+
 		// Render Scene to Eye Buffers
 		for (int eye = 0; eye < 2; ++eye) {
 			HRESULT hr;
@@ -619,6 +1557,7 @@ private:
 
 			// destroy old g-buffer views.
 			SAFE_RELEASE(m_pGBufferDepthView[eye]);
+			SAFE_RELEASE(m_pGBufferReadOnlyDepthView[eye]);
 
 			for (u32 i = 0; i < kMaxGBufferColourTargets; ++i)
 			{
@@ -708,6 +1647,15 @@ private:
 					panicF("Failed to create Depth Stencil View for GBuffer");
 				}
 
+				// Read only depth lets the light volumes test against the depth the shaders are sampling,
+				// stencil stays writable for the volume mask.
+				depthDesc.Flags = D3D11_DSV_READ_ONLY_DEPTH;
+				hr = pD3DDevice->CreateDepthStencilView(m_pGBufferTexture[eye][kGBufferDepth], &depthDesc, &m_pGBufferReadOnlyDepthView[eye]);
+				if (FAILED(hr))
+				{
+					panicF("Failed to create read only Depth Stencil View for GBuffer");
+				}
+
 				D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
 				srvDesc.Format = DXGI_FORMAT_R24_UNORM_X8_TYPELESS; // View suitable for decoding full 24bits of depth to red channel.
 				srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
@@ -733,25 +1681,104 @@ private:
 	};
 	ID3D11BlendState* m_pBlendStates[kMaxBlendStates];
 
-	PerFrameCBData m_perFrameCBData;
+	// Stencil masked light volumes, see LightVolumes.h.
+	ID3D11DepthStencilState* m_pVolumeDepthStates[kMaxVolumeStates] = {};
+	ID3D11RasterizerState* m_pVolumeRasterizerStates[kMaxVolumeRasterStates] = {};
+
 	ID3D11Buffer* m_pPerFrameCB = nullptr;
 
 	PerDrawCBData m_perDrawCBData;
 	ID3D11Buffer* m_pPerDrawCB = nullptr;
 
 
-	std::vector<Light> m_lights;
+	std::vector<LightInfo> m_stereoLights;
+	std::vector<u8> m_stereoEyeMasks;
+	u32 m_stereoTypeStart[kMaxLightTypes + 1] = {};
+	LightBudget m_lightBudget;
+	std::vector<u32> m_boxLights;
+	D3D11RenderDevice m_renderDevice;
+	StateCacheDevice m_stateCache;
+	D3D11CommandLists m_commandLists;
+	ParallelRecorder m_parallelRecorder;
+	ID3D11Buffer* m_pConstantRingBuffer = nullptr;
+	FrameFence m_frameFence;
+
+	// Timings over the last camera path replay.
+	struct ReplayStats
+	{
+		u32 m_frames;
+		f64 m_cpuMs;
+		f64 m_worstCpuMs;
+		f64 m_gpuMs;
+	};
+	ReplayStats m_replayStats = {};
+
+
+	// Light markers for the debug view, culled against the camera.
+	std::vector<f32> m_markerBounds;
+	std::vector<u32> m_markerMask;
+	std::vector<u32> m_markerIndices;
+	CoherentCuller m_markerCuller;
+	GpuTimer m_frameTimer;
 	ID3D11Buffer* m_pLightInfoCB = nullptr;
 
+	// Visible lights and the tiled lighting lists.
+	ID3D11Buffer* m_pLightBuffer = nullptr;
+	ID3D11ShaderResourceView* m_pLightBufferView = nullptr;
+	ID3D11Buffer* m_pTileCullingCB = nullptr;
+	ID3D11Buffer* m_pLightVolumeCB = nullptr;
+	ID3D11Buffer* m_pInstanceBatchCB = nullptr;
+	ID3D11Buffer* m_pInstanceBuffer = nullptr;
+	ID3D11ShaderResourceView* m_pInstanceBufferView = nullptr;
+	ID3D11Buffer* m_pTileLightsBuffer = nullptr;
+	ID3D11UnorderedAccessView* m_pTileLightsUAV = nullptr;
+	ID3D11ShaderResourceView* m_pTileLightsView = nullptr;
+
+	// Clustered lighting, one grid per eye built on the CPU.
+	std::vector<LightBounds> m_lightBounds;
+	LightClusterGrid m_clusterGrid[2];
+	ID3D11Buffer* m_pClusterCB = nullptr;
+	ID3D11Buffer* m_pClusterBuffer = nullptr;
+	ID3D11ShaderResourceView* m_pClusterBufferView = nullptr;
+	ID3D11Buffer* m_pClusterIndexBuffer = nullptr;
+	ID3D11ShaderResourceView* m_pClusterIndexView = nullptr;
+	u32 m_clusterIndexCapacity = 0;
+
 
 	ShaderSet m_geometryPassShader;
+	ShaderSet m_geometryPassInstancedShader;
 	ShaderSet m_directionalLightShader;
 	ShaderSet m_pointLightShader;
+	ShaderSet m_directionalLightInstancedShader;
+	ShaderSet m_pointLightInstancedShader;
+	ShaderSet m_spotLightShader;
+	ShaderSet m_spotLightInstancedShader;
+	ShaderSet m_tileCullingShader;
+	ShaderSet m_tiledLightingShader;
+	ShaderSet m_clusteredLightingShader;
 	ShaderSet m_GBufferDebugShaders[kMaxGBufferDebugModes];
+	ShaderSet m_shadowCasterShader;
+	ShaderSet m_shadowClearShader;
+
+	// Shadow maps, one atlas for every shadowed light.
+	ShadowAtlas m_shadowAtlas;
+	ShadowCache m_shadowCache;
+	std::vector<ShadowRequest> m_shadowRequests;
+	std::vector<ShadowView> m_shadowViews;
+	ID3D11Texture2D* m_pShadowAtlasTexture = nullptr;
+	ID3D11DepthStencilView* m_pShadowAtlasDepthView = nullptr;
+	ID3D11ShaderResourceView* m_pShadowAtlasView = nullptr;
+	ID3D11Buffer* m_pShadowViewBuffer = nullptr;
+	ID3D11ShaderResourceView* m_pShadowViewBufferView = nullptr;
+	ID3D11Buffer* m_pShadowCB = nullptr;
+	ID3D11SamplerState* m_pShadowSampler = nullptr;
+	ID3D11RasterizerState* m_pShadowRasterizerState = nullptr;
+	ID3D11DepthStencilState* m_pShadowClearState = nullptr;
 
 	// Scene related objects
 	Mesh m_meshArray[2];
-	Texture m_textureArray[2];
+	TextureCache m_textureCache;
+	TextureRef m_textureArray[2];
 	ID3D11SamplerState* m_pSamplerState = nullptr;
 
 	Mesh m_plane;
@@ -759,12 +1786,14 @@ private:
 	// Screen quad : for deferred passes
 	Mesh m_fullScreenQuad;
 	Mesh m_lightVolumeSphere;
+	Mesh m_lightVolumeCone;
 
 
 	// GBuffer objects
 	ID3D11Texture2D*		m_pGBufferTexture[2][kMaxGBufferTextures];
 	ID3D11RenderTargetView* m_pGBufferTargetViews[2][kMaxGBufferColourTargets];
 	ID3D11DepthStencilView* m_pGBufferDepthView[2];
+	ID3D11DepthStencilView* m_pGBufferReadOnlyDepthView[2];
 	ID3D11ShaderResourceView* m_pGBufferTextureViews[2][kMaxGBufferTextures];
 
 
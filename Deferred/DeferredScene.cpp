@@ -0,0 +1,452 @@
+#include "DeferredScene.h"
+
+#include "MeshInfo.h"
+
+#include <cstdint>
+
+//================================================================================
+// Stand-in resources
+//================================================================================
+
+template<typename Handle>
+static void stand_in(Handle*& rHandleOut, uintptr_t& rNext)
+{
+	rHandleOut = reinterpret_cast<Handle*>(++rNext);
+}
+
+static void stand_in_shader(ShaderBinding& rBindingOut, uintptr_t& rNext)
+{
+	// A vertex and pixel shader set, like ShaderSetDesc::Create_VS_PS makes.
+	rBindingOut = {};
+	stand_in(rBindingOut.m_pInputLayout, rNext);
+	stand_in(rBindingOut.m_pShaders[ShaderStage::kVertex], rNext);
+	stand_in(rBindingOut.m_pShaders[ShaderStage::kPixel], rNext);
+}
+
+static void stand_in_mesh(MeshBinding& rBindingOut, const MeshInfo& rInfo, uintptr_t& rNext)
+{
+	// The stride doesn't matter to a device that never reads the buffer.
+	rBindingOut = {};
+	stand_in(rBindingOut.m_pVertexBuffer, rNext);
+	stand_in(rBindingOut.m_pIndexBuffer, rNext);
+	rBindingOut.m_vertices = rInfo.m_vertices;
+	rBindingOut.m_indices = rInfo.m_indices;
+}
+
+// A model's counts and bounds, the cube's when it won't load.
+static bool stand_in_model(const char* pFilename, const f32 kScale, MeshInfo& rInfoOut)
+{
+	if (mesh_info_from_obj(pFilename, kScale, rInfoOut))
+		return true;
+	rInfoOut = mesh_info_cube(0.5f);
+	return false;
+}
+
+bool stand_in_resources(DeferredSceneResources& rResourcesOut)
+{
+	// The meshes DeferredApp::on_init makes.
+	MeshInfo models[kNumModelTypes];
+	MeshInfo plane;
+	MeshInfo sphere;
+	models[0] = mesh_info_cube(0.5f);
+	bool bLoaded = stand_in_model("Assets/Models/apple.obj", 0.01f, models[1]);
+	bLoaded &= stand_in_model("Assets/Models/plane.obj", 4.f, plane);
+	bLoaded &= stand_in_model("Assets/Models/unit_sphere.obj", 1.f, sphere);
+
+	DeferredSceneResources& r = rResourcesOut;
+	r = {};
+	uintptr_t next = 0;
+
+	stand_in_shader(r.m_geometryPassShader, next);
+	stand_in_shader(r.m_geometryPassInstancedShader, next);
+	stand_in_shader(r.m_directionalLightShader, next);
+	stand_in_shader(r.m_pointLightShader, next);
+	stand_in_shader(r.m_spotLightShader, next);
+
+	for (u32 i = 0; i < kNumModelTypes; ++i)
+	{
+		stand_in_mesh(r.m_models[i], models[i], next);
+		r.m_vModelBoundsMin[i] = models[i].m_vBoundsMin;
+		r.m_vModelBoundsMax[i] = models[i].m_vBoundsMax;
+		stand_in(r.m_materials[i].m_pView, next);
+	}
+	stand_in_mesh(r.m_plane, plane, next);
+	stand_in_mesh(r.m_fullScreenQuad, mesh_info_quad_xy(1.f), next);
+	stand_in_mesh(r.m_lightVolumeSphere, sphere, next);
+	stand_in_mesh(r.m_lightVolumeCone, mesh_info_cone(24), next);
+
+	stand_in(r.m_pSamplerState, next);
+	stand_in(r.m_pPerFrameCB, next);
+	stand_in(r.m_pPerDrawCB, next);
+	stand_in(r.m_pLightInfoCB, next);
+	stand_in(r.m_pLightBuffer, next);
+	stand_in(r.m_pInstanceBatchCB, next);
+	stand_in(r.m_pInstanceBuffer, next);
+	stand_in(r.m_pInstanceBufferView, next);
+	stand_in(r.m_pConstantRingBuffer, next);
+
+	stand_in(r.m_pOpaqueBlendState, next);
+	for (RenderDepthStencilState*& rState : r.m_pVolumeDepthStates)
+		stand_in(rState, next);
+	for (RenderRasterizerState*& rState : r.m_pVolumeRasterizerStates)
+		stand_in(rState, next);
+	return bLoaded;
+}
+
+//================================================================================
+// Deferred Scene
+//================================================================================
+
+void DeferredScene::init_scene()
+{
+	m_perFrameCBData.m_time = 0.0f;
+
+	create_lights();
+	m_lightHash.init(LightSpatialHashDesc());
+	m_occlusion[0].init(OcclusionCullerDesc());
+	m_occlusion[1].init(OcclusionCullerDesc());
+}
+
+void DeferredScene::set_resources(const DeferredSceneResources& rResources)
+{
+	m_resources = rResources;
+	m_constantRing.init(rResources.m_pConstantRingBuffer, kConstantRingBytes);
+}
+
+void DeferredScene::create_lights()
+{
+	// A directional light.
+	m_lightSystem.add_directional(v3(0.5773f, 0.5773f, 0.5773f), v3(1.f, 0.7f, .6f) * 0.2f);
+
+	// Lots of point lights.
+	v3 colours[] =
+	{
+		v3(1,1,1),
+		v3(1,1,0),
+		v3(0,1,1),
+		v3(1,0,1)
+	};
+
+	for (u32 i = 0; i < kLightGridSize; ++i)
+	{
+		for (u32 j = 0; j < kLightGridSize; ++j)
+		{
+			const u32 kLight = m_lightSystem.add_point(v3(i - 5.f, 0.5f, j - 5.f), colours[j % 4] * 0.9f, v4(0.001f, 0.1f, 5.0f, 2.0f));
+
+			// Bob around a point above the grid cell.
+			m_lightSystem.set_animation(kLight, v3(i - 5.f, 1.f, j - 5.f), v3(f32(i), f32(i * j), f32(j)), 1.f);
+		}
+	}
+
+	// A ring of spot lights looking down at the middle of the grid.
+	constexpr u32 kSpotCount = 8;
+	const v3 vTarget(kLightGridSize * 0.5f - 5.f, 0.f, kLightGridSize * 0.5f - 5.f);
+	for (u32 i = 0; i < kSpotCount; ++i)
+	{
+		const f32 kAngle = 2.f * kfPI * i / kSpotCount;
+		const v3 vPosition = vTarget + v3(cosf(kAngle) * 6.f, 4.f, sinf(kAngle) * 6.f);
+		m_lightSystem.add_spot(vPosition, vTarget - vPosition, colours[i % 4], v4(0.001f, 0.05f, 0.02f, 10.f), 0.25f, 0.35f);
+	}
+}
+
+u32 DeferredScene::render_geometry_pass(RenderDevice& rDevice, const m4x4& rViewProjection, const bool kOcclusion)
+{
+	const u32 kOccluded = record_geometry_pass(rViewProjection, kOcclusion);
+	submit_geometry_pass(rDevice, 0, static_cast<u32>(m_commandQueue.packets().size()));
+	return kOccluded;
+}
+
+u32 DeferredScene::record_geometry_pass(const m4x4& rViewProjection, const bool kOcclusion)
+{
+	m_commandQueue.begin(1);
+	CommandBuffer& rCommands = m_commandQueue.buffer(0);
+
+	// Mesh ids for the key, the plane after the model types.
+	auto record = [&](const MeshBinding& rMesh, const u32 kMeshId, const u32 kMaterial, const v3& vOffset)
+	{
+		DrawCommand command = {};
+		command.m_pShader = &m_resources.m_geometryPassShader;
+		command.m_pInstancedShader = &m_resources.m_geometryPassInstancedShader;
+		command.m_pMesh = &rMesh;
+		command.m_pTexture = &m_resources.m_materials[kMaterial];
+		command.m_pConstantBuffer = m_resources.m_pPerDrawCB;
+		command.m_constantSlot = 1;
+		command.m_instances = 1;
+
+		PerDrawCBData perDraw;
+		perDraw.m_matMVP = (m4x4::CreateTranslation(vOffset) * rViewProjection).Transpose();
+
+		// Front to back by the depth of the model's origin.
+		const v4 vClip = v4::Transform(v4(vOffset, 1.f), rViewProjection);
+		const f32 kDepth = vClip.w > 0.f ? vClip.z / vClip.w : 0.f;
+		rCommands.draw(make_sort_key(0, 0, kMaterial, kMeshId, sort_key_depth(kDepth, false)), command, perDraw);
+	};
+
+	record(m_resources.m_plane, kNumModelTypes, 0, v3(0.f, 0.f, 0.f));
+
+	u32 occluded = 0;
+	for (u32 i = 0; i < kNumModelTypes; ++i)
+	{
+		for (u32 j = 0; j < kNumInstances; ++j)
+		{
+			const v3 vOffset(j * kGridSpacing, i * kGridSpacing, 0.f);
+			if (kOcclusion && !is_visible(i, vOffset))
+			{
+				++occluded;
+				continue;
+			}
+			record(m_resources.m_models[i], i, i, vOffset);
+		}
+	}
+
+	m_commandQueue.sort();
+	return occluded;
+}
+
+void DeferredScene::submit_geometry_pass(RenderDevice& rDevice, const u32 kBegin, const u32 kEnd) const
+{
+	m_commandQueue.submit(rDevice, kBegin, kEnd, [this](RenderDevice& rDevice, u32)
+	{
+		// Bind Constant Buffers, to both PS and VS stages
+		RenderBuffer* buffers[] = { m_resources.m_pPerFrameCB, m_resources.m_pPerDrawCB };
+		rDevice.set_constant_buffers(ShaderStage::kVertex, 0, 2, buffers);
+		rDevice.set_constant_buffers(ShaderStage::kPixel, 0, 2, buffers);
+
+		// Bind a sampler state
+		RenderSampler* samplers[] = { m_resources.m_pSamplerState };
+		rDevice.set_samplers(ShaderStage::kPixel, 0, 1, samplers);
+
+		// Instances of batched draws and where each batch starts in them
+		RenderShaderView* pInstanceBufferView = m_resources.m_pInstanceBufferView;
+		RenderBuffer* pInstanceBatchCB = m_resources.m_pInstanceBatchCB;
+		rDevice.set_shader_resources(ShaderStage::kVertex, kInstanceBufferSlot, 1, &pInstanceBufferView);
+		rDevice.set_constant_buffers(ShaderStage::kVertex, kInstanceBatchSlot, 1, &pInstanceBatchCB);
+
+		// Opaque blend
+		rDevice.set_blend_state(m_resources.m_pOpaqueBlendState, kBlendFactor, kSampleMask);
+	});
+
+	if (m_commandQueue.staged())
+	{
+		// The whole per draw and batch buffers back where the ring blocks were, the batch one read by the vertex stage only.
+		RenderBuffer* pPerDrawCB = m_resources.m_pPerDrawCB;
+		RenderBuffer* pInstanceBatchCB = m_resources.m_pInstanceBatchCB;
+		rDevice.set_constant_buffers(ShaderStage::kVertex, 1, 1, &pPerDrawCB);
+		rDevice.set_constant_buffers(ShaderStage::kPixel, 1, 1, &pPerDrawCB);
+		rDevice.set_constant_buffers(ShaderStage::kVertex, kInstanceBatchSlot, 1, &pInstanceBatchCB);
+	}
+}
+
+void DeferredScene::build_occlusion(const m4x4 eyeViewProjections[2])
+{
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		OcclusionCuller& rCuller = m_occlusion[eye];
+		rCuller.begin_frame(eyeViewProjections[eye]);
+		for (u32 j = 0; j < kNumInstances; ++j)
+			rCuller.add_occluder_box(m_resources.m_vModelBoundsMin[0], m_resources.m_vModelBoundsMax[0], m4x4::CreateTranslation(v3(j * kGridSpacing, 0.f, 0.f)));
+		rCuller.rasterize(&m_jobs);
+	}
+}
+
+bool DeferredScene::is_visible(const u32 kModel, const v3& vOffset) const
+{
+	const v3 vMin = m_resources.m_vModelBoundsMin[kModel] + vOffset;
+	const v3 vMax = m_resources.m_vModelBoundsMax[kModel] + vOffset;
+	return m_occlusion[0].test_box(vMin, vMax) || m_occlusion[1].test_box(vMin, vMax);
+}
+
+u32 DeferredScene::submit_light_volumes(RenderDevice& rDevice, const m4x4& rViewProjection, const u32 kBegin, const u32 kEnd, const bool kRingConstants) const
+{
+	// bind the light constant buffer
+	RenderBuffer* pLightInfoCB = m_resources.m_pLightInfoCB;
+	rDevice.set_constant_buffers(ShaderStage::kPixel, 2, 1, &pLightInfoCB);
+	u32 apiCalls = 1;
+
+	for (u32 i = kBegin; i < kEnd; ++i)
+	{
+		const LightInfo& rLight(m_packedLights[i]);
+		const ELightType kType = gpu_light_type(rLight);
+		const bool kCameraInside = i < m_lightTypeStart[kType] + m_lightInsideCount[kType];
+
+		// Update and the light info constants, or point at them.
+		if (kRingConstants)
+		{
+			m_constantRing.bind(rDevice, ShaderStage::kPixel, 2, m_lightBlocks[i].m_light);
+			apiCalls += 1;
+		}
+		else
+		{
+			push_constant_buffer(rDevice, pLightInfoCB, rLight);
+			apiCalls += kPushConstantCalls;
+		}
+
+		if (kType == kLightType_Directional)
+		{
+			// For drawing a directional light which hits everywhere we draw a full screen quad.
+			rDevice.set_depth_stencil_state(m_resources.m_pVolumeDepthStates[kVolumeState_FullScreen], 0);
+			rDevice.set_rasterizer_state(m_resources.m_pVolumeRasterizerStates[kVolumeRaster_BothFaces]);
+			m_resources.m_directionalLightShader.bind(rDevice);
+			m_resources.m_fullScreenQuad.bind(rDevice);
+			m_resources.m_fullScreenQuad.draw(rDevice);
+			apiCalls += 2 + kShaderBindCalls + kMeshBindCalls + 1;
+			continue;
+		}
+		if (kType != kLightType_Point && kType != kLightType_Spot)
+			continue;
+
+		// Update Per Draw Data
+		if (kRingConstants)
+		{
+			m_constantRing.bind(rDevice, ShaderStage::kVertex, 1, m_lightBlocks[i].m_perDraw);
+			m_constantRing.bind(rDevice, ShaderStage::kPixel, 1, m_lightBlocks[i].m_perDraw);
+			apiCalls += 2;
+		}
+		else
+		{
+			PerDrawCBData perDraw;
+			perDraw.m_matMVP = light_volume_mvp(rLight, rViewProjection).Transpose();
+			push_constant_buffer(rDevice, m_resources.m_pPerDrawCB, perDraw);
+			apiCalls += kPushConstantCalls;
+		}
+
+		if (kType == kLightType_Point)
+			apiCalls += draw_light_volume(rDevice, m_resources.m_pointLightShader, m_resources.m_lightVolumeSphere, kCameraInside);
+		else
+			apiCalls += draw_light_volume(rDevice, m_resources.m_spotLightShader, m_resources.m_lightVolumeCone, kCameraInside);
+	}
+	return apiCalls;
+}
+
+m4x4 DeferredScene::light_volume_mvp(const LightInfo& rLight, const m4x4& rViewProjection)
+{
+	if (gpu_light_type(rLight) == kLightType_Point)
+	{
+		m4x4 matModel = m4x4::CreateScale(rLight.m_vAtt.w);
+		matModel *= m4x4::CreateTranslation(v3(rLight.m_vPosition));
+		return matModel * rViewProjection;
+	}
+
+	// Stretch the unit cone along the light, same basis as VS_SpotLightVolumeInstanced.
+	const v3 vAxis(rLight.m_vDirection);
+	v3 vSide = vAxis.Cross(fabsf(vAxis.y) < 0.99f ? v3(0.f, 1.f, 0.f) : v3(1.f, 0.f, 0.f));
+	vSide.Normalize();
+	const v3 vUp = vSide.Cross(vAxis);
+	const f32 kCapRadius = gpu_light_cone_radius(rLight);
+
+	const m4x4 matModel(v4(vSide * kCapRadius, 0.f), v4(vUp * kCapRadius, 0.f), v4(vAxis * rLight.m_vAtt.w, 0.f), v4(v3(rLight.m_vPosition), 1.f));
+	return matModel * rViewProjection;
+}
+
+bool DeferredScene::stage_light_constants(const m4x4& rViewProjection)
+{
+	m_lightBlocks.resize(m_packedLights.size());
+	for (u32 i = 0; i < m_packedLights.size(); ++i)
+	{
+		const LightInfo& rLight = m_packedLights[i];
+		LightConstantBlocks& rBlocks = m_lightBlocks[i];
+		if (!m_constantRing.push(rLight, rBlocks.m_light))
+			return false;
+
+		const ELightType kType = gpu_light_type(rLight);
+		if (kType == kLightType_Point || kType == kLightType_Spot)
+		{
+			PerDrawCBData perDraw;
+			perDraw.m_matMVP = light_volume_mvp(rLight, rViewProjection).Transpose();
+			if (!m_constantRing.push(perDraw, rBlocks.m_perDraw))
+				return false;
+		}
+	}
+	return true;
+}
+
+u32 DeferredScene::draw_light_volume(RenderDevice& rDevice, const ShaderBinding& rShader, const MeshBinding& rMesh, bool bCameraInside) const
+{
+	rShader.bind(rDevice);
+	rMesh.bind(rDevice);
+	u32 apiCalls = kShaderBindCalls + kMeshBindCalls;
+
+	if (bCameraInside)
+	{
+		// The near plane clips the front faces, back faces in front of the scene cover every lit pixel.
+		rDevice.set_depth_stencil_state(m_resources.m_pVolumeDepthStates[kVolumeState_CameraInside], 0);
+		rDevice.set_rasterizer_state(m_resources.m_pVolumeRasterizerStates[kVolumeRaster_BackFaces]);
+		rMesh.draw(rDevice);
+		return apiCalls + 3;
+	}
+
+	rDevice.set_depth_stencil_state(m_resources.m_pVolumeDepthStates[kVolumeState_StencilMark], 0);
+	rDevice.set_rasterizer_state(m_resources.m_pVolumeRasterizerStates[kVolumeRaster_BothFaces]);
+	rDevice.set_shader(ShaderStage::kPixel, nullptr);
+	rMesh.draw(rDevice);
+
+	rDevice.set_depth_stencil_state(m_resources.m_pVolumeDepthStates[kVolumeState_StencilLight], 0);
+	rDevice.set_rasterizer_state(m_resources.m_pVolumeRasterizerStates[kVolumeRaster_BackFaces]);
+	rDevice.set_shader(ShaderStage::kPixel, rShader.m_pShaders[ShaderStage::kPixel]);
+	rMesh.draw(rDevice);
+	return apiCalls + 8;
+}
+
+u32 DeferredScene::pack_lights(const m4x4& rViewProjection)
+{
+	v4 planes[6];
+	LightSystem::frustum_planes(rViewProjection, planes);
+	const u32 kVisibleCount = m_lightSystem.cull_and_pack(planes, 6, m_packedLights, &m_jobs);
+
+	for (u32 t = 0; t < kMaxLightTypes; ++t)
+	{
+		m_lightTypeStart[t] = m_lightSystem.visible_first(static_cast<ELightType>(t));
+		m_lightInsideCount[t] = 0;
+	}
+	m_lightTypeStart[kMaxLightTypes] = kVisibleCount;
+	return kVisibleCount;
+}
+
+HeadlessFrameStats DeferredScene::run_frames(RenderDevice& rDevice, const m4x4* pViews, const u32 kFrames, const f32 kTimeStep)
+{
+	HeadlessFrameStats result = {};
+	rDevice.reset_stats();
+
+	// Nothing is in flight once submitted, every frame is done with by the next.
+	u64 completedFrame = 0;
+	for (u32 frame = 0; frame < kFrames; ++frame)
+	{
+		const s64 kFrameStart = getTimeMicroseconds();
+		const m4x4& rView = pViews[frame];
+
+		m_perFrameCBData.m_time = frame * kTimeStep;
+		m_lightSystem.animate(m_perFrameCBData.m_time, &m_jobs);
+		m_lightHash.update(m_lightSystem, &m_jobs);
+
+		const u32 kVisibleCount = pack_lights(rView);
+		if (kVisibleCount)
+			rDevice.update_buffer(m_resources.m_pLightBuffer, m_packedLights.data(), kVisibleCount * sizeof(LightInfo));
+		m_perFrameCBData.m_matViewProjection = rView.Transpose();
+		push_constant_buffer(rDevice, m_resources.m_pPerFrameCB, m_perFrameCBData);
+
+		m_constantRing.begin_frame(completedFrame);
+
+		const m4x4 kEyeViews[2] = { rView, rView };
+		build_occlusion(kEyeViews);
+		record_geometry_pass(rView, true);
+		m_commandQueue.batch_instances(sizeof(PerDrawCBData), kMaxGeometryInstances, m_resources.m_pInstanceBatchCB, kInstanceBatchSlot);
+		const std::vector<u8>& rInstances = m_commandQueue.instance_data();
+		if (!rInstances.empty())
+			rDevice.write_buffer(m_resources.m_pInstanceBuffer, 0, rInstances.data(), static_cast<u32>(rInstances.size()), true);
+		// The lights are packed already, so both passes' constants go in the one map.
+		m_commandQueue.stage_constants(m_constantRing);
+		const bool kStaged = stage_light_constants(rView);
+		m_constantRing.flush(rDevice);
+		submit_geometry_pass(rDevice, 0, static_cast<u32>(m_commandQueue.packets().size()));
+		submit_light_volumes(rDevice, rView, 0, kVisibleCount, kStaged);
+
+		completedFrame = m_constantRing.end_frame();
+
+		const f64 kFrameMs = (getTimeMicroseconds() - kFrameStart) / 1000.0;
+		++result.m_frames;
+		result.m_cpuMs += kFrameMs;
+		result.m_worstCpuMs = std::max(result.m_worstCpuMs, kFrameMs);
+	}
+	result.m_deviceStats = rDevice.stats();
+	return result;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "RenderDevice.h"
+#include "CommandBuffer.h"
+#include "ConstantRing.h"
+#include "LightSystem.h"
+#include "LightSpatialHash.h"
+#include "OcclusionCuller.h"
+#include "JobQueue.h"
+
+#include <vector>
+
+//================================================================================
+// Deferred Scene
+// The part of the Deferred example that never touches a window, D3D or OVR:
+// the lights, the scene's draws and the light volume loop, all through a
+// RenderDevice and the handles in DeferredSceneResources. DeferredApp fills
+// those in with its D3D objects, the Headless target with stand-ins.
+//================================================================================
+
+constexpr f32 kBlendFactor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+constexpr u32 kSampleMask = 0xffffffff;
+constexpr u32 kLightGridSize = 24;
+constexpr u32 kConstantRingBytes = 8 * 1024 * 1024;
+
+// Scene layout, rows of each model along x.
+constexpr f32 kGridSpacing = 1.5f;
+constexpr u32 kNumInstances = 5;
+constexpr u32 kNumModelTypes = 2;
+constexpr u32 kMaxGeometryInstances = 1024;		// held by the geometry pass's instance buffer.
+constexpr u32 kInstanceBatchSlot = 7;				// InstanceBatchCB in DeferredShaders.fx.
+constexpr u32 kInstanceBufferSlot = 9;				// instances in DeferredShaders.fx.
+
+// D3D calls made by the helpers, used to tally the light volume pass.
+constexpr u32 kShaderBindCalls = 7;		// input layout and six stages.
+constexpr u32 kMeshBindCalls = 3;		// topology, vertex and index buffers.
+constexpr u32 kPushConstantCalls = 2;	// map and unmap.
+
+// Stencil masked light volumes, see LightVolumes.h.
+enum LightVolumeStates
+{
+	kVolumeState_StencilMark,
+	kVolumeState_StencilLight,
+	kVolumeState_StencilLightBatch,
+	kVolumeState_CameraInside,
+	kVolumeState_FullScreen,
+	kMaxVolumeStates
+};
+
+enum LightVolumeRasterStates
+{
+	kVolumeRaster_BothFaces,
+	kVolumeRaster_BackFaces,
+	kMaxVolumeRasterStates
+};
+
+// Everything the scene draws with, as handles and bindings.
+struct DeferredSceneResources
+{
+	ShaderBinding m_geometryPassShader;
+	ShaderBinding m_geometryPassInstancedShader;
+	ShaderBinding m_directionalLightShader;
+	ShaderBinding m_pointLightShader;
+	ShaderBinding m_spotLightShader;
+
+	MeshBinding m_models[kNumModelTypes];
+	v3 m_vModelBoundsMin[kNumModelTypes];
+	v3 m_vModelBoundsMax[kNumModelTypes];
+	MeshBinding m_plane;
+	MeshBinding m_fullScreenQuad;
+	MeshBinding m_lightVolumeSphere;
+	MeshBinding m_lightVolumeCone;
+
+	TextureBinding m_materials[kNumModelTypes];
+	RenderSampler* m_pSamplerState;
+
+	RenderBuffer* m_pPerFrameCB;
+	RenderBuffer* m_pPerDrawCB;
+	RenderBuffer* m_pLightInfoCB;
+	RenderBuffer* m_pLightBuffer;
+	RenderBuffer* m_pInstanceBatchCB;
+	RenderBuffer* m_pInstanceBuffer;
+	RenderShaderView* m_pInstanceBufferView;
+	RenderBuffer* m_pConstantRingBuffer;		// none leaves the constant ring disabled.
+
+	RenderBlendState* m_pOpaqueBlendState;
+	RenderDepthStencilState* m_pVolumeDepthStates[kMaxVolumeStates];
+	RenderRasterizerState* m_pVolumeRasterizerStates[kMaxVolumeRasterStates];
+};
+
+// Stand-ins for every handle, each distinct so a recording device tells them apart, and the meshes' counts
+// and bounds from MeshInfo. For running the scene without a backend. False when a model wouldn't load from
+// Assets/Models and the cube stood in for it.
+bool stand_in_resources(DeferredSceneResources& rResourcesOut);
+
+// Timings over a run of frames on a device, from DeferredScene::run_frames.
+struct HeadlessFrameStats
+{
+	u32 m_frames;
+	f64 m_cpuMs;
+	f64 m_worstCpuMs;
+	RenderDeviceStats m_deviceStats;	// summed over the frames.
+};
+
+class DeferredScene
+{
+public:
+
+	struct PerFrameCBData
+	{
+		m4x4 m_matProjection;
+		m4x4 m_matView;
+		m4x4 m_matViewProjection;
+		m4x4 m_matInverseProjection;
+		m4x4 m_matInverseView;
+		f32		m_time;
+		f32     m_padding[3];
+	};
+
+	struct PerDrawCBData
+	{
+		m4x4 m_matMVP;
+	};
+
+	// Light info presented to the shader constant buffer, the same layout the light system packs.
+	typedef GPULight LightInfo;
+
+	// The lights, their spatial hash and the occlusion buffers, nothing needing resources.
+	void init_scene();
+
+	// Take the resources to draw with, and the constant ring's buffer.
+	void set_resources(const DeferredSceneResources& rResources);
+
+	void create_lights();
+
+	// Record the scene's draws as sorted packets, then bind the geometry pass and submit them.
+	// Returns the draws skipped as occluded.
+	u32 render_geometry_pass(RenderDevice& rDevice, const m4x4& rViewProjection, const bool kOcclusion);
+
+	// The scene's draws into m_commandQueue, sorted. Returns the draws skipped as occluded.
+	u32 record_geometry_pass(const m4x4& rViewProjection, const bool kOcclusion);
+
+	// Bind the geometry pass and submit the sorted packets [kBegin, kEnd), a range binding everything it draws with.
+	// Draws bind their constant ring blocks when the queue's constants were staged there.
+	void submit_geometry_pass(RenderDevice& rDevice, const u32 kBegin, const u32 kEnd) const;
+
+	// The cubes are the only occluders, each eye gets its own buffer so a draw is skipped only when hidden from both.
+	void build_occlusion(const m4x4 eyeViewProjections[2]);
+	bool is_visible(const u32 kModel, const v3& vOffset) const;
+
+	// The per light part of the light volume pass for the packed lights [kBegin, kEnd), everything through the device.
+	// Safe to call for separate ranges at once, each recording into its own command list.
+	// With kRingConstants each light binds the blocks stage_light_constants put in the ring rather than pushing its constants.
+	u32 submit_light_volumes(RenderDevice& rDevice, const m4x4& rViewProjection, const u32 kBegin, const u32 kEnd, const bool kRingConstants) const;
+
+	// Every packed light's constants into the ring ahead of the light volume loop. False when it runs out of room.
+	bool stage_light_constants(const m4x4& rViewProjection);
+
+	// The volume of a point or spot light into clip space.
+	static m4x4 light_volume_mvp(const LightInfo& rLight, const m4x4& rViewProjection);
+
+	// Draw one light volume, stencil masked unless the camera is inside it.
+	// Marks pixels whose geometry lies inside the volume with both faces and no pixel shader,
+	// then shades back faces where the mark is set, zeroing it on the way for the next light.
+	// Returns the number of D3D calls made.
+	u32 draw_light_volume(RenderDevice& rDevice, const ShaderBinding& rShader, const MeshBinding& rMesh, bool bCameraInside) const;
+
+	// The lights inside the view into m_packedLights by type, no eye split or budget, nobody counted inside.
+	// Returns the lights kept.
+	u32 pack_lights(const m4x4& rViewProjection);
+
+	// Run the frame's CPU side on a device: animate and hash the lights, cull and upload them, build the
+	// occlusion buffers, batch and submit the scene, then the light volume loop. A frame for each of pViews,
+	// both eyes sharing it, kTimeStep apart.
+	HeadlessFrameStats run_frames(RenderDevice& rDevice, const m4x4* pViews, const u32 kFrames, const f32 kTimeStep);
+
+protected:
+
+	DeferredSceneResources m_resources = {};
+	PerFrameCBData m_perFrameCBData = {};
+
+	LightSystem m_lightSystem;
+	LightSpatialHash m_lightHash;
+	std::vector<LightInfo> m_packedLights;
+	u32 m_lightTypeStart[kMaxLightTypes + 1] = {};
+	u32 m_lightInsideCount[kMaxLightTypes] = {};
+
+	OcclusionCuller m_occlusion[2];
+	CommandQueue m_commandQueue;
+	ConstantRing m_constantRing;
+
+	// A packed light's blocks in the constant ring, the per draw one for point and spot lights only.
+	struct LightConstantBlocks
+	{
+		ConstantBlock m_light;
+		ConstantBlock m_perDraw;
+	};
+	std::vector<LightConstantBlocks> m_lightBlocks;
+
+	JobSystem m_jobs;
+};
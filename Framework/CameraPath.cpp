@@ -0,0 +1,134 @@
+#include "CameraPath.h"
+
+#include <fstream>
+
+namespace
+{
+
+constexpr u32 kCameraPathMagic = 0x48544150;		// "PATH"
+constexpr u32 kCameraPathVersion = 1;
+
+struct CameraPathHeader
+{
+	u32 m_magic;
+	u32 m_version;
+	u32 m_frames;
+	u32 m_frameSize;		// catches a file from a build with a different layout.
+	f32 m_timeStep;
+};
+
+} // namespace
+
+void CameraPath::start_recording(const f32 kTimeStep)
+{
+	m_frames.clear();
+	m_frame = 0;
+	m_timeStep = kTimeStep;
+	m_mode = kMode_Recording;
+}
+
+void CameraPath::start_replay()
+{
+	m_frame = 0;
+	m_mode = m_frames.empty() ? kMode_Idle : kMode_Replaying;
+}
+
+void CameraPath::stop()
+{
+	m_mode = kMode_Idle;
+}
+
+void CameraPath::apply_camera(Camera& rCamera) const
+{
+	if (m_mode != kMode_Replaying)
+		return;
+
+	const CameraPathFrame& rFrame = m_frames[m_frame];
+	rCamera.eye = rFrame.m_vEye;
+	rCamera.right = rFrame.m_vRight;
+	rCamera.up = rFrame.m_vUp;
+	rCamera.forward = rFrame.m_vForward;
+}
+
+void CameraPath::eye_poses(const Camera& rCamera, ovrPosef eyePoses[2])
+{
+	if (m_mode == kMode_Recording)
+	{
+		CameraPathFrame frame;
+		frame.m_vEye = rCamera.eye;
+		frame.m_vRight = rCamera.right;
+		frame.m_vUp = rCamera.up;
+		frame.m_vForward = rCamera.forward;
+		frame.m_eyePoses[0] = eyePoses[0];
+		frame.m_eyePoses[1] = eyePoses[1];
+		m_frames.push_back(frame);
+		m_frame = frames();
+	}
+	else if (m_mode == kMode_Replaying)
+	{
+		eyePoses[0] = m_frames[m_frame].m_eyePoses[0];
+		eyePoses[1] = m_frames[m_frame].m_eyePoses[1];
+		if (++m_frame == frames())
+			m_mode = kMode_Idle;
+	}
+}
+
+bool CameraPath::save(const char* pFilename) const
+{
+	std::ofstream hFile(pFilename, std::ios::binary);
+	if (!hFile.good())
+		return false;
+
+	const CameraPathHeader kHeader = { kCameraPathMagic, kCameraPathVersion, frames(), sizeof(CameraPathFrame), m_timeStep };
+	hFile.write((const char*)&kHeader, sizeof(kHeader));
+	hFile.write((const char*)m_frames.data(), sizeof(CameraPathFrame) * m_frames.size());
+	return hFile.good();
+}
+
+bool CameraPath::load(const char* pFilename)
+{
+	std::ifstream hFile(pFilename, std::ios::binary);
+	if (!hFile.good())
+		return false;
+
+	CameraPathHeader header = {};
+	hFile.read((char*)&header, sizeof(header));
+	if (!hFile.good() || header.m_magic != kCameraPathMagic || header.m_version != kCameraPathVersion || header.m_frameSize != sizeof(CameraPathFrame))
+	{
+		debugF("Not a camera path: %s\n", pFilename);
+		return false;
+	}
+
+	std::vector<CameraPathFrame> frames(header.m_frames);
+	hFile.read((char*)frames.data(), sizeof(CameraPathFrame) * frames.size());
+	if (!hFile.good())
+	{
+		debugF("Camera path is cut short: %s\n", pFilename);
+		return false;
+	}
+
+	m_frames.swap(frames);
+	m_timeStep = header.m_timeStep;
+	m_frame = 0;
+	m_mode = kMode_Idle;
+	return true;
+}
+
+void CameraPath::build_views(Camera camera, const f32 kReach, std::vector<m4x4>& rViewsOut, std::vector<f32>& rDeltasOut) const
+{
+	rViewsOut.resize(m_frames.size());
+	rDeltasOut.resize(m_frames.size());
+
+	for (u32 f = 0; f < frames(); ++f)
+	{
+		const CameraPathFrame& rFrame = m_frames[f];
+		camera.eye = rFrame.m_vEye;
+		camera.right = rFrame.m_vRight;
+		camera.up = rFrame.m_vUp;
+		camera.forward = rFrame.m_vForward;
+		camera.updateMatrices();
+
+		rViewsOut[f] = camera.vpMatrix;
+		rDeltasOut[f] = camera.frameDelta(kReach);
+	}
+}
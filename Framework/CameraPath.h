@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Framework.h"
+
+#include <vector>
+
+//================================================================================
+// Camera Path
+// Records what drove the view each frame, the free camera and the two eye
+// poses from ovr_GetEyePoses, so a run can be played back exactly. Live input
+// and frame times differ between runs, a replay doesn't: every frame gets the
+// recorded camera and poses, and time() steps by a fixed amount per frame for
+// anything animated.
+//
+// The framework applies the camera before it updates its matrices, the app
+// hands over its eye poses once a frame after ovr_GetEyePoses. That call is
+// also what records the frame or moves the replay on.
+//
+// Files are a small header then the frames as they are in memory.
+//================================================================================
+
+struct CameraPathFrame
+{
+	v3 m_vEye;
+	v3 m_vRight;
+	v3 m_vUp;
+	v3 m_vForward;
+	ovrPosef m_eyePoses[2];
+};
+
+class CameraPath
+{
+public:
+
+	enum EMode
+	{
+		kMode_Idle,
+		kMode_Recording,
+		kMode_Replaying
+	};
+
+	// Drop any frames held and record from the next one.
+	void start_recording(const f32 kTimeStep);
+
+	// Play the frames held from the first.
+	void start_replay();
+
+	void stop();
+
+	// Replaying, put the current frame's camera in place. Called by the framework in place of input.
+	void apply_camera(Camera& rCamera) const;
+
+	// Once a frame after ovr_GetEyePoses. Recording, keep the camera and poses. Replaying, swap in the recorded poses.
+	void eye_poses(const Camera& rCamera, ovrPosef eyePoses[2]);
+
+	bool save(const char* pFilename) const;
+	bool load(const char* pFilename);
+
+	// Each frame's view projection and Camera::frameDelta, as the given camera would see the path.
+	void build_views(Camera camera, const f32 kReach, std::vector<m4x4>& rViewsOut, std::vector<f32>& rDeltasOut) const;
+
+	// Seconds since the first frame at the recorded step.
+	f32 time() const { return m_frame * m_timeStep; }
+
+	EMode mode() const { return m_mode; }
+	bool recording() const { return m_mode == kMode_Recording; }
+	bool replaying() const { return m_mode == kMode_Replaying; }
+	u32 frame() const { return m_frame; }
+	u32 frames() const { return static_cast<u32>(m_frames.size()); }
+	f32 time_step() const { return m_timeStep; }
+
+private:
+
+	EMode m_mode = kMode_Idle;
+	u32 m_frame = 0;
+	f32 m_timeStep = 1.f / 90.f;
+	std::vector<CameraPathFrame> m_frames;
+};
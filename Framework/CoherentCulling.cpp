@@ -0,0 +1,231 @@
+#include "CoherentCulling.h"
+#include "JobQueue.h"
+
+#include <cfloat>
+#include <emmintrin.h>
+
+namespace
+{
+
+// Mask words per job, each job owns whole words so no two write the same one.
+constexpr u32 kWordsPerJob = 64;
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+// The visible test is cull_spheres' own, in the same operation order, so a full pass gives the same
+// mask. The margin is the smallest distance + radius over the planes, negative when culled.
+bool sphere_margin(const CullPlanes& rPlanes, const f32 kX, const f32 kY, const f32 kZ, const f32 kRadius, f32& rMarginOut)
+{
+	bool bInside = true;
+	f32 margin = FLT_MAX;
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		f32 distance = kX * rPlanes.m_x[p] + rPlanes.m_w[p];
+		distance = distance + kY * rPlanes.m_y[p];
+		distance = distance + kZ * rPlanes.m_z[p];
+		bInside &= distance >= -kRadius;
+		margin = std::min(margin, distance + kRadius);
+	}
+	rMarginOut = margin;
+	return bInside;
+}
+
+void margins_scalar(const CullPlanes& rPlanes, const SphereBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask, f32* pMargins)
+{
+	for (; i < kEnd; ++i)
+	{
+		if (sphere_margin(rPlanes, b.m_pX[i], b.m_pY[i], b.m_pZ[i], b.m_pRadius[i], pMargins[i]))
+			pMask[i / 32] |= 1u << (i % 32);
+	}
+}
+
+void margins_sse(const CullPlanes& rPlanes, const SphereBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask, f32* pMargins)
+{
+	__m128 nx[kMaxCullPlanes], ny[kMaxCullPlanes], nz[kMaxCullPlanes], nw[kMaxCullPlanes];
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		nx[p] = _mm_set1_ps(rPlanes.m_x[p]);
+		ny[p] = _mm_set1_ps(rPlanes.m_y[p]);
+		nz[p] = _mm_set1_ps(rPlanes.m_z[p]);
+		nw[p] = _mm_set1_ps(rPlanes.m_w[p]);
+	}
+
+	for (; i + 4 <= kEnd; i += 4)
+	{
+		const __m128 kX = _mm_loadu_ps(b.m_pX + i);
+		const __m128 kY = _mm_loadu_ps(b.m_pY + i);
+		const __m128 kZ = _mm_loadu_ps(b.m_pZ + i);
+		const __m128 kRadius = _mm_loadu_ps(b.m_pRadius + i);
+		const __m128 kNegRadius = _mm_sub_ps(_mm_setzero_ps(), kRadius);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		__m128 margin = _mm_set1_ps(FLT_MAX);
+		for (u32 p = 0; p < rPlanes.m_count; ++p)
+		{
+			__m128 distance = _mm_add_ps(_mm_mul_ps(kX, nx[p]), nw[p]);
+			distance = _mm_add_ps(distance, _mm_mul_ps(kY, ny[p]));
+			distance = _mm_add_ps(distance, _mm_mul_ps(kZ, nz[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, kNegRadius));
+			margin = _mm_min_ps(margin, _mm_add_ps(distance, kRadius));
+		}
+		_mm_storeu_ps(pMargins + i, margin);
+
+		// Ranges start on a word, so four never straddle two words.
+		pMask[i / 32] |= u32(_mm_movemask_ps(inside)) << (i % 32);
+	}
+
+	margins_scalar(rPlanes, b, i, kEnd, pMask, pMargins);
+}
+
+} // namespace
+
+void CoherentCuller::init(const CoherentCullerDesc& rDesc)
+{
+	m_desc = rDesc;
+	reset();
+}
+
+void CoherentCuller::reset()
+{
+	m_bValid = false;
+}
+
+void CoherentCuller::cull(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, const f32 kCameraDelta
+	, const u32* pMoved, const u32 kMovedCount, JobSystem* pJobs)
+{
+	m_stats = {};
+	m_cameraMotion += kCameraDelta;
+	++m_framesSinceFull;
+
+	if (!m_bValid || kCount != m_count || m_cameraMotion > m_desc.m_band || m_framesSinceFull >= m_desc.m_fullPassInterval)
+	{
+		full_pass(rPlanes, rBounds, kCount, pJobs);
+	}
+	else
+	{
+		partial_pass(rPlanes, rBounds, pMoved, kMovedCount, pJobs);
+	}
+	m_stats.m_boundary = static_cast<u32>(m_boundary.size());
+}
+
+void CoherentCuller::full_pass(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, JobSystem* pJobs)
+{
+	const u32 kWords = (kCount + 31) / 32;
+	const std::vector<u32> kPrevious = m_bValid && kCount == m_count ? m_mask : std::vector<u32>();
+
+	m_count = kCount;
+	m_mask.assign(kWords, 0);
+	m_margins.resize(kCount);
+
+	u32* pMask = m_mask.data();
+	f32* pMargins = m_margins.data();
+	run(pJobs, kWords, kWordsPerJob, [&](u32 begin, u32 end)
+	{
+		margins_sse(rPlanes, rBounds, begin * 32, std::min(end * 32, kCount), pMask, pMargins);
+	});
+
+	// Bucket the spheres within the band by margin, nearest the boundary first, so later frames only
+	// retest as far into the list as the camera has moved.
+	const f32 kBucketScale = kBoundaryBuckets / m_desc.m_band;
+	u32 bucketStart[kBoundaryBuckets + 1] = {};
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const f32 kMargin = fabsf(pMargins[i]);
+		if (kMargin <= m_desc.m_band)
+			++bucketStart[std::min(u32(kMargin * kBucketScale), kBoundaryBuckets - 1) + 1];
+	}
+	for (u32 b = 0; b < kBoundaryBuckets; ++b)
+	{
+		bucketStart[b + 1] += bucketStart[b];
+		m_bucketEnd[b] = bucketStart[b + 1];
+	}
+
+	m_boundary.resize(bucketStart[kBoundaryBuckets]);
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const f32 kMargin = fabsf(pMargins[i]);
+		if (kMargin <= m_desc.m_band)
+			m_boundary[bucketStart[std::min(u32(kMargin * kBucketScale), kBoundaryBuckets - 1)]++] = i;
+	}
+
+	for (const u32 kSphere : m_moved)
+		m_bMoved[kSphere] = 0;
+	m_moved.clear();
+	m_bMoved.resize(kCount, 0);
+
+	if (!kPrevious.empty())
+	{
+		for (u32 w = 0; w < kWords; ++w)
+		{
+			for (u32 bits = kPrevious[w] ^ m_mask[w]; bits; bits &= bits - 1)
+				++m_stats.m_changed;
+		}
+	}
+
+	m_framesSinceFull = 0;
+	m_cameraMotion = 0.f;
+	m_bValid = true;
+	m_stats.m_tested = kCount;
+	m_stats.m_bFullPass = true;
+}
+
+void CoherentCuller::partial_pass(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32* pMoved, const u32 kMovedCount, JobSystem* pJobs)
+{
+	// A moved sphere's margin is stale, it is retested every frame until the next full pass.
+	for (u32 i = 0; i < kMovedCount; ++i)
+	{
+		const u32 kSphere = pMoved[i];
+		if (!m_bMoved[kSphere])
+		{
+			m_moved.push_back(kSphere);
+			m_bMoved[kSphere] = 1;
+		}
+	}
+
+	// A sphere can only have changed if the camera moved the planes by at least its margin.
+	m_tested.clear();
+	if (m_cameraMotion > 0.f)
+	{
+		const u32 kBuckets = std::min(u32(m_cameraMotion * kBoundaryBuckets / m_desc.m_band) + 1, kBoundaryBuckets);
+		for (u32 k = 0; k < m_bucketEnd[kBuckets - 1]; ++k)
+		{
+			if (!m_bMoved[m_boundary[k]])
+				m_tested.push_back(m_boundary[k]);
+		}
+	}
+	m_tested.insert(m_tested.end(), m_moved.begin(), m_moved.end());
+
+	const u32 kTested = static_cast<u32>(m_tested.size());
+	m_visible.resize(kTested);
+
+	// Spheres are unique in the list so their margins can be written in parallel, the shared mask words can't.
+	const SphereBoundsSoA& b = rBounds;
+	run(pJobs, kTested, 1024, [&](u32 begin, u32 end)
+	{
+		for (u32 k = begin; k < end; ++k)
+		{
+			const u32 i = m_tested[k];
+			m_visible[k] = sphere_margin(rPlanes, b.m_pX[i], b.m_pY[i], b.m_pZ[i], b.m_pRadius[i], m_margins[i]) ? 1 : 0;
+		}
+	});
+
+	for (u32 k = 0; k < kTested; ++k)
+	{
+		const u32 i = m_tested[k];
+		const u32 kBit = 1u << (i % 32);
+		const u32 kWas = m_mask[i / 32] & kBit;
+		if ((kWas != 0) != (m_visible[k] != 0))
+		{
+			m_mask[i / 32] ^= kBit;
+			++m_stats.m_changed;
+		}
+	}
+
+	m_stats.m_tested = kTested;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "FrustumCulling.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Coherent Culling
+// Frustum culling that carries last frame's answer forward. A full pass tests
+// every sphere and keeps, besides the visible bit, how far each one is from
+// changing its answer: the smallest distance any plane would have to move
+// before the sphere crossed it.
+//
+// Frames in between only retest the spheres that were within a band of the
+// boundary at the last full pass, plus the ones the caller says moved. The
+// rest keep their bit, which stays right for as long as the camera has moved
+// the planes less than the band since the full pass. The caller reports that
+// motion each frame, Camera::frameDelta gives it for the free camera, and once
+// the total passes the band, or every so many frames regardless, the next
+// call is a full pass again. The band is kept in buckets by margin, so a camera
+// that has hardly moved only retests the spheres right on the boundary, and
+// one that holds still retests nothing.
+//
+// The mask is the same one bit per sphere FrustumCulling writes, so
+// compact_visible reads it directly.
+//================================================================================
+
+constexpr u32 kBoundaryBuckets = 8;
+
+struct CoherentCullerDesc
+{
+	f32 m_band = 1.f;				// metres, spheres nearer the boundary than this are retested every frame.
+	u32 m_fullPassInterval = 16;	// frames, a full pass at least this often.
+};
+
+class CoherentCuller
+{
+public:
+
+	struct Stats
+	{
+		u32 m_tested;			// spheres tested this frame.
+		u32 m_boundary;			// within the band at the last full pass.
+		u32 m_changed;			// visibility bits that flipped this frame.
+		bool m_bFullPass;
+	};
+
+	void init(const CoherentCullerDesc& rDesc);
+
+	// Forget the previous frame, the next cull is a full pass.
+	void reset();
+
+	// kCameraDelta bounds how far the planes moved near the spheres since the last call, in metres.
+	// pMoved lists spheres whose bounds changed since the last call, they are always retested.
+	void cull(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, const f32 kCameraDelta
+		, const u32* pMoved, const u32 kMovedCount, JobSystem* pJobs);
+
+	// One bit per sphere, set when visible.
+	const std::vector<u32>& mask() const { return m_mask; }
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	void full_pass(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, JobSystem* pJobs);
+	void partial_pass(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32* pMoved, const u32 kMovedCount, JobSystem* pJobs);
+
+	CoherentCullerDesc m_desc;
+	std::vector<u32> m_mask;
+	std::vector<f32> m_margins;			// per sphere, distance to the nearest change of answer at its last test.
+	std::vector<u32> m_boundary;		// spheres within the band, nearest the boundary first.
+	u32 m_bucketEnd[kBoundaryBuckets] = {};
+	std::vector<u32> m_moved;			// reported moved since the last full pass.
+	std::vector<u8> m_bMoved;			// per sphere, set when in m_moved.
+	std::vector<u32> m_tested;			// this frame's retests.
+	std::vector<u8> m_visible;			// per retest, this frame's answer.
+	u32 m_count = 0;
+	u32 m_framesSinceFull = 0;
+	f32 m_cameraMotion = 0.f;			// total reported since the last full pass.
+	bool m_bValid = false;
+
+	Stats m_stats = {};
+};
@@ -0,0 +1,284 @@
+#include "CommandBuffer.h"
+#include "JobQueue.h"
+
+namespace
+{
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+// Least significant byte first, eight counting passes at most. A byte every key shares is skipped,
+// which with small ids is most of the high ones.
+void radix_sort(std::vector<DrawPacket>& rPackets, std::vector<DrawPacket>& rScratch)
+{
+	const u32 kCount = static_cast<u32>(rPackets.size());
+	if (kCount < 2)
+		return;
+
+	rScratch.resize(kCount);
+
+	// Every byte's histogram from a single read of the keys.
+	std::vector<u32> histograms(8 * 256, 0);
+	for (const DrawPacket& rPacket : rPackets)
+	{
+		for (u32 b = 0; b < 8; ++b)
+			++histograms[b * 256 + ((rPacket.m_key >> (b * 8)) & 0xff)];
+	}
+
+	DrawPacket* pSource = rPackets.data();
+	DrawPacket* pDest = rScratch.data();
+	for (u32 b = 0; b < 8; ++b)
+	{
+		u32* pCounts = &histograms[b * 256];
+		const u32 kShift = b * 8;
+		if (pCounts[(pSource[0].m_key >> kShift) & 0xff] == kCount)
+			continue;
+
+		u32 offset = 0;
+		for (u32 i = 0; i < 256; ++i)
+		{
+			const u32 kBucket = pCounts[i];
+			pCounts[i] = offset;
+			offset += kBucket;
+		}
+
+		for (u32 i = 0; i < kCount; ++i)
+			pDest[pCounts[(pSource[i].m_key >> kShift) & 0xff]++] = pSource[i];
+
+		std::swap(pSource, pDest);
+	}
+
+	if (pSource != rPackets.data())
+		rPackets.swap(rScratch);
+}
+
+} // namespace
+
+void CommandBuffer::clear()
+{
+	m_keys.clear();
+	m_commands.clear();
+	m_constants.clear();
+}
+
+void CommandBuffer::draw(const u64 kKey, const DrawCommand& rCommand, const void* pConstants, const u32 kConstantBytes)
+{
+	const u32 kOffset = static_cast<u32>(m_constants.size());
+	m_constants.resize(kOffset + kConstantBytes);
+	if (kConstantBytes)
+		memcpy(m_constants.data() + kOffset, pConstants, kConstantBytes);
+
+	m_keys.push_back(kKey);
+	m_commands.push_back(rCommand);
+	m_commands.back().m_constantOffset = kOffset;
+	m_commands.back().m_constantBytes = kConstantBytes;
+}
+
+void CommandQueue::begin(const u32 kBuffers)
+{
+	// Buffers keep their capacity from frame to frame.
+	m_buffers.resize(kBuffers);
+	for (CommandBuffer& rBuffer : m_buffers)
+		rBuffer.clear();
+	m_packets.clear();
+	m_instanceData.clear();
+	m_pRing = nullptr;
+}
+
+void CommandQueue::record(const u32 kCount, const u32 kGrain, const RecordJob& job, JobSystem* pJobs)
+{
+	const u32 kSlices = (kCount + kGrain - 1) / std::max(1u, kGrain);
+	begin(kSlices);
+
+	run(pJobs, kSlices, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 s = begin; s < end; ++s)
+			job(m_buffers[s], s * kGrain, std::min(kCount, (s + 1) * kGrain));
+	});
+}
+
+void CommandQueue::sort()
+{
+	u32 count = 0;
+	for (const CommandBuffer& rBuffer : m_buffers)
+		count += rBuffer.size();
+
+	m_packets.resize(count);
+	DrawPacket* pPacket = m_packets.data();
+	for (u32 b = 0; b < buffers(); ++b)
+	{
+		const std::vector<u64>& rKeys = m_buffers[b].m_keys;
+		for (u32 c = 0; c < rKeys.size(); ++c, ++pPacket)
+		{
+			pPacket->m_key = rKeys[c];
+			pPacket->m_buffer = b;
+			pPacket->m_command = c;
+		}
+	}
+
+	radix_sort(m_packets, m_scratch);
+	m_pRing = nullptr;
+}
+
+bool CommandQueue::stage_constants(ConstantRing& rRing)
+{
+	m_pRing = nullptr;
+	m_blocks.resize(m_packets.size());
+	for (u32 p = 0; p < m_packets.size(); ++p)
+	{
+		const DrawPacket& rPacket = m_packets[p];
+		const CommandBuffer& rBuffer = m_buffers[rPacket.m_buffer];
+		const DrawCommand& rCommand = rBuffer.m_commands[rPacket.m_command];
+		if (rCommand.m_constantBytes && !rRing.push(rBuffer.m_constants.data() + rCommand.m_constantOffset, rCommand.m_constantBytes, m_blocks[p]))
+			return false;
+	}
+	m_pRing = &rRing;
+	return true;
+}
+
+u32 CommandQueue::batch_instances(const u32 kInstanceBytes, const u32 kMaxInstances, RenderBuffer* pBatchConstantBuffer, const u32 kBatchConstantSlot)
+{
+	constexpr u32 kDepthShift = kSortKeyDepthBits + 4;
+
+	auto batchable = [kInstanceBytes](const DrawCommand& rCommand)
+	{
+		return rCommand.m_pInstancedShader && rCommand.m_instances == 1 && rCommand.m_constantBytes == kInstanceBytes;
+	};
+
+	// Batched draws are recorded into a buffer of their own after the others.
+	const u32 kBatchBuffer = buffers();
+	m_buffers.emplace_back();
+	CommandBuffer& rBatches = m_buffers.back();
+	m_instanceData.clear();
+	m_pRing = nullptr;
+
+	// Packets are compacted in place, a run is read before anything is written over it.
+	const u32 kCount = static_cast<u32>(m_packets.size());
+	u32 kept = 0;
+	for (u32 p = 0; p < kCount;)
+	{
+		const DrawPacket kFirst = m_packets[p];
+		const DrawCommand& rFirst = command(kFirst);
+
+		u32 end = p + 1;
+		if (batchable(rFirst))
+		{
+			for (; end < kCount && !((m_packets[end].m_key ^ kFirst.m_key) >> kDepthShift); ++end)
+			{
+				const DrawCommand& rNext = command(m_packets[end]);
+				if (!batchable(rNext) || rNext.m_pShader != rFirst.m_pShader || rNext.m_pInstancedShader != rFirst.m_pInstancedShader
+					|| rNext.m_pMesh != rFirst.m_pMesh || rNext.m_pTexture != rFirst.m_pTexture
+					|| rNext.m_pConstantBuffer != rFirst.m_pConstantBuffer || rNext.m_constantSlot != rFirst.m_constantSlot)
+					break;
+			}
+		}
+
+		const u32 kRun = end - p;
+		const u32 kFirstInstance = kInstanceBytes ? static_cast<u32>(m_instanceData.size()) / kInstanceBytes : 0;
+		if (kRun == 1 || kFirstInstance + kRun > kMaxInstances)
+		{
+			for (; p < end; ++p)
+				m_packets[kept++] = m_packets[p];
+			continue;
+		}
+
+		m_instanceData.resize((kFirstInstance + kRun) * kInstanceBytes);
+		u8* pInstance = m_instanceData.data() + kFirstInstance * kInstanceBytes;
+		for (; p < end; ++p, pInstance += kInstanceBytes)
+		{
+			memcpy(pInstance, m_buffers[m_packets[p].m_buffer].constants(command(m_packets[p])), kInstanceBytes);
+		}
+
+		DrawCommand batch = rFirst;
+		batch.m_pShader = rFirst.m_pInstancedShader;
+		batch.m_pInstancedShader = nullptr;
+		batch.m_pConstantBuffer = pBatchConstantBuffer;
+		batch.m_constantSlot = kBatchConstantSlot;
+		batch.m_instances = kRun;
+
+		InstanceBatchConstants constants = {};
+		constants.m_firstInstance = kFirstInstance;
+		rBatches.draw(kFirst.m_key, batch, constants);
+		m_packets[kept++] = { kFirst.m_key, kBatchBuffer, rBatches.size() - 1 };
+	}
+
+	m_packets.resize(kept);
+	return kept;
+}
+
+void CommandQueue::submit(RenderDevice& rDevice, const PassJob& passJob) const
+{
+	submit(rDevice, 0, static_cast<u32>(m_packets.size()), passJob);
+}
+
+void CommandQueue::submit(RenderDevice& rDevice, const u32 kBegin, const u32 kEnd, const PassJob& passJob) const
+{
+	const ShaderBinding* pShader = nullptr;
+	const MeshBinding* pMesh = nullptr;
+	const TextureBinding* pTexture = nullptr;
+	bool bTextureBound = false;		// pTexture, null included, is what slot 0 holds.
+	u32 pass = ~0u;
+
+	for (u32 p = kBegin; p < kEnd; ++p)
+	{
+		const DrawPacket& rPacket = m_packets[p];
+		const u32 kPass = sort_key_pass(rPacket.m_key);
+		if (kPass != pass)
+		{
+			// A pass may set anything, so bind afresh after it.
+			pass = kPass;
+			if (passJob)
+				passJob(rDevice, kPass);
+			pShader = nullptr;
+			pMesh = nullptr;
+			bTextureBound = false;
+		}
+
+		const CommandBuffer& rBuffer = m_buffers[rPacket.m_buffer];
+		const DrawCommand& rCommand = rBuffer.m_commands[rPacket.m_command];
+		if (rCommand.m_pShader != pShader)
+		{
+			pShader = rCommand.m_pShader;
+			pShader->bind(rDevice);
+		}
+		if (rCommand.m_pMesh != pMesh)
+		{
+			pMesh = rCommand.m_pMesh;
+			pMesh->bind(rDevice);
+		}
+		if (rCommand.m_pTexture != pTexture || !bTextureBound)
+		{
+			// No texture unbinds the last, rather than drawing with it.
+			pTexture = rCommand.m_pTexture;
+			bTextureBound = true;
+			if (pTexture)
+			{
+				pTexture->bind(rDevice, ShaderStage::kPixel, 0);
+			}
+			else
+			{
+				RenderShaderView* pNullView = nullptr;
+				rDevice.set_shader_resources(ShaderStage::kPixel, 0, 1, &pNullView);
+			}
+		}
+		if (rCommand.m_constantBytes && m_pRing)
+		{
+			m_pRing->bind(rDevice, ShaderStage::kVertex, rCommand.m_constantSlot, m_blocks[p]);
+			m_pRing->bind(rDevice, ShaderStage::kPixel, rCommand.m_constantSlot, m_blocks[p]);
+		}
+		else if (rCommand.m_constantBytes)
+		{
+			rDevice.update_buffer(rCommand.m_pConstantBuffer, rBuffer.m_constants.data() + rCommand.m_constantOffset, rCommand.m_constantBytes);
+		}
+
+		if (rCommand.m_instances > 1)
+			pMesh->draw_instanced(rDevice, rCommand.m_instances);
+		else
+			pMesh->draw(rDevice);
+	}
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "ConstantRing.h"
+#include "RenderDevice.h"
+
+#include <functional>
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Command Buffers
+// Draws recorded as packets rather than issued on the spot, then sorted and
+// submitted in one go. A packet is a 64 bit sort key and where to find the
+// draw. Sorting by key groups draws sharing a shader, then a material, then a
+// mesh, so submission only binds what actually changes between neighbours.
+//
+// Each recording thread writes its own CommandBuffer, nothing is shared until
+// the queue gathers the packets and radix sorts them. The sort is stable and
+// buffers are gathered in order, so the submitted order never depends on how
+// the recording was split across threads.
+//
+// The key, most significant bits first:
+//   pass 4 | shader 8 | material 12 | mesh 12 | depth 24 | spare 4
+// Depth comes last, front to back within a state for opaque passes. A pass
+// drawn back to front passes zero ids and an inverted depth, so depth leads.
+//
+// Once sorted, draws differing only in depth and constants are neighbours, and
+// batch_instances() can collapse each run of them into one instanced draw
+// reading every instance's constants from a structured buffer.
+//================================================================================
+
+constexpr u32 kSortKeyPassBits = 4;
+constexpr u32 kSortKeyShaderBits = 8;
+constexpr u32 kSortKeyMaterialBits = 12;
+constexpr u32 kSortKeyMeshBits = 12;
+constexpr u32 kSortKeyDepthBits = 24;
+
+// Pack a sort key, ids past their field's width are masked.
+inline u64 make_sort_key(const u32 kPass, const u32 kShader, const u32 kMaterial, const u32 kMesh, const u32 kDepth)
+{
+	u64 key = kPass & ((1u << kSortKeyPassBits) - 1);
+	key = (key << kSortKeyShaderBits) | (kShader & ((1u << kSortKeyShaderBits) - 1));
+	key = (key << kSortKeyMaterialBits) | (kMaterial & ((1u << kSortKeyMaterialBits) - 1));
+	key = (key << kSortKeyMeshBits) | (kMesh & ((1u << kSortKeyMeshBits) - 1));
+	key = (key << kSortKeyDepthBits) | (kDepth & ((1u << kSortKeyDepthBits) - 1));
+	return key << 4;
+}
+
+// Quantize a depth in [0, 1] to the key's depth field, far first when kBackToFront.
+inline u32 sort_key_depth(const f32 kDepth, const bool kBackToFront)
+{
+	const f32 kClamped = kDepth < 0.f ? 0.f : (kDepth > 1.f ? 1.f : kDepth);
+	const u32 kQuantized = static_cast<u32>(kClamped * f32((1u << kSortKeyDepthBits) - 1));
+	return kBackToFront ? ((1u << kSortKeyDepthBits) - 1) - kQuantized : kQuantized;
+}
+
+inline u32 sort_key_pass(const u64 kKey)
+{
+	return static_cast<u32>(kKey >> (64 - kSortKeyPassBits));
+}
+
+// Everything a draw binds. The per draw constants live in the recording buffer.
+struct DrawCommand
+{
+	const ShaderBinding* m_pShader;
+	const ShaderBinding* m_pInstancedShader;	// reads each instance's constants from the instance data, null when never batched.
+	const MeshBinding* m_pMesh;
+	const TextureBinding* m_pTexture;	// bound to pixel shader slot 0, none when null.
+	RenderBuffer* m_pConstantBuffer;	// replaced with the recorded constants before the draw.
+	u32 m_constantSlot;					// the buffer's vertex and pixel shader slot, for binding ring blocks there instead.
+	u32 m_instances;					// one for a plain draw.
+	u32 m_constantOffset;				// filled in by CommandBuffer::draw.
+	u32 m_constantBytes;
+};
+
+// A batched draw's own constants, in a buffer and slot of their own.
+struct InstanceBatchConstants
+{
+	u32 m_firstInstance;	// in the instance data.
+	u32 m_padding[3];
+};
+
+struct DrawPacket
+{
+	u64 m_key;
+	u32 m_buffer;		// recording buffer and command within it.
+	u32 m_command;
+};
+
+class CommandBuffer
+{
+public:
+
+	void clear();
+
+	// Record a draw, kConstantBytes from pConstants are copied for the command's constant buffer.
+	void draw(const u64 kKey, const DrawCommand& rCommand, const void* pConstants, const u32 kConstantBytes);
+
+	template<typename ConstantBufferType>
+	void draw(const u64 kKey, const DrawCommand& rCommand, const ConstantBufferType& rConstants)
+	{
+		draw(kKey, rCommand, &rConstants, sizeof(ConstantBufferType));
+	}
+
+	u32 size() const { return static_cast<u32>(m_commands.size()); }
+
+	// A command's copy of its constants.
+	const u8* constants(const DrawCommand& rCommand) const { return m_constants.data() + rCommand.m_constantOffset; }
+
+private:
+
+	friend class CommandQueue;
+
+	std::vector<u64> m_keys;
+	std::vector<DrawCommand> m_commands;
+	std::vector<u8> m_constants;
+};
+
+class CommandQueue
+{
+public:
+
+	typedef std::function<void(CommandBuffer& rBuffer, u32 begin, u32 end)> RecordJob;
+
+	// Called as submission reaches the first packet of each pass, to set up its targets and fixed function state.
+	typedef std::function<void(RenderDevice& rDevice, u32 pass)> PassJob;
+
+	// Drop everything recorded and make kBuffers empty buffers.
+	void begin(const u32 kBuffers);
+
+	CommandBuffer& buffer(const u32 kIndex) { return m_buffers[kIndex]; }
+	u32 buffers() const { return static_cast<u32>(m_buffers.size()); }
+
+	// Split [0, kCount) into slices of kGrain, each recorded into a buffer of its own across the job system.
+	// Replaces anything recorded before.
+	void record(const u32 kCount, const u32 kGrain, const RecordJob& job, JobSystem* pJobs);
+
+	// Gather every buffer's packets and radix sort them by key.
+	void sort();
+
+	// Copy every sorted draw's constants into the ring, submission then binds each draw's block at its constant
+	// slot rather than updating its buffer. The ring must be flushed before submitting. False, with draws left
+	// updating their buffers, when the ring is disabled or out of room.
+	bool stage_constants(ConstantRing& rRing);
+	bool staged() const { return m_pRing != nullptr; }
+
+	// Collapse each run of sorted draws sharing a pass, shader, material, mesh and constant buffer into one
+	// instanced draw with the run's instanced shader. The draws' constants, kInstanceBytes each, are copied to the
+	// instance data in submission order and the batched draw's constants, updating pBatchConstantBuffer bound at
+	// kBatchConstantSlot, give where its run starts. Draws without an instanced shader or of another constant size
+	// are left alone, as are runs that would take the instance data past kMaxInstances. Once, after sort() and
+	// before staging. Returns the draws left.
+	u32 batch_instances(const u32 kInstanceBytes, const u32 kMaxInstances, RenderBuffer* pBatchConstantBuffer, const u32 kBatchConstantSlot);
+	const std::vector<u8>& instance_data() const { return m_instanceData; }
+
+	// Issue the sorted draws, binding a shader, mesh or texture only when it differs from the previous draw's.
+	void submit(RenderDevice& rDevice, const PassJob& passJob = nullptr) const;
+
+	// The sorted packets [kBegin, kEnd) alone, binding everything from scratch and starting with the range's pass,
+	// so separate ranges can be recorded into separate command lists.
+	void submit(RenderDevice& rDevice, const u32 kBegin, const u32 kEnd, const PassJob& passJob = nullptr) const;
+
+	const std::vector<DrawPacket>& packets() const { return m_packets; }
+	const DrawCommand& command(const DrawPacket& rPacket) const { return m_buffers[rPacket.m_buffer].m_commands[rPacket.m_command]; }
+
+private:
+
+	std::vector<CommandBuffer> m_buffers;
+	std::vector<DrawPacket> m_packets;
+	std::vector<DrawPacket> m_scratch;
+	const ConstantRing* m_pRing = nullptr;
+	std::vector<ConstantBlock> m_blocks;	// by packet, once staged.
+	std::vector<u8> m_instanceData;
+};
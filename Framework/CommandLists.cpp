@@ -0,0 +1,55 @@
+#include "CommandLists.h"
+#include "JobQueue.h"
+
+namespace
+{
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job, const u32 kMaxThreads = 0)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job, kMaxThreads);
+	else
+		job(0, kCount);
+}
+
+} // namespace
+
+void NullCommandLists::begin(const u32 kChunks)
+{
+	m_devices.resize(kChunks);
+	for (NullRenderDevice& rDevice : m_devices)
+		rDevice.reset_stats();
+}
+
+void RecordingCommandLists::begin(const u32 kChunks)
+{
+	m_devices.resize(kChunks);
+	for (RecordingRenderDevice& rDevice : m_devices)
+		rDevice.clear();
+}
+
+void ParallelRecorder::record(CommandLists& rLists, const u32 kCount, const u32 kChunks, const RecordJob& job, JobSystem* pJobs, const u32 kMaxThreads)
+{
+	const u32 kChunkCount = std::max(1u, kChunks);
+	m_caches.resize(kChunkCount);
+	rLists.begin(kChunkCount);
+
+	const s64 kRecordStart = getTimeMicroseconds();
+	run(pJobs, kChunkCount, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 c = begin; c < end; ++c)
+		{
+			StateCacheDevice& rCache = m_caches[c];
+			rCache.set_device(&rLists.begin_chunk(c));
+			job(rCache, u32(u64(kCount) * c / kChunkCount), u32(u64(kCount) * (c + 1) / kChunkCount));
+			rLists.end_chunk(c);
+		}
+	}, kMaxThreads);
+	m_stats.m_recordMs = (getTimeMicroseconds() - kRecordStart) / 1000.0;
+
+	const s64 kExecuteStart = getTimeMicroseconds();
+	for (u32 c = 0; c < kChunkCount; ++c)
+		rLists.execute(c);
+	m_stats.m_executeMs = (getTimeMicroseconds() - kExecuteStart) / 1000.0;
+	m_stats.m_chunks = kChunkCount;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "RenderDevice.h"
+#include "StateCache.h"
+
+#include <functional>
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Command Lists
+// Recording a pass on several threads at once. The pass's draws are split
+// into chunks, each recorded on a worker through a device of its own into a
+// command list, then the lists are executed one after another in chunk order,
+// so the result is the same as recording the draws in order on one thread.
+//
+// CommandLists is what a backend provides: a device per chunk, a way to close
+// a chunk's list and a way to run it. D3D11CommandLists (D3D11RenderDevice.h)
+// records into deferred contexts and runs them on the immediate one. NullCommandLists and
+// RecordingCommandLists keep everything on the CPU, the first only counting,
+// for timing, the second logging every call, for checking the merged stream.
+//
+// A chunk can't see what the chunk before it set, it binds everything it
+// draws with from scratch. ParallelRecorder puts a fresh state cache in front of each chunk's
+// device, so a job can bind everything it needs without repeating itself.
+//================================================================================
+
+class CommandLists
+{
+public:
+	virtual ~CommandLists() {}
+
+	// Ready kChunks lists for recording, called on the submitting thread.
+	virtual void begin(const u32 kChunks) = 0;
+
+	// The device recording a chunk. Each chunk is recorded by one thread, between these two calls.
+	virtual RenderDevice& begin_chunk(const u32 kChunk) = 0;
+	virtual void end_chunk(const u32 kChunk) = 0;
+
+	// Run a finished chunk, on the submitting thread and in chunk order.
+	virtual void execute(const u32 kChunk) = 0;
+};
+
+//--------------------------------------------------------------------------------
+// Counts only. Executing adds a chunk's counts to the total.
+
+class NullCommandLists final : public CommandLists
+{
+public:
+	void begin(const u32 kChunks) override;
+	RenderDevice& begin_chunk(const u32 kChunk) override { return m_devices[kChunk]; }
+	void end_chunk(const u32) override {}
+	void execute(const u32 kChunk) override { accumulate_stats(m_executed, m_devices[kChunk].stats()); }
+
+	// Everything executed since the last reset.
+	const RenderDeviceStats& executed() const { return m_executed; }
+	void reset() { m_executed = {}; }
+
+private:
+	std::vector<NullRenderDevice> m_devices;
+	RenderDeviceStats m_executed = {};
+};
+
+//--------------------------------------------------------------------------------
+// Logs every call. Executing appends a chunk's log to one merged log.
+
+class RecordingCommandLists final : public CommandLists
+{
+public:
+	void begin(const u32 kChunks) override;
+	RenderDevice& begin_chunk(const u32 kChunk) override { return m_devices[kChunk]; }
+	void end_chunk(const u32) override {}
+	void execute(const u32 kChunk) override { m_executed.append(m_devices[kChunk]); }
+
+	// Every call executed since the last reset, in execution order.
+	const RecordingRenderDevice& executed() const { return m_executed; }
+	void reset() { m_executed.clear(); }
+
+private:
+	std::vector<RecordingRenderDevice> m_devices;
+	RecordingRenderDevice m_executed;
+};
+
+//--------------------------------------------------------------------------------
+
+class ParallelRecorder
+{
+public:
+
+	typedef std::function<void(RenderDevice& rDevice, u32 begin, u32 end)> RecordJob;
+
+	struct Stats
+	{
+		u32 m_chunks;
+		f64 m_recordMs;		// every chunk recorded, across the job system.
+		f64 m_executeMs;
+	};
+
+	// Split [0, kCount) into kChunks even ranges, record each into its own list across the job system, then
+	// execute the lists in order. Recording runs on one thread without a job system, and on at most kMaxThreads
+	// with one, zero allowing every worker.
+	void record(CommandLists& rLists, const u32 kCount, const u32 kChunks, const RecordJob& job, JobSystem* pJobs, const u32 kMaxThreads = 0);
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	std::vector<StateCacheDevice> m_caches;
+	Stats m_stats = {};
+};
@@ -0,0 +1,75 @@
+#include "ConstantRing.h"
+
+void ConstantRing::init(RenderBuffer* pBuffer, const u32 kBytes)
+{
+	if (!pBuffer)
+		return;
+
+	ASSERT(!(kBytes & (kConstantRingAlignment - 1)));
+	m_pBuffer = pBuffer;
+	m_allocator.init(kBytes, kConstantRingAlignment);
+	m_image.resize(m_allocator.capacity());
+}
+
+void ConstantRing::begin_frame(const u64 kCompletedFrame)
+{
+	if (enabled())
+		m_allocator.retire(kCompletedFrame);
+}
+
+u64 ConstantRing::end_frame()
+{
+	ASSERT(!m_bPending);
+	if (enabled())
+		m_allocator.end_frame(m_frame);
+	return m_frame++;
+}
+
+bool ConstantRing::push(const void* pData, const u32 kBytes, ConstantBlock& rBlockOut)
+{
+	if (!enabled())
+		return false;
+
+	const u32 kOffset = m_allocator.allocate(kBytes);
+	if (kOffset == kRingAllocatorFull)
+		return false;
+
+	const u32 kSize = (kBytes + kConstantRingAlignment - 1) & ~(kConstantRingAlignment - 1);
+	memcpy(m_image.data() + kOffset, pData, kBytes);
+	rBlockOut.m_firstConstant = kOffset / 16;
+	rBlockOut.m_constants = kSize / 16;
+
+	if (!m_bPending)
+	{
+		m_pendingStart = kOffset;
+		m_bPending = true;
+		m_bPendingWrapped = false;
+	}
+	else if (kOffset != m_pendingEnd || m_pendingEnd == m_allocator.capacity())
+	{
+		// Pending blocks are never given out again, so this is the one wrap before the next flush.
+		ASSERT(!m_bPendingWrapped && kOffset == 0);
+		m_bPendingWrapped = true;
+	}
+	m_pendingEnd = kOffset + kSize;
+	return true;
+}
+
+void ConstantRing::flush(RenderDevice& rDevice)
+{
+	if (!m_bPending)
+		return;
+
+	const u32 kFirstEnd = m_bPendingWrapped ? m_allocator.capacity() : m_pendingEnd;
+	rDevice.write_buffer(m_pBuffer, m_pendingStart, m_image.data() + m_pendingStart, kFirstEnd - m_pendingStart, m_bFirstWrite);
+	if (m_bPendingWrapped)
+		rDevice.write_buffer(m_pBuffer, 0, m_image.data(), m_pendingEnd, false);
+
+	m_bFirstWrite = false;
+	m_bPending = false;
+}
+
+void ConstantRing::bind(RenderDevice& rDevice, const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const ConstantBlock& rBlock) const
+{
+	rDevice.set_constant_buffer_range(kStage, kSlot, m_pBuffer, rBlock.m_firstConstant, rBlock.m_constants);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "RingAllocator.h"
+#include "RenderDevice.h"
+
+//================================================================================
+// Constant Ring
+// Per draw constants sub-allocated from one large dynamic constant buffer
+// rather than written over a small one for every draw. Blocks are 256 byte
+// aligned, the granularity constant buffers are bound by offset at, and are
+// copied to a CPU side image of the buffer as they are pushed. flush() writes
+// everything pushed since the last flush in one map without overwrite, ahead
+// of the draws reading it, and each draw binds its own block by offset.
+//
+// Every flush is a map of its own, so push all that a frame's draws read
+// ahead of one flush where the constants are known that early. A pass whose
+// constants depend on an earlier pass having been drawn, as the app's light
+// volumes packed per eye after that eye's geometry pass are, needs a flush of
+// its own between the two, a map per pass rather than per frame.
+//
+// A frame's blocks are only handed out again once the GPU is past the frame.
+// The ring knows nothing of how that is found out, the caller fences the
+// frame end_frame() returns and passes the newest completed one to
+// begin_frame(), as with RingAllocator. Until then a full ring refuses pushes
+// and the caller falls back to updating its own constant buffer.
+//
+// The buffer is the backend's, a dynamic constant buffer that can be bound by
+// offset and mapped without overwrite. A backend that can't do both passes
+// none and enabled() is false.
+//================================================================================
+
+constexpr u32 kConstantRingAlignment = 256;
+
+struct ConstantBlock
+{
+	u32 m_firstConstant;	// in 16 byte constants, as set_constant_buffer_range takes them.
+	u32 m_constants;
+};
+
+class ConstantRing
+{
+public:
+	// pBuffer kBytes long, kBytes a multiple of kConstantRingAlignment. Disabled without a buffer.
+	void init(RenderBuffer* pBuffer, const u32 kBytes);
+	bool enabled() const { return m_pBuffer != nullptr; }
+
+	// Give back the frames up to kCompletedFrame, the newest the GPU is done with.
+	void begin_frame(const u64 kCompletedFrame);
+
+	// Close the frame, everything pushed flushed by now. Returns the frame to fence.
+	u64 end_frame();
+
+	// Copy kBytes into the next block, false when disabled or out of room.
+	bool push(const void* pData, const u32 kBytes, ConstantBlock& rBlockOut);
+
+	template<typename ConstantBufferType>
+	bool push(const ConstantBufferType& rData, ConstantBlock& rBlockOut)
+	{
+		return push(&rData, sizeof(ConstantBufferType), rBlockOut);
+	}
+
+	// Write the blocks pushed since the last flush to the buffer, one map or two when they wrapped.
+	void flush(RenderDevice& rDevice);
+
+	void bind(RenderDevice& rDevice, const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const ConstantBlock& rBlock) const;
+
+	const RingAllocator& allocator() const { return m_allocator; }
+
+private:
+
+	RenderBuffer* m_pBuffer = nullptr;
+	RingAllocator m_allocator;
+	std::vector<u8> m_image;	// what the buffer holds once flushed.
+	u64 m_frame = 1;
+	u32 m_pendingStart = 0;
+	u32 m_pendingEnd = 0;
+	bool m_bPending = false;
+	bool m_bPendingWrapped = false;
+	bool m_bFirstWrite = true;	// discard on the buffer's first map, nothing to keep yet.
+};
@@ -0,0 +1,162 @@
+//================================================================================
+// Core
+// Definitions for CoreHeader.h, the Windows specific parts kept to #ifdefs.
+//================================================================================
+
+#include "CoreHeader.h"
+
+#include <chrono>
+#include <fstream>
+
+#ifdef _WIN32
+	#include <intrin.h>
+	#include <malloc.h>
+#else
+	#include <cpuid.h>
+#endif
+
+//================================================================================
+// Time releated functions
+//================================================================================
+
+using TimePoint = std::chrono::time_point<std::chrono::high_resolution_clock>;
+static TimePoint g_startupTime = std::chrono::high_resolution_clock::now();
+
+std::int64_t getTimeMicroseconds()
+{
+	const auto currentTime = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(currentTime - g_startupTime).count();
+}
+
+double getTimeSeconds()
+{
+	return getTimeMicroseconds() * 0.000001;
+}
+
+//================================================================================
+// CPU features.
+//================================================================================
+
+bool cpu_has_avx()
+{
+	// The CPU has AVX and the OS saves the YMM registers across context switches.
+	static const bool s_bAvx = []()
+	{
+#ifdef _WIN32
+		int info[4];
+		__cpuid(info, 1);
+		const bool kAvx = (info[2] & (1 << 28)) != 0;
+		const bool kOSXSave = (info[2] & (1 << 27)) != 0;
+		return kAvx && kOSXSave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+		unsigned int eax, ebx, ecx, edx;
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+			return false;
+		const bool kAvx = (ecx & (1 << 28)) != 0;
+		const bool kOSXSave = (ecx & (1 << 27)) != 0;
+		if (!kAvx || !kOSXSave)
+			return false;
+		unsigned int xcr0Low, xcr0High;
+		__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+		return (xcr0Low & 0x6) == 0x6;
+#endif
+	}();
+	return s_bAvx;
+}
+
+//================================================================================
+// Debug print functions.
+//================================================================================
+
+void errorF(const char * format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	std::vfprintf(stderr, format, args);
+	va_end(args);
+
+	// Default newline and flush (like std::endl)
+	std::fputc('\n', stderr);
+	std::fflush(stderr);
+}
+
+void panicF(const char * format, ...)
+{
+	va_list args;
+	char buffer[2048] = { '\0' };
+
+	va_start(args, format);
+	std::vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+#ifdef _WIN32
+	MessageBoxA(nullptr, buffer, "Fatal Error", MB_OK);
+#else
+	std::fprintf(stderr, "Fatal Error: %s\n", buffer);
+#endif
+	std::abort();
+}
+
+void debugF(const char * format, ...)
+{
+	va_list args;
+	char buffer[2048] = { '\0' };
+
+	va_start(args, format);
+	std::vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+#ifdef _WIN32
+	OutputDebugStringA(buffer);
+#else
+	std::fputs(buffer, stdout);
+#endif
+}
+
+//================================================================================
+// File loading
+//================================================================================
+
+memtype_t* load_file(const char* pstrName, u32& rLengthOut, const u32 kAlignment, const u32 kZeroPadding)
+{
+	std::ifstream hFile;
+
+	hFile.open(pstrName, std::ios::binary);
+	if (hFile.good())
+	{
+		hFile.seekg(0, std::ios::end);
+		u32 length = static_cast<u32>(hFile.tellg());
+		hFile.seekg(0, std::ios::beg);
+
+		rLengthOut = length;
+#ifdef _WIN32
+		memtype_t* pMemory = (memtype_t*)_aligned_malloc(length + kZeroPadding, kAlignment);
+#else
+		// aligned_alloc wants a size in whole alignments.
+		const size_t kBytes = (length + kZeroPadding + kAlignment - 1) / kAlignment * kAlignment;
+		memtype_t* pMemory = (memtype_t*)aligned_alloc(kAlignment, kBytes);
+#endif
+		ASSERT(pMemory);
+
+		hFile.read((char*)pMemory, length);
+		if (kZeroPadding > 0)
+		{
+			memset(pMemory + length, 0, kZeroPadding);
+		}
+
+		hFile.close();
+
+		return pMemory;
+	}
+	ASSERT(false && "Couldn't load the file.");
+	return nullptr;
+}
+
+void release_loaded_file(memtype_t* ptr)
+{
+#ifdef _WIN32
+	if (ptr) _aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
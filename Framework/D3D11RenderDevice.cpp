@@ -0,0 +1,411 @@
+#include "D3D11RenderDevice.h"
+
+void D3D11RenderDevice::set_context(ID3D11DeviceContext* pContext)
+{
+	m_pContext = pContext;
+	m_pContext1.Reset();
+}
+
+void D3D11RenderDevice::set_input_layout(RenderInputLayout* pLayout)
+{
+	++m_stats.m_stateChanges;
+	m_pContext->IASetInputLayout(to_d3d(pLayout));
+}
+
+void D3D11RenderDevice::set_topology(const EPrimitiveTopology kTopology)
+{
+	static const D3D11_PRIMITIVE_TOPOLOGY kTopologies[kMaxPrimitiveTopologies] =
+	{
+		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST,
+		D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP,
+		D3D11_PRIMITIVE_TOPOLOGY_LINELIST,
+		D3D11_PRIMITIVE_TOPOLOGY_POINTLIST
+	};
+
+	++m_stats.m_stateChanges;
+	m_pContext->IASetPrimitiveTopology(kTopologies[kTopology]);
+}
+
+void D3D11RenderDevice::set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	ID3D11Buffer* buffers[] = { to_d3d(pBuffer) };
+	const UINT kStrides[] = { kStride };
+	const UINT kOffsets[] = { kOffset };
+	m_pContext->IASetVertexBuffers(kSlot, 1, buffers, kStrides, kOffsets);
+}
+
+void D3D11RenderDevice::set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	m_pContext->IASetIndexBuffer(to_d3d(pBuffer), kFormat == kIndexFormat_16 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT, kOffset);
+}
+
+void D3D11RenderDevice::set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader)
+{
+	++m_stats.m_stateChanges;
+	switch (kStage)
+	{
+	case ShaderStage::kVertex:
+		m_pContext->VSSetShader(reinterpret_cast<ID3D11VertexShader*>(pShader), NULL, 0);
+		break;
+	case ShaderStage::kHull:
+		m_pContext->HSSetShader(reinterpret_cast<ID3D11HullShader*>(pShader), NULL, 0);
+		break;
+	case ShaderStage::kDomain:
+		m_pContext->DSSetShader(reinterpret_cast<ID3D11DomainShader*>(pShader), NULL, 0);
+		break;
+	case ShaderStage::kGeometry:
+		m_pContext->GSSetShader(reinterpret_cast<ID3D11GeometryShader*>(pShader), NULL, 0);
+		break;
+	case ShaderStage::kPixel:
+		m_pContext->PSSetShader(reinterpret_cast<ID3D11PixelShader*>(pShader), NULL, 0);
+		break;
+	case ShaderStage::kCompute:
+		m_pContext->CSSetShader(reinterpret_cast<ID3D11ComputeShader*>(pShader), NULL, 0);
+		break;
+	}
+}
+
+void D3D11RenderDevice::set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppHandles)
+{
+	ASSERT(kCount <= D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT);
+	ID3D11Buffer* ppBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+	for (u32 i = 0; i < kCount; ++i)
+		ppBuffers[i] = to_d3d(ppHandles[i]);
+
+	++m_stats.m_stateChanges;
+	switch (kStage)
+	{
+	case ShaderStage::kVertex:
+		m_pContext->VSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	case ShaderStage::kHull:
+		m_pContext->HSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	case ShaderStage::kDomain:
+		m_pContext->DSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	case ShaderStage::kGeometry:
+		m_pContext->GSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	case ShaderStage::kPixel:
+		m_pContext->PSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	case ShaderStage::kCompute:
+		m_pContext->CSSetConstantBuffers(kSlot, kCount, ppBuffers);
+		break;
+	}
+}
+
+void D3D11RenderDevice::set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pHandle, const u32 kFirstConstant, const u32 kConstants)
+{
+	if (!m_pContext1)
+		m_pContext->QueryInterface(IID_PPV_ARGS(&m_pContext1));
+	ASSERT(m_pContext1);
+
+	++m_stats.m_stateChanges;
+	ID3D11Buffer* pBuffer = to_d3d(pHandle);
+	const UINT kFirst[] = { kFirstConstant };
+	const UINT kCount[] = { kConstants };
+	switch (kStage)
+	{
+	case ShaderStage::kVertex:
+		m_pContext1->VSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	case ShaderStage::kHull:
+		m_pContext1->HSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	case ShaderStage::kDomain:
+		m_pContext1->DSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	case ShaderStage::kGeometry:
+		m_pContext1->GSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	case ShaderStage::kPixel:
+		m_pContext1->PSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	case ShaderStage::kCompute:
+		m_pContext1->CSSetConstantBuffers1(kSlot, 1, &pBuffer, kFirst, kCount);
+		break;
+	}
+}
+
+void D3D11RenderDevice::set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppHandles)
+{
+	ASSERT(kCount <= D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT);
+	ID3D11ShaderResourceView* ppViews[D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT];
+	for (u32 i = 0; i < kCount; ++i)
+		ppViews[i] = to_d3d(ppHandles[i]);
+
+	++m_stats.m_stateChanges;
+	switch (kStage)
+	{
+	case ShaderStage::kVertex:
+		m_pContext->VSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	case ShaderStage::kHull:
+		m_pContext->HSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	case ShaderStage::kDomain:
+		m_pContext->DSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	case ShaderStage::kGeometry:
+		m_pContext->GSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	case ShaderStage::kPixel:
+		m_pContext->PSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	case ShaderStage::kCompute:
+		m_pContext->CSSetShaderResources(kSlot, kCount, ppViews);
+		break;
+	}
+}
+
+void D3D11RenderDevice::set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppHandles)
+{
+	ASSERT(kCount <= D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT);
+	ID3D11SamplerState* ppSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+	for (u32 i = 0; i < kCount; ++i)
+		ppSamplers[i] = to_d3d(ppHandles[i]);
+
+	++m_stats.m_stateChanges;
+	switch (kStage)
+	{
+	case ShaderStage::kVertex:
+		m_pContext->VSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	case ShaderStage::kHull:
+		m_pContext->HSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	case ShaderStage::kDomain:
+		m_pContext->DSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	case ShaderStage::kGeometry:
+		m_pContext->GSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	case ShaderStage::kPixel:
+		m_pContext->PSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	case ShaderStage::kCompute:
+		m_pContext->CSSetSamplers(kSlot, kCount, ppSamplers);
+		break;
+	}
+}
+
+void D3D11RenderDevice::set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask)
+{
+	++m_stats.m_stateChanges;
+	m_pContext->OMSetBlendState(to_d3d(pState), kBlendFactor, kSampleMask);
+}
+
+void D3D11RenderDevice::set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef)
+{
+	++m_stats.m_stateChanges;
+	m_pContext->OMSetDepthStencilState(to_d3d(pState), kStencilRef);
+}
+
+void D3D11RenderDevice::set_rasterizer_state(RenderRasterizerState* pState)
+{
+	++m_stats.m_stateChanges;
+	m_pContext->RSSetState(to_d3d(pState));
+}
+
+void D3D11RenderDevice::update_buffer(RenderBuffer* pHandle, const void* pData, const u32 kBytes)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+
+	ID3D11Buffer* pBuffer = to_d3d(pHandle);
+	D3D11_MAPPED_SUBRESOURCE subresource;
+	if (!FAILED(m_pContext->Map(pBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &subresource)))
+	{
+		memcpy(subresource.pData, pData, kBytes);
+		m_pContext->Unmap(pBuffer, 0);
+	}
+}
+
+void D3D11RenderDevice::write_buffer(RenderBuffer* pHandle, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+
+	ID3D11Buffer* pBuffer = to_d3d(pHandle);
+	D3D11_MAPPED_SUBRESOURCE subresource;
+	if (!FAILED(m_pContext->Map(pBuffer, 0, kDiscard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &subresource)))
+	{
+		memcpy(static_cast<u8*>(subresource.pData) + kOffset, pData, kBytes);
+		m_pContext->Unmap(pBuffer, 0);
+	}
+}
+
+void D3D11RenderDevice::draw(const u32 kVertices, const u32 kFirstVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	m_pContext->Draw(kVertices, kFirstVertex);
+}
+
+void D3D11RenderDevice::draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	m_pContext->DrawIndexed(kIndices, kFirstIndex, kBaseVertex);
+}
+
+void D3D11RenderDevice::draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	m_pContext->DrawInstanced(kVertices, kInstances, kFirstVertex, kFirstInstance);
+}
+
+void D3D11RenderDevice::draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	m_pContext->DrawIndexedInstanced(kIndices, kInstances, kFirstIndex, kBaseVertex, kFirstInstance);
+}
+
+void D3D11RenderDevice::dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ)
+{
+	++m_stats.m_dispatches;
+	m_pContext->Dispatch(kGroupsX, kGroupsY, kGroupsZ);
+}
+
+D3D11CommandLists::~D3D11CommandLists()
+{
+	release_snapshot();
+	for (ID3D11CommandList*& rpList : m_lists)
+		SAFE_RELEASE(rpList);
+	for (ID3D11DeviceContext*& rpContext : m_contexts)
+		SAFE_RELEASE(rpContext);
+}
+
+void D3D11CommandLists::init(ID3D11Device* pDevice, ID3D11DeviceContext* pImmediate)
+{
+	m_pDevice = pDevice;
+	m_pImmediate = pImmediate;
+}
+
+void D3D11CommandLists::begin(const u32 kChunks)
+{
+	release_snapshot();
+	capture();
+
+	while (m_contexts.size() < kChunks)
+	{
+		ID3D11DeviceContext* pContext = nullptr;
+		HRESULT hr = m_pDevice->CreateDeferredContext(0, &pContext);
+		ASSERT(!FAILED(hr) && pContext);
+		m_contexts.push_back(pContext);
+	}
+
+	m_lists.resize(m_contexts.size(), nullptr);
+	m_devices.resize(m_contexts.size());
+	for (u32 i = 0; i < m_devices.size(); ++i)
+		m_devices[i].set_context(m_contexts[i]);
+}
+
+RenderDevice& D3D11CommandLists::begin_chunk(const u32 kChunk)
+{
+	apply(m_contexts[kChunk]);
+	m_devices[kChunk].reset_stats();
+	return m_devices[kChunk];
+}
+
+void D3D11CommandLists::end_chunk(const u32 kChunk)
+{
+	ASSERT(!m_lists[kChunk]);
+	HRESULT hr = m_contexts[kChunk]->FinishCommandList(FALSE, &m_lists[kChunk]);
+	ASSERT(!FAILED(hr));
+}
+
+void D3D11CommandLists::execute(const u32 kChunk)
+{
+	if (m_lists[kChunk])
+	{
+		m_pImmediate->ExecuteCommandList(m_lists[kChunk], TRUE);
+		SAFE_RELEASE(m_lists[kChunk]);
+	}
+}
+
+void D3D11CommandLists::capture()
+{
+	Snapshot& s = m_snapshot;
+	ID3D11DeviceContext* pContext = m_pImmediate;
+
+	pContext->OMGetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, s.m_pTargets, &s.m_pDepth);
+	s.m_viewportCount = D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE;
+	pContext->RSGetViewports(&s.m_viewportCount, s.m_viewports);
+	pContext->OMGetBlendState(&s.m_pBlendState, s.m_blendFactor, &s.m_sampleMask);
+	pContext->OMGetDepthStencilState(&s.m_pDepthStencilState, &s.m_stencilRef);
+	pContext->RSGetState(&s.m_pRasterizerState);
+
+	pContext->IAGetInputLayout(&s.m_pInputLayout);
+	pContext->IAGetPrimitiveTopology(&s.m_topology);
+	pContext->IAGetVertexBuffers(0, 1, &s.m_pVertexBuffer, &s.m_vertexStride, &s.m_vertexOffset);
+	pContext->IAGetIndexBuffer(&s.m_pIndexBuffer, &s.m_indexFormat, &s.m_indexOffset);
+
+	pContext->VSGetShader(&s.m_pVertexShader, nullptr, nullptr);
+	pContext->PSGetShader(&s.m_pPixelShader, nullptr, nullptr);
+	pContext->VSGetConstantBuffers(0, kCommandListSnapshotSlots, s.m_pConstantBuffers[0]);
+	pContext->PSGetConstantBuffers(0, kCommandListSnapshotSlots, s.m_pConstantBuffers[1]);
+	pContext->VSGetShaderResources(0, kCommandListSnapshotSlots, s.m_pShaderResources[0]);
+	pContext->PSGetShaderResources(0, kCommandListSnapshotSlots, s.m_pShaderResources[1]);
+	pContext->VSGetSamplers(0, kCommandListSnapshotSlots, s.m_pSamplers[0]);
+	pContext->PSGetSamplers(0, kCommandListSnapshotSlots, s.m_pSamplers[1]);
+}
+
+void D3D11CommandLists::apply(ID3D11DeviceContext* pContext) const
+{
+	const Snapshot& s = m_snapshot;
+
+	pContext->OMSetRenderTargets(D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT, s.m_pTargets, s.m_pDepth);
+	pContext->RSSetViewports(s.m_viewportCount, s.m_viewports);
+	pContext->OMSetBlendState(s.m_pBlendState, s.m_blendFactor, s.m_sampleMask);
+	pContext->OMSetDepthStencilState(s.m_pDepthStencilState, s.m_stencilRef);
+	pContext->RSSetState(s.m_pRasterizerState);
+
+	pContext->IASetInputLayout(s.m_pInputLayout);
+	pContext->IASetPrimitiveTopology(s.m_topology);
+	pContext->IASetVertexBuffers(0, 1, &s.m_pVertexBuffer, &s.m_vertexStride, &s.m_vertexOffset);
+	pContext->IASetIndexBuffer(s.m_pIndexBuffer, s.m_indexFormat, s.m_indexOffset);
+
+	pContext->VSSetShader(s.m_pVertexShader, nullptr, 0);
+	pContext->PSSetShader(s.m_pPixelShader, nullptr, 0);
+	pContext->VSSetConstantBuffers(0, kCommandListSnapshotSlots, s.m_pConstantBuffers[0]);
+	pContext->PSSetConstantBuffers(0, kCommandListSnapshotSlots, s.m_pConstantBuffers[1]);
+	pContext->VSSetShaderResources(0, kCommandListSnapshotSlots, s.m_pShaderResources[0]);
+	pContext->PSSetShaderResources(0, kCommandListSnapshotSlots, s.m_pShaderResources[1]);
+	pContext->VSSetSamplers(0, kCommandListSnapshotSlots, s.m_pSamplers[0]);
+	pContext->PSSetSamplers(0, kCommandListSnapshotSlots, s.m_pSamplers[1]);
+}
+
+void D3D11CommandLists::release_snapshot()
+{
+	Snapshot& s = m_snapshot;
+
+	for (ID3D11RenderTargetView*& rpTarget : s.m_pTargets)
+		SAFE_RELEASE(rpTarget);
+	SAFE_RELEASE(s.m_pDepth);
+	SAFE_RELEASE(s.m_pBlendState);
+	SAFE_RELEASE(s.m_pDepthStencilState);
+	SAFE_RELEASE(s.m_pRasterizerState);
+	SAFE_RELEASE(s.m_pInputLayout);
+	SAFE_RELEASE(s.m_pVertexBuffer);
+	SAFE_RELEASE(s.m_pIndexBuffer);
+	SAFE_RELEASE(s.m_pVertexShader);
+	SAFE_RELEASE(s.m_pPixelShader);
+	for (u32 stage = 0; stage < 2; ++stage)
+	{
+		for (u32 slot = 0; slot < kCommandListSnapshotSlots; ++slot)
+		{
+			SAFE_RELEASE(s.m_pConstantBuffers[stage][slot]);
+			SAFE_RELEASE(s.m_pShaderResources[stage][slot]);
+			SAFE_RELEASE(s.m_pSamplers[stage][slot]);
+		}
+	}
+
+	s = {};
+}
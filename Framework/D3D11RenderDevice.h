@@ -0,0 +1,137 @@
+#pragma once
+
+#include "CommonHeader.h"
+#include "RenderDevice.h"
+#include "CommandLists.h"
+
+#include <vector>
+
+//================================================================================
+// D3D11 Render Device
+// The Direct3D 11 backend of RenderDevice and CommandLists. Handles are the
+// D3D objects themselves, to_handle() and to_d3d() convert between the two
+// and never change the pointer.
+//================================================================================
+
+inline RenderBuffer* to_handle(ID3D11Buffer* p) { return reinterpret_cast<RenderBuffer*>(p); }
+inline RenderInputLayout* to_handle(ID3D11InputLayout* p) { return reinterpret_cast<RenderInputLayout*>(p); }
+inline RenderShader* to_handle(ID3D11DeviceChild* p) { return reinterpret_cast<RenderShader*>(p); }
+inline RenderShaderView* to_handle(ID3D11ShaderResourceView* p) { return reinterpret_cast<RenderShaderView*>(p); }
+inline RenderSampler* to_handle(ID3D11SamplerState* p) { return reinterpret_cast<RenderSampler*>(p); }
+inline RenderBlendState* to_handle(ID3D11BlendState* p) { return reinterpret_cast<RenderBlendState*>(p); }
+inline RenderDepthStencilState* to_handle(ID3D11DepthStencilState* p) { return reinterpret_cast<RenderDepthStencilState*>(p); }
+inline RenderRasterizerState* to_handle(ID3D11RasterizerState* p) { return reinterpret_cast<RenderRasterizerState*>(p); }
+
+inline ID3D11Buffer* to_d3d(RenderBuffer* p) { return reinterpret_cast<ID3D11Buffer*>(p); }
+inline ID3D11InputLayout* to_d3d(RenderInputLayout* p) { return reinterpret_cast<ID3D11InputLayout*>(p); }
+inline ID3D11ShaderResourceView* to_d3d(RenderShaderView* p) { return reinterpret_cast<ID3D11ShaderResourceView*>(p); }
+inline ID3D11SamplerState* to_d3d(RenderSampler* p) { return reinterpret_cast<ID3D11SamplerState*>(p); }
+inline ID3D11BlendState* to_d3d(RenderBlendState* p) { return reinterpret_cast<ID3D11BlendState*>(p); }
+inline ID3D11DepthStencilState* to_d3d(RenderDepthStencilState* p) { return reinterpret_cast<ID3D11DepthStencilState*>(p); }
+inline ID3D11RasterizerState* to_d3d(RenderRasterizerState* p) { return reinterpret_cast<ID3D11RasterizerState*>(p); }
+
+//--------------------------------------------------------------------------------
+// Forwards to an immediate or deferred context. Cheap to make on the stack
+// around a context, the Direct3D 11.1 interface is only looked up the first
+// time a constant buffer window is bound.
+
+class D3D11RenderDevice final : public RenderDevice
+{
+public:
+	explicit D3D11RenderDevice(ID3D11DeviceContext* pContext = nullptr) : m_pContext(pContext) {}
+
+	void set_context(ID3D11DeviceContext* pContext);
+	ID3D11DeviceContext* context() const { return m_pContext; }
+
+	void set_input_layout(RenderInputLayout* pLayout) override;
+	void set_topology(const EPrimitiveTopology kTopology) override;
+	void set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset) override;
+	void set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset) override;
+
+	void set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader) override;
+
+	void set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers) override;
+	void set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants) override;
+	void set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews) override;
+	void set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers) override;
+
+	void set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask) override;
+	void set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef) override;
+	void set_rasterizer_state(RenderRasterizerState* pState) override;
+
+	void update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes) override;
+	void write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard) override;
+
+	void draw(const u32 kVertices, const u32 kFirstVertex) override;
+	void draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex) override;
+	void draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance) override;
+	void draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance) override;
+	void dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ) override;
+
+private:
+	ID3D11DeviceContext* m_pContext = nullptr;
+	Microsoft::WRL::ComPtr<ID3D11DeviceContext1> m_pContext1;	// for binding by offset, null before Direct3D 11.1 or until first needed.
+};
+
+//--------------------------------------------------------------------------------
+// Deferred contexts, made as needed and kept. Every chunk starts with the
+// state the immediate context had at begin() for the vertex and pixel stages,
+// input assembler, rasterizer and output merger, so a pass recorded this way
+// sees what it would have drawn straight to the immediate context.
+// Executing restores the immediate context's own state afterwards.
+
+constexpr u32 kCommandListSnapshotSlots = 16;
+
+class D3D11CommandLists final : public CommandLists
+{
+public:
+	~D3D11CommandLists();
+
+	void init(ID3D11Device* pDevice, ID3D11DeviceContext* pImmediate);
+
+	void begin(const u32 kChunks) override;
+	RenderDevice& begin_chunk(const u32 kChunk) override;
+	void end_chunk(const u32 kChunk) override;
+	void execute(const u32 kChunk) override;
+
+private:
+
+	// Pipeline state read back from the immediate context, holding a reference to everything in it.
+	struct Snapshot
+	{
+		ID3D11RenderTargetView* m_pTargets[D3D11_SIMULTANEOUS_RENDER_TARGET_COUNT];
+		ID3D11DepthStencilView* m_pDepth;
+		D3D11_VIEWPORT m_viewports[D3D11_VIEWPORT_AND_SCISSORRECT_OBJECT_COUNT_PER_PIPELINE];
+		UINT m_viewportCount;
+		ID3D11BlendState* m_pBlendState;
+		f32 m_blendFactor[4];
+		UINT m_sampleMask;
+		ID3D11DepthStencilState* m_pDepthStencilState;
+		UINT m_stencilRef;
+		ID3D11RasterizerState* m_pRasterizerState;
+		ID3D11InputLayout* m_pInputLayout;
+		D3D11_PRIMITIVE_TOPOLOGY m_topology;
+		ID3D11Buffer* m_pVertexBuffer;
+		UINT m_vertexStride;
+		UINT m_vertexOffset;
+		ID3D11Buffer* m_pIndexBuffer;
+		DXGI_FORMAT m_indexFormat;
+		UINT m_indexOffset;
+		ID3D11VertexShader* m_pVertexShader;
+		ID3D11PixelShader* m_pPixelShader;
+		ID3D11Buffer* m_pConstantBuffers[2][kCommandListSnapshotSlots];					// vertex then pixel.
+		ID3D11ShaderResourceView* m_pShaderResources[2][kCommandListSnapshotSlots];
+		ID3D11SamplerState* m_pSamplers[2][kCommandListSnapshotSlots];
+	};
+
+	void capture();
+	void apply(ID3D11DeviceContext* pContext) const;
+	void release_snapshot();
+
+	ID3D11Device* m_pDevice = nullptr;
+	ID3D11DeviceContext* m_pImmediate = nullptr;
+	std::vector<ID3D11DeviceContext*> m_contexts;
+	std::vector<ID3D11CommandList*> m_lists;
+	std::vector<D3D11RenderDevice> m_devices;
+	Snapshot m_snapshot = {};
+};
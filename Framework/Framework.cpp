@@ -10,11 +10,11 @@
 #define DEBUG_DRAW_IMPLEMENTATION
 #include "Framework.h"
 #include "ShaderSet.h"
+#include "CameraPath.h"
 
 #include <vector>
 #include <cstdlib>
 #include <tuple>
-#include <chrono>
 #include <fstream>
 
 // ========================================================
@@ -50,71 +50,13 @@ Keys keys;
 Mouse mouse;
 Time deltaTime;
 Camera camera;
-
-//================================================================================
-// Time releated functions
-//================================================================================
-
-using TimePoint = std::chrono::time_point<std::chrono::high_resolution_clock>;
-static TimePoint g_startupTime = std::chrono::high_resolution_clock::now();
-
-std::int64_t getTimeMicroseconds()
-{
-	const auto currentTime = std::chrono::high_resolution_clock::now();
-	return std::chrono::duration_cast<std::chrono::microseconds>(currentTime - g_startupTime).count();
-}
-
-double getTimeSeconds()
-{
-	return getTimeMicroseconds() * 0.000001;
-}
+CameraPath cameraPath;
 
 v2 getMousePosition()
 {
 	return v2(mouse.lastPosX, mouse.lastPosY);
 }
 
-//================================================================================
-// Debug print functions.
-//================================================================================
-
-void errorF(const char * format, ...)
-{
-	va_list args;
-	va_start(args, format);
-	std::vfprintf(stderr, format, args);
-	va_end(args);
-
-	// Default newline and flush (like std::endl)
-	std::fputc('\n', stderr);
-	std::fflush(stderr);
-}
-
-void panicF(const char * format, ...)
-{
-	va_list args;
-	char buffer[2048] = { '\0' };
-
-	va_start(args, format);
-	std::vsnprintf(buffer, sizeof(buffer), format, args);
-	va_end(args);
-
-	MessageBoxA(nullptr, buffer, "Fatal Error", MB_OK);
-	std::abort();
-}
-
-void debugF(const char * format, ...)
-{
-	va_list args;
-	char buffer[2048] = { '\0' };
-
-	va_start(args, format);
-	std::vsnprintf(buffer, sizeof(buffer), format, args);
-	va_end(args);
-
-	OutputDebugString(buffer);
-}
-
 // ========================================================
 // Window
 // ========================================================
@@ -1254,6 +1196,7 @@ int framework_main(FrameworkApp& rApp, const char* pTitleString, HINSTANCE hInst
 	systems.pEyeRenderViewport = renderWindow.m_pOvrEyeRenderViewport;
 	systems.pEyeRenderTexture = renderWindow.m_pOvrEyeRenderTexture;
 	systems.pCamera = &camera;
+	systems.pCameraPath = &cameraPath;
 	systems.width = 1344;
 	systems.height = 1600;
 
@@ -1309,7 +1252,11 @@ int framework_main(FrameworkApp& rApp, const char* pTitleString, HINSTANCE hInst
 		systems.height = renderWindow.s_height;
 
 
-		if (mouse.rightButtonDown) {
+		// A replay drives the camera in place of input.
+		if (cameraPath.replaying()) {
+			cameraPath.apply_camera(camera);
+		}
+		else if (mouse.rightButtonDown) {
 			camera.checkKeyboardMovement();
 			camera.checkMouseRotation();
 		}
@@ -1382,6 +1329,11 @@ Camera::Camera()
 		planes[i] = v4(0.0f);
 	}
 
+	lastEye = eye;
+	lastRight = right;
+	lastUp = up;
+	lastForward = forward;
+
 	resizeViewport(Window::s_width, Window::s_height);
 }
 
@@ -1492,6 +1444,17 @@ void Camera::resizeViewport(u32 width, u32 height)
 
 void Camera::updateMatrices()
 {
+	// Angle of the rotation taking the old axes to the new: summing each axis with its old self gives
+	// 2cos + 1 from the dots and 2sin along the rotation axis from the crosses. atan2 keeps small turns exact.
+	const float cosTerm = right.Dot(lastRight) + up.Dot(lastUp) + forward.Dot(lastForward) - 1.0f;
+	const float sinTerm = (lastRight.Cross(right) + lastUp.Cross(up) + lastForward.Cross(forward)).Length();
+	deltaRotation = std::atan2(sinTerm, cosTerm);
+	deltaTranslation = (eye - lastEye).Length();
+	lastEye = eye;
+	lastRight = right;
+	lastUp = up;
+	lastForward = forward;
+
 	viewMatrix = m4x4::CreateLookAt(eye, getTarget(), up);
 	vpMatrix = viewMatrix * projMatrix;
 
@@ -1543,6 +1506,12 @@ void Camera::look_at(const v3& vTarget)
 	up.Normalize();
 }
 
+float Camera::frameDelta(const float reach) const
+{
+	// A point at distance r from the eye is carried at most r * angle by the turn.
+	return deltaTranslation + deltaRotation * reach;
+}
+
 v3 Camera::getTarget() const
 {
 	return eye + forward;
@@ -1586,40 +1555,3 @@ v3 Camera::rotateAroundAxis(const v3 & vec, const v3 & axis, const float angle)
 
 	return v3(x, y, z);
 }
-
-memtype_t* load_file(const char* pstrName, u32& rLengthOut, const u32 kAlignment, const u32 kZeroPadding)
-{
-	std::ifstream hFile;
-
-	hFile.open(pstrName, std::ios::binary);
-	if (hFile.good())
-	{
-		hFile.seekg(0, std::ios::end);
-		u32 length = static_cast<u32>(hFile.tellg());
-		hFile.seekg(0, std::ios::beg);
-
-		rLengthOut = length;
-		memtype_t* pMemory = (memtype_t*)_aligned_malloc(length + kZeroPadding, kAlignment);
-		ASSERT(pMemory);
-
-		hFile.read((char*)pMemory, length);
-		if (kZeroPadding > 0)
-		{
-			memset(pMemory + length, 0, kZeroPadding);
-		}
-
-		hFile.close();
-
-		return pMemory;
-	}
-	ASSERT(false && "Couldn't load the file.");
-	return nullptr;
-}
-
-void release_loaded_file(memtype_t* ptr)
-{
-	if (ptr) _aligned_free(ptr);
-}
-
-
-
@@ -10,15 +10,6 @@
 
 
 
-// ========================================================
-//================================================================================
-// Time releated functions
-//================================================================================
-
-std::int64_t getTimeMicroseconds();
-
-double getTimeSeconds();
-
 // ========================================================
 // Key/Mouse input + A simple 3D camera:
 // ========================================================
@@ -83,6 +74,14 @@ struct Camera
 	enum { A, B, C, D };
 	v4 planes[6];
 
+	// Movement since the previous updateMatrices(), for deciding how much of last frame's work still holds:
+	float deltaTranslation; // Distance the eye moved.
+	float deltaRotation;    // Radians the view turned.
+	v3 lastEye;
+	v3 lastRight;
+	v3 lastUp;
+	v3 lastForward;
+
 	// Tunable values:
 	float movementSpeed = 10.0f;
 	float lookSpeed = 10.0f;
@@ -117,11 +116,17 @@ struct Camera
 
 	bool pointInFrustum(const v3& v) const;
 
+	// Bound on how far any plane fixed to the camera moved since the previous frame,
+	// measured at points within 'reach' of the eye.
+	float frameDelta(const float reach) const;
+
 	static v3 rotateAroundAxis(const v3 & vec, const v3 & axis, const float angle);
 };
 
 
 
+class CameraPath;
+
 // ========================================================
 // The SystemsInterface provide access to
 // systems and device contexts.
@@ -136,6 +141,7 @@ struct SystemsInterface
 	OculusTexture* pEyeRenderTexture;
 	dd::ContextHandle pDebugDrawContext;
 	Camera* pCamera;
+	CameraPath* pCameraPath; // Records or replays the camera and eye poses.
 	u32 width;
 	u32 height;
 };
@@ -183,15 +189,3 @@ void drawFrustum(dd::ContextHandle ctx);
 
 void drawText(dd::ContextHandle ctx);
 }
-
-//================================================================================
-// File loading
-//================================================================================
-
-// Loads an entire file into an allocated memory block.
-memtype_t* load_file(const char* pstrName, u32& rLengthOut, const u32 kAlignment, const u32 kZeroPadding);
-
-// Release a previously allocated block.
-void release_loaded_file(memtype_t* ptr);
-
-
@@ -0,0 +1,343 @@
+#include "FrustumCulling.h"
+#include "JobQueue.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace
+{
+
+// Mask words per job, each job owns whole words so no two write the same one.
+constexpr u32 kWordsPerJob = 64;
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+//--------------------------------------------------------------------------------
+// Scalar, the reference and the tail of every wide loop.
+
+bool sphere_visible(const CullPlanes& rPlanes, const f32 kX, const f32 kY, const f32 kZ, const f32 kRadius)
+{
+	bool bInside = true;
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		// Same operation order as the SIMD paths so results match bit for bit.
+		f32 distance = kX * rPlanes.m_x[p] + rPlanes.m_w[p];
+		distance = distance + kY * rPlanes.m_y[p];
+		distance = distance + kZ * rPlanes.m_z[p];
+		bInside &= distance >= -kRadius;
+	}
+	return bInside;
+}
+
+bool box_visible(const CullPlanes& rPlanes, const f32 kX, const f32 kY, const f32 kZ, const f32 kExtentX, const f32 kExtentY, const f32 kExtentZ)
+{
+	bool bInside = true;
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		f32 distance = kX * rPlanes.m_x[p] + rPlanes.m_w[p];
+		distance = distance + kY * rPlanes.m_y[p];
+		distance = distance + kZ * rPlanes.m_z[p];
+
+		// Projected half size of the box onto the plane normal.
+		f32 reach = kExtentX * fabsf(rPlanes.m_x[p]);
+		reach = reach + kExtentY * fabsf(rPlanes.m_y[p]);
+		reach = reach + kExtentZ * fabsf(rPlanes.m_z[p]);
+		bInside &= distance >= -reach;
+	}
+	return bInside;
+}
+
+void spheres_scalar(const CullPlanes& rPlanes, const SphereBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	for (; i < kEnd; ++i)
+	{
+		if (sphere_visible(rPlanes, b.m_pX[i], b.m_pY[i], b.m_pZ[i], b.m_pRadius[i]))
+			pMask[i / 32] |= 1u << (i % 32);
+	}
+}
+
+void boxes_scalar(const CullPlanes& rPlanes, const BoxBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	for (; i < kEnd; ++i)
+	{
+		if (box_visible(rPlanes, b.m_pCentreX[i], b.m_pCentreY[i], b.m_pCentreZ[i], b.m_pExtentX[i], b.m_pExtentY[i], b.m_pExtentZ[i]))
+			pMask[i / 32] |= 1u << (i % 32);
+	}
+}
+
+//--------------------------------------------------------------------------------
+// SSE, kGroups sets of four bounds per iteration.
+
+template <u32 kGroups>
+void spheres_sse(const CullPlanes& rPlanes, const SphereBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	__m128 nx[kMaxCullPlanes], ny[kMaxCullPlanes], nz[kMaxCullPlanes], nw[kMaxCullPlanes];
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		nx[p] = _mm_set1_ps(rPlanes.m_x[p]);
+		ny[p] = _mm_set1_ps(rPlanes.m_y[p]);
+		nz[p] = _mm_set1_ps(rPlanes.m_z[p]);
+		nw[p] = _mm_set1_ps(rPlanes.m_w[p]);
+	}
+
+	constexpr u32 kStep = kGroups * 4;
+	for (; i + kStep <= kEnd; i += kStep)
+	{
+		u32 bits = 0;
+		for (u32 g = 0; g < kGroups; ++g)
+		{
+			const u32 j = i + g * 4;
+			const __m128 kX = _mm_loadu_ps(b.m_pX + j);
+			const __m128 kY = _mm_loadu_ps(b.m_pY + j);
+			const __m128 kZ = _mm_loadu_ps(b.m_pZ + j);
+			const __m128 kNegRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(b.m_pRadius + j));
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (u32 p = 0; p < rPlanes.m_count; ++p)
+			{
+				__m128 distance = _mm_add_ps(_mm_mul_ps(kX, nx[p]), nw[p]);
+				distance = _mm_add_ps(distance, _mm_mul_ps(kY, ny[p]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(kZ, nz[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, kNegRadius));
+			}
+			bits |= u32(_mm_movemask_ps(inside)) << (g * 4);
+		}
+
+		// Steps divide 32 and ranges start on a word, so a step never straddles two words.
+		pMask[i / 32] |= bits << (i % 32);
+	}
+
+	spheres_scalar(rPlanes, b, i, kEnd, pMask);
+}
+
+template <u32 kGroups>
+void boxes_sse(const CullPlanes& rPlanes, const BoxBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	const __m128 kAbsMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	__m128 nx[kMaxCullPlanes], ny[kMaxCullPlanes], nz[kMaxCullPlanes], nw[kMaxCullPlanes];
+	__m128 ax[kMaxCullPlanes], ay[kMaxCullPlanes], az[kMaxCullPlanes];
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		nx[p] = _mm_set1_ps(rPlanes.m_x[p]);
+		ny[p] = _mm_set1_ps(rPlanes.m_y[p]);
+		nz[p] = _mm_set1_ps(rPlanes.m_z[p]);
+		nw[p] = _mm_set1_ps(rPlanes.m_w[p]);
+		ax[p] = _mm_and_ps(nx[p], kAbsMask);
+		ay[p] = _mm_and_ps(ny[p], kAbsMask);
+		az[p] = _mm_and_ps(nz[p], kAbsMask);
+	}
+
+	constexpr u32 kStep = kGroups * 4;
+	for (; i + kStep <= kEnd; i += kStep)
+	{
+		u32 bits = 0;
+		for (u32 g = 0; g < kGroups; ++g)
+		{
+			const u32 j = i + g * 4;
+			const __m128 kX = _mm_loadu_ps(b.m_pCentreX + j);
+			const __m128 kY = _mm_loadu_ps(b.m_pCentreY + j);
+			const __m128 kZ = _mm_loadu_ps(b.m_pCentreZ + j);
+			const __m128 kExtentX = _mm_loadu_ps(b.m_pExtentX + j);
+			const __m128 kExtentY = _mm_loadu_ps(b.m_pExtentY + j);
+			const __m128 kExtentZ = _mm_loadu_ps(b.m_pExtentZ + j);
+
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+			for (u32 p = 0; p < rPlanes.m_count; ++p)
+			{
+				__m128 distance = _mm_add_ps(_mm_mul_ps(kX, nx[p]), nw[p]);
+				distance = _mm_add_ps(distance, _mm_mul_ps(kY, ny[p]));
+				distance = _mm_add_ps(distance, _mm_mul_ps(kZ, nz[p]));
+
+				__m128 reach = _mm_mul_ps(kExtentX, ax[p]);
+				reach = _mm_add_ps(reach, _mm_mul_ps(kExtentY, ay[p]));
+				reach = _mm_add_ps(reach, _mm_mul_ps(kExtentZ, az[p]));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_sub_ps(_mm_setzero_ps(), reach)));
+			}
+			bits |= u32(_mm_movemask_ps(inside)) << (g * 4);
+		}
+
+		pMask[i / 32] |= bits << (i % 32);
+	}
+
+	boxes_scalar(rPlanes, b, i, kEnd, pMask);
+}
+
+//--------------------------------------------------------------------------------
+// AVX, kGroups sets of eight bounds per iteration.
+
+template <u32 kGroups>
+TARGET_AVX void spheres_avx(const CullPlanes& rPlanes, const SphereBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	__m256 nx[kMaxCullPlanes], ny[kMaxCullPlanes], nz[kMaxCullPlanes], nw[kMaxCullPlanes];
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		nx[p] = _mm256_set1_ps(rPlanes.m_x[p]);
+		ny[p] = _mm256_set1_ps(rPlanes.m_y[p]);
+		nz[p] = _mm256_set1_ps(rPlanes.m_z[p]);
+		nw[p] = _mm256_set1_ps(rPlanes.m_w[p]);
+	}
+
+	constexpr u32 kStep = kGroups * 8;
+	for (; i + kStep <= kEnd; i += kStep)
+	{
+		u32 bits = 0;
+		for (u32 g = 0; g < kGroups; ++g)
+		{
+			const u32 j = i + g * 8;
+			const __m256 kX = _mm256_loadu_ps(b.m_pX + j);
+			const __m256 kY = _mm256_loadu_ps(b.m_pY + j);
+			const __m256 kZ = _mm256_loadu_ps(b.m_pZ + j);
+			const __m256 kNegRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(b.m_pRadius + j));
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (u32 p = 0; p < rPlanes.m_count; ++p)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_mul_ps(kX, nx[p]), nw[p]);
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(kY, ny[p]));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(kZ, nz[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, kNegRadius, _CMP_GE_OQ));
+			}
+			bits |= u32(_mm256_movemask_ps(inside)) << (g * 8);
+		}
+
+		pMask[i / 32] |= bits << (i % 32);
+	}
+
+	spheres_scalar(rPlanes, b, i, kEnd, pMask);
+}
+
+template <u32 kGroups>
+TARGET_AVX void boxes_avx(const CullPlanes& rPlanes, const BoxBoundsSoA& b, u32 i, const u32 kEnd, u32* pMask)
+{
+	const __m256 kAbsMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	__m256 nx[kMaxCullPlanes], ny[kMaxCullPlanes], nz[kMaxCullPlanes], nw[kMaxCullPlanes];
+	__m256 ax[kMaxCullPlanes], ay[kMaxCullPlanes], az[kMaxCullPlanes];
+	for (u32 p = 0; p < rPlanes.m_count; ++p)
+	{
+		nx[p] = _mm256_set1_ps(rPlanes.m_x[p]);
+		ny[p] = _mm256_set1_ps(rPlanes.m_y[p]);
+		nz[p] = _mm256_set1_ps(rPlanes.m_z[p]);
+		nw[p] = _mm256_set1_ps(rPlanes.m_w[p]);
+		ax[p] = _mm256_and_ps(nx[p], kAbsMask);
+		ay[p] = _mm256_and_ps(ny[p], kAbsMask);
+		az[p] = _mm256_and_ps(nz[p], kAbsMask);
+	}
+
+	constexpr u32 kStep = kGroups * 8;
+	for (; i + kStep <= kEnd; i += kStep)
+	{
+		u32 bits = 0;
+		for (u32 g = 0; g < kGroups; ++g)
+		{
+			const u32 j = i + g * 8;
+			const __m256 kX = _mm256_loadu_ps(b.m_pCentreX + j);
+			const __m256 kY = _mm256_loadu_ps(b.m_pCentreY + j);
+			const __m256 kZ = _mm256_loadu_ps(b.m_pCentreZ + j);
+			const __m256 kExtentX = _mm256_loadu_ps(b.m_pExtentX + j);
+			const __m256 kExtentY = _mm256_loadu_ps(b.m_pExtentY + j);
+			const __m256 kExtentZ = _mm256_loadu_ps(b.m_pExtentZ + j);
+
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (u32 p = 0; p < rPlanes.m_count; ++p)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_mul_ps(kX, nx[p]), nw[p]);
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(kY, ny[p]));
+				distance = _mm256_add_ps(distance, _mm256_mul_ps(kZ, nz[p]));
+
+				__m256 reach = _mm256_mul_ps(kExtentX, ax[p]);
+				reach = _mm256_add_ps(reach, _mm256_mul_ps(kExtentY, ay[p]));
+				reach = _mm256_add_ps(reach, _mm256_mul_ps(kExtentZ, az[p]));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_sub_ps(_mm256_setzero_ps(), reach), _CMP_GE_OQ));
+			}
+			bits |= u32(_mm256_movemask_ps(inside)) << (g * 8);
+		}
+
+		pMask[i / 32] |= bits << (i % 32);
+	}
+
+	boxes_scalar(rPlanes, b, i, kEnd, pMask);
+}
+
+template <typename Bounds>
+using CullKernel = void (*)(const CullPlanes&, const Bounds&, u32, const u32, u32*);
+
+template <typename Bounds>
+void cull(const CullPlanes& rPlanes, const Bounds& rBounds, const u32 kCount, CullKernel<Bounds> kernel, std::vector<u32>& rMaskOut, JobSystem* pJobs)
+{
+	const u32 kWords = (kCount + 31) / 32;
+	rMaskOut.assign(kWords, 0);
+
+	u32* pMask = rMaskOut.data();
+	run(pJobs, kWords, kWordsPerJob, [&](u32 begin, u32 end)
+	{
+		kernel(rPlanes, rBounds, begin * 32, std::min(end * 32, kCount), pMask);
+	});
+}
+
+// Index of the lowest set bit, a de Bruijn multiply isolates it without a loop.
+u32 lowest_bit(const u32 kBits)
+{
+	static const u8 kDeBruijn[32] = { 0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8, 31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9 };
+	return kDeBruijn[((kBits & (0u - kBits)) * 0x077CB531u) >> 27];
+}
+
+} // namespace
+
+void set_cull_planes(const v4* pPlanes, const u32 kCount, CullPlanes& rPlanesOut)
+{
+	ASSERT(kCount <= kMaxCullPlanes);
+	rPlanesOut.m_count = kCount;
+	for (u32 p = 0; p < kCount; ++p)
+	{
+		rPlanesOut.m_x[p] = pPlanes[p].x;
+		rPlanesOut.m_y[p] = pPlanes[p].y;
+		rPlanesOut.m_z[p] = pPlanes[p].z;
+		rPlanesOut.m_w[p] = pPlanes[p].w;
+	}
+}
+
+void cull_spheres(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, ECullWidth width, std::vector<u32>& rMaskOut, JobSystem* pJobs)
+{
+	static const bool kAvx = cpu_has_avx();
+	CullKernel<SphereBoundsSoA> kernels[kMaxCullWidths] =
+	{
+		spheres_scalar,
+		spheres_sse<1>,
+		kAvx ? spheres_avx<1> : spheres_sse<2>,
+		kAvx ? spheres_avx<2> : spheres_sse<4>,
+	};
+	cull(rPlanes, rBounds, kCount, kernels[width], rMaskOut, pJobs);
+}
+
+void cull_boxes(const CullPlanes& rPlanes, const BoxBoundsSoA& rBounds, const u32 kCount, ECullWidth width, std::vector<u32>& rMaskOut, JobSystem* pJobs)
+{
+	static const bool kAvx = cpu_has_avx();
+	CullKernel<BoxBoundsSoA> kernels[kMaxCullWidths] =
+	{
+		boxes_scalar,
+		boxes_sse<1>,
+		kAvx ? boxes_avx<1> : boxes_sse<2>,
+		kAvx ? boxes_avx<2> : boxes_sse<4>,
+	};
+	cull(rPlanes, rBounds, kCount, kernels[width], rMaskOut, pJobs);
+}
+
+u32 compact_visible(const std::vector<u32>& rMask, const u32 kCount, std::vector<u32>& rIndicesOut)
+{
+	rIndicesOut.clear();
+	const u32 kWords = (kCount + 31) / 32;
+	for (u32 w = 0; w < kWords; ++w)
+	{
+		for (u32 bits = rMask[w]; bits; bits &= bits - 1)
+		{
+			rIndicesOut.push_back(w * 32 + lowest_bit(bits));
+		}
+	}
+	return static_cast<u32>(rIndicesOut.size());
+}
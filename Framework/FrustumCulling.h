@@ -0,0 +1,73 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Frustum Culling
+// Batches of spheres or boxes against up to eight planes, for when there are
+// far too many bounds to go through Camera::pointInFrustum one at a time.
+//
+// Bounds come in as separate arrays per component and the planes are
+// transposed the same way, so one SSE register holds four bounds and each
+// plane component is a broadcast. Every plane is tested for every bound with
+// no early out, branches cost more than the few multiplies they would save.
+//
+// The 8 and 16 wide paths use AVX when the CPU has it and run two or four
+// SSE groups per iteration when it doesn't, float compares need nothing from
+// AVX2. The scalar path is the reference the others must match exactly.
+//================================================================================
+
+constexpr u32 kMaxCullPlanes = 8;
+
+enum ECullWidth
+{
+	kCullWidth_1,		// scalar reference.
+	kCullWidth_4,
+	kCullWidth_8,
+	kCullWidth_16,
+
+	kMaxCullWidths
+};
+
+// Planes face inwards, a bound is visible unless it lies wholly behind one of them.
+// Planes must be normalized for sphere tests, box tests don't mind.
+struct CullPlanes
+{
+	f32 m_x[kMaxCullPlanes];
+	f32 m_y[kMaxCullPlanes];
+	f32 m_z[kMaxCullPlanes];
+	f32 m_w[kMaxCullPlanes];
+	u32 m_count;
+};
+
+void set_cull_planes(const v4* pPlanes, const u32 kCount, CullPlanes& rPlanesOut);
+
+struct SphereBoundsSoA
+{
+	const f32* m_pX;
+	const f32* m_pY;
+	const f32* m_pZ;
+	const f32* m_pRadius;
+};
+
+struct BoxBoundsSoA
+{
+	const f32* m_pCentreX;
+	const f32* m_pCentreY;
+	const f32* m_pCentreZ;
+	const f32* m_pExtentX;		// half sizes.
+	const f32* m_pExtentY;
+	const f32* m_pExtentZ;
+};
+
+// One bit per bound, set when visible, 32 bounds to a word with bound i at bit i % 32 of word i / 32.
+// Runs across the job system when one is given.
+void cull_spheres(const CullPlanes& rPlanes, const SphereBoundsSoA& rBounds, const u32 kCount, ECullWidth width, std::vector<u32>& rMaskOut, JobSystem* pJobs);
+void cull_boxes(const CullPlanes& rPlanes, const BoxBoundsSoA& rBounds, const u32 kCount, ECullWidth width, std::vector<u32>& rMaskOut, JobSystem* pJobs);
+
+// Indices of the visible bounds in order, returns how many.
+u32 compact_visible(const std::vector<u32>& rMask, const u32 kCount, std::vector<u32>& rIndicesOut);
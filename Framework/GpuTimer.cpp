@@ -0,0 +1,121 @@
+#include "GpuTimer.h"
+
+GpuTimer::~GpuTimer()
+{
+	for (Slot& rSlot : m_slots)
+	{
+		SAFE_RELEASE(rSlot.m_pDisjoint);
+		SAFE_RELEASE(rSlot.m_pStart);
+		SAFE_RELEASE(rSlot.m_pEnd);
+	}
+}
+
+void GpuTimer::init(ID3D11Device* pDevice)
+{
+	D3D11_QUERY_DESC disjointDesc = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+	D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+
+	for (Slot& rSlot : m_slots)
+	{
+		if (FAILED(pDevice->CreateQuery(&disjointDesc, &rSlot.m_pDisjoint))
+			|| FAILED(pDevice->CreateQuery(&timestampDesc, &rSlot.m_pStart))
+			|| FAILED(pDevice->CreateQuery(&timestampDesc, &rSlot.m_pEnd)))
+		{
+			panicF("Failed to create GPU timer queries");
+		}
+	}
+}
+
+void GpuTimer::begin(ID3D11DeviceContext* pContext)
+{
+	m_bNewSample = poll(pContext);
+
+	// Every slot still waiting, skip this frame rather than overwrite one.
+	Slot& rSlot = m_slots[m_current];
+	if (rSlot.m_bPending)
+		return;
+
+	pContext->Begin(rSlot.m_pDisjoint);
+	pContext->End(rSlot.m_pStart);
+}
+
+void GpuTimer::end(ID3D11DeviceContext* pContext)
+{
+	Slot& rSlot = m_slots[m_current];
+	if (rSlot.m_bPending)
+		return;
+
+	pContext->End(rSlot.m_pEnd);
+	pContext->End(rSlot.m_pDisjoint);
+	rSlot.m_bPending = true;
+	m_current = (m_current + 1) % kMaxFramesInFlight;
+}
+
+bool GpuTimer::poll(ID3D11DeviceContext* pContext)
+{
+	// Oldest first so m_lastMs ends on the newest result.
+	bool bNewSample = false;
+	for (u32 i = 0; i < kMaxFramesInFlight; ++i)
+	{
+		Slot& rSlot = m_slots[(m_current + i) % kMaxFramesInFlight];
+		if (!rSlot.m_bPending)
+			continue;
+
+		D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+		UINT64 start, end;
+		if (pContext->GetData(rSlot.m_pDisjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+			|| pContext->GetData(rSlot.m_pStart, &start, sizeof(start), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK
+			|| pContext->GetData(rSlot.m_pEnd, &end, sizeof(end), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)
+		{
+			break;
+		}
+
+		rSlot.m_bPending = false;
+		if (!disjoint.Disjoint)
+		{
+			m_lastMs = static_cast<f32>(f64(end - start) * 1000.0 / f64(disjoint.Frequency));
+			bNewSample = true;
+		}
+	}
+	return bNewSample;
+}
+
+FrameFence::~FrameFence()
+{
+	for (Slot& rSlot : m_slots)
+		SAFE_RELEASE(rSlot.m_pQuery);
+}
+
+void FrameFence::init(ID3D11Device* pDevice)
+{
+	D3D11_QUERY_DESC queryDesc = { D3D11_QUERY_EVENT, 0 };
+	for (Slot& rSlot : m_slots)
+	{
+		if (FAILED(pDevice->CreateQuery(&queryDesc, &rSlot.m_pQuery)))
+			panicF("Failed to create frame fences");
+	}
+}
+
+void FrameFence::signal(ID3D11DeviceContext* pContext, const u64 kFrame)
+{
+	// A query still out from kMaxFramesInFlight ago is issued again, its frame then completes with this one.
+	Slot& rSlot = m_slots[kFrame % kMaxFramesInFlight];
+	pContext->End(rSlot.m_pQuery);
+	rSlot.m_frame = kFrame;
+	rSlot.m_bPending = true;
+}
+
+u64 FrameFence::completed(ID3D11DeviceContext* pContext)
+{
+	// Queries finish in order, the newest finished covers every frame before it.
+	for (Slot& rSlot : m_slots)
+	{
+		BOOL bDone = FALSE;
+		if (rSlot.m_bPending && pContext->GetData(rSlot.m_pQuery, &bDone, sizeof(bDone), D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK && bDone)
+		{
+			rSlot.m_bPending = false;
+			m_completed = std::max(m_completed, rSlot.m_frame);
+		}
+	}
+	return m_completed;
+}
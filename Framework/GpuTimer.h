@@ -0,0 +1,79 @@
+#pragma once
+
+#include "CommonHeader.h"
+
+//================================================================================
+// GPU Timer
+// Timestamp queries around a span of the frame. Results arrive a few frames
+// late, so each frame's queries get their own slot in a small ring and the
+// newest finished one is read back without stalling.
+//
+// Frame Fence
+// An event query at the end of each frame, for knowing which frames the GPU
+// is done with. The same ring of slots, polled without stalling.
+//================================================================================
+
+class GpuTimer
+{
+public:
+	~GpuTimer();
+
+	void init(ID3D11Device* pDevice);
+
+	void begin(ID3D11DeviceContext* pContext);
+	void end(ID3D11DeviceContext* pContext);
+
+	// Milliseconds of the newest span that has finished, negative until one has.
+	f32 last_ms() const { return m_lastMs; }
+
+	// True when the last begin() read back a span, so last_ms() is a new sample rather than a repeat.
+	bool has_new_sample() const { return m_bNewSample; }
+
+private:
+
+	static constexpr u32 kMaxFramesInFlight = 4;
+
+	struct Slot
+	{
+		ID3D11Query* m_pDisjoint = nullptr;
+		ID3D11Query* m_pStart = nullptr;
+		ID3D11Query* m_pEnd = nullptr;
+		bool m_bPending = false;
+	};
+
+	// Returns true when a finished span updated m_lastMs.
+	bool poll(ID3D11DeviceContext* pContext);
+
+	Slot m_slots[kMaxFramesInFlight];
+	u32 m_current = 0;
+	f32 m_lastMs = -1.f;
+	bool m_bNewSample = false;
+};
+
+class FrameFence
+{
+public:
+	~FrameFence();
+
+	void init(ID3D11Device* pDevice);
+
+	// Mark the end of kFrame in the context's command stream, frames counting up from one.
+	void signal(ID3D11DeviceContext* pContext, const u64 kFrame);
+
+	// The newest frame signalled that the GPU has passed, zero until one has.
+	u64 completed(ID3D11DeviceContext* pContext);
+
+private:
+
+	static constexpr u32 kMaxFramesInFlight = 4;
+
+	struct Slot
+	{
+		ID3D11Query* m_pQuery = nullptr;
+		u64 m_frame = 0;
+		bool m_bPending = false;
+	};
+
+	Slot m_slots[kMaxFramesInFlight];
+	u64 m_completed = 0;
+};
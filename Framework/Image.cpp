@@ -0,0 +1,222 @@
+#include "Image.h"
+#include "JobQueue.h"
+
+//================================================================================
+// stb_image allocation hooks
+// The decoders allocate their output buffer with STBI_MALLOC. While a decode
+// is running we hand out the caller's buffer for an allocation of exactly the
+// output's size, so the image lands in place. Anything else goes to the heap.
+// The output is never resized or freed before it's returned, so an intermediate
+// that happens to share its size (the PNG zlib buffer of a one row image is
+// (4w+1)*h bytes, the same as a JPEG output) gives the buffer back when it's
+// resized or freed, leaving it for the real output.
+//================================================================================
+
+namespace
+{
+
+struct DecodeTarget
+{
+	void* m_pMemory;
+	size_t m_minSize;
+	size_t m_maxSize;
+	size_t m_claimedSize;
+	bool m_bClaimed;
+};
+
+thread_local DecodeTarget t_decodeTarget = {};
+
+void* image_malloc(size_t size)
+{
+	DecodeTarget& rTarget = t_decodeTarget;
+	if (rTarget.m_pMemory && !rTarget.m_bClaimed && size >= rTarget.m_minSize && size <= rTarget.m_maxSize)
+	{
+		rTarget.m_bClaimed = true;
+		rTarget.m_claimedSize = size;
+		return rTarget.m_pMemory;
+	}
+	return malloc(size);
+}
+
+void* image_realloc(void* p, size_t size)
+{
+	// Only intermediates grow, move this one to the heap and release the target.
+	DecodeTarget& rTarget = t_decodeTarget;
+	if (p && p == rTarget.m_pMemory)
+	{
+		void* pMoved = malloc(size);
+		if (pMoved)
+		{
+			memcpy(pMoved, p, std::min(size, rTarget.m_claimedSize));
+			rTarget.m_bClaimed = false;
+		}
+		return pMoved;
+	}
+	return realloc(p, size);
+}
+
+void image_free(void* p)
+{
+	// Freed before the decode finished, so it wasn't the output.
+	DecodeTarget& rTarget = t_decodeTarget;
+	if (p && p == rTarget.m_pMemory)
+	{
+		rTarget.m_bClaimed = false;
+		return;
+	}
+	free(p);
+}
+
+} // namespace
+
+#define STBI_MALLOC(sz) image_malloc(sz)
+#define STBI_REALLOC(p, sz) image_realloc(p, sz)
+#define STBI_FREE(p) image_free(p)
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+//================================================================================
+// Decoding
+//================================================================================
+
+// stb_image 2.16 can't report bit depth, so read it from the PNG header ourselves.
+static bool is_16bit_png(const memtype_t* pData, const u32 kSize)
+{
+	static const u8 kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+	// Signature, IHDR length and tag, width, height then the bit depth.
+	constexpr u32 kBitDepthOffset = 24;
+	return kSize > kBitDepthOffset && memcmp(pData, kSignature, sizeof(kSignature)) == 0 && pData[kBitDepthOffset] == 16;
+}
+
+bool query_image_info(const memtype_t* pData, const u32 kSize, ImageInfo& rInfoOut)
+{
+	int width, height, channels;
+	if (!stbi_info_from_memory(pData, kSize, &width, &height, &channels))
+		return false;
+
+	rInfoOut.m_width = width;
+	rInfoOut.m_height = height;
+	if (stbi_is_hdr_from_memory(pData, kSize))
+		rInfoOut.m_format = kImageFormat_RGBA32F;
+	else if (is_16bit_png(pData, kSize))
+		rInfoOut.m_format = kImageFormat_RGBA16;
+	else
+		rInfoOut.m_format = kImageFormat_RGBA8;
+	return true;
+}
+
+bool decode_image(const memtype_t* pData, const u32 kSize, const ImageInfo& rInfo, void* pDest, const u32 kDestPitch)
+{
+	const bool kInPlace = kDestPitch == rInfo.pitch();
+
+	// Offer the destination to the allocator for the output's size, the JPEG decoder asks for one spare byte.
+	DecodeTarget& rTarget = t_decodeTarget;
+	if (kInPlace)
+	{
+		rTarget.m_pMemory = pDest;
+		rTarget.m_minSize = rInfo.size_bytes();
+		rTarget.m_maxSize = rInfo.size_bytes() + 1;
+		rTarget.m_claimedSize = 0;
+		rTarget.m_bClaimed = false;
+	}
+
+	int width, height, channels;
+	void* pDecoded = nullptr;
+	switch (rInfo.m_format)
+	{
+	case kImageFormat_RGBA8:
+		pDecoded = stbi_load_from_memory(pData, kSize, &width, &height, &channels, 4);
+		break;
+	case kImageFormat_RGBA16:
+		pDecoded = stbi_load_16_from_memory(pData, kSize, &width, &height, &channels, 4);
+		break;
+	case kImageFormat_RGBA32F:
+		pDecoded = stbi_loadf_from_memory(pData, kSize, &width, &height, &channels, 4);
+		break;
+	}
+
+	rTarget = {};
+
+	if (!pDecoded)
+	{
+		errorF("Could not decode image : %s", stbi_failure_reason());
+		return false;
+	}
+	ASSERT(u32(width) == rInfo.m_width && u32(height) == rInfo.m_height);
+
+	// The decoder picked another buffer for its output (or the pitch differs), copy it across.
+	if (pDecoded != pDest)
+	{
+		const u32 kPitch = rInfo.pitch();
+		for (u32 y = 0; y < rInfo.m_height; ++y)
+		{
+			memcpy((u8*)pDest + y * kDestPitch, (const u8*)pDecoded + y * kPitch, kPitch);
+		}
+		stbi_image_free(pDecoded);
+	}
+	return true;
+}
+
+void decode_images(ImageDecodeRequest* pRequests, const u32 kCount, JobSystem* pJobs)
+{
+	auto decodeRange = [pRequests](u32 kBegin, u32 kEnd)
+	{
+		for (u32 i = kBegin; i < kEnd; ++i)
+		{
+			ImageDecodeRequest& rRequest = pRequests[i];
+			rRequest.m_bSucceeded = false;
+
+			u32 size = 0;
+			memtype_t* pData = load_file(rRequest.m_pFilename, size, 16, 0);
+			if (!pData)
+				continue;
+
+			if (query_image_info(pData, size, rRequest.m_info))
+			{
+				rRequest.m_staging.resize(rRequest.m_info.staging_bytes());
+				rRequest.m_bSucceeded = decode_image(pData, size, rRequest.m_info, rRequest.m_staging.data(), rRequest.m_info.pitch());
+			}
+
+			release_loaded_file(pData);
+		}
+	};
+
+	if (pJobs)
+	{
+		pJobs->parallelFor(kCount, 1, decodeRange);
+	}
+	else
+	{
+		decodeRange(0, kCount);
+	}
+}
+
+bool load_image_rgba8(const char* pFilename, Image& rImageOut)
+{
+	u32 size = 0;
+	memtype_t* pData = load_file(pFilename, size, 16, 0);
+	if (!pData)
+		return false;
+
+	ImageInfo info;
+	bool bSucceeded = query_image_info(pData, size, info);
+	if (bSucceeded)
+	{
+		// Always 8 bits here, whatever the source precision.
+		info.m_format = kImageFormat_RGBA8;
+		rImageOut.m_width = info.m_width;
+		rImageOut.m_height = info.m_height;
+		rImageOut.m_pixels.resize(info.staging_bytes());
+		bSucceeded = decode_image(pData, size, info, rImageOut.m_pixels.data(), info.pitch());
+		rImageOut.m_pixels.resize(info.size_bytes());
+	}
+	else
+	{
+		errorF("Could not decode image %s : %s", pFilename, stbi_failure_reason());
+	}
+
+	release_loaded_file(pData);
+	return bSucceeded;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Image
+// A CPU side RGBA8 image, the working format for offline texture processing.
+//================================================================================
+struct Image
+{
+	u32 m_width = 0;
+	u32 m_height = 0;
+	std::vector<u8> m_pixels; // RGBA8, tightly packed rows.
+
+	void resize(const u32 kWidth, const u32 kHeight)
+	{
+		m_width = kWidth;
+		m_height = kHeight;
+		m_pixels.resize(kWidth * kHeight * 4);
+	}
+
+	u8* row(const u32 y) { return m_pixels.data() + y * m_width * 4; }
+	const u8* row(const u32 y) const { return m_pixels.data() + y * m_width * 4; }
+
+	u32 pitch() const { return m_width * 4; }
+};
+
+// Decode a PNG, JPEG, TGA or BMP to RGBA8 using stb_image.
+bool load_image_rgba8(const char* pFilename, Image& rImageOut);
+
+//================================================================================
+// Image Decoding
+// Portable stb_image based decoding straight into caller owned memory, such as
+// a mapped staging buffer, so the pixels are written once and never copied.
+// Every image is expanded to four channels at its native precision.
+//================================================================================
+
+enum EImageFormat
+{
+	kImageFormat_RGBA8,		// 8 bit sources, PNG, JPEG, TGA, BMP...
+	kImageFormat_RGBA16,	// 16 bit PNG.
+	kImageFormat_RGBA32F,	// Radiance HDR.
+};
+
+struct ImageInfo
+{
+	u32 m_width;
+	u32 m_height;
+	EImageFormat m_format;
+
+	u32 bytes_per_pixel() const { return m_format == kImageFormat_RGBA8 ? 4 : (m_format == kImageFormat_RGBA16 ? 8 : 16); }
+	u32 pitch() const { return m_width * bytes_per_pixel(); }
+	u32 size_bytes() const { return pitch() * m_height; }
+
+	// What a destination buffer needs to hold, the decoders may over allocate slightly.
+	u32 staging_bytes() const { return size_bytes() + 16; }
+};
+
+// Read the dimensions and precision from the header without decoding.
+bool query_image_info(const memtype_t* pData, const u32 kSize, ImageInfo& rInfoOut);
+
+// Decode into pDest which must hold rInfo.staging_bytes(). When kDestPitch is the tight pitch
+// the decoder writes there directly, other pitches take one extra copy.
+bool decode_image(const memtype_t* pData, const u32 kSize, const ImageInfo& rInfo, void* pDest, const u32 kDestPitch);
+
+// A file decoded into memory owned by the request.
+struct ImageDecodeRequest
+{
+	const char* m_pFilename = nullptr;
+	ImageInfo m_info = {};
+	std::vector<u8> m_staging;
+	bool m_bSucceeded = false;
+};
+
+// Load and decode a batch of files, one job per file when a job system is given.
+void decode_images(ImageDecodeRequest* pRequests, const u32 kCount, JobSystem* pJobs);
@@ -5,6 +5,10 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
 
 // ========================================================
 // class JobQueue
@@ -85,3 +89,159 @@ private:
 	std::condition_variable condition;
 };
 
+
+// ========================================================
+// class JobSystem
+// A pool of workers sharing one queue, for data parallel work.
+// ========================================================
+
+class JobSystem final
+{
+public:
+	typedef std::function<void()> Job;
+	typedef std::function<void(uint32_t begin, uint32_t end)> RangeJob;
+
+	// Launch the workers, zero picks one per hardware thread.
+	explicit JobSystem(uint32_t kThreads = 0)
+	{
+		uint32_t count = kThreads ? kThreads : std::max(1u, std::thread::hardware_concurrency());
+		workers.reserve(count);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			workers.emplace_back(&JobSystem::workerLoop, this);
+		}
+	}
+
+	// Finish outstanding work then join the workers.
+	~JobSystem()
+	{
+		waitAll();
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			terminating = true;
+		}
+		condition.notify_all();
+		for (auto& rWorker : workers)
+		{
+			rWorker.join();
+		}
+	}
+
+	uint32_t workerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+	// Add a new job to the shared queue.
+	void pushJob(Job job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push(std::move(job));
+			++pending;
+		}
+		condition.notify_one();
+	}
+
+	// Wait until all work items have been completed.
+	void waitAll()
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this]() { return pending == 0; });
+	}
+
+	// Split [0, kCount) into chunks of at least kGrain and run them across the workers.
+	// The calling thread takes part and the call returns once every chunk is done.
+	// kMaxThreads caps the threads working on it, the caller included, zero allows every worker.
+	void parallelFor(uint32_t kCount, uint32_t kGrain, const RangeJob& job, uint32_t kMaxThreads = 0)
+	{
+		if (kCount == 0)
+			return;
+
+		const uint32_t kChunks = std::min(workerCount() * 4, (kCount + kGrain - 1) / std::max(1u, kGrain));
+		if (kChunks <= 1)
+		{
+			job(0, kCount);
+			return;
+		}
+
+		// Shared state outlives this call, helpers that start late find no chunks left and
+		// exit without touching our stack. That also makes nested calls from workers safe.
+		struct RangeState
+		{
+			const RangeJob* pJob;
+			uint32_t count;
+			uint32_t chunkSize;
+			uint32_t chunks;
+			std::atomic<uint32_t> nextChunk;
+			std::atomic<uint32_t> doneChunks;
+		};
+		auto pState = std::make_shared<RangeState>();
+		pState->pJob = &job;
+		pState->count = kCount;
+		pState->chunkSize = (kCount + kChunks - 1) / kChunks;
+		pState->chunks = kChunks;
+		pState->nextChunk = 0;
+		pState->doneChunks = 0;
+
+		auto runChunks = [](RangeState& rState)
+		{
+			for (uint32_t chunk = rState.nextChunk++; chunk < rState.chunks; chunk = rState.nextChunk++)
+			{
+				const uint32_t kBegin = chunk * rState.chunkSize;
+				const uint32_t kEnd = std::min(rState.count, kBegin + rState.chunkSize);
+				if (kBegin < kEnd)
+					(*rState.pJob)(kBegin, kEnd);
+				++rState.doneChunks;
+			}
+		};
+
+		const uint32_t kHelpers = std::min(std::min(workerCount(), kChunks - 1), kMaxThreads ? kMaxThreads - 1 : ~0u);
+		for (uint32_t i = 0; i < kHelpers; ++i)
+		{
+			pushJob([pState, runChunks]() { runChunks(*pState); });
+		}
+
+		runChunks(*pState);
+
+		while (pState->doneChunks < kChunks)
+		{
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	void workerLoop()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				condition.wait(lock, [this] { return !queue.empty() || terminating; });
+				if (terminating && queue.empty())
+				{
+					break;
+				}
+				job = std::move(queue.front());
+				queue.pop();
+			}
+
+			job();
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				if (--pending == 0)
+				{
+					finished.notify_all();
+				}
+			}
+		}
+	}
+
+	bool terminating = false;
+	uint32_t pending = 0;
+
+	std::vector<std::thread> workers;
+	std::queue<Job> queue;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::condition_variable finished;
+};
@@ -0,0 +1,193 @@
+#include "LightBudget.h"
+
+#include <unordered_map>
+
+namespace
+{
+
+f32 luminance(const v4& vColour)
+{
+	return vColour.x * 0.2126f + vColour.y * 0.7152f + vColour.z * 0.0722f;
+}
+
+// Grid cell of a position packed into one key, 21 bits per axis.
+u64 merge_cell_key(const v4& vPosition, const f32 kInverseCellSize)
+{
+	const u64 kMask = (1ull << 21) - 1;
+	const u64 x = static_cast<u64>(static_cast<s64>(floorf(vPosition.x * kInverseCellSize)) & kMask);
+	const u64 y = static_cast<u64>(static_cast<s64>(floorf(vPosition.y * kInverseCellSize)) & kMask);
+	const u64 z = static_cast<u64>(static_cast<s64>(floorf(vPosition.z * kInverseCellSize)) & kMask);
+	return x | (y << 21) | (z << 42);
+}
+
+// Running sums for one virtual light.
+struct MergeAccumulator
+{
+	v3 m_vWeightedPosition;
+	v3 m_vColour;
+	v3 m_vWeightedAtt;
+	f32 m_weight;
+	f32 m_radius;
+};
+
+} // namespace
+
+void LightBudget::set_desc(const LightBudgetDesc& rDesc)
+{
+	m_desc = rDesc;
+	m_budget = std::min(std::max(m_budget, m_desc.m_minLights), m_desc.m_maxLights);
+}
+
+f32 LightBudget::score(const GPULight& rLight, const v3& vEye, const f32 kPixelsPerUnit, const f32 kScreenArea)
+{
+	if (rLight.m_vPosition.w == 0.f)
+		return FLT_MAX;
+
+	const f32 kRadius = rLight.m_vAtt.w;
+	const f32 kDistance = (v3(rLight.m_vPosition) - vEye).Length();
+
+	// Fraction of the screen the bounding sphere covers, all of it once the eye is inside.
+	f32 coverage = 1.f;
+	if (kDistance > kRadius)
+	{
+		const f32 kProjectedRadius = kRadius * kPixelsPerUnit / kDistance;
+		coverage = std::min(kfPI * kProjectedRadius * kProjectedRadius / kScreenArea, 1.f);
+	}
+
+	// Light reaching the nearest point of the sphere to the viewer.
+	const f32 x = std::max(kDistance - kRadius, 0.f);
+	const f32 kFalloff = 1.f / std::max(rLight.m_vAtt.x + rLight.m_vAtt.y * x + rLight.m_vAtt.z * x * x, 1e-6f);
+
+	return coverage * luminance(rLight.m_vColour) * kFalloff;
+}
+
+void LightBudget::apply(const v3& vEye, const f32 kPixelsPerUnit, const f32 kScreenArea, std::vector<GPULight>& rLights, u32 typeStart[kMaxLightTypes + 1])
+{
+	const u32 kFirstRanked = typeStart[kLightType_Directional + 1];
+	const u32 kRanked = typeStart[kMaxLightTypes] - kFirstRanked;
+
+	// A shadowed light is always kept, its shadow map has already been paid for. They take their
+	// places first, and the budget never drops below them.
+	u32 shadowed = 0;
+	for (u32 i = 0; i < kRanked; ++i)
+	{
+		shadowed += rLights[kFirstRanked + i].m_shadow != kNoShadow ? 1 : 0;
+	}
+	const u32 kKeep = std::min(std::max(m_budget, shadowed), kRanked);
+
+	m_stats = {};
+	m_stats.m_ranked = kRanked;
+	m_stats.m_full = kKeep;
+	if (kKeep == kRanked)
+		return;
+
+	m_scores.resize(kRanked);
+	m_order.resize(kRanked);
+	u32 reserved = 0, unreserved = shadowed;
+	for (u32 i = 0; i < kRanked; ++i)
+	{
+		const GPULight& rLight = rLights[kFirstRanked + i];
+		if (rLight.m_shadow != kNoShadow)
+		{
+			m_order[reserved++] = i;
+		}
+		else
+		{
+			m_scores[i] = score(rLight, vEye, kPixelsPerUnit, kScreenArea);
+			m_order[unreserved++] = i;
+		}
+	}
+
+	// The unshadowed lights compete for what is left. Only the split matters, not the order on either side of it.
+	std::nth_element(m_order.begin() + shadowed, m_order.begin() + kKeep, m_order.end(), [&](u32 a, u32 b) { return m_scores[a] > m_scores[b]; });
+
+	// Reuse the scores as keep flags, leaving the survivors in their original order keeps them stable frame to frame.
+	for (u32 i = 0; i < kRanked; ++i)
+	{
+		m_scores[m_order[i]] = i < kKeep ? 1.f : 0.f;
+	}
+
+	// Merge the rest by grid cell. Energy is conserved, a spot gives up all but its cone's share of the sphere.
+	const f32 kInverseCellSize = 1.f / m_desc.m_mergeCellSize;
+	std::unordered_map<u64, u32> cells;
+	std::vector<MergeAccumulator> accumulators;
+	for (u32 i = 0; i < kRanked; ++i)
+	{
+		if (m_scores[i] != 0.f)
+			continue;
+
+		const GPULight& rLight = rLights[kFirstRanked + i];
+		const f32 kShare = rLight.m_vPosition.w == kGPULightSpot ? (1.f - rLight.m_vDirection.w) * 0.5f : 1.f;
+		const v3 vColour = v3(rLight.m_vColour) * kShare;
+		const f32 kWeight = std::max(luminance(rLight.m_vColour) * kShare, 1e-6f);
+
+		auto it = cells.emplace(merge_cell_key(rLight.m_vPosition, kInverseCellSize), static_cast<u32>(accumulators.size())).first;
+		if (it->second == accumulators.size())
+			accumulators.push_back(MergeAccumulator{});
+
+		MergeAccumulator& rAccumulator = accumulators[it->second];
+		rAccumulator.m_vWeightedPosition += v3(rLight.m_vPosition) * kWeight;
+		rAccumulator.m_vWeightedAtt += v3(rLight.m_vAtt) * kWeight;
+		rAccumulator.m_vColour += vColour;
+		rAccumulator.m_weight += kWeight;
+
+		// Growing the radius to cover every member's sphere spreads the summed colour far past where
+		// the members reached and overshoots badly with steep falloffs, keeping the largest is closer.
+		rAccumulator.m_radius = std::max(rAccumulator.m_radius, rLight.m_vAtt.w);
+		++m_stats.m_merged;
+	}
+	m_stats.m_virtual = static_cast<u32>(accumulators.size());
+
+	// Directional, kept points, virtual points then kept spots.
+	m_output.clear();
+	m_output.insert(m_output.end(), rLights.begin(), rLights.begin() + kFirstRanked);
+
+	u32 outputStart[kMaxLightTypes + 1] = {};
+	outputStart[kLightType_Point] = kFirstRanked;
+	for (u32 i = typeStart[kLightType_Point] - kFirstRanked; i < typeStart[kLightType_Point + 1] - kFirstRanked; ++i)
+	{
+		if (m_scores[i] != 0.f)
+			m_output.push_back(rLights[kFirstRanked + i]);
+	}
+	for (const MergeAccumulator& rAccumulator : accumulators)
+	{
+		const f32 kInverseWeight = 1.f / rAccumulator.m_weight;
+
+		GPULight light;
+		light.m_vPosition = v4(rAccumulator.m_vWeightedPosition * kInverseWeight, kGPULightPoint);
+		light.m_vDirection = v4(0.f, 0.f, 0.f, 0.f);
+		light.m_vColour = v4(rAccumulator.m_vColour, 0.f);
+		light.m_vAtt = v4(rAccumulator.m_vWeightedAtt * kInverseWeight, rAccumulator.m_radius);
+		light.m_shadow = kNoShadow;
+		light.m_padding[0] = light.m_padding[1] = light.m_padding[2] = 0;
+		m_output.push_back(light);
+	}
+
+	outputStart[kLightType_Spot] = static_cast<u32>(m_output.size());
+	for (u32 i = typeStart[kLightType_Spot] - kFirstRanked; i < typeStart[kLightType_Spot + 1] - kFirstRanked; ++i)
+	{
+		if (m_scores[i] != 0.f)
+			m_output.push_back(rLights[kFirstRanked + i]);
+	}
+	outputStart[kMaxLightTypes] = static_cast<u32>(m_output.size());
+
+	rLights.swap(m_output);
+	for (u32 t = 0; t <= kMaxLightTypes; ++t)
+	{
+		typeStart[t] = outputStart[t];
+	}
+}
+
+void LightBudget::update(const f32 kFrameMs)
+{
+	// Back off hard when over so a spike costs few frames, creep up when there is clear headroom.
+	if (kFrameMs > m_desc.m_targetMs)
+	{
+		m_budget = static_cast<u32>(m_budget * 0.85f);
+	}
+	else if (kFrameMs < m_desc.m_targetMs * 0.85f)
+	{
+		m_budget += std::max(m_budget / 32, 1u);
+	}
+	m_budget = std::min(std::max(m_budget, m_desc.m_minLights), m_desc.m_maxLights);
+}
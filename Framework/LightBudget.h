@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "LightSystem.h"
+
+#include <vector>
+
+//================================================================================
+// Light Budget
+// Ranks the visible lights by how much they are likely to add to the image,
+// keeps the best K at full quality and merges the rest into a few virtual
+// point lights on a coarse world grid. K follows a frame time target, shrinking
+// quickly when over and growing slowly when comfortably under.
+//
+// score = screen coverage * intensity * attenuation at the viewer's distance
+//================================================================================
+
+struct LightBudgetDesc
+{
+	f32 m_targetMs = 8.f;		// GPU time to aim for.
+	u32 m_minLights = 16;
+	u32 m_maxLights = 4096;
+	f32 m_mergeCellSize = 2.f;	// world size of the grid cells lights are merged in.
+};
+
+class LightBudget
+{
+public:
+
+	struct Stats
+	{
+		u32 m_ranked;		// point and spot lights that were scored.
+		u32 m_full;			// kept at full quality.
+		u32 m_merged;		// folded into virtual lights.
+		u32 m_virtual;		// virtual lights produced.
+	};
+
+	void set_desc(const LightBudgetDesc& rDesc);
+
+	// Importance of one light seen from vEye. kPixelsPerUnit is the projected size of one unit at
+	// distance one, projection _22 times half the screen height. Directional lights score infinity.
+	static f32 score(const GPULight& rLight, const v3& vEye, const f32 kPixelsPerUnit, const f32 kScreenArea);
+
+	// rLights is grouped by type with typeStart giving where each type begins, as LightSystem::cull_and_pack leaves it.
+	// Rewrites both with the top budget() lights followed by the virtual ones, still grouped by type.
+	// Lights with a shadow map are always among the top, their map has already been drawn.
+	void apply(const v3& vEye, const f32 kPixelsPerUnit, const f32 kScreenArea, std::vector<GPULight>& rLights, u32 typeStart[kMaxLightTypes + 1]);
+
+	// Feed back the measured frame time to move the budget towards the target.
+	void update(const f32 kFrameMs);
+
+	u32 budget() const { return m_budget; }
+	const Stats& stats() const { return m_stats; }
+	const LightBudgetDesc& desc() const { return m_desc; }
+
+private:
+
+	LightBudgetDesc m_desc;
+	u32 m_budget = 256;
+	Stats m_stats = {};
+
+	// Scratch, reused every frame.
+	std::vector<f32> m_scores;
+	std::vector<u32> m_order;
+	std::vector<GPULight> m_output;
+};
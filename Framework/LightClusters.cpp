@@ -0,0 +1,376 @@
+#include "LightClusters.h"
+#include "JobQueue.h"
+
+#include <emmintrin.h>
+
+namespace
+{
+
+// Point on the far plane under an NDC position, in view space.
+v3 unproject_far(const m4x4& rInverseProjection, const f32 kX, const f32 kY)
+{
+	const v4 p = v4::Transform(v4(kX, kY, 1.f, 1.f), rInverseProjection);
+	return v3(p.x / p.w, p.y / p.w, p.z / p.w);
+}
+
+v3 plane_through_eye(const v3& a, const v3& b, const v3& rPositiveSide)
+{
+	v3 n = a.Cross(b);
+	n.Normalize();
+	return n.Dot(rPositiveSide) < 0.f ? -n : n;
+}
+
+// Distance from a point to a box, the scalar twin of the SSE test in bin_row.
+f32 box_distance_squared(const f32 kMin[3], const f32 kMax[3], const v3& rPoint)
+{
+	const f32 p[3] = { rPoint.x, rPoint.y, rPoint.z };
+	f32 d[3];
+	for (u32 i = 0; i < 3; ++i)
+	{
+		d[i] = std::max(kMin[i] - p[i], 0.f) + std::max(p[i] - kMax[i], 0.f);
+	}
+	return (d[0] * d[0] + d[1] * d[1]) + d[2] * d[2];
+}
+
+} // namespace
+
+void LightClusterGrid::set_projection(const m4x4& rProjection, const ClusterGridDesc& rDesc)
+{
+	ASSERT(rDesc.m_tilesX <= 32 && rDesc.m_tilesY <= 32 && rDesc.m_slices <= 32);
+	m_desc = rDesc;
+
+	const u32 kTilesX = rDesc.m_tilesX;
+	const u32 kTilesY = rDesc.m_tilesY;
+	const u32 kSlices = rDesc.m_slices;
+	const m4x4 kInverseProjection = rProjection.Invert();
+
+	m_forwardSign = unproject_far(kInverseProjection, 0.f, 0.f).z < 0.f ? -1.f : 1.f;
+
+	// Tile boundaries, NDC y runs up while tile rows run down the screen.
+	m_columnPlanes.resize(kTilesX + 1);
+	for (u32 i = 0; i <= kTilesX; ++i)
+	{
+		const f32 kX = f32(i) / kTilesX * 2.f - 1.f;
+		m_columnPlanes[i] = plane_through_eye(unproject_far(kInverseProjection, kX, 1.f), unproject_far(kInverseProjection, kX, -1.f)
+			, unproject_far(kInverseProjection, kX + 1.f / kTilesX, 0.f));
+	}
+
+	m_rowPlanes.resize(kTilesY + 1);
+	for (u32 i = 0; i <= kTilesY; ++i)
+	{
+		const f32 kY = 1.f - f32(i) / kTilesY * 2.f;
+		m_rowPlanes[i] = plane_through_eye(unproject_far(kInverseProjection, -1.f, kY), unproject_far(kInverseProjection, 1.f, kY)
+			, unproject_far(kInverseProjection, 0.f, kY - 1.f / kTilesY));
+	}
+
+	m_sliceDepths.resize(kSlices + 1);
+	for (u32 i = 0; i <= kSlices; ++i)
+	{
+		m_sliceDepths[i] = rDesc.m_near * powf(rDesc.m_far / rDesc.m_near, f32(i) / kSlices);
+	}
+	m_sliceScale = kSlices / logf(rDesc.m_far / rDesc.m_near);
+
+	// Rays through every tile corner, scaled to each slice depth to bound the froxels.
+	std::vector<v3> cornerRays((kTilesX + 1) * (kTilesY + 1));
+	for (u32 y = 0; y <= kTilesY; ++y)
+	{
+		for (u32 x = 0; x <= kTilesX; ++x)
+		{
+			const v3 kRay = unproject_far(kInverseProjection, f32(x) / kTilesX * 2.f - 1.f, 1.f - f32(y) / kTilesY * 2.f);
+			cornerRays[y * (kTilesX + 1) + x] = kRay * (1.f / (kRay.z * m_forwardSign));
+		}
+	}
+
+	// Padded so a row's last group of four can always be loaded.
+	const u32 kPaddedCount = cluster_count() + 4;
+	for (u32 axis = 0; axis < 3; ++axis)
+	{
+		m_boundsMin[axis].assign(kPaddedCount, 0.f);
+		m_boundsMax[axis].assign(kPaddedCount, 0.f);
+	}
+
+	for (u32 z = 0; z < kSlices; ++z)
+	{
+		for (u32 y = 0; y < kTilesY; ++y)
+		{
+			for (u32 x = 0; x < kTilesX; ++x)
+			{
+				f32 minimum[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+				f32 maximum[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+				for (u32 corner = 0; corner < 8; ++corner)
+				{
+					const v3& rRay = cornerRays[(y + ((corner >> 1) & 1)) * (kTilesX + 1) + x + (corner & 1)];
+					const v3 kPoint = rRay * m_sliceDepths[z + (corner >> 2)];
+					const f32 p[3] = { kPoint.x, kPoint.y, kPoint.z };
+					for (u32 axis = 0; axis < 3; ++axis)
+					{
+						minimum[axis] = std::min(minimum[axis], p[axis]);
+						maximum[axis] = std::max(maximum[axis], p[axis]);
+					}
+				}
+
+				const u32 kCluster = cluster_index(x, y, z);
+				for (u32 axis = 0; axis < 3; ++axis)
+				{
+					m_boundsMin[axis][kCluster] = minimum[axis];
+					m_boundsMax[axis][kCluster] = maximum[axis];
+				}
+			}
+		}
+	}
+
+	m_clusterLights.resize(cluster_count());
+	m_sliceLights.resize(kSlices);
+}
+
+u32 LightClusterGrid::depth_slice(const f32 kViewDepth) const
+{
+	if (kViewDepth <= m_desc.m_near)
+		return 0;
+	return std::min(static_cast<u32>(logf(kViewDepth / m_desc.m_near) * m_sliceScale), m_desc.m_slices - 1);
+}
+
+LightClusterGrid::ViewLight LightClusterGrid::transform_light(const LightBounds& rLight, const m4x4& rView) const
+{
+	ViewLight light = {};
+	light.m_vCentre = v3::Transform(rLight.m_vCentre, rView);
+	light.m_radius = rLight.m_radius;
+
+	// Lights without bounds reach every cluster.
+	if (rLight.m_radius >= kInfiniteLightRadius)
+	{
+		light.m_columnMask = 0xffffffffu >> (32 - m_desc.m_tilesX);
+		light.m_rowMask = 0xffffffffu >> (32 - m_desc.m_tilesY);
+		light.m_sliceMask = 0xffffffffu >> (32 - m_desc.m_slices);
+		light.m_x1 = static_cast<u16>(m_desc.m_tilesX - 1);
+		return light;
+	}
+
+	const v3& c = light.m_vCentre;
+	const f32 r = light.m_radius;
+	const f32 kDepth = c.z * m_forwardSign;
+
+	// The same tests as light_in_cluster, one axis at a time.
+	for (u32 z = 0; z < m_desc.m_slices; ++z)
+	{
+		if (kDepth + r >= m_sliceDepths[z] && kDepth - r <= m_sliceDepths[z + 1])
+			light.m_sliceMask |= 1u << z;
+	}
+	if (!light.m_sliceMask)
+		return light;
+
+	for (u32 x = 0; x < m_desc.m_tilesX; ++x)
+	{
+		if (m_columnPlanes[x].Dot(c) >= -r && m_columnPlanes[x + 1].Dot(c) <= r)
+			light.m_columnMask |= 1u << x;
+	}
+
+	for (u32 y = 0; y < m_desc.m_tilesY; ++y)
+	{
+		if (m_rowPlanes[y].Dot(c) >= -r && m_rowPlanes[y + 1].Dot(c) <= r)
+			light.m_rowMask |= 1u << y;
+	}
+
+	if (light.m_columnMask && light.m_rowMask)
+	{
+		u32 x0 = 0, x1 = 31;
+		while (!(light.m_columnMask & (1u << x0)))
+			++x0;
+		while (!(light.m_columnMask & (1u << x1)))
+			--x1;
+		light.m_x0 = static_cast<u16>(x0);
+		light.m_x1 = static_cast<u16>(x1);
+	}
+	else
+	{
+		light.m_sliceMask = 0;
+	}
+	return light;
+}
+
+bool LightClusterGrid::light_in_cluster(const ViewLight& rLight, const u32 kX, const u32 kY, const u32 kZ) const
+{
+	if (rLight.m_radius >= kInfiniteLightRadius)
+		return true;
+
+	const v3& c = rLight.m_vCentre;
+	const f32 r = rLight.m_radius;
+	const f32 kDepth = c.z * m_forwardSign;
+
+	if (kDepth + r < m_sliceDepths[kZ] || kDepth - r > m_sliceDepths[kZ + 1])
+		return false;
+	if (m_columnPlanes[kX].Dot(c) < -r || m_columnPlanes[kX + 1].Dot(c) > r)
+		return false;
+	if (m_rowPlanes[kY].Dot(c) < -r || m_rowPlanes[kY + 1].Dot(c) > r)
+		return false;
+
+	const u32 kCluster = cluster_index(kX, kY, kZ);
+	const f32 kMin[3] = { m_boundsMin[0][kCluster], m_boundsMin[1][kCluster], m_boundsMin[2][kCluster] };
+	const f32 kMax[3] = { m_boundsMax[0][kCluster], m_boundsMax[1][kCluster], m_boundsMax[2][kCluster] };
+	return box_distance_squared(kMin, kMax, c) <= r * r;
+}
+
+void LightClusterGrid::bin_row(const u32 kY, const u32 kZ, const std::vector<u32>& sliceLights)
+{
+	const u32 kRowStart = cluster_index(0, kY, kZ);
+	for (u32 x = 0; x < m_desc.m_tilesX; ++x)
+	{
+		m_clusterLights[kRowStart + x].clear();
+	}
+
+	const __m128 kZero = _mm_setzero_ps();
+
+	for (const u32 kLight : sliceLights)
+	{
+		const ViewLight& rLight = m_viewLights[kLight];
+		if (!(rLight.m_rowMask & (1u << kY)))
+			continue;
+
+		if (rLight.m_radius >= kInfiniteLightRadius)
+		{
+			for (u32 x = rLight.m_x0; x <= rLight.m_x1; ++x)
+			{
+				m_clusterLights[kRowStart + x].push_back(kLight);
+			}
+			continue;
+		}
+
+		const __m128 kCentreX = _mm_set1_ps(rLight.m_vCentre.x);
+		const __m128 kCentreY = _mm_set1_ps(rLight.m_vCentre.y);
+		const __m128 kCentreZ = _mm_set1_ps(rLight.m_vCentre.z);
+		const __m128 kRadiusSquared = _mm_set1_ps(rLight.m_radius * rLight.m_radius);
+
+		// Sphere against four neighbouring froxel boxes at a time.
+		for (u32 x = rLight.m_x0; x <= rLight.m_x1; x += 4)
+		{
+			const u32 kCluster = kRowStart + x;
+
+			__m128 dx = _mm_add_ps(
+				_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_boundsMin[0][kCluster]), kCentreX), kZero),
+				_mm_max_ps(_mm_sub_ps(kCentreX, _mm_loadu_ps(&m_boundsMax[0][kCluster])), kZero));
+			__m128 dy = _mm_add_ps(
+				_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_boundsMin[1][kCluster]), kCentreY), kZero),
+				_mm_max_ps(_mm_sub_ps(kCentreY, _mm_loadu_ps(&m_boundsMax[1][kCluster])), kZero));
+			__m128 dz = _mm_add_ps(
+				_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&m_boundsMin[2][kCluster]), kCentreZ), kZero),
+				_mm_max_ps(_mm_sub_ps(kCentreZ, _mm_loadu_ps(&m_boundsMax[2][kCluster])), kZero));
+
+			const __m128 kDistanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+			// Keep only the lanes whose columns passed the plane tests.
+			u32 mask = _mm_movemask_ps(_mm_cmple_ps(kDistanceSquared, kRadiusSquared)) & (rLight.m_columnMask >> x);
+
+			while (mask)
+			{
+				const u32 kLane = mask & 1 ? 0 : (mask & 2 ? 1 : (mask & 4 ? 2 : 3));
+				m_clusterLights[kCluster + kLane].push_back(kLight);
+				mask &= mask - 1;
+			}
+		}
+	}
+}
+
+void LightClusterGrid::build(const LightBounds* pLights, const u32 kLightCount, const m4x4& rView, JobSystem* pJobs)
+{
+	ASSERT(!m_sliceDepths.empty());
+
+	auto parallel = [pJobs](u32 kCount, u32 kGrain, const JobSystem::RangeJob& job)
+	{
+		if (pJobs)
+			pJobs->parallelFor(kCount, kGrain, job);
+		else
+			job(0, kCount);
+	};
+
+	// View space centres and the froxel ranges each light can reach.
+	m_viewLights.resize(kLightCount);
+	parallel(kLightCount, 1024, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 i = kBegin; i < kEnd; ++i)
+		{
+			m_viewLights[i] = transform_light(pLights[i], rView);
+		}
+	});
+
+	// Bucket by slice, in light order so every cluster list comes out sorted.
+	for (auto& rSlice : m_sliceLights)
+	{
+		rSlice.clear();
+	}
+	for (u32 i = 0; i < kLightCount; ++i)
+	{
+		for (u32 mask = m_viewLights[i].m_sliceMask; mask; mask &= mask - 1)
+		{
+			u32 z = 0;
+			while (!(mask & (1u << z)))
+				++z;
+			m_sliceLights[z].push_back(i);
+		}
+	}
+
+	// Each row of froxels is independent.
+	const u32 kTilesY = m_desc.m_tilesY;
+	parallel(m_desc.m_slices * kTilesY, 1, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 row = kBegin; row < kEnd; ++row)
+		{
+			bin_row(row % kTilesY, row / kTilesY, m_sliceLights[row / kTilesY]);
+		}
+	});
+
+	// Flatten to offset / count plus one index list.
+	const u32 kClusters = cluster_count();
+	m_clusters.resize(kClusters);
+	u32 offset = 0;
+	for (u32 i = 0; i < kClusters; ++i)
+	{
+		m_clusters[i].m_offset = offset;
+		m_clusters[i].m_count = static_cast<u32>(m_clusterLights[i].size());
+		offset += m_clusters[i].m_count;
+	}
+
+	m_indices.resize(offset);
+	parallel(kClusters, 64, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 i = kBegin; i < kEnd; ++i)
+		{
+			if (m_clusters[i].m_count)
+				memcpy(&m_indices[m_clusters[i].m_offset], m_clusterLights[i].data(), m_clusters[i].m_count * sizeof(u32));
+		}
+	});
+}
+
+void LightClusterGrid::build_reference(const LightBounds* pLights, const u32 kLightCount, const m4x4& rView)
+{
+	ASSERT(!m_sliceDepths.empty());
+
+	m_viewLights.resize(kLightCount);
+	for (u32 i = 0; i < kLightCount; ++i)
+	{
+		m_viewLights[i] = transform_light(pLights[i], rView);
+	}
+
+	m_clusters.resize(cluster_count());
+	m_indices.clear();
+
+	for (u32 z = 0; z < m_desc.m_slices; ++z)
+	{
+		for (u32 y = 0; y < m_desc.m_tilesY; ++y)
+		{
+			for (u32 x = 0; x < m_desc.m_tilesX; ++x)
+			{
+				LightCluster& rCluster = m_clusters[cluster_index(x, y, z)];
+				rCluster.m_offset = static_cast<u32>(m_indices.size());
+
+				for (u32 i = 0; i < kLightCount; ++i)
+				{
+					if (light_in_cluster(m_viewLights[i], x, y, z))
+						m_indices.push_back(i);
+				}
+
+				rCluster.m_count = static_cast<u32>(m_indices.size()) - rCluster.m_offset;
+			}
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "TiledLightCulling.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Clustered Light Grid
+// Splits the view frustum into froxels, screen tiles crossed with exponential
+// depth slices, and lists the lights touching each one. Unlike screen tiles a
+// light only lands in the slices its sphere covers, so lights hidden far
+// behind foreground geometry don't bloat the lists of nearby pixels.
+//
+// A light touches a froxel when its sphere is inside the froxel's column and
+// row planes and depth range and overlaps the froxel's view space bounding
+// box. build() and build_reference() apply exactly that test, one with SIMD
+// and range pruning spread across jobs, the other cluster by cluster.
+//================================================================================
+
+// Each axis has at most 32 divisions.
+struct ClusterGridDesc
+{
+	u32 m_tilesX = 16;
+	u32 m_tilesY = 9;
+	u32 m_slices = 24;
+	f32 m_near = 0.2f;		// depth range of the slices, match the projection.
+	f32 m_far = 1000.f;
+};
+
+// Where a cluster's lights are in the index list.
+struct LightCluster
+{
+	u32 m_offset;
+	u32 m_count;
+};
+
+class LightClusterGrid
+{
+public:
+
+	// Build the froxel planes and bounds, only needed when the projection changes.
+	void set_projection(const m4x4& rProjection, const ClusterGridDesc& rDesc);
+
+	// Bin view transformed lights into clusters. Slices are spread across the job system when one is given.
+	void build(const LightBounds* pLights, const u32 kLightCount, const m4x4& rView, JobSystem* pJobs);
+
+	// Test every light against every cluster, for validating build().
+	void build_reference(const LightBounds* pLights, const u32 kLightCount, const m4x4& rView);
+
+	// Slice of a view depth, the inverse of the exponential split.
+	u32 depth_slice(const f32 kViewDepth) const;
+
+	u32 cluster_index(const u32 kX, const u32 kY, const u32 kZ) const { return (kZ * m_desc.m_tilesY + kY) * m_desc.m_tilesX + kX; }
+	u32 cluster_count() const { return m_desc.m_tilesX * m_desc.m_tilesY * m_desc.m_slices; }
+
+	// What a shader needs to repeat depth_slice().
+	f32 slice_scale() const { return m_sliceScale; }
+	f32 forward_sign() const { return m_forwardSign; }
+
+	const ClusterGridDesc& desc() const { return m_desc; }
+	const std::vector<LightCluster>& clusters() const { return m_clusters; }
+	const std::vector<u32>& indices() const { return m_indices; }
+
+private:
+
+	// A light in view space with masks of the columns, rows and slices it can touch.
+	// Behind the eye the plane tests need not pass in one contiguous run, so ranges aren't enough.
+	struct ViewLight
+	{
+		v3 m_vCentre;
+		f32 m_radius;
+		u32 m_columnMask;
+		u32 m_rowMask;
+		u32 m_sliceMask;
+		u16 m_x0, m_x1;	// lowest and highest bits of m_columnMask.
+	};
+
+	ViewLight transform_light(const LightBounds& rLight, const m4x4& rView) const;
+	bool light_in_cluster(const ViewLight& rLight, const u32 kX, const u32 kY, const u32 kZ) const;
+	void bin_row(const u32 kY, const u32 kZ, const std::vector<u32>& sliceLights);
+
+	ClusterGridDesc m_desc;
+	f32 m_forwardSign = 1.f;		// view space z of points in front of the camera.
+	f32 m_sliceScale = 0.f;			// slices per log unit of depth.
+
+	std::vector<v3> m_columnPlanes;	// m_tilesX + 1 planes through the eye, positive to the right.
+	std::vector<v3> m_rowPlanes;	// m_tilesY + 1 planes through the eye, positive downwards.
+	std::vector<f32> m_sliceDepths;	// m_slices + 1 view depths.
+
+	// Bounding boxes of every froxel, structure of arrays so four neighbours in a row load at once.
+	std::vector<f32> m_boundsMin[3];
+	std::vector<f32> m_boundsMax[3];
+
+	std::vector<ViewLight> m_viewLights;
+	std::vector<std::vector<u32>> m_sliceLights;
+	std::vector<std::vector<u32>> m_clusterLights;
+
+	std::vector<LightCluster> m_clusters;
+	std::vector<u32> m_indices;
+};
@@ -0,0 +1,342 @@
+#include "LightSpatialHash.h"
+#include "LightSystem.h"
+#include "JobQueue.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Cell coordinates are packed 21 bits an axis, clamp well inside that.
+constexpr s32 kMaxCellCoord = (1 << 20) - 1;
+
+// Queries per job in a batch, each block gathers into its own list.
+constexpr u32 kQueryBlockSize = 256;
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+f32 box_distance_squared(const v3& vPoint, const v3& vMin, const v3& vMax)
+{
+	const f32 kDx = std::max(std::max(vMin.x - vPoint.x, vPoint.x - vMax.x), 0.f);
+	const f32 kDy = std::max(std::max(vMin.y - vPoint.y, vPoint.y - vMax.y), 0.f);
+	const f32 kDz = std::max(std::max(vMin.z - vPoint.z, vPoint.z - vMax.z), 0.f);
+	return kDx * kDx + kDy * kDy + kDz * kDz;
+}
+
+bool sphere_touches_box(const v3& vCentre, const f32 kRadius, const v3& vMin, const v3& vMax)
+{
+	// Radius is FLT_MAX for directional lights, its square is infinite and still compares true.
+	return box_distance_squared(vCentre, vMin, vMax) <= kRadius * kRadius;
+}
+
+} // namespace
+
+void LightSpatialHash::init(const LightSpatialHashDesc& rDesc)
+{
+	m_desc = rDesc;
+	m_inverseCellSize = 1.f / rDesc.m_cellSize;
+
+	m_entries.clear();
+	m_cells.clear();
+	m_global.clear();
+	m_stats = {};
+}
+
+u64 LightSpatialHash::cell_key(const s32 kX, const s32 kY, const s32 kZ)
+{
+	constexpr u64 kMask = (1u << 21) - 1;
+	return ((u64(kX) & kMask) << 42) | ((u64(kY) & kMask) << 21) | (u64(kZ) & kMask);
+}
+
+void LightSpatialHash::cell_range(const v3& vMin, const v3& vMax, s32 minOut[3], s32 maxOut[3]) const
+{
+	const f32 kMin[3] = { vMin.x, vMin.y, vMin.z };
+	const f32 kMax[3] = { vMax.x, vMax.y, vMax.z };
+	const f32 kLimit = f32(kMaxCellCoord);
+	for (u32 i = 0; i < 3; ++i)
+	{
+		minOut[i] = s32(std::min(std::max(floorf(kMin[i] * m_inverseCellSize), -kLimit), kLimit));
+		maxOut[i] = s32(std::min(std::max(floorf(kMax[i] * m_inverseCellSize), -kLimit), kLimit));
+	}
+}
+
+bool LightSpatialHash::is_global(const f32 kRadius) const
+{
+	// Compared in floats, a FLT_MAX radius would overflow any cell count.
+	return 2.f * kRadius * m_inverseCellSize >= f32(m_desc.m_maxCellsPerAxis);
+}
+
+void LightSpatialHash::insert(const u32 kLight)
+{
+	const Entry& rEntry = m_entries[kLight];
+	if (rEntry.m_bGlobal)
+	{
+		m_global.push_back(kLight);
+		return;
+	}
+
+	for (s32 z = rEntry.m_min[2]; z <= rEntry.m_max[2]; ++z)
+		for (s32 y = rEntry.m_min[1]; y <= rEntry.m_max[1]; ++y)
+			for (s32 x = rEntry.m_min[0]; x <= rEntry.m_max[0]; ++x)
+				m_cells[cell_key(x, y, z)].push_back(kLight);
+}
+
+void LightSpatialHash::remove(const u32 kLight)
+{
+	const Entry& rEntry = m_entries[kLight];
+	if (rEntry.m_bGlobal)
+	{
+		auto it = std::find(m_global.begin(), m_global.end(), kLight);
+		ASSERT(it != m_global.end());
+		*it = m_global.back();
+		m_global.pop_back();
+		return;
+	}
+
+	for (s32 z = rEntry.m_min[2]; z <= rEntry.m_max[2]; ++z)
+	{
+		for (s32 y = rEntry.m_min[1]; y <= rEntry.m_max[1]; ++y)
+		{
+			for (s32 x = rEntry.m_min[0]; x <= rEntry.m_max[0]; ++x)
+			{
+				auto cell = m_cells.find(cell_key(x, y, z));
+				ASSERT(cell != m_cells.end());
+				std::vector<u32>& rLights = cell->second;
+
+				// Cells hold a handful of lights, order within one doesn't matter.
+				auto it = std::find(rLights.begin(), rLights.end(), kLight);
+				ASSERT(it != rLights.end());
+				*it = rLights.back();
+				rLights.pop_back();
+
+				if (rLights.empty())
+					m_cells.erase(cell);
+			}
+		}
+	}
+}
+
+void LightSpatialHash::update(const LightSystem& rLights, JobSystem* pJobs)
+{
+	const u32 kCount = rLights.count();
+	const u32 kOldCount = static_cast<u32>(m_entries.size());
+
+	// Lights only ever get added, but stay correct if the system was rebuilt smaller.
+	for (u32 i = kCount; i < kOldCount; ++i)
+		remove(i);
+
+	m_entries.resize(kCount);
+	m_pending.resize(kCount);
+	m_moved.resize(kCount);
+
+	// Work out every light's cells. Lights that stayed in theirs just refresh their sphere in place,
+	// the rest leave their new bounds for the serial pass.
+	run(pJobs, kCount, 1024, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			Entry entry;
+			entry.m_vCentre = rLights.position(i);
+			entry.m_radius = rLights.radius(i);
+			entry.m_bGlobal = is_global(entry.m_radius);
+			if (entry.m_bGlobal)
+			{
+				std::fill(entry.m_min, entry.m_min + 3, 0);
+				std::fill(entry.m_max, entry.m_max + 3, 0);
+			}
+			else
+			{
+				const v3 vExtent(entry.m_radius);
+				cell_range(entry.m_vCentre - vExtent, entry.m_vCentre + vExtent, entry.m_min, entry.m_max);
+			}
+
+			const Entry& rOld = m_entries[i];
+			const bool kSameCells = i < kOldCount && rOld.m_bGlobal == entry.m_bGlobal
+				&& std::equal(entry.m_min, entry.m_min + 3, rOld.m_min) && std::equal(entry.m_max, entry.m_max + 3, rOld.m_max);
+
+			if (kSameCells)
+			{
+				m_entries[i].m_vCentre = entry.m_vCentre;
+				m_entries[i].m_radius = entry.m_radius;
+			}
+			else
+			{
+				m_pending[i] = entry;
+			}
+			m_moved[i] = kSameCells ? 0 : 1;
+		}
+	});
+
+	u32 moved = 0;
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		if (!m_moved[i])
+			continue;
+
+		if (i < kOldCount)
+			remove(i);
+		m_entries[i] = m_pending[i];
+		insert(i);
+		++moved;
+	}
+
+	m_stats.m_lights = kCount;
+	m_stats.m_moved = moved;
+	m_stats.m_global = static_cast<u32>(m_global.size());
+	m_stats.m_cells = static_cast<u32>(m_cells.size());
+}
+
+void LightSpatialHash::query_point(const v3& vPoint, std::vector<u32>& rLightsOut) const
+{
+	for (const u32 kLight : m_global)
+	{
+		const Entry& rEntry = m_entries[kLight];
+		if (sphere_touches_box(rEntry.m_vCentre, rEntry.m_radius, vPoint, vPoint))
+			rLightsOut.push_back(kLight);
+	}
+
+	// A point lies in one cell, no light can be met twice.
+	s32 cellMin[3], cellMax[3];
+	cell_range(vPoint, vPoint, cellMin, cellMax);
+	auto cell = m_cells.find(cell_key(cellMin[0], cellMin[1], cellMin[2]));
+	if (cell == m_cells.end())
+		return;
+
+	for (const u32 kLight : cell->second)
+	{
+		const Entry& rEntry = m_entries[kLight];
+		if (sphere_touches_box(rEntry.m_vCentre, rEntry.m_radius, vPoint, vPoint))
+			rLightsOut.push_back(kLight);
+	}
+}
+
+void LightSpatialHash::query_box(const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut) const
+{
+	for (const u32 kLight : m_global)
+	{
+		const Entry& rEntry = m_entries[kLight];
+		if (sphere_touches_box(rEntry.m_vCentre, rEntry.m_radius, vMin, vMax))
+			rLightsOut.push_back(kLight);
+	}
+
+	query_box_cells(vMin, vMax, rLightsOut);
+}
+
+void LightSpatialHash::query_box_cells(const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut) const
+{
+	s32 queryMin[3], queryMax[3];
+	cell_range(vMin, vMax, queryMin, queryMax);
+
+	// Boxes covering more cells than there are lights are quicker to answer light by light.
+	const f64 kQueryCells = f64(queryMax[0] - queryMin[0] + 1) * f64(queryMax[1] - queryMin[1] + 1) * f64(queryMax[2] - queryMin[2] + 1);
+	if (kQueryCells > f64(m_entries.size()))
+	{
+		for (u32 i = 0; i < m_entries.size(); ++i)
+		{
+			const Entry& rEntry = m_entries[i];
+			if (!rEntry.m_bGlobal && sphere_touches_box(rEntry.m_vCentre, rEntry.m_radius, vMin, vMax))
+				rLightsOut.push_back(i);
+		}
+		return;
+	}
+
+	for (s32 z = queryMin[2]; z <= queryMax[2]; ++z)
+	{
+		for (s32 y = queryMin[1]; y <= queryMax[1]; ++y)
+		{
+			for (s32 x = queryMin[0]; x <= queryMax[0]; ++x)
+			{
+				auto cell = m_cells.find(cell_key(x, y, z));
+				if (cell == m_cells.end())
+					continue;
+
+				for (const u32 kLight : cell->second)
+				{
+					// Only the lowest cell shared by the light and the query reports it.
+					const Entry& rEntry = m_entries[kLight];
+					if (x != std::max(rEntry.m_min[0], queryMin[0]) || y != std::max(rEntry.m_min[1], queryMin[1]) || z != std::max(rEntry.m_min[2], queryMin[2]))
+						continue;
+
+					if (sphere_touches_box(rEntry.m_vCentre, rEntry.m_radius, vMin, vMax))
+						rLightsOut.push_back(kLight);
+				}
+			}
+		}
+	}
+}
+
+template <typename QueryFunction>
+void LightSpatialHash::run_batch(const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs, const QueryFunction& query) const
+{
+	const u32 kBlocks = (kCount + kQueryBlockSize - 1) / kQueryBlockSize;
+	std::vector<std::vector<u32>> blockLights(kBlocks);
+	std::vector<u32> blockStart(kBlocks + 1);
+	rOffsetsOut.resize(kCount + 1);
+
+	// Each block gathers its queries' lights with offsets relative to the block.
+	run(pJobs, kBlocks, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 block = begin; block < end; ++block)
+		{
+			std::vector<u32>& rLights = blockLights[block];
+			const u32 kLast = std::min(kCount, (block + 1) * kQueryBlockSize);
+			for (u32 i = block * kQueryBlockSize; i < kLast; ++i)
+			{
+				rOffsetsOut[i] = static_cast<u32>(rLights.size());
+				query(i, rLights);
+			}
+		}
+	});
+
+	blockStart[0] = 0;
+	for (u32 block = 0; block < kBlocks; ++block)
+		blockStart[block + 1] = blockStart[block] + static_cast<u32>(blockLights[block].size());
+
+	rLightsOut.resize(blockStart[kBlocks]);
+	rOffsetsOut[kCount] = blockStart[kBlocks];
+
+	// Then lands at its place in the combined list.
+	run(pJobs, kBlocks, 1, [&](u32 begin, u32 end)
+	{
+		for (u32 block = begin; block < end; ++block)
+		{
+			const u32 kLast = std::min(kCount, (block + 1) * kQueryBlockSize);
+			for (u32 i = block * kQueryBlockSize; i < kLast; ++i)
+				rOffsetsOut[i] += blockStart[block];
+
+			std::copy(blockLights[block].begin(), blockLights[block].end(), rLightsOut.begin() + blockStart[block]);
+		}
+	});
+}
+
+void LightSpatialHash::query_points(const v3* pPoints, const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs) const
+{
+	run_batch(kCount, rOffsetsOut, rLightsOut, pJobs, [&](const u32 kQuery, std::vector<u32>& rLights)
+	{
+		query_point(pPoints[kQuery], rLights);
+	});
+}
+
+void LightSpatialHash::query_boxes(const v3* pMins, const v3* pMaxs, const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs) const
+{
+	run_batch(kCount, rOffsetsOut, rLightsOut, pJobs, [&](const u32 kQuery, std::vector<u32>& rLights)
+	{
+		query_box(pMins[kQuery], pMaxs[kQuery], rLights);
+	});
+}
+
+void LightSpatialHash::query_box_reference(const LightSystem& rLights, const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut)
+{
+	for (u32 i = 0; i < rLights.count(); ++i)
+	{
+		if (sphere_touches_box(rLights.position(i), rLights.radius(i), vMin, vMax))
+			rLightsOut.push_back(i);
+	}
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <unordered_map>
+#include <vector>
+
+class JobSystem;
+class LightSystem;
+
+//================================================================================
+// Light Spatial Hash
+// Answers "which lights reach this point or box" for code outside the
+// lighting passes, forward shaded transparents and light probes, without
+// scanning every light.
+//
+// Light spheres are bucketed in a uniform grid of cells hashed by their
+// coordinates, a light goes in every cell its bounding box overlaps. update()
+// only touches lights whose cell range changed, which for lights bobbing
+// around inside a cell is almost none of them. Lights spanning more than a
+// few cells per axis, directional ones included, sit in a list every query
+// checks instead.
+//
+// A box query spanning several cells would meet a light once per shared
+// cell, it is reported only from the lowest cell of the overlap so results
+// need no dedupe and queries stay read only, safe to run from many threads.
+//================================================================================
+
+struct LightSpatialHashDesc
+{
+	f32 m_cellSize = 4.f;			// about the diameter of a typical light.
+	u32 m_maxCellsPerAxis = 8;		// lights spanning more go in the global list.
+};
+
+class LightSpatialHash
+{
+public:
+
+	struct Stats
+	{
+		u32 m_lights;
+		u32 m_moved;		// lights that changed cells in the last update.
+		u32 m_global;		// lights in the global list.
+		u32 m_cells;		// occupied cells.
+	};
+
+	void init(const LightSpatialHashDesc& rDesc);
+
+	// Bring the hash in line with the lights' current positions and radii.
+	// Cell ranges are worked out across the job system when one is given, moving lights between cells is serial.
+	void update(const LightSystem& rLights, JobSystem* pJobs);
+
+	// Lights whose sphere contains the point or overlaps the box, appended to rLightsOut.
+	void query_point(const v3& vPoint, std::vector<u32>& rLightsOut) const;
+	void query_box(const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut) const;
+
+	// Many queries at once, spread across the job system when one is given.
+	// The lights for query i are rLightsOut[rOffsetsOut[i]] up to rLightsOut[rOffsetsOut[i + 1]].
+	void query_points(const v3* pPoints, const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs) const;
+	void query_boxes(const v3* pMins, const v3* pMaxs, const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs) const;
+
+	// Test every light, what the hash replaces. For validating and benchmarking.
+	static void query_box_reference(const LightSystem& rLights, const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut);
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	// Bounds of a light as last inserted.
+	struct Entry
+	{
+		v3 m_vCentre;
+		f32 m_radius;
+		s32 m_min[3], m_max[3];		// cell range, unused for global lights.
+		bool m_bGlobal;
+	};
+
+	static u64 cell_key(const s32 kX, const s32 kY, const s32 kZ);
+	void cell_range(const v3& vMin, const v3& vMax, s32 minOut[3], s32 maxOut[3]) const;
+	bool is_global(const f32 kRadius) const;
+
+	void insert(const u32 kLight);
+	void remove(const u32 kLight);
+
+	void query_box_cells(const v3& vMin, const v3& vMax, std::vector<u32>& rLightsOut) const;
+
+	template <typename QueryFunction>
+	void run_batch(const u32 kCount, std::vector<u32>& rOffsetsOut, std::vector<u32>& rLightsOut, JobSystem* pJobs, const QueryFunction& query) const;
+
+	LightSpatialHashDesc m_desc;
+	f32 m_inverseCellSize = 0.25f;
+
+	std::vector<Entry> m_entries;
+	std::unordered_map<u64, std::vector<u32>> m_cells;
+	std::vector<u32> m_global;
+	Stats m_stats = {};
+
+	// Update scratch, the new bounds of every light and whether it changed cells.
+	std::vector<Entry> m_pending;
+	std::vector<u8> m_moved;
+};
@@ -0,0 +1,362 @@
+#include "LightSystem.h"
+#include "JobQueue.h"
+
+#include <emmintrin.h>
+
+namespace
+{
+
+// Sine and cosine of four angles at once, Cephes single precision polynomials
+// after reducing the angle to an octant. Good to a few ulp for |x| < 8192.
+void sincos_ps(__m128 x, __m128& rSinOut, __m128& rCosOut)
+{
+	const __m128 kSignMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+
+	__m128 signSin = _mm_and_ps(x, kSignMask);
+	x = _mm_andnot_ps(kSignMask, x);
+
+	// Octant, rounded up to even so the remainder lies in [-pi/4, pi/4].
+	__m128i octant = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+	octant = _mm_and_si128(_mm_add_epi32(octant, _mm_set1_epi32(1)), _mm_set1_epi32(~1));
+	const __m128 y = _mm_cvtepi32_ps(octant);
+
+	const __m128 kFlipSin = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(octant, _mm_set1_epi32(4)), 29));
+	const __m128 kFlipCos = _mm_castsi128_ps(_mm_slli_epi32(_mm_andnot_si128(_mm_sub_epi32(octant, _mm_set1_epi32(2)), _mm_set1_epi32(4)), 29));
+	const __m128 kUseSinPoly = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(octant, _mm_set1_epi32(2)), _mm_setzero_si128()));
+	signSin = _mm_xor_ps(signSin, kFlipSin);
+
+	// Extended precision remainder, pi/4 split in three.
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+	x = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+	const __m128 z = _mm_mul_ps(x, x);
+
+	__m128 polyCos = _mm_set1_ps(2.443315711809948e-5f);
+	polyCos = _mm_add_ps(_mm_mul_ps(polyCos, z), _mm_set1_ps(-1.388731625493765e-3f));
+	polyCos = _mm_add_ps(_mm_mul_ps(polyCos, z), _mm_set1_ps(4.166664568298827e-2f));
+	polyCos = _mm_mul_ps(_mm_mul_ps(polyCos, z), z);
+	polyCos = _mm_sub_ps(polyCos, _mm_mul_ps(z, _mm_set1_ps(0.5f)));
+	polyCos = _mm_add_ps(polyCos, _mm_set1_ps(1.f));
+
+	__m128 polySin = _mm_set1_ps(-1.9515295891e-4f);
+	polySin = _mm_add_ps(_mm_mul_ps(polySin, z), _mm_set1_ps(8.3321608736e-3f));
+	polySin = _mm_add_ps(_mm_mul_ps(polySin, z), _mm_set1_ps(-1.6666654611e-1f));
+	polySin = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(polySin, z), x), x);
+
+	const __m128 kSin = _mm_or_ps(_mm_and_ps(kUseSinPoly, polySin), _mm_andnot_ps(kUseSinPoly, polyCos));
+	const __m128 kCos = _mm_or_ps(_mm_and_ps(kUseSinPoly, polyCos), _mm_andnot_ps(kUseSinPoly, polySin));
+	rSinOut = _mm_xor_ps(kSin, signSin);
+	rCosOut = _mm_xor_ps(kCos, kFlipCos);
+}
+
+// Groups of four lights per culling job, each job packs its own survivors.
+constexpr u32 kCullChunkGroups = 256;
+
+// Index of the lowest set bit of a four lane mask.
+constexpr u8 kLowestLane[16] = { 0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0 };
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+} // namespace
+
+u32 LightSystem::add_light(ELightType type)
+{
+	const u32 kLight = m_count++;
+
+	// Grow a whole group of four at a time so SIMD loops never need a tail.
+	if (kLight % 4 == 0)
+	{
+		const size_t kPadded = kLight + 4;
+		for (std::vector<f32>* pArray : { &m_positionX, &m_positionY, &m_positionZ, &m_radius
+			, &m_directionX, &m_directionY, &m_directionZ, &m_colourR, &m_colourG, &m_colourB
+			, &m_attenuationX, &m_attenuationY, &m_attenuationZ, &m_cosInner, &m_cosOuter, &m_coneRadius
+			, &m_centreX, &m_centreY, &m_centreZ, &m_frequencyX, &m_frequencyY, &m_frequencyZ, &m_amplitude })
+		{
+			pArray->resize(kPadded, 0.f);
+		}
+		m_type.resize(kPadded, kLightType_Point);
+		m_shadow.resize(kPadded, kNoShadow);
+	}
+
+	m_type[kLight] = type;
+	return kLight;
+}
+
+u32 LightSystem::add_directional(const v3& vDirection, const v3& vColour)
+{
+	const u32 kLight = add_light(kLightType_Directional);
+	m_radius[kLight] = FLT_MAX;
+	m_directionX[kLight] = vDirection.x;
+	m_directionY[kLight] = vDirection.y;
+	m_directionZ[kLight] = vDirection.z;
+	m_colourR[kLight] = vColour.x;
+	m_colourG[kLight] = vColour.y;
+	m_colourB[kLight] = vColour.z;
+	return kLight;
+}
+
+u32 LightSystem::add_point(const v3& vPosition, const v3& vColour, const v4& vAttenuation)
+{
+	const u32 kLight = add_light(kLightType_Point);
+	m_positionX[kLight] = m_centreX[kLight] = vPosition.x;
+	m_positionY[kLight] = m_centreY[kLight] = vPosition.y;
+	m_positionZ[kLight] = m_centreZ[kLight] = vPosition.z;
+	m_radius[kLight] = vAttenuation.w;
+	m_colourR[kLight] = vColour.x;
+	m_colourG[kLight] = vColour.y;
+	m_colourB[kLight] = vColour.z;
+	m_attenuationX[kLight] = vAttenuation.x;
+	m_attenuationY[kLight] = vAttenuation.y;
+	m_attenuationZ[kLight] = vAttenuation.z;
+	return kLight;
+}
+
+u32 LightSystem::add_spot(const v3& vPosition, const v3& vDirection, const v3& vColour, const v4& vAttenuation, const f32 kInnerAngle, const f32 kOuterAngle)
+{
+	ASSERT(kInnerAngle < kOuterAngle && kOuterAngle < kfPI * 0.5f);
+
+	const u32 kLight = add_point(vPosition, vColour, vAttenuation);
+	m_type[kLight] = kLightType_Spot;
+
+	v3 vAxis = vDirection;
+	vAxis.Normalize();
+	m_directionX[kLight] = vAxis.x;
+	m_directionY[kLight] = vAxis.y;
+	m_directionZ[kLight] = vAxis.z;
+	m_cosInner[kLight] = cosf(kInnerAngle);
+	m_cosOuter[kLight] = cosf(kOuterAngle);
+	m_coneRadius[kLight] = vAttenuation.w * tanf(kOuterAngle);
+	return kLight;
+}
+
+void LightSystem::set_shadow(const u32 kLight, const u32 kFirstView)
+{
+	ASSERT(kLight < m_count);
+	m_shadow[kLight] = kFirstView;
+}
+
+void LightSystem::clear_shadows()
+{
+	std::fill(m_shadow.begin(), m_shadow.end(), kNoShadow);
+}
+
+void LightSystem::set_animation(const u32 kLight, const v3& vCentre, const v3& vFrequency, const f32 kAmplitude)
+{
+	ASSERT(kLight < m_count);
+	m_centreX[kLight] = vCentre.x;
+	m_centreY[kLight] = vCentre.y;
+	m_centreZ[kLight] = vCentre.z;
+	m_frequencyX[kLight] = vFrequency.x;
+	m_frequencyY[kLight] = vFrequency.y;
+	m_frequencyZ[kLight] = vFrequency.z;
+	m_amplitude[kLight] = kAmplitude;
+}
+
+void LightSystem::animate(const f32 kTime, JobSystem* pJobs)
+{
+	const u32 kGroups = (m_count + 3) / 4;
+	const __m128 t = _mm_set1_ps(kTime);
+
+	// Directional lights have zero amplitude so the same kernel leaves them alone.
+	run(pJobs, kGroups, 256, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 g = kBegin; g < kEnd; ++g)
+		{
+			const u32 i = g * 4;
+			const __m128 kAmplitude = _mm_loadu_ps(&m_amplitude[i]);
+
+			__m128 sinX, cosX, sinY, cosY, sinZ, cosZ;
+			sincos_ps(_mm_mul_ps(_mm_loadu_ps(&m_frequencyX[i]), t), sinX, cosX);
+			sincos_ps(_mm_mul_ps(_mm_loadu_ps(&m_frequencyY[i]), t), sinY, cosY);
+			sincos_ps(_mm_mul_ps(_mm_loadu_ps(&m_frequencyZ[i]), t), sinZ, cosZ);
+
+			const __m128 kMoving = _mm_cmpneq_ps(kAmplitude, _mm_setzero_ps());
+			const __m128 kNewX = _mm_add_ps(_mm_loadu_ps(&m_centreX[i]), _mm_mul_ps(kAmplitude, sinX));
+			const __m128 kNewY = _mm_add_ps(_mm_loadu_ps(&m_centreY[i]), _mm_mul_ps(kAmplitude, cosY));
+			const __m128 kNewZ = _mm_add_ps(_mm_loadu_ps(&m_centreZ[i]), _mm_mul_ps(kAmplitude, cosZ));
+
+			_mm_storeu_ps(&m_positionX[i], _mm_or_ps(_mm_and_ps(kMoving, kNewX), _mm_andnot_ps(kMoving, _mm_loadu_ps(&m_positionX[i]))));
+			_mm_storeu_ps(&m_positionY[i], _mm_or_ps(_mm_and_ps(kMoving, kNewY), _mm_andnot_ps(kMoving, _mm_loadu_ps(&m_positionY[i]))));
+			_mm_storeu_ps(&m_positionZ[i], _mm_or_ps(_mm_and_ps(kMoving, kNewZ), _mm_andnot_ps(kMoving, _mm_loadu_ps(&m_positionZ[i]))));
+		}
+	});
+}
+
+void LightSystem::animate_scalar(const f32 kTime)
+{
+	for (u32 i = 0; i < m_count; ++i)
+	{
+		if (m_amplitude[i] == 0.f)
+			continue;
+
+		m_positionX[i] = static_cast<f32>(m_centreX[i] + m_amplitude[i] * sin(m_frequencyX[i] * kTime));
+		m_positionY[i] = static_cast<f32>(m_centreY[i] + m_amplitude[i] * cos(m_frequencyY[i] * kTime));
+		m_positionZ[i] = static_cast<f32>(m_centreZ[i] + m_amplitude[i] * cos(m_frequencyZ[i] * kTime));
+	}
+}
+
+u32 LightSystem::cull_and_pack(const v4* pPlanes, const u32 kPlaneCount, std::vector<GPULight>& rPackedOut, JobSystem* pJobs)
+{
+	const u32 kGroups = (m_count + 3) / 4;
+	const u32 kChunks = (kGroups + kCullChunkGroups - 1) / kCullChunkGroups;
+	m_groupMasks.resize(kGroups);
+	m_chunkCounts.resize(kChunks * kMaxLightTypes);
+
+	// Four lights against one plane per step, a light survives if no plane has it fully behind.
+	// Spots are bounded by the sphere and by the cone, the cone is outside a plane when its apex and
+	// the furthest point of its end cap along the plane normal are both behind it.
+	// Each chunk of groups also counts its survivors by type so the packing below can run in parallel.
+	run(pJobs, kChunks, 1, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 chunk = kBegin; chunk < kEnd; ++chunk)
+		{
+			u32* pCounts = &m_chunkCounts[chunk * kMaxLightTypes];
+			memset(pCounts, 0, kMaxLightTypes * sizeof(u32));
+
+			const u32 kFirstGroup = chunk * kCullChunkGroups;
+			const u32 kEndGroup = std::min(kFirstGroup + kCullChunkGroups, kGroups);
+			for (u32 g = kFirstGroup; g < kEndGroup; ++g)
+			{
+				const u32 i = g * 4;
+				const __m128 kX = _mm_loadu_ps(&m_positionX[i]);
+				const __m128 kY = _mm_loadu_ps(&m_positionY[i]);
+				const __m128 kZ = _mm_loadu_ps(&m_positionZ[i]);
+				const __m128 kRadius = _mm_loadu_ps(&m_radius[i]);
+				const __m128 kNegRadius = _mm_sub_ps(_mm_setzero_ps(), kRadius);
+				const __m128 kDirX = _mm_loadu_ps(&m_directionX[i]);
+				const __m128 kDirY = _mm_loadu_ps(&m_directionY[i]);
+				const __m128 kDirZ = _mm_loadu_ps(&m_directionZ[i]);
+				const __m128 kConeRadius = _mm_loadu_ps(&m_coneRadius[i]);
+				const __m128 kNotSpot = _mm_cmpeq_ps(kConeRadius, _mm_setzero_ps());
+				const bool kAnySpot = _mm_movemask_ps(kNotSpot) != 0xf;
+
+				// Most groups are points only and most lights are outside, so skip the cone and stop once all four are out.
+				__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (u32 p = 0; p < kPlaneCount && _mm_movemask_ps(inside); ++p)
+				{
+					const v4& rPlane = pPlanes[p];
+					const __m128 kNX = _mm_set1_ps(rPlane.x);
+					const __m128 kNY = _mm_set1_ps(rPlane.y);
+					const __m128 kNZ = _mm_set1_ps(rPlane.z);
+
+					__m128 distance = _mm_add_ps(_mm_mul_ps(kX, kNX), _mm_set1_ps(rPlane.w));
+					distance = _mm_add_ps(distance, _mm_mul_ps(kY, kNY));
+					distance = _mm_add_ps(distance, _mm_mul_ps(kZ, kNZ));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, kNegRadius));
+					if (!kAnySpot)
+						continue;
+
+					__m128 axisDot = _mm_mul_ps(kDirX, kNX);
+					axisDot = _mm_add_ps(axisDot, _mm_mul_ps(kDirY, kNY));
+					axisDot = _mm_add_ps(axisDot, _mm_mul_ps(kDirZ, kNZ));
+					const __m128 kCapSpread = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(_mm_set1_ps(1.f), _mm_mul_ps(axisDot, axisDot)), _mm_setzero_ps()));
+					const __m128 kCapDistance = _mm_add_ps(_mm_add_ps(distance, _mm_mul_ps(kRadius, axisDot)), _mm_mul_ps(kConeRadius, kCapSpread));
+					const __m128 kConeInside = _mm_or_ps(_mm_cmpge_ps(distance, _mm_setzero_ps()), _mm_cmpge_ps(kCapDistance, _mm_setzero_ps()));
+					inside = _mm_and_ps(inside, _mm_or_ps(kNotSpot, kConeInside));
+				}
+
+				u32 mask = _mm_movemask_ps(inside);
+
+				// Infinite radius makes the distances meaningless, directional lights always pass.
+				for (u32 lane = 0; lane < 4; ++lane)
+				{
+					if (m_type[i + lane] == kLightType_Directional && i + lane < m_count)
+						mask |= 1u << lane;
+				}
+
+				// Padding lights never survive.
+				if (i + 4 > m_count)
+					mask &= (1u << (m_count - i)) - 1u;
+
+				m_groupMasks[g] = static_cast<u8>(mask);
+				for (u32 lane = 0; lane < 4; ++lane)
+				{
+					pCounts[m_type[i + lane]] += (mask >> lane) & 1;
+				}
+			}
+		}
+	});
+
+	// Counting sort by type, order within a type is kept. Every chunk gets its own range of
+	// slots in each type's run, in chunk order.
+	m_visibleStart[0] = 0;
+	for (u32 t = 0; t < kMaxLightTypes; ++t)
+	{
+		u32 cursor = m_visibleStart[t];
+		for (u32 chunk = 0; chunk < kChunks; ++chunk)
+		{
+			const u32 kCount = m_chunkCounts[chunk * kMaxLightTypes + t];
+			m_chunkCounts[chunk * kMaxLightTypes + t] = cursor;
+			cursor += kCount;
+		}
+		m_visibleStart[t + 1] = cursor;
+	}
+
+	const u32 kVisibleCount = m_visibleStart[kMaxLightTypes];
+	m_visible.resize(kVisibleCount);
+	rPackedOut.resize(kVisibleCount);
+	run(pJobs, kChunks, 1, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 chunk = kBegin; chunk < kEnd; ++chunk)
+		{
+			u32* pCursors = &m_chunkCounts[chunk * kMaxLightTypes];
+			const u32 kEndGroup = std::min((chunk + 1) * kCullChunkGroups, kGroups);
+			for (u32 g = chunk * kCullChunkGroups; g < kEndGroup; ++g)
+			{
+				for (u32 mask = m_groupMasks[g]; mask; mask &= mask - 1)
+				{
+					const u32 kLight = g * 4 + kLowestLane[mask];
+					const u32 kSlot = pCursors[m_type[kLight]]++;
+					m_visible[kSlot] = kLight;
+					rPackedOut[kSlot] = gpu_light(kLight);
+				}
+			}
+		}
+	});
+
+	return kVisibleCount;
+}
+
+GPULight LightSystem::gpu_light(const u32 kLight) const
+{
+	const ELightType kType = type(kLight);
+	const bool kDirectional = kType == kLightType_Directional;
+
+	GPULight light;
+	light.m_vPosition = v4(m_positionX[kLight], m_positionY[kLight], m_positionZ[kLight], kDirectional ? 0.f : (kType == kLightType_Spot ? kGPULightSpot : kGPULightPoint));
+	light.m_vDirection = v4(m_directionX[kLight], m_directionY[kLight], m_directionZ[kLight], m_cosOuter[kLight]);
+	light.m_vColour = v4(m_colourR[kLight], m_colourG[kLight], m_colourB[kLight], m_cosInner[kLight]);
+	light.m_vAtt = v4(m_attenuationX[kLight], m_attenuationY[kLight], m_attenuationZ[kLight], kDirectional ? 0.f : m_radius[kLight]);
+	light.m_shadow = m_shadow[kLight];
+	light.m_padding[0] = light.m_padding[1] = light.m_padding[2] = 0;
+	return light;
+}
+
+void LightSystem::frustum_planes(const m4x4& rViewProjection, v4 planesOut[6])
+{
+	// Row vectors, so clip space x, y, z and w are the matrix columns.
+	const m4x4& m = rViewProjection;
+	const v4 x(m._11, m._21, m._31, m._41);
+	const v4 y(m._12, m._22, m._32, m._42);
+	const v4 z(m._13, m._23, m._33, m._43);
+	const v4 w(m._14, m._24, m._34, m._44);
+
+	planesOut[0] = w + x;	// left
+	planesOut[1] = w - x;	// right
+	planesOut[2] = w + y;	// bottom
+	planesOut[3] = w - y;	// top
+	planesOut[4] = z;		// near, D3D depth starts at zero.
+	planesOut[5] = w - z;	// far
+
+	for (u32 i = 0; i < 6; ++i)
+	{
+		const f32 kLength = sqrtf(planesOut[i].x * planesOut[i].x + planesOut[i].y * planesOut[i].y + planesOut[i].z * planesOut[i].z);
+		planesOut[i] = planesOut[i] * (1.f / kLength);
+	}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <cfloat>
+#include <cstddef>
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Light System
+// Lights stored as structure of arrays so animation and culling can work on
+// four lights per instruction. Culling compacts the visible lights into the
+// array of structures layout the shaders read.
+//================================================================================
+
+enum ELightType : u8
+{
+	kLightType_Directional,
+	kLightType_Point,
+	kLightType_Spot,
+
+	kMaxLightTypes
+};
+
+// One light as the shaders see it, matches Light in DeferredShaders.fx.
+struct GPULight
+{
+	v4 m_vPosition;		// w : 0 directional, 1 point, 2 spot.
+	v4 m_vDirection;	// for directional and spot, cosine of the outer angle in w.
+	v4 m_vColour;		// cosine of the spot inner angle in w.
+	v4 m_vAtt;			// attenuation factors, radius in w.
+	u32 m_shadow;		// first shadow view, cascades or cube faces follow. kNoShadow when unshadowed.
+	u32 m_padding[3];
+};
+
+// Structured buffer stride and member offsets the shader expects.
+static_assert(sizeof(GPULight) == 80, "GPULight must match Light in DeferredShaders.fx");
+static_assert(offsetof(GPULight, m_vPosition) == 0, "GPULight must match Light in DeferredShaders.fx");
+static_assert(offsetof(GPULight, m_vDirection) == 16, "GPULight must match Light in DeferredShaders.fx");
+static_assert(offsetof(GPULight, m_vColour) == 32, "GPULight must match Light in DeferredShaders.fx");
+static_assert(offsetof(GPULight, m_vAtt) == 48, "GPULight must match Light in DeferredShaders.fx");
+static_assert(offsetof(GPULight, m_shadow) == 64, "GPULight must match Light in DeferredShaders.fx");
+
+constexpr f32 kGPULightPoint = 1.f;
+constexpr f32 kGPULightSpot = 2.f;
+constexpr u32 kNoShadow = 0xffffffff;
+
+inline ELightType gpu_light_type(const GPULight& rLight)
+{
+	return rLight.m_vPosition.w == 0.f ? kLightType_Directional : (rLight.m_vPosition.w == kGPULightSpot ? kLightType_Spot : kLightType_Point);
+}
+
+// Radius of a spot's end cap, range * tan(outer angle).
+inline f32 gpu_light_cone_radius(const GPULight& rLight)
+{
+	const f32 kCosOuter = rLight.m_vDirection.w;
+	return rLight.m_vAtt.w * sqrtf(1.f - kCosOuter * kCosOuter) / kCosOuter;
+}
+
+class LightSystem
+{
+public:
+
+	u32 add_directional(const v3& vDirection, const v3& vColour);
+
+	// vAttenuation holds constant, linear and quadratic factors with the radius in w.
+	u32 add_point(const v3& vPosition, const v3& vColour, const v4& vAttenuation);
+
+	// A cone from vPosition along vDirection, vAttenuation.w is the range.
+	// Angles are half angles in radians, light fades out between the inner and outer angle.
+	// Inner must be below outer and outer below pi / 2.
+	u32 add_spot(const v3& vPosition, const v3& vDirection, const v3& vColour, const v4& vAttenuation, const f32 kInnerAngle, const f32 kOuterAngle);
+
+	// Shadow view packed into the light's GPULight, kNoShadow to turn it off.
+	void set_shadow(const u32 kLight, const u32 kFirstView);
+	void clear_shadows();
+
+	// Bob around vCentre : centre + amplitude * (sin(f.x t), cos(f.y t), cos(f.z t)).
+	void set_animation(const u32 kLight, const v3& vCentre, const v3& vFrequency, const f32 kAmplitude);
+
+	// Move every animated light to its position at time kTime.
+	void animate(const f32 kTime, JobSystem* pJobs);
+
+	// One light at a time with the C library, what animate() replaced. Kept for comparison.
+	void animate_scalar(const f32 kTime);
+
+	// Test bounding spheres against planes facing into the volume, and write the survivors to rPackedOut.
+	// Directional lights always pass and spot lights must also have their cone in front of every plane.
+	// Returns the visible count, visible() maps packed slots back to lights.
+	// Survivors are grouped by type so each type is a contiguous range that can be drawn instanced.
+	u32 cull_and_pack(const v4* pPlanes, const u32 kPlaneCount, std::vector<GPULight>& rPackedOut, JobSystem* pJobs);
+
+	// The six planes of a view projection matrix, normalized, facing inwards.
+	static void frustum_planes(const m4x4& rViewProjection, v4 planesOut[6]);
+
+	u32 count() const { return m_count; }
+	ELightType type(const u32 kLight) const { return static_cast<ELightType>(m_type[kLight]); }
+	v3 position(const u32 kLight) const { return v3(m_positionX[kLight], m_positionY[kLight], m_positionZ[kLight]); }
+	v3 direction(const u32 kLight) const { return v3(m_directionX[kLight], m_directionY[kLight], m_directionZ[kLight]); }
+	f32 radius(const u32 kLight) const { return m_radius[kLight]; }
+	f32 cone_radius(const u32 kLight) const { return m_coneRadius[kLight]; }
+	v3 animation_centre(const u32 kLight) const { return v3(m_centreX[kLight], m_centreY[kLight], m_centreZ[kLight]); }
+	f32 animation_amplitude(const u32 kLight) const { return m_amplitude[kLight]; }
+	GPULight gpu_light(const u32 kLight) const;
+
+	const std::vector<u32>& visible() const { return m_visible; }
+	u32 visible_first(ELightType type) const { return m_visibleStart[type]; }
+	u32 visible_count(ELightType type) const { return m_visibleStart[type + 1] - m_visibleStart[type]; }
+
+private:
+
+	u32 add_light(ELightType type);
+
+	u32 m_count = 0;
+
+	// Arrays are padded to a multiple of four, padding lights have zero radius and amplitude.
+	std::vector<f32> m_positionX, m_positionY, m_positionZ;
+	std::vector<f32> m_radius;
+	std::vector<f32> m_directionX, m_directionY, m_directionZ;
+	std::vector<f32> m_colourR, m_colourG, m_colourB;
+	std::vector<f32> m_attenuationX, m_attenuationY, m_attenuationZ;
+	std::vector<f32> m_cosInner, m_cosOuter;
+	std::vector<f32> m_coneRadius;		// radius of the cone's end cap, zero for anything but spots.
+	std::vector<u8> m_type;
+	std::vector<u32> m_shadow;
+
+	// Animation.
+	std::vector<f32> m_centreX, m_centreY, m_centreZ;
+	std::vector<f32> m_frequencyX, m_frequencyY, m_frequencyZ;
+	std::vector<f32> m_amplitude;
+
+	// Culling scratch, one mask per group of four and the survivors of each chunk of groups by type.
+	std::vector<u8> m_groupMasks;
+	std::vector<u32> m_chunkCounts;
+	std::vector<u32> m_visible;
+	u32 m_visibleStart[kMaxLightTypes + 1] = {};
+};
@@ -0,0 +1,45 @@
+#include "LightVolumes.h"
+
+f32 near_plane_corner_distance(const m4x4& rProjection, const f32 kNear)
+{
+	// Row vectors, x_ndc * w = x * _11 + z * _31 with w = kNear on the near plane.
+	const f32 kHalfWidth = kNear * (1.f + fabsf(rProjection._31)) / fabsf(rProjection._11);
+	const f32 kHalfHeight = kNear * (1.f + fabsf(rProjection._32)) / fabsf(rProjection._22);
+	return sqrtf(kHalfWidth * kHalfWidth + kHalfHeight * kHalfHeight + kNear * kNear);
+}
+
+bool camera_inside_light_volume(const v3& vCentre, const f32 kRadius, const v3& vEye, const f32 kNearCornerDistance)
+{
+	const f32 kReach = kRadius + kNearCornerDistance;
+	return (vCentre - vEye).LengthSquared() < kReach * kReach;
+}
+
+u32 partition_camera_inside(GPULight* pLights, const u32 kCount, const v3& vEye, const f32 kNearCornerDistance)
+{
+	GPULight* pEnd = std::stable_partition(pLights, pLights + kCount, [&](const GPULight& rLight)
+	{
+		return camera_inside_light_volume(v3(rLight.m_vPosition), rLight.m_vAtt.w, vEye, kNearCornerDistance);
+	});
+	return static_cast<u32>(pEnd - pLights);
+}
+
+void light_depth_bounds(const v3& vCentre, const f32 kRadius, const m4x4& rView, const m4x4& rProjection, f32& rMinOut, f32& rMaxOut)
+{
+	// Only z and w of the projection depend on view z, and both are monotonic in it along the view axis.
+	const f32 kViewZ = v3::Transform(vCentre, rView).z;
+	const m4x4& p = rProjection;
+
+	f32 depths[2];
+	const f32 kEnds[2] = { kViewZ - kRadius, kViewZ + kRadius };
+	for (u32 i = 0; i < 2; ++i)
+	{
+		const f32 z = kEnds[i] * p._33 + p._43;
+		const f32 w = kEnds[i] * p._34 + p._44;
+
+		// Behind the eye, the sphere reaches the near plane.
+		depths[i] = w > 0.f ? z / w : 0.f;
+	}
+
+	rMinOut = std::min(std::max(std::min(depths[0], depths[1]), 0.f), 1.f);
+	rMaxOut = std::min(std::max(std::max(depths[0], depths[1]), 0.f), 1.f);
+}
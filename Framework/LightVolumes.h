@@ -0,0 +1,31 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "LightSystem.h"
+
+//================================================================================
+// Light Volumes
+// CPU side of the stencil masked light volume pass.
+//
+// A volume the camera is outside of is drawn twice: once to count in stencil
+// how many of its faces lie behind the scene at each pixel, then back faces
+// only where the count is odd, which is exactly where geometry sits inside
+// the volume. That breaks once the near plane clips the front faces, so those
+// lights are drawn back faces only with a greater-equal depth test instead.
+//
+// D3D11 has no depth bounds test, the shaders reject pixels outside the
+// depth range light_depth_bounds() gives before fetching the rest of the G-buffer.
+//================================================================================
+
+// Furthest distance from the eye to a corner of the near plane, works for off centre projections.
+f32 near_plane_corner_distance(const m4x4& rProjection, const f32 kNear);
+
+// True when the sphere contains the eye or reaches the near plane.
+bool camera_inside_light_volume(const v3& vCentre, const f32 kRadius, const v3& vEye, const f32 kNearCornerDistance);
+
+// Move the lights whose volume the camera is inside to the front, keeping the order otherwise.
+// Returns how many there are.
+u32 partition_camera_inside(GPULight* pLights, const u32 kCount, const v3& vEye, const f32 kNearCornerDistance);
+
+// Post projection depth range of a sphere, clamped to [0, 1]. Matches LightDepthBounds in DeferredShaders.fx.
+void light_depth_bounds(const v3& vCentre, const f32 kRadius, const m4x4& rView, const m4x4& rProjection, f32& rMinOut, f32& rMaxOut);
@@ -1,12 +1,15 @@
 
 #include "Mesh.h"
+#include "D3D11RenderDevice.h"
 
-#define TINYOBJLOADER_IMPLEMENTATION
 #include "tinyobjloader/tiny_obj_loader.h"
 
 Mesh::Mesh()
 	: m_pVertexBuffer(nullptr)
 	, m_pIndexBuffer(nullptr)
+	, m_vertices(0)
+	, m_indices(0)
+	, m_binding()
 {
 
 }
@@ -54,33 +57,38 @@ void Mesh::init_buffers(ID3D11Device* pDevice, const MeshVertex* pVertices, cons
 
 	m_vertices = kNumVerts;
 	m_indices = kNumIndices;
-}
-
-void Mesh::bind(ID3D11DeviceContext* pContext) const
-{
-	pContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-	ID3D11Buffer* buffers[] = { m_pVertexBuffer };
-	UINT strides[] = { sizeof(MeshVertex) };
-	UINT offsets[] = { 0 };
-	pContext->IASetVertexBuffers(0, 1, buffers, strides, offsets);
+	m_binding.m_pVertexBuffer = to_handle(m_pVertexBuffer);
+	m_binding.m_pIndexBuffer = to_handle(m_pIndexBuffer);
+	m_binding.m_vertexStride = sizeof(MeshVertex);
+	m_binding.m_vertices = kNumVerts;
+	m_binding.m_indices = kNumIndices;
 
-	if (m_pIndexBuffer)
+	m_vBoundsMin = kNumVerts ? v3(pVertices[0].pos) : v3::Zero;
+	m_vBoundsMax = m_vBoundsMin;
+	for (u32 i = 1; i < kNumVerts; ++i)
 	{
-		pContext->IASetIndexBuffer(m_pIndexBuffer, DXGI_FORMAT_R16_UINT, 0);
+		m_vBoundsMin = v3::Min(m_vBoundsMin, v3(pVertices[i].pos));
+		m_vBoundsMax = v3::Max(m_vBoundsMax, v3(pVertices[i].pos));
 	}
 }
 
+void Mesh::bind(ID3D11DeviceContext* pContext) const
+{
+	D3D11RenderDevice device(pContext);
+	m_binding.bind(device);
+}
+
 void Mesh::draw(ID3D11DeviceContext* pContext) const
 {
-	if (m_pIndexBuffer)
-	{
-		pContext->DrawIndexed(m_indices, 0, 0);
-	}
-	else
-	{
-		pContext->Draw(m_vertices, 0);
-	}
+	D3D11RenderDevice device(pContext);
+	m_binding.draw(device);
+}
+
+void Mesh::draw_instanced(ID3D11DeviceContext* pContext, const u32 kInstances) const
+{
+	D3D11RenderDevice device(pContext);
+	m_binding.draw_instanced(device, kInstances);
 }
 
 // Computes tangents using Lengyel's method for an indexed triangle list.
@@ -295,6 +303,51 @@ void create_mesh_quad_xy(ID3D11Device* pDevice, Mesh& rMeshOut, const f32 kHalfS
 	rMeshOut.init_buffers(pDevice, verts, kVertices, indices, kIndices);
 }
 
+void create_mesh_cone(ID3D11Device* pDevice, Mesh& rMeshOut, const u32 kSegments)
+{
+	const u32 c = 0xFFFFFFFF;
+
+	// Push the ring out so the flat sides touch the unit circle rather than cut inside it.
+	const f32 kRingRadius = 1.f / cosf(kfPI / kSegments);
+
+	std::vector<MeshVertex> verts;
+	std::vector<u16> indices;
+	verts.reserve(kSegments + 2);
+	indices.reserve(kSegments * 6);
+
+	verts.push_back(MeshVertex(v3(0.f, 0.f, 0.f), c, v3(0.f, 0.f, -1.f), v2(0.5f, 0.5f)));	// apex
+	verts.push_back(MeshVertex(v3(0.f, 0.f, 1.f), c, v3(0.f, 0.f, 1.f), v2(0.5f, 0.5f)));	// cap centre
+
+	for (u32 i = 0; i < kSegments; ++i)
+	{
+		const f32 kAngle = 2.f * kfPI * i / kSegments;
+		const v3 vRing(cosf(kAngle) * kRingRadius, sinf(kAngle) * kRingRadius, 1.f);
+		v3 vNormal(cosf(kAngle), sinf(kAngle), -1.f);
+		vNormal.Normalize();
+		verts.push_back(MeshVertex(vRing, c, vNormal, v2(0.5f + cosf(kAngle) * 0.5f, 0.5f + sinf(kAngle) * 0.5f)));
+	}
+
+	for (u32 i = 0; i < kSegments; ++i)
+	{
+		const u16 kA = static_cast<u16>(2 + i);
+		const u16 kB = static_cast<u16>(2 + (i + 1) % kSegments);
+
+		// side
+		indices.push_back(0);
+		indices.push_back(kB);
+		indices.push_back(kA);
+
+		// cap
+		indices.push_back(1);
+		indices.push_back(kA);
+		indices.push_back(kB);
+	}
+
+	compute_tangents_lengyel(verts.data(), static_cast<u32>(verts.size()), indices.data(), static_cast<u32>(indices.size()));
+
+	rMeshOut.init_buffers(pDevice, verts.data(), static_cast<u32>(verts.size()), indices.data(), static_cast<u32>(indices.size()));
+}
+
 void create_mesh_from_obj(ID3D11Device* pDevice, Mesh& rMeshOut, const char* pFilename, const f32 kScale)
 {
 	tinyobj::attrib_t attrib;
@@ -2,7 +2,7 @@
 
 #include "CommonHeader.h"
 #include "VertexFormats.h"
-
+#include "RenderDevice.h"
 
 using MeshVertex = Vertex_Pos3fColour4ubNormal3fTangent3fTex2f; // vertex type
 
@@ -20,6 +20,15 @@ public:
 	void init_buffers(ID3D11Device* pDevice, const MeshVertex* pVertices, const u32 kNumVerts, const u16* pIndices, const u32 kNumIndices);
 	void bind(ID3D11DeviceContext* pContext) const;
 	void draw(ID3D11DeviceContext* pContext) const;
+	void draw_instanced(ID3D11DeviceContext* pContext, const u32 kInstances) const;
+
+	// The same through a render device.
+	void bind(RenderDevice& rDevice) const { m_binding.bind(rDevice); }
+	void draw(RenderDevice& rDevice) const { m_binding.draw(rDevice); }
+	void draw_instanced(RenderDevice& rDevice, const u32 kInstances) const { m_binding.draw_instanced(rDevice, kInstances); }
+
+	// The buffers as handles, filled in by init_buffers.
+	const MeshBinding& binding() const { return m_binding; }
 
 	// Accessors.
 	const ID3D11Buffer* vertex_buffer() const { return m_pVertexBuffer; }
@@ -28,11 +37,18 @@ public:
 	u32 vertices() const { return m_vertices; }
 	u32 indices() const { return m_indices; }
 
+	// Object space bounds of the vertices, for culling.
+	const v3& bounds_min() const { return m_vBoundsMin; }
+	const v3& bounds_max() const { return m_vBoundsMax; }
+
 private:
 	ID3D11Buffer* m_pVertexBuffer;
 	ID3D11Buffer* m_pIndexBuffer;
 	u32 m_vertices;
 	u32 m_indices;
+	MeshBinding m_binding;
+	v3 m_vBoundsMin;
+	v3 m_vBoundsMax;
 };
 
 //================================================================================
@@ -43,6 +59,10 @@ void create_mesh_cube(ID3D11Device* pDevice, Mesh& rMeshOut, const f32 kHalfSize
 
 void create_mesh_quad_xy(ID3D11Device* pDevice, Mesh& rMeshOut, const f32 kHalfSize);
 
+// Closed cone with its apex at the origin and a unit radius cap at z = 1, used as a spot light volume.
+// The sides circumscribe the round cone so the proxy never cuts into it.
+void create_mesh_cone(ID3D11Device* pDevice, Mesh& rMeshOut, const u32 kSegments);
+
 void create_mesh_from_obj(ID3D11Device* pDevice, Mesh& rMeshOut, const char* pFilename, const f32 kScale);
 
 
@@ -0,0 +1,67 @@
+#include "MeshInfo.h"
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tinyobjloader/tiny_obj_loader.h"
+
+MeshInfo mesh_info_cube(const f32 kHalfSize)
+{
+	// Four vertices and two triangles a face.
+	MeshInfo info;
+	info.m_vertices = 24;
+	info.m_indices = 36;
+	info.m_vBoundsMin = v3(-kHalfSize);
+	info.m_vBoundsMax = v3(kHalfSize);
+	return info;
+}
+
+MeshInfo mesh_info_quad_xy(const f32 kHalfSize)
+{
+	MeshInfo info;
+	info.m_vertices = 4;
+	info.m_indices = 6;
+	info.m_vBoundsMin = v3(-kHalfSize, -kHalfSize, 0.f);
+	info.m_vBoundsMax = v3(kHalfSize, kHalfSize, 0.f);
+	return info;
+}
+
+MeshInfo mesh_info_cone(const u32 kSegments)
+{
+	// Apex, cap centre and the ring pushed out to touch the unit circle. A side and a cap triangle a segment.
+	const f32 kRingRadius = 1.f / cosf(kfPI / kSegments);
+	MeshInfo info;
+	info.m_vertices = kSegments + 2;
+	info.m_indices = kSegments * 6;
+	info.m_vBoundsMin = v3(-kRingRadius, -kRingRadius, 0.f);
+	info.m_vBoundsMax = v3(kRingRadius, kRingRadius, 1.f);
+	return info;
+}
+
+bool mesh_info_from_obj(const char* pFilename, const f32 kScale, MeshInfo& rInfoOut)
+{
+	tinyobj::attrib_t attrib;
+	std::vector<tinyobj::shape_t> shapes;
+	std::vector<tinyobj::material_t> materials;
+
+	std::string err;
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, pFilename) || shapes.empty())
+	{
+		debugF("mesh_info_from_obj( %s ) : %s\n", pFilename, err.c_str());
+		return false;
+	}
+
+	// Unindexed like the loaded mesh, a vertex and an index per face corner. z flips to match DX the same way.
+	const tinyobj::mesh_t& rMesh = shapes.back().mesh;
+	const u32 kCorners = static_cast<u32>(rMesh.indices.size());
+	rInfoOut.m_vertices = kCorners;
+	rInfoOut.m_indices = kCorners;
+	rInfoOut.m_vBoundsMin = v3(0.f);
+	rInfoOut.m_vBoundsMax = v3(0.f);
+	for (u32 i = 0; i < kCorners; ++i)
+	{
+		const tinyobj::real_t* pPosition = &attrib.vertices[3 * rMesh.indices[i].vertex_index];
+		const v3 vPosition = v3(pPosition[0], pPosition[1], -pPosition[2]) * kScale;
+		rInfoOut.m_vBoundsMin = i ? v3::Min(rInfoOut.m_vBoundsMin, vPosition) : vPosition;
+		rInfoOut.m_vBoundsMax = i ? v3::Max(rInfoOut.m_vBoundsMax, vPosition) : vPosition;
+	}
+	return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+//================================================================================
+// Mesh Info
+// What a Mesh holds apart from its buffers: counts and object space bounds.
+// Enough for code that culls and counts draws without a device to make the
+// buffers on, the headless frame loop in particular.
+//================================================================================
+
+struct MeshInfo
+{
+	u32 m_vertices;
+	u32 m_indices;
+	v3 m_vBoundsMin;
+	v3 m_vBoundsMax;
+};
+
+// The cube create_mesh_cube() builds.
+MeshInfo mesh_info_cube(const f32 kHalfSize);
+
+// The quad create_mesh_quad_xy() builds.
+MeshInfo mesh_info_quad_xy(const f32 kHalfSize);
+
+// The cone create_mesh_cone() builds.
+MeshInfo mesh_info_cone(const u32 kSegments);
+
+// The mesh create_mesh_from_obj() would load, false when the file won't load.
+bool mesh_info_from_obj(const char* pFilename, const f32 kScale, MeshInfo& rInfoOut);
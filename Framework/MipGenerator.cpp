@@ -0,0 +1,365 @@
+#include "MipGenerator.h"
+#include "JobQueue.h"
+
+#include <emmintrin.h>
+#include <immintrin.h>
+
+namespace
+{
+
+// Working format, linear RGBA floats so each texel is one SSE register.
+struct LinearImage
+{
+	u32 m_width = 0;
+	u32 m_height = 0;
+	std::vector<f32> m_texels;
+
+	void resize(const u32 kWidth, const u32 kHeight)
+	{
+		m_width = kWidth;
+		m_height = kHeight;
+		m_texels.resize(size_t(kWidth) * kHeight * 4);
+	}
+
+	f32* row(const u32 y) { return m_texels.data() + size_t(y) * m_width * 4; }
+	const f32* row(const u32 y) const { return m_texels.data() + size_t(y) * m_width * 4; }
+};
+
+// One source texel contributing to a destination texel.
+struct FilterTap
+{
+	u32 m_index;
+	f32 m_weight;
+};
+
+// Taps for every destination texel along one axis.
+struct FilterTaps
+{
+	std::vector<u32> m_first;	// offset of each destination's taps.
+	std::vector<u32> m_count;
+	std::vector<FilterTap> m_taps;
+};
+
+constexpr f32 kKaiserRadius = 3.0f;
+constexpr f32 kKaiserAlpha = 4.0f;
+
+// Zeroth order modified Bessel function of the first kind, by its power series.
+f32 bessel_i0(const f32 x)
+{
+	f32 sum = 1.0f;
+	f32 term = 1.0f;
+	const f32 kHalfXSq = x * x * 0.25f;
+	for (u32 k = 1; k < 32; ++k)
+	{
+		term *= kHalfXSq / f32(k * k);
+		sum += term;
+		if (term < sum * 1e-7f)
+			break;
+	}
+	return sum;
+}
+
+f32 kaiser_sinc(const f32 t)
+{
+	const f32 kAbsT = std::fabs(t);
+	if (kAbsT >= kKaiserRadius)
+		return 0.0f;
+
+	const f32 kSinc = kAbsT < 1e-5f ? 1.0f : std::sin(kfPI * t) / (kfPI * t);
+	const f32 kRatio = t / kKaiserRadius;
+	const f32 kWindow = bessel_i0(kKaiserAlpha * std::sqrt(1.0f - kRatio * kRatio)) / bessel_i0(kKaiserAlpha);
+	return kSinc * kWindow;
+}
+
+// Build normalised taps resampling kSrcSize texels down to kDstSize.
+// Texels past the edges clamp to the border texel.
+void build_taps(const u32 kSrcSize, const u32 kDstSize, EMipFilter filter, FilterTaps& rTapsOut)
+{
+	const f32 kScale = f32(kSrcSize) / f32(kDstSize);
+
+	rTapsOut.m_first.resize(kDstSize);
+	rTapsOut.m_count.resize(kDstSize);
+	rTapsOut.m_taps.clear();
+
+	for (u32 d = 0; d < kDstSize; ++d)
+	{
+		const f32 kCentre = (f32(d) + 0.5f) * kScale;
+		const u32 kFirst = static_cast<u32>(rTapsOut.m_taps.size());
+		f32 totalWeight = 0.0f;
+
+		if (filter == kMipFilter_Box)
+		{
+			// Weight by how much of each source texel the destination footprint covers.
+			const f32 kLo = kCentre - kScale * 0.5f;
+			const f32 kHi = kCentre + kScale * 0.5f;
+			for (s32 i = s32(std::floor(kLo)); f32(i) < kHi; ++i)
+			{
+				const f32 kWeight = std::min(f32(i + 1), kHi) - std::max(f32(i), kLo);
+				if (kWeight <= 0.0f)
+					continue;
+				rTapsOut.m_taps.push_back({ u32(std::min(std::max(i, 0), s32(kSrcSize) - 1)), kWeight });
+				totalWeight += kWeight;
+			}
+		}
+		else
+		{
+			// The kernel is stretched by the scale so it band limits to the destination rate.
+			const f32 kSupport = kKaiserRadius * kScale;
+			for (s32 i = s32(std::floor(kCentre - kSupport)); f32(i) < kCentre + kSupport; ++i)
+			{
+				const f32 kWeight = kaiser_sinc((f32(i) + 0.5f - kCentre) / kScale);
+				if (kWeight == 0.0f)
+					continue;
+				rTapsOut.m_taps.push_back({ u32(std::min(std::max(i, 0), s32(kSrcSize) - 1)), kWeight });
+				totalWeight += kWeight;
+			}
+		}
+
+		const f32 kInvWeight = 1.0f / totalWeight;
+		for (u32 t = kFirst; t < rTapsOut.m_taps.size(); ++t)
+		{
+			rTapsOut.m_taps[t].m_weight *= kInvWeight;
+		}
+
+		rTapsOut.m_first[d] = kFirst;
+		rTapsOut.m_count[d] = static_cast<u32>(rTapsOut.m_taps.size()) - kFirst;
+	}
+}
+
+// sRGB <-> linear conversion tables, decode is exact per byte, encode uses 4096 linear steps.
+constexpr u32 kLinearToSRGBSteps = 4096;
+
+struct SRGBTables
+{
+	f32 m_toLinear[256];
+	u8 m_toSRGB[kLinearToSRGBSteps];
+
+	SRGBTables()
+	{
+		for (u32 i = 0; i < 256; ++i)
+		{
+			const f32 kC = i / 255.0f;
+			m_toLinear[i] = kC <= 0.04045f ? kC / 12.92f : std::pow((kC + 0.055f) / 1.055f, 2.4f);
+		}
+		for (u32 i = 0; i < kLinearToSRGBSteps; ++i)
+		{
+			const f32 kL = i / f32(kLinearToSRGBSteps - 1);
+			const f32 kC = kL <= 0.0031308f ? kL * 12.92f : 1.055f * std::pow(kL, 1.0f / 2.4f) - 0.055f;
+			m_toSRGB[i] = u8(std::min(std::max(kC * 255.0f + 0.5f, 0.0f), 255.0f));
+		}
+	}
+};
+
+const SRGBTables& srgb_tables()
+{
+	static SRGBTables s_tables;
+	return s_tables;
+}
+
+constexpr u32 kRowGrain = 16;
+
+// Levels at or below this many texels are too small to split by rows, so they're built a level per job.
+constexpr size_t kMipTailTexels = 256 * 256;
+
+void run_jobs(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const std::function<void(u32, u32)>& job)
+{
+	if (pJobs)
+	{
+		pJobs->parallelFor(kCount, kGrain, job);
+	}
+	else
+	{
+		job(0, kCount);
+	}
+}
+
+void run_rows(JobSystem* pJobs, const u32 kRows, const std::function<void(u32, u32)>& job)
+{
+	run_jobs(pJobs, kRows, kRowGrain, job);
+}
+
+void decode_to_linear(const Image& rSource, bool bSRGB, LinearImage& rOut, JobSystem* pJobs)
+{
+	const SRGBTables& rTables = srgb_tables();
+	rOut.resize(rSource.m_width, rSource.m_height);
+
+	run_rows(pJobs, rSource.m_height, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 y = kBegin; y < kEnd; ++y)
+		{
+			const u8* pSrc = rSource.row(y);
+			f32* pDst = rOut.row(y);
+			for (u32 i = 0; i < rSource.m_width * 4; i += 4)
+			{
+				for (u32 c = 0; c < 3; ++c)
+				{
+					pDst[i + c] = bSRGB ? rTables.m_toLinear[pSrc[i + c]] : pSrc[i + c] * (1.0f / 255.0f);
+				}
+				pDst[i + 3] = pSrc[i + 3] * (1.0f / 255.0f);
+			}
+		}
+	});
+}
+
+void encode_from_linear(const LinearImage& rSource, bool bSRGB, Image& rOut, JobSystem* pJobs)
+{
+	const SRGBTables& rTables = srgb_tables();
+	rOut.resize(rSource.m_width, rSource.m_height);
+
+	run_rows(pJobs, rSource.m_height, [&](u32 kBegin, u32 kEnd)
+	{
+		const __m128 kZero = _mm_setzero_ps();
+		const __m128 kOne = _mm_set1_ps(1.0f);
+		const __m128 kSteps = bSRGB ? _mm_set_ps(255.0f, kLinearToSRGBSteps - 1.0f, kLinearToSRGBSteps - 1.0f, kLinearToSRGBSteps - 1.0f) : _mm_set1_ps(255.0f);
+
+		for (u32 y = kBegin; y < kEnd; ++y)
+		{
+			const f32* pSrc = rSource.row(y);
+			u8* pDst = rOut.row(y);
+			for (u32 i = 0; i < rSource.m_width * 4; i += 4)
+			{
+				// Negative lobes of the Kaiser kernel can overshoot, clamp before quantising.
+				__m128 texel = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pSrc + i), kZero), kOne);
+				alignas(16) s32 q[4];
+				_mm_store_si128((__m128i*)q, _mm_cvtps_epi32(_mm_mul_ps(texel, kSteps)));
+
+				for (u32 c = 0; c < 3; ++c)
+				{
+					pDst[i + c] = bSRGB ? rTables.m_toSRGB[q[c]] : u8(q[c]);
+				}
+				pDst[i + 3] = u8(q[3]);
+			}
+		}
+	});
+}
+
+// Adds kWeight times pSrc to pDst eight floats at a time, returns how far it got.
+TARGET_AVX u32 accumulate_row_avx(f32* pDst, const f32* pSrc, const f32 kWeight, const u32 kRowFloats)
+{
+	const __m256 kWeight8 = _mm256_set1_ps(kWeight);
+	u32 i = 0;
+	for (; i + 8 <= kRowFloats; i += 8)
+	{
+		_mm256_storeu_ps(pDst + i, _mm256_add_ps(_mm256_loadu_ps(pDst + i), _mm256_mul_ps(kWeight8, _mm256_loadu_ps(pSrc + i))));
+	}
+	return i;
+}
+
+// Separable resample, horizontal into a scratch image then vertical into the destination.
+void downsample(const LinearImage& rSource, EMipFilter filter, LinearImage& rScratch, LinearImage& rOut, JobSystem* pJobs)
+{
+	FilterTaps tapsX, tapsY;
+	build_taps(rSource.m_width, rOut.m_width, filter, tapsX);
+	build_taps(rSource.m_height, rOut.m_height, filter, tapsY);
+
+	rScratch.resize(rOut.m_width, rSource.m_height);
+
+	// Horizontal : one texel is one SSE register so accumulate whole RGBA texels.
+	run_rows(pJobs, rSource.m_height, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 y = kBegin; y < kEnd; ++y)
+		{
+			const f32* pSrc = rSource.row(y);
+			f32* pDst = rScratch.row(y);
+			for (u32 x = 0; x < rOut.m_width; ++x)
+			{
+				const FilterTap* pTap = &tapsX.m_taps[tapsX.m_first[x]];
+				__m128 acc = _mm_setzero_ps();
+				for (u32 t = 0; t < tapsX.m_count[x]; ++t, ++pTap)
+				{
+					acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(pTap->m_weight), _mm_loadu_ps(pSrc + pTap->m_index * 4)));
+				}
+				_mm_storeu_ps(pDst + x * 4, acc);
+			}
+		}
+	});
+
+	// Vertical : weighted sum of whole rows, so it runs 8 floats wide when the CPU has AVX.
+	const u32 kRowFloats = rOut.m_width * 4;
+	const bool kAvx = cpu_has_avx();
+	run_rows(pJobs, rOut.m_height, [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 y = kBegin; y < kEnd; ++y)
+		{
+			f32* pDst = rOut.row(y);
+			memset(pDst, 0, kRowFloats * sizeof(f32));
+
+			const FilterTap* pTap = &tapsY.m_taps[tapsY.m_first[y]];
+			for (u32 t = 0; t < tapsY.m_count[y]; ++t, ++pTap)
+			{
+				const f32* pSrc = rScratch.row(pTap->m_index);
+				u32 i = kAvx ? accumulate_row_avx(pDst, pSrc, pTap->m_weight, kRowFloats) : 0;
+				const __m128 kWeight = _mm_set1_ps(pTap->m_weight);
+				for (; i < kRowFloats; i += 4)
+				{
+					_mm_storeu_ps(pDst + i, _mm_add_ps(_mm_loadu_ps(pDst + i), _mm_mul_ps(kWeight, _mm_loadu_ps(pSrc + i))));
+				}
+			}
+		}
+	});
+}
+
+} // namespace
+
+u32 mip_level_count(const u32 kWidth, const u32 kHeight)
+{
+	u32 levels = 1;
+	for (u32 size = std::max(kWidth, kHeight); size > 1; size >>= 1)
+	{
+		++levels;
+	}
+	return levels;
+}
+
+void mip_level_size(const u32 kWidth, const u32 kHeight, const u32 kLevel, u32& rWidthOut, u32& rHeightOut)
+{
+	rWidthOut = std::max(1u, kWidth >> kLevel);
+	rHeightOut = std::max(1u, kHeight >> kLevel);
+}
+
+void generate_mip_chain(const Image& rSource, EMipFilter filter, bool bSRGB, std::vector<Image>& rMipsOut, JobSystem* pJobs)
+{
+	const u32 kLevels = mip_level_count(rSource.m_width, rSource.m_height);
+	rMipsOut.resize(kLevels);
+	rMipsOut[0] = rSource;
+
+	// Large levels filter the one above, ping ponging between two linear images with rows across the jobs.
+	LinearImage linear[2], scratch;
+	decode_to_linear(rSource, bSRGB, linear[0], pJobs);
+
+	u32 level = 1;
+	for (; level < kLevels; ++level)
+	{
+		const LinearImage& rPrev = linear[(level - 1) & 1];
+		if (size_t(rPrev.m_width) * rPrev.m_height <= kMipTailTexels)
+			break;
+
+		LinearImage& rNext = linear[level & 1];
+
+		u32 width, height;
+		mip_level_size(rSource.m_width, rSource.m_height, level, width, height);
+		rNext.resize(width, height);
+
+		downsample(rPrev, filter, scratch, rNext, pJobs);
+		encode_from_linear(rNext, bSRGB, rMipsOut[level], pJobs);
+	}
+
+	// The tail levels each resample the last large level directly, so they don't depend on one another and
+	// run a level per job. The filter footprint widens with the ratio, so each still band limits to its own size.
+	const LinearImage& rTailBase = linear[(level - 1) & 1];
+	const u32 kFirstTail = level;
+	run_jobs(pJobs, kLevels - kFirstTail, 1, [&](u32 kBegin, u32 kEnd)
+	{
+		LinearImage tailScratch, tailLevel;
+		for (u32 t = kBegin; t < kEnd; ++t)
+		{
+			const u32 kLevel = kFirstTail + t;
+			u32 width, height;
+			mip_level_size(rSource.m_width, rSource.m_height, kLevel, width, height);
+			tailLevel.resize(width, height);
+
+			downsample(rTailBase, filter, tailScratch, tailLevel, nullptr);
+			encode_from_linear(tailLevel, bSRGB, rMipsOut[kLevel], nullptr);
+		}
+	});
+}
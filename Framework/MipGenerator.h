@@ -0,0 +1,32 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "Image.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Mip Generation
+// Builds full mip chains on the CPU. Filtering happens in linear space so
+// sRGB sources don't darken as they shrink, and non power of two levels are
+// resampled with a separable polyphase filter rather than 2x2 averaging.
+//================================================================================
+
+enum EMipFilter
+{
+	kMipFilter_Box,		// area weighted average, cheap and never rings.
+	kMipFilter_Kaiser,	// Kaiser windowed sinc, sharper distant detail.
+};
+
+// Number of levels down to and including 1x1.
+u32 mip_level_count(const u32 kWidth, const u32 kHeight);
+
+// Dimensions of a level, each axis halves (rounding down) and stops at 1.
+void mip_level_size(const u32 kWidth, const u32 kHeight, const u32 kLevel, u32& rWidthOut, u32& rHeightOut);
+
+// Generate every level below the source, rMipsOut[0] is a copy of the source.
+// With a job system, rows of the large levels are spread across it, then the small levels
+// are each filtered from the last large one, a level per job.
+void generate_mip_chain(const Image& rSource, EMipFilter filter, bool bSRGB, std::vector<Image>& rMipsOut, JobSystem* pJobs);
@@ -0,0 +1,339 @@
+#include "OcclusionCuller.h"
+#include "JobQueue.h"
+
+#include <cfloat>
+
+namespace
+{
+
+constexpr u32 kTileWidth = 32;
+constexpr u32 kTileHeight = 8;
+
+// Triangles per setup job.
+constexpr u32 kSetupGrain = 256;
+
+void run(JobSystem* pJobs, const u32 kCount, const u32 kGrain, const JobSystem::RangeJob& job)
+{
+	if (pJobs)
+		pJobs->parallelFor(kCount, kGrain, job);
+	else
+		job(0, kCount);
+}
+
+// Faces of a box as corner indices, bit 0 picks max x, bit 1 max y and bit 2 max z.
+// Each quad is listed clockwise seen from outside, a D3D front face.
+constexpr u16 kBoxIndices[36] =
+{
+	0, 1, 3,  0, 3, 2,		// -z
+	4, 6, 7,  4, 7, 5,		// +z
+	0, 2, 6,  0, 6, 4,		// -x
+	1, 5, 7,  1, 7, 3,		// +x
+	0, 4, 5,  0, 5, 1,		// -y
+	2, 3, 7,  2, 7, 6,		// +y
+};
+
+void box_corners(const v3& vMin, const v3& vMax, v3 cornersOut[8])
+{
+	for (u32 i = 0; i < 8; ++i)
+		cornersOut[i] = v3(i & 1 ? vMax.x : vMin.x, i & 2 ? vMax.y : vMin.y, i & 4 ? vMax.z : vMin.z);
+}
+
+} // namespace
+
+void OcclusionCuller::init(const OcclusionCullerDesc& rDesc)
+{
+	ASSERT(rDesc.m_width % kTileWidth == 0 && rDesc.m_height % kTileHeight == 0);
+
+	m_desc = rDesc;
+	m_tilesX = rDesc.m_width / kTileWidth;
+	m_tilesY = rDesc.m_height / kTileHeight;
+	m_tiles.resize(m_tilesX * m_tilesY);
+}
+
+void OcclusionCuller::begin_frame(const m4x4& rViewProjection)
+{
+	m_viewProjection = rViewProjection;
+
+	for (Tile& rTile : m_tiles)
+	{
+		rTile.m_z0 = 1.f;
+		rTile.m_z1 = 0.f;
+		std::fill(rTile.m_mask, rTile.m_mask + kTileHeight, 0u);
+	}
+
+	m_clipVertices.clear();
+	m_triangleIndices.clear();
+	m_cullBackFaces.clear();
+	m_stats = {};
+}
+
+void OcclusionCuller::add_occluder(const v3* pVertices, const u32 kVertexCount, const u16* pIndices, const u32 kIndexCount, const m4x4& rWorld, const bool kCullBackFaces)
+{
+	const m4x4 kWorldViewProjection = rWorld * m_viewProjection;
+	const u32 kBase = static_cast<u32>(m_clipVertices.size());
+	for (u32 i = 0; i < kVertexCount; ++i)
+		m_clipVertices.push_back(v4::Transform(v4(pVertices[i], 1.f), kWorldViewProjection));
+
+	for (u32 i = 0; i + 2 < kIndexCount; i += 3)
+	{
+		m_triangleIndices.push_back(kBase + pIndices[i]);
+		m_triangleIndices.push_back(kBase + pIndices[i + 1]);
+		m_triangleIndices.push_back(kBase + pIndices[i + 2]);
+		m_cullBackFaces.push_back(kCullBackFaces ? 1 : 0);
+	}
+
+	++m_stats.m_occluders;
+	m_stats.m_triangles += kIndexCount / 3;
+}
+
+void OcclusionCuller::add_occluder_box(const v3& vMin, const v3& vMax, const m4x4& rWorld)
+{
+	v3 corners[8];
+	box_corners(vMin, vMax, corners);
+	add_occluder(corners, 8, kBoxIndices, 36, rWorld, true);
+}
+
+bool OcclusionCuller::setup_triangle(const v4& a, const v4& b, const v4& c, const bool kCullBackFaces, ScreenTriangle& rTriangleOut) const
+{
+	// In front of the near plane or dropped, D3D clip space z runs from 0 to w.
+	if (a.z < 0.f || b.z < 0.f || c.z < 0.f)
+		return false;
+
+	const v4* pVertices[3] = { &a, &b, &c };
+	const f32 kWidth = f32(m_desc.m_width);
+	const f32 kHeight = f32(m_desc.m_height);
+	f32 z[3];
+	for (u32 i = 0; i < 3; ++i)
+	{
+		const f32 kInvW = 1.f / pVertices[i]->w;
+		rTriangleOut.m_x[i] = (pVertices[i]->x * kInvW * 0.5f + 0.5f) * kWidth;
+		rTriangleOut.m_y[i] = (0.5f - pVertices[i]->y * kInvW * 0.5f) * kHeight;
+		z[i] = pVertices[i]->z * kInvW;
+	}
+
+	// Positive when clockwise on screen with y down. Turn back faces around when they are kept.
+	const f32* x = rTriangleOut.m_x;
+	const f32* y = rTriangleOut.m_y;
+	f32 area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (area < 0.f && !kCullBackFaces)
+	{
+		std::swap(rTriangleOut.m_x[1], rTriangleOut.m_x[2]);
+		std::swap(rTriangleOut.m_y[1], rTriangleOut.m_y[2]);
+		std::swap(z[1], z[2]);
+		area = -area;
+	}
+	if (!(area > 0.f))
+		return false;
+
+	const f32 kMinX = std::min(std::min(x[0], x[1]), x[2]);
+	const f32 kMaxX = std::max(std::max(x[0], x[1]), x[2]);
+	const f32 kMinY = std::min(std::min(y[0], y[1]), y[2]);
+	const f32 kMaxY = std::max(std::max(y[0], y[1]), y[2]);
+
+	// Pixels whose centres might be inside, clamped to the screen.
+	rTriangleOut.m_minX = std::max(s32(ceilf(kMinX - 0.5f)), 0);
+	rTriangleOut.m_maxX = std::min(s32(floorf(kMaxX - 0.5f)), s32(m_desc.m_width) - 1);
+	rTriangleOut.m_minY = std::max(s32(ceilf(kMinY - 0.5f)), 0);
+	rTriangleOut.m_maxY = std::min(s32(floorf(kMaxY - 0.5f)), s32(m_desc.m_height) - 1);
+	if (rTriangleOut.m_minX > rTriangleOut.m_maxX || rTriangleOut.m_minY > rTriangleOut.m_maxY)
+		return false;
+
+	// z / w is linear in screen space.
+	const f32 kInvArea = 1.f / area;
+	const f32 kDz1 = z[1] - z[0];
+	const f32 kDz2 = z[2] - z[0];
+	rTriangleOut.m_dzdx = (kDz1 * (y[2] - y[0]) - kDz2 * (y[1] - y[0])) * kInvArea;
+	rTriangleOut.m_dzdy = (kDz2 * (x[1] - x[0]) - kDz1 * (x[2] - x[0])) * kInvArea;
+	rTriangleOut.m_z = z[0];
+	rTriangleOut.m_zMax = std::max(std::max(z[0], z[1]), z[2]);
+	return true;
+}
+
+void OcclusionCuller::update_tile(Tile& rTile, const u32 kCoverage[8], const f32 kZ)
+{
+	// Behind what the tile already has everywhere, nothing to gain.
+	if (kZ >= rTile.m_z0)
+		return;
+
+	// Much nearer than the working layer, measured against how far that layer is from the reference:
+	// start the layer again from this triangle rather than push it back.
+	const bool kRestart = rTile.m_z1 - kZ > rTile.m_z0 - rTile.m_z1;
+
+	u32 full = ~0u;
+	for (u32 r = 0; r < kTileHeight; ++r)
+	{
+		rTile.m_mask[r] = kRestart ? kCoverage[r] : rTile.m_mask[r] | kCoverage[r];
+		full &= rTile.m_mask[r];
+	}
+	rTile.m_z1 = kRestart ? kZ : std::max(rTile.m_z1, kZ);
+
+	if (full == ~0u)
+	{
+		rTile.m_z0 = std::min(rTile.m_z0, rTile.m_z1);
+		rTile.m_z1 = 0.f;
+		std::fill(rTile.m_mask, rTile.m_mask + kTileHeight, 0u);
+	}
+}
+
+void OcclusionCuller::rasterize_rows(const ScreenTriangle& t, const u32 kFirstTileRow, const u32 kEndTileRow)
+{
+	const s32 kFirstY = std::max(t.m_minY, s32(kFirstTileRow * kTileHeight));
+	const s32 kLastY = std::min(t.m_maxY, s32(kEndTileRow * kTileHeight) - 1);
+	if (kFirstY > kLastY)
+		return;
+
+	// Span of covered pixel centres on each row, from the three edge functions.
+	// Edge k runs from vertex k to the next, inside is where A * x + B >= 0.
+	f32 edgeA[3], edgeInvA[3], edgeDx[3], edgeY0[3], edgeX0[3];
+	for (u32 k = 0; k < 3; ++k)
+	{
+		const u32 n = (k + 1) % 3;
+		edgeA[k] = -(t.m_y[n] - t.m_y[k]);
+		edgeInvA[k] = edgeA[k] != 0.f ? 1.f / edgeA[k] : 0.f;
+		edgeDx[k] = t.m_x[n] - t.m_x[k];
+		edgeX0[k] = t.m_x[k];
+		edgeY0[k] = t.m_y[k];
+	}
+
+	s32 spanStart[kTileHeight], spanEnd[kTileHeight];
+	const u32 kFirstTile = u32(kFirstY) / kTileHeight;
+	const u32 kLastTile = u32(kLastY) / kTileHeight;
+	for (u32 tileY = kFirstTile; tileY <= kLastTile; ++tileY)
+	{
+		bool bAnyRow = false;
+		for (u32 r = 0; r < kTileHeight; ++r)
+		{
+			const s32 kY = s32(tileY * kTileHeight + r);
+			s32 start = t.m_minX;
+			s32 end = t.m_maxX;
+			if (kY < kFirstY || kY > kLastY)
+				end = start - 1;
+
+			const f32 kPy = kY + 0.5f;
+			for (u32 k = 0; k < 3 && start <= end; ++k)
+			{
+				const f32 kB = edgeDx[k] * (kPy - edgeY0[k]) - edgeA[k] * edgeX0[k];
+				if (edgeA[k] > 0.f)
+					start = std::max(start, s32(ceilf(-kB * edgeInvA[k] - 0.5f)));
+				else if (edgeA[k] < 0.f)
+					end = std::min(end, s32(floorf(-kB * edgeInvA[k] - 0.5f)));
+				else if (kB < 0.f)
+					end = start - 1;
+			}
+
+			spanStart[r] = start;
+			spanEnd[r] = end;
+			bAnyRow |= start <= end;
+		}
+		if (!bAnyRow)
+			continue;
+
+		const f32 kTileTop = f32(tileY * kTileHeight);
+		const f32 kTileBottom = kTileTop + kTileHeight;
+		for (u32 tileX = u32(t.m_minX) / kTileWidth; tileX <= u32(t.m_maxX) / kTileWidth; ++tileX)
+		{
+			const s32 kLeft = s32(tileX * kTileWidth);
+			u32 coverage[kTileHeight];
+			u32 any = 0;
+			for (u32 r = 0; r < kTileHeight; ++r)
+			{
+				const s32 kStart = std::max(spanStart[r], kLeft) - kLeft;
+				const s32 kEnd = std::min(spanEnd[r], kLeft + s32(kTileWidth) - 1) - kLeft;
+				coverage[r] = kStart <= kEnd ? (~0u >> (31 - (kEnd - kStart))) << kStart : 0u;
+				any |= coverage[r];
+			}
+			if (!any)
+				continue;
+
+			// Furthest the triangle's plane gets over the tile, never past its furthest vertex.
+			const f32 kTileX0 = f32(kLeft) - t.m_x[0];
+			const f32 kTileX1 = kTileX0 + kTileWidth;
+			const f32 kTileY0 = kTileTop - t.m_y[0];
+			const f32 kTileY1 = kTileBottom - t.m_y[0];
+			const f32 kPlaneMax = t.m_z + std::max(t.m_dzdx * kTileX0, t.m_dzdx * kTileX1) + std::max(t.m_dzdy * kTileY0, t.m_dzdy * kTileY1);
+
+			update_tile(m_tiles[tileY * m_tilesX + tileX], coverage, std::min(kPlaneMax, t.m_zMax));
+		}
+	}
+}
+
+void OcclusionCuller::rasterize(JobSystem* pJobs)
+{
+	const s64 kStart = getTimeMicroseconds();
+
+	const u32 kTriangles = static_cast<u32>(m_cullBackFaces.size());
+	m_screenTriangles.resize(kTriangles);
+	run(pJobs, kTriangles, kSetupGrain, [&](u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			const u32* pIndices = &m_triangleIndices[i * 3];
+			ScreenTriangle& rTriangle = m_screenTriangles[i];
+			if (!setup_triangle(m_clipVertices[pIndices[0]], m_clipVertices[pIndices[1]], m_clipVertices[pIndices[2]], m_cullBackFaces[i] != 0, rTriangle))
+				rTriangle.m_minY = rTriangle.m_maxY + 1;
+		}
+	});
+
+	// Occluders are drawn in submission order so results don't depend on the thread count.
+	run(pJobs, m_tilesY, 1, [&](u32 begin, u32 end)
+	{
+		for (const ScreenTriangle& rTriangle : m_screenTriangles)
+			rasterize_rows(rTriangle, begin, end);
+	});
+
+	u32 rasterized = 0;
+	for (const ScreenTriangle& rTriangle : m_screenTriangles)
+		rasterized += rTriangle.m_minY <= rTriangle.m_maxY ? 1 : 0;
+
+	m_stats.m_rasterized = rasterized;
+	m_stats.m_rasterMs = (getTimeMicroseconds() - kStart) / 1000.0;
+}
+
+bool OcclusionCuller::test_box(const v3& vMin, const v3& vMax) const
+{
+	v3 corners[8];
+	box_corners(vMin, vMax, corners);
+
+	f32 minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (u32 i = 0; i < 8; ++i)
+	{
+		const v4 vClip = v4::Transform(v4(corners[i], 1.f), m_viewProjection);
+
+		// Reaching the near plane, nothing in the buffer can be in front of it.
+		if (vClip.z < 0.f)
+			return true;
+
+		const f32 kInvW = 1.f / vClip.w;
+		const f32 kX = (vClip.x * kInvW * 0.5f + 0.5f) * m_desc.m_width;
+		const f32 kY = (0.5f - vClip.y * kInvW * 0.5f) * m_desc.m_height;
+		minX = std::min(minX, kX);
+		maxX = std::max(maxX, kX);
+		minY = std::min(minY, kY);
+		maxY = std::max(maxY, kY);
+		minZ = std::min(minZ, vClip.z * kInvW);
+	}
+
+	if (maxX < 0.f || maxY < 0.f || minX >= f32(m_desc.m_width) || minY >= f32(m_desc.m_height))
+		return false;
+
+	const u32 kTileX0 = u32(std::max(minX, 0.f)) / kTileWidth;
+	const u32 kTileX1 = std::min(u32(maxX), m_desc.m_width - 1) / kTileWidth;
+	const u32 kTileY0 = u32(std::max(minY, 0.f)) / kTileHeight;
+	const u32 kTileY1 = std::min(u32(maxY), m_desc.m_height - 1) / kTileHeight;
+	for (u32 tileY = kTileY0; tileY <= kTileY1; ++tileY)
+	{
+		for (u32 tileX = kTileX0; tileX <= kTileX1; ++tileX)
+		{
+			if (minZ <= m_tiles[tileY * m_tilesX + tileX].m_z0)
+				return true;
+		}
+	}
+	return false;
+}
+
+void OcclusionCuller::tile_depths(std::vector<f32>& rDepthsOut) const
+{
+	rDepthsOut.resize(m_tiles.size());
+	for (size_t i = 0; i < m_tiles.size(); ++i)
+		rDepthsOut[i] = m_tiles[i].m_z0;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Occlusion Culler
+// A small CPU depth buffer of the big occluders, so objects hidden behind
+// them can be skipped before any draw is issued. After the masked occlusion
+// culling of Andersson et al.
+//
+// The buffer is tiles of 32x8 pixels and keeps no per pixel depth. A tile
+// holds a reference depth everything in it is known to be in front of, and a
+// working layer: a coverage mask with the furthest depth of the triangles
+// that made it. Once the mask fills the tile the working depth becomes the
+// reference. A triangle much nearer than the working layer starts a new one
+// instead of widening it. Forgetting a working layer only loses occlusion,
+// never hides anything that shows.
+//
+// Depth follows D3D, 0 at the near plane and 1 at the far plane. Triangles
+// crossing the near plane are dropped rather than clipped, which is only ever
+// conservative. Rasterizing runs in bands of tile rows across the job system,
+// each band owning its tiles outright.
+//
+// Occludees are tested as world space boxes. A box is visible when its
+// nearest depth is in front of the reference depth of any tile its screen
+// rectangle touches, or when it crosses the near plane.
+//================================================================================
+
+struct OcclusionCullerDesc
+{
+	u32 m_width = 256;		// a multiple of 32.
+	u32 m_height = 256;		// a multiple of 8.
+};
+
+class OcclusionCuller
+{
+public:
+
+	struct Stats
+	{
+		u32 m_occluders;
+		u32 m_triangles;		// submitted.
+		u32 m_rasterized;		// left after near plane, back face and screen rejection.
+		f64 m_rasterMs;			// triangle setup and rasterizing, excludes add_occluder's transform.
+	};
+
+	void init(const OcclusionCullerDesc& rDesc);
+
+	// Empty the buffer and the occluder list for a new view.
+	void begin_frame(const m4x4& rViewProjection);
+
+	// Queue an indexed triangle list for this frame, transformed by rWorld then the view projection.
+	// Front faces are clockwise on screen as for D3D, back faces are skipped when asked.
+	void add_occluder(const v3* pVertices, const u32 kVertexCount, const u16* pIndices, const u32 kIndexCount, const m4x4& rWorld, const bool kCullBackFaces);
+
+	// A solid box, the cheapest stand-in for a large prop or wall.
+	void add_occluder_box(const v3& vMin, const v3& vMax, const m4x4& rWorld);
+
+	// Draw the queued occluders into the buffer.
+	void rasterize(JobSystem* pJobs);
+
+	// False only when the box is certainly hidden behind the occluders or off screen.
+	bool test_box(const v3& vMin, const v3& vMax) const;
+
+	// Reference depth of every tile, row major, for debugging and tests.
+	void tile_depths(std::vector<f32>& rDepthsOut) const;
+
+	u32 tiles_x() const { return m_tilesX; }
+	u32 tiles_y() const { return m_tilesY; }
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	struct Tile
+	{
+		f32 m_z0;			// reference, every pixel of the tile is at least this near.
+		f32 m_z1;			// furthest depth of the working layer.
+		u32 m_mask[8];		// working layer coverage, one row of 32 pixels per word.
+	};
+
+	// A triangle in pixels after setup, y down.
+	struct ScreenTriangle
+	{
+		f32 m_x[3], m_y[3];
+		f32 m_z, m_dzdx, m_dzdy;	// depth plane through the first vertex.
+		f32 m_zMax;
+		s32 m_minX, m_maxX, m_minY, m_maxY;		// inclusive pixel bounds, empty when rejected.
+	};
+
+	bool setup_triangle(const v4& a, const v4& b, const v4& c, const bool kCullBackFaces, ScreenTriangle& rTriangleOut) const;
+	void rasterize_rows(const ScreenTriangle& rTriangle, const u32 kFirstTileRow, const u32 kEndTileRow);
+	void update_tile(Tile& rTile, const u32 kCoverage[8], const f32 kZ);
+
+	OcclusionCullerDesc m_desc;
+	u32 m_tilesX = 0;
+	u32 m_tilesY = 0;
+	std::vector<Tile> m_tiles;
+	m4x4 m_viewProjection;
+
+	// This frame's occluders, clip space vertices and triangles as index triples into them.
+	std::vector<v4> m_clipVertices;
+	std::vector<u32> m_triangleIndices;
+	std::vector<u8> m_cullBackFaces;		// per triangle.
+	std::vector<ScreenTriangle> m_screenTriangles;
+
+	Stats m_stats = {};
+};
@@ -0,0 +1,373 @@
+#pragma once
+
+#include <cmath>
+
+//================================================================================
+// Portable Math
+// The part of SimpleMath the portable modules use, for builds without the
+// Windows SDK. Same layout and conventions: row vectors multiplied on the
+// left, row major matrices, left handed like the SimpleMath this tree ships.
+// CoreHeader.h picks SimpleMath on Windows, this everywhere else, so code
+// written against one compiles against the other.
+//================================================================================
+
+namespace PortableMath
+{
+
+struct Vector4;
+struct Matrix;
+
+//--------------------------------------------------------------------------------
+
+struct Vector2
+{
+	float x, y;
+
+	Vector2() : x(0.f), y(0.f) {}
+	explicit Vector2(const float f) : x(f), y(f) {}
+	Vector2(const float fx, const float fy) : x(fx), y(fy) {}
+
+	Vector2& operator+=(const Vector2& v) { x += v.x; y += v.y; return *this; }
+	Vector2& operator-=(const Vector2& v) { x -= v.x; y -= v.y; return *this; }
+	Vector2& operator*=(const float s) { x *= s; y *= s; return *this; }
+
+	bool operator==(const Vector2& v) const { return x == v.x && y == v.y; }
+	bool operator!=(const Vector2& v) const { return !(*this == v); }
+
+	float Length() const { return sqrtf(x * x + y * y); }
+	float LengthSquared() const { return x * x + y * y; }
+	float Dot(const Vector2& v) const { return x * v.x + y * v.y; }
+};
+
+inline Vector2 operator+(const Vector2& a, const Vector2& b) { return Vector2(a.x + b.x, a.y + b.y); }
+inline Vector2 operator-(const Vector2& a, const Vector2& b) { return Vector2(a.x - b.x, a.y - b.y); }
+inline Vector2 operator*(const Vector2& a, const Vector2& b) { return Vector2(a.x * b.x, a.y * b.y); }
+inline Vector2 operator*(const Vector2& v, const float s) { return Vector2(v.x * s, v.y * s); }
+inline Vector2 operator*(const float s, const Vector2& v) { return Vector2(v.x * s, v.y * s); }
+inline Vector2 operator/(const Vector2& v, const float s) { return Vector2(v.x / s, v.y / s); }
+
+//--------------------------------------------------------------------------------
+
+struct Vector3
+{
+	float x, y, z;
+
+	Vector3() : x(0.f), y(0.f), z(0.f) {}
+	explicit Vector3(const float f) : x(f), y(f), z(f) {}
+	Vector3(const float fx, const float fy, const float fz) : x(fx), y(fy), z(fz) {}
+	explicit Vector3(const Vector4& v);
+
+	Vector3& operator+=(const Vector3& v) { x += v.x; y += v.y; z += v.z; return *this; }
+	Vector3& operator-=(const Vector3& v) { x -= v.x; y -= v.y; z -= v.z; return *this; }
+	Vector3& operator*=(const Vector3& v) { x *= v.x; y *= v.y; z *= v.z; return *this; }
+	Vector3& operator*=(const float s) { x *= s; y *= s; z *= s; return *this; }
+	Vector3& operator/=(const float s) { x /= s; y /= s; z /= s; return *this; }
+	Vector3 operator-() const { return Vector3(-x, -y, -z); }
+	Vector3 operator+() const { return *this; }
+
+	bool operator==(const Vector3& v) const { return x == v.x && y == v.y && z == v.z; }
+	bool operator!=(const Vector3& v) const { return !(*this == v); }
+
+	float Length() const { return sqrtf(x * x + y * y + z * z); }
+	float LengthSquared() const { return x * x + y * y + z * z; }
+	float Dot(const Vector3& v) const { return x * v.x + y * v.y + z * v.z; }
+	Vector3 Cross(const Vector3& v) const { return Vector3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x); }
+
+	// Zero length stays zero, as XMVector3Normalize leaves it.
+	void Normalize()
+	{
+		const float kLength = Length();
+		if (kLength > 0.f)
+			*this /= kLength;
+	}
+	void Normalize(Vector3& result) const { result = *this; result.Normalize(); }
+
+	static float Distance(const Vector3& a, const Vector3& b) { return Vector3(a.x - b.x, a.y - b.y, a.z - b.z).Length(); }
+	static float DistanceSquared(const Vector3& a, const Vector3& b) { return Vector3(a.x - b.x, a.y - b.y, a.z - b.z).LengthSquared(); }
+	static Vector3 Min(const Vector3& a, const Vector3& b) { return Vector3(fminf(a.x, b.x), fminf(a.y, b.y), fminf(a.z, b.z)); }
+	static Vector3 Max(const Vector3& a, const Vector3& b) { return Vector3(fmaxf(a.x, b.x), fmaxf(a.y, b.y), fmaxf(a.z, b.z)); }
+	static Vector3 Lerp(const Vector3& a, const Vector3& b, const float t) { return Vector3(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t); }
+
+	// As a point, divided through by w like XMVector3TransformCoord.
+	static Vector3 Transform(const Vector3& v, const Matrix& m);
+
+	// As a direction, the translation row is ignored.
+	static Vector3 TransformNormal(const Vector3& v, const Matrix& m);
+
+	static const Vector3 Zero;
+	static const Vector3 One;
+	static const Vector3 UnitX;
+	static const Vector3 UnitY;
+	static const Vector3 UnitZ;
+};
+
+inline Vector3 operator+(const Vector3& a, const Vector3& b) { return Vector3(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Vector3 operator-(const Vector3& a, const Vector3& b) { return Vector3(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Vector3 operator*(const Vector3& a, const Vector3& b) { return Vector3(a.x * b.x, a.y * b.y, a.z * b.z); }
+inline Vector3 operator*(const Vector3& v, const float s) { return Vector3(v.x * s, v.y * s, v.z * s); }
+inline Vector3 operator*(const float s, const Vector3& v) { return Vector3(v.x * s, v.y * s, v.z * s); }
+inline Vector3 operator/(const Vector3& a, const Vector3& b) { return Vector3(a.x / b.x, a.y / b.y, a.z / b.z); }
+inline Vector3 operator/(const Vector3& v, const float s) { return Vector3(v.x / s, v.y / s, v.z / s); }
+
+inline const Vector3 Vector3::Zero(0.f, 0.f, 0.f);
+inline const Vector3 Vector3::One(1.f, 1.f, 1.f);
+inline const Vector3 Vector3::UnitX(1.f, 0.f, 0.f);
+inline const Vector3 Vector3::UnitY(0.f, 1.f, 0.f);
+inline const Vector3 Vector3::UnitZ(0.f, 0.f, 1.f);
+
+//--------------------------------------------------------------------------------
+
+struct Vector4
+{
+	float x, y, z, w;
+
+	Vector4() : x(0.f), y(0.f), z(0.f), w(0.f) {}
+	explicit Vector4(const float f) : x(f), y(f), z(f), w(f) {}
+	Vector4(const float fx, const float fy, const float fz, const float fw) : x(fx), y(fy), z(fz), w(fw) {}
+	Vector4(const Vector3& v, const float fw) : x(v.x), y(v.y), z(v.z), w(fw) {}
+
+	Vector4& operator+=(const Vector4& v) { x += v.x; y += v.y; z += v.z; w += v.w; return *this; }
+	Vector4& operator-=(const Vector4& v) { x -= v.x; y -= v.y; z -= v.z; w -= v.w; return *this; }
+	Vector4& operator*=(const float s) { x *= s; y *= s; z *= s; w *= s; return *this; }
+	Vector4& operator/=(const float s) { x /= s; y /= s; z /= s; w /= s; return *this; }
+	Vector4 operator-() const { return Vector4(-x, -y, -z, -w); }
+
+	bool operator==(const Vector4& v) const { return x == v.x && y == v.y && z == v.z && w == v.w; }
+	bool operator!=(const Vector4& v) const { return !(*this == v); }
+
+	float Length() const { return sqrtf(x * x + y * y + z * z + w * w); }
+	float LengthSquared() const { return x * x + y * y + z * z + w * w; }
+	float Dot(const Vector4& v) const { return x * v.x + y * v.y + z * v.z + w * v.w; }
+
+	void Normalize()
+	{
+		const float kLength = Length();
+		if (kLength > 0.f)
+			*this /= kLength;
+	}
+
+	static Vector4 Transform(const Vector4& v, const Matrix& m);
+};
+
+inline Vector4 operator+(const Vector4& a, const Vector4& b) { return Vector4(a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w); }
+inline Vector4 operator-(const Vector4& a, const Vector4& b) { return Vector4(a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w); }
+inline Vector4 operator*(const Vector4& a, const Vector4& b) { return Vector4(a.x * b.x, a.y * b.y, a.z * b.z, a.w * b.w); }
+inline Vector4 operator*(const Vector4& v, const float s) { return Vector4(v.x * s, v.y * s, v.z * s, v.w * s); }
+inline Vector4 operator*(const float s, const Vector4& v) { return Vector4(v.x * s, v.y * s, v.z * s, v.w * s); }
+inline Vector4 operator/(const Vector4& v, const float s) { return Vector4(v.x / s, v.y / s, v.z / s, v.w / s); }
+
+inline Vector3::Vector3(const Vector4& v) : x(v.x), y(v.y), z(v.z) {}
+
+//--------------------------------------------------------------------------------
+
+struct Matrix
+{
+	union
+	{
+		struct
+		{
+			float _11, _12, _13, _14;
+			float _21, _22, _23, _24;
+			float _31, _32, _33, _34;
+			float _41, _42, _43, _44;
+		};
+		float m[4][4];
+	};
+
+	Matrix() : Matrix(1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f) {}
+	Matrix(const float m00, const float m01, const float m02, const float m03
+		, const float m10, const float m11, const float m12, const float m13
+		, const float m20, const float m21, const float m22, const float m23
+		, const float m30, const float m31, const float m32, const float m33)
+		: _11(m00), _12(m01), _13(m02), _14(m03)
+		, _21(m10), _22(m11), _23(m12), _24(m13)
+		, _31(m20), _32(m21), _33(m22), _34(m23)
+		, _41(m30), _42(m31), _43(m32), _44(m33)
+	{}
+	Matrix(const Vector3& r0, const Vector3& r1, const Vector3& r2)
+		: Matrix(r0.x, r0.y, r0.z, 0.f, r1.x, r1.y, r1.z, 0.f, r2.x, r2.y, r2.z, 0.f, 0.f, 0.f, 0.f, 1.f)
+	{}
+	Matrix(const Vector4& r0, const Vector4& r1, const Vector4& r2, const Vector4& r3)
+		: Matrix(r0.x, r0.y, r0.z, r0.w, r1.x, r1.y, r1.z, r1.w, r2.x, r2.y, r2.z, r2.w, r3.x, r3.y, r3.z, r3.w)
+	{}
+
+	bool operator==(const Matrix& rOther) const
+	{
+		for (int r = 0; r < 4; ++r)
+			for (int c = 0; c < 4; ++c)
+				if (m[r][c] != rOther.m[r][c])
+					return false;
+		return true;
+	}
+	bool operator!=(const Matrix& rOther) const { return !(*this == rOther); }
+
+	Matrix& operator*=(const Matrix& rOther);
+
+	Vector3 Translation() const { return Vector3(_41, _42, _43); }
+	void Translation(const Vector3& v) { _41 = v.x; _42 = v.y; _43 = v.z; }
+
+	Matrix Transpose() const
+	{
+		return Matrix(_11, _21, _31, _41, _12, _22, _32, _42, _13, _23, _33, _43, _14, _24, _34, _44);
+	}
+
+	// General inverse by cofactors, a singular matrix comes back as it went in.
+	Matrix Invert() const;
+
+	static Matrix CreateTranslation(const Vector3& v) { return CreateTranslation(v.x, v.y, v.z); }
+	static Matrix CreateTranslation(const float x, const float y, const float z)
+	{
+		return Matrix(1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, x, y, z, 1.f);
+	}
+
+	static Matrix CreateScale(const float s) { return CreateScale(s, s, s); }
+	static Matrix CreateScale(const Vector3& v) { return CreateScale(v.x, v.y, v.z); }
+	static Matrix CreateScale(const float x, const float y, const float z)
+	{
+		return Matrix(x, 0.f, 0.f, 0.f, 0.f, y, 0.f, 0.f, 0.f, 0.f, z, 0.f, 0.f, 0.f, 0.f, 1.f);
+	}
+
+	static Matrix CreateRotationX(const float kRadians)
+	{
+		const float c = cosf(kRadians), s = sinf(kRadians);
+		return Matrix(1.f, 0.f, 0.f, 0.f, 0.f, c, s, 0.f, 0.f, -s, c, 0.f, 0.f, 0.f, 0.f, 1.f);
+	}
+	static Matrix CreateRotationY(const float kRadians)
+	{
+		const float c = cosf(kRadians), s = sinf(kRadians);
+		return Matrix(c, 0.f, -s, 0.f, 0.f, 1.f, 0.f, 0.f, s, 0.f, c, 0.f, 0.f, 0.f, 0.f, 1.f);
+	}
+	static Matrix CreateRotationZ(const float kRadians)
+	{
+		const float c = cosf(kRadians), s = sinf(kRadians);
+		return Matrix(c, s, 0.f, 0.f, -s, c, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f);
+	}
+
+	// XMMatrixLookAtLH.
+	static Matrix CreateLookAt(const Vector3& vEye, const Vector3& vTarget, const Vector3& vUp)
+	{
+		Vector3 r2 = vTarget - vEye;
+		r2.Normalize();
+		Vector3 r0 = vUp.Cross(r2);
+		r0.Normalize();
+		const Vector3 r1 = r2.Cross(r0);
+		return Matrix(r0.x, r1.x, r2.x, 0.f
+			, r0.y, r1.y, r2.y, 0.f
+			, r0.z, r1.z, r2.z, 0.f
+			, -r0.Dot(vEye), -r1.Dot(vEye), -r2.Dot(vEye), 1.f);
+	}
+
+	// XMMatrixPerspectiveFovLH, depth from zero at the near plane to one at the far.
+	static Matrix CreatePerspectiveFieldOfView(const float kFovY, const float kAspect, const float kNear, const float kFar)
+	{
+		const float kHeight = 1.f / tanf(0.5f * kFovY);
+		const float kWidth = kHeight / kAspect;
+		const float kRange = kFar / (kFar - kNear);
+		return Matrix(kWidth, 0.f, 0.f, 0.f, 0.f, kHeight, 0.f, 0.f, 0.f, 0.f, kRange, 1.f, 0.f, 0.f, -kRange * kNear, 0.f);
+	}
+
+	// XMMatrixPerspectiveOffCenterLH, the extents at the near plane.
+	static Matrix CreatePerspectiveOffCenter(const float kLeft, const float kRight, const float kBottom, const float kTop, const float kNear, const float kFar)
+	{
+		const float kTwoNear = kNear + kNear;
+		const float kReciprocalWidth = 1.f / (kRight - kLeft);
+		const float kReciprocalHeight = 1.f / (kTop - kBottom);
+		const float kRange = kFar / (kFar - kNear);
+		return Matrix(kTwoNear * kReciprocalWidth, 0.f, 0.f, 0.f
+			, 0.f, kTwoNear * kReciprocalHeight, 0.f, 0.f
+			, -(kLeft + kRight) * kReciprocalWidth, -(kTop + kBottom) * kReciprocalHeight, kRange, 1.f
+			, 0.f, 0.f, -kRange * kNear, 0.f);
+	}
+
+	// XMMatrixOrthographicOffCenterLH.
+	static Matrix CreateOrthographicOffCenter(const float kLeft, const float kRight, const float kBottom, const float kTop, const float kNear, const float kFar)
+	{
+		const float kReciprocalWidth = 1.f / (kRight - kLeft);
+		const float kReciprocalHeight = 1.f / (kTop - kBottom);
+		const float kRange = 1.f / (kFar - kNear);
+		return Matrix(kReciprocalWidth + kReciprocalWidth, 0.f, 0.f, 0.f
+			, 0.f, kReciprocalHeight + kReciprocalHeight, 0.f, 0.f
+			, 0.f, 0.f, kRange, 0.f
+			, -(kLeft + kRight) * kReciprocalWidth, -(kTop + kBottom) * kReciprocalHeight, -kRange * kNear, 1.f);
+	}
+
+	static const Matrix Identity;
+};
+
+inline const Matrix Matrix::Identity;
+
+inline Matrix operator*(const Matrix& a, const Matrix& b)
+{
+	Matrix r;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+		{
+			r.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+	}
+	return r;
+}
+
+inline Matrix& Matrix::operator*=(const Matrix& rOther)
+{
+	*this = *this * rOther;
+	return *this;
+}
+
+inline Matrix Matrix::Invert() const
+{
+	const float* a = &m[0][0];
+	float inv[16];
+
+	inv[0] = a[5] * a[10] * a[15] - a[5] * a[11] * a[14] - a[9] * a[6] * a[15] + a[9] * a[7] * a[14] + a[13] * a[6] * a[11] - a[13] * a[7] * a[10];
+	inv[4] = -a[4] * a[10] * a[15] + a[4] * a[11] * a[14] + a[8] * a[6] * a[15] - a[8] * a[7] * a[14] - a[12] * a[6] * a[11] + a[12] * a[7] * a[10];
+	inv[8] = a[4] * a[9] * a[15] - a[4] * a[11] * a[13] - a[8] * a[5] * a[15] + a[8] * a[7] * a[13] + a[12] * a[5] * a[11] - a[12] * a[7] * a[9];
+	inv[12] = -a[4] * a[9] * a[14] + a[4] * a[10] * a[13] + a[8] * a[5] * a[14] - a[8] * a[6] * a[13] - a[12] * a[5] * a[10] + a[12] * a[6] * a[9];
+	inv[1] = -a[1] * a[10] * a[15] + a[1] * a[11] * a[14] + a[9] * a[2] * a[15] - a[9] * a[3] * a[14] - a[13] * a[2] * a[11] + a[13] * a[3] * a[10];
+	inv[5] = a[0] * a[10] * a[15] - a[0] * a[11] * a[14] - a[8] * a[2] * a[15] + a[8] * a[3] * a[14] + a[12] * a[2] * a[11] - a[12] * a[3] * a[10];
+	inv[9] = -a[0] * a[9] * a[15] + a[0] * a[11] * a[13] + a[8] * a[1] * a[15] - a[8] * a[3] * a[13] - a[12] * a[1] * a[11] + a[12] * a[3] * a[9];
+	inv[13] = a[0] * a[9] * a[14] - a[0] * a[10] * a[13] - a[8] * a[1] * a[14] + a[8] * a[2] * a[13] + a[12] * a[1] * a[10] - a[12] * a[2] * a[9];
+	inv[2] = a[1] * a[6] * a[15] - a[1] * a[7] * a[14] - a[5] * a[2] * a[15] + a[5] * a[3] * a[14] + a[13] * a[2] * a[7] - a[13] * a[3] * a[6];
+	inv[6] = -a[0] * a[6] * a[15] + a[0] * a[7] * a[14] + a[4] * a[2] * a[15] - a[4] * a[3] * a[14] - a[12] * a[2] * a[7] + a[12] * a[3] * a[6];
+	inv[10] = a[0] * a[5] * a[15] - a[0] * a[7] * a[13] - a[4] * a[1] * a[15] + a[4] * a[3] * a[13] + a[12] * a[1] * a[7] - a[12] * a[3] * a[5];
+	inv[14] = -a[0] * a[5] * a[14] + a[0] * a[6] * a[13] + a[4] * a[1] * a[14] - a[4] * a[2] * a[13] - a[12] * a[1] * a[6] + a[12] * a[2] * a[5];
+	inv[3] = -a[1] * a[6] * a[11] + a[1] * a[7] * a[10] + a[5] * a[2] * a[11] - a[5] * a[3] * a[10] - a[9] * a[2] * a[7] + a[9] * a[3] * a[6];
+	inv[7] = a[0] * a[6] * a[11] - a[0] * a[7] * a[10] - a[4] * a[2] * a[11] + a[4] * a[3] * a[10] + a[8] * a[2] * a[7] - a[8] * a[3] * a[6];
+	inv[11] = -a[0] * a[5] * a[11] + a[0] * a[7] * a[9] + a[4] * a[1] * a[11] - a[4] * a[3] * a[9] - a[8] * a[1] * a[7] + a[8] * a[3] * a[5];
+	inv[15] = a[0] * a[5] * a[10] - a[0] * a[6] * a[9] - a[4] * a[1] * a[10] + a[4] * a[2] * a[9] + a[8] * a[1] * a[6] - a[8] * a[2] * a[5];
+
+	const float kDeterminant = a[0] * inv[0] + a[1] * inv[4] + a[2] * inv[8] + a[3] * inv[12];
+	if (kDeterminant == 0.f)
+		return *this;
+
+	const float kScale = 1.f / kDeterminant;
+	Matrix r;
+	float* pOut = &r.m[0][0];
+	for (int i = 0; i < 16; ++i)
+		pOut[i] = inv[i] * kScale;
+	return r;
+}
+
+//--------------------------------------------------------------------------------
+
+inline Vector4 Vector4::Transform(const Vector4& v, const Matrix& m)
+{
+	return Vector4(v.x * m._11 + v.y * m._21 + v.z * m._31 + v.w * m._41
+		, v.x * m._12 + v.y * m._22 + v.z * m._32 + v.w * m._42
+		, v.x * m._13 + v.y * m._23 + v.z * m._33 + v.w * m._43
+		, v.x * m._14 + v.y * m._24 + v.z * m._34 + v.w * m._44);
+}
+
+inline Vector3 Vector3::Transform(const Vector3& v, const Matrix& m)
+{
+	const Vector4 kPoint = Vector4::Transform(Vector4(v, 1.f), m);
+	return Vector3(kPoint.x / kPoint.w, kPoint.y / kPoint.w, kPoint.z / kPoint.w);
+}
+
+inline Vector3 Vector3::TransformNormal(const Vector3& v, const Matrix& m)
+{
+	return Vector3(Vector4::Transform(Vector4(v, 0.f), m));
+}
+
+} // namespace PortableMath
@@ -0,0 +1,265 @@
+#include "RenderDevice.h"
+
+#include <map>
+#include <tuple>
+
+namespace
+{
+
+// Folds call parameters into one value, FNV-1a over their bytes.
+u64 fold(u64 hash, const void* pData, const u32 kBytes)
+{
+	const u8* pBytes = static_cast<const u8*>(pData);
+	for (u32 i = 0; i < kBytes; ++i)
+		hash = (hash ^ pBytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+template<typename T>
+u64 fold(const u64 kHash, const T& rValue)
+{
+	return fold(kHash, &rValue, sizeof(T));
+}
+
+constexpr u64 kFoldSeed = 14695981039346656037ull;
+
+} // namespace
+
+void RecordingRenderDevice::set_input_layout(RenderInputLayout* pLayout)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_InputLayout];
+	log(kCall_InputLayout, 0, 0, pLayout, 0);
+}
+
+void RecordingRenderDevice::set_topology(const EPrimitiveTopology kTopology)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_Topology];
+	log(kCall_Topology, 0, 0, nullptr, kTopology);
+}
+
+void RecordingRenderDevice::set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_VertexBuffer];
+	log(kCall_VertexBuffer, 0, kSlot, pBuffer, (u64(kStride) << 32) | kOffset);
+}
+
+void RecordingRenderDevice::set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_IndexBuffer];
+	log(kCall_IndexBuffer, 0, 0, pBuffer, (u64(kFormat) << 32) | kOffset);
+}
+
+void RecordingRenderDevice::set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_Shader];
+	log(kCall_Shader, kStage, 0, pShader, 0);
+}
+
+void RecordingRenderDevice::set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_ConstantBuffer];
+	for (u32 i = 0; i < kCount; ++i)
+		log(kCall_ConstantBuffer, kStage, kSlot + i, ppBuffers[i], 0);
+}
+
+void RecordingRenderDevice::set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_ConstantBuffer];
+	log(kCall_ConstantBuffer, kStage, kSlot, pBuffer, (u64(kFirstConstant) << 32) | kConstants);
+}
+
+void RecordingRenderDevice::set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_ShaderResource];
+	for (u32 i = 0; i < kCount; ++i)
+		log(kCall_ShaderResource, kStage, kSlot + i, ppViews[i], 0);
+}
+
+void RecordingRenderDevice::set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_Sampler];
+	for (u32 i = 0; i < kCount; ++i)
+		log(kCall_Sampler, kStage, kSlot + i, ppSamplers[i], 0);
+}
+
+void RecordingRenderDevice::set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_BlendState];
+	log(kCall_BlendState, 0, 0, pState, fold(fold(kFoldSeed, kBlendFactor, sizeof(f32) * 4), kSampleMask));
+}
+
+void RecordingRenderDevice::set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_DepthStencilState];
+	log(kCall_DepthStencilState, 0, 0, pState, kStencilRef);
+}
+
+void RecordingRenderDevice::set_rasterizer_state(RenderRasterizerState* pState)
+{
+	++m_stats.m_stateChanges;
+	++m_callCounts[kCall_RasterizerState];
+	log(kCall_RasterizerState, 0, 0, pState, 0);
+}
+
+void RecordingRenderDevice::update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+	++m_callCounts[kCall_UpdateBuffer];
+	log(kCall_UpdateBuffer, 0, 0, pBuffer, fold(fold(kFoldSeed, pData, kBytes), kBytes));
+}
+
+void RecordingRenderDevice::write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+	++m_callCounts[kCall_UpdateBuffer];
+	log(kCall_UpdateBuffer, 0, kOffset, pBuffer, fold(fold(fold(kFoldSeed, pData, kBytes), kBytes), kDiscard));
+}
+
+void RecordingRenderDevice::draw(const u32 kVertices, const u32 kFirstVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	++m_callCounts[kCall_Draw];
+	log(kCall_Draw, 0, 0, nullptr, fold(fold(fold(kFoldSeed, 0), kVertices), kFirstVertex));
+}
+
+void RecordingRenderDevice::draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	++m_callCounts[kCall_Draw];
+	log(kCall_Draw, 0, 0, nullptr, fold(fold(fold(fold(kFoldSeed, 1), kIndices), kFirstIndex), kBaseVertex));
+}
+
+void RecordingRenderDevice::draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	++m_callCounts[kCall_Draw];
+	log(kCall_Draw, 0, 0, nullptr, fold(fold(fold(fold(fold(kFoldSeed, 2), kVertices), kInstances), kFirstVertex), kFirstInstance));
+}
+
+void RecordingRenderDevice::draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	++m_callCounts[kCall_Draw];
+	log(kCall_Draw, 0, 0, nullptr, fold(fold(fold(fold(fold(fold(kFoldSeed, 3), kIndices), kInstances), kFirstIndex), kBaseVertex), kFirstInstance));
+}
+
+void RecordingRenderDevice::dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ)
+{
+	++m_stats.m_dispatches;
+	++m_callCounts[kCall_Dispatch];
+	log(kCall_Dispatch, 0, 0, nullptr, fold(fold(fold(kFoldSeed, kGroupsX), kGroupsY), kGroupsZ));
+}
+
+void RecordingRenderDevice::append(const RecordingRenderDevice& rOther)
+{
+	m_calls.insert(m_calls.end(), rOther.m_calls.begin(), rOther.m_calls.end());
+	for (u32 c = 0; c < kMaxCalls; ++c)
+		m_callCounts[c] += rOther.m_callCounts[c];
+	accumulate_stats(m_stats, rOther.m_stats);
+}
+
+bool RecordingRenderDevice::same_draws(const RecordingRenderDevice& rOther) const
+{
+	// Bound state keyed by what it is bound to, buffer contents keyed by the buffer.
+	typedef std::tuple<u32, u32, u32, const void*> StateKey;
+	typedef std::map<StateKey, std::pair<const void*, u64>> State;
+
+	struct Replay
+	{
+		const std::vector<Call>& m_rCalls;
+		size_t m_next;
+		State m_state;
+
+		// Apply calls up to the next draw or dispatch, which is returned, or null past the end.
+		const Call* advance()
+		{
+			while (m_next < m_rCalls.size())
+			{
+				const Call& rCall = m_rCalls[m_next++];
+				if (rCall.m_call == kCall_Draw || rCall.m_call == kCall_Dispatch)
+					return &rCall;
+
+				const void* pKeyObject = rCall.m_call == kCall_UpdateBuffer ? rCall.m_pObject : nullptr;
+				m_state[StateKey(rCall.m_call, rCall.m_stage, rCall.m_slot, pKeyObject)] = std::make_pair(rCall.m_pObject, rCall.m_params);
+			}
+			return nullptr;
+		}
+	};
+
+	Replay mine = { m_calls, 0, State() };
+	Replay theirs = { rOther.m_calls, 0, State() };
+	for (;;)
+	{
+		const Call* pMine = mine.advance();
+		const Call* pTheirs = theirs.advance();
+		if (!pMine || !pTheirs)
+			return pMine == pTheirs;
+
+		if (pMine->m_call != pTheirs->m_call || pMine->m_params != pTheirs->m_params || mine.m_state != theirs.m_state)
+			return false;
+	}
+}
+
+void ShaderBinding::bind(RenderDevice& rDevice) const
+{
+	rDevice.set_input_layout(m_pShaders[ShaderStage::kVertex] ? m_pInputLayout : nullptr);
+	for (u32 stage = 0; stage < ShaderStage::kMaxStages; ++stage)
+		rDevice.set_shader(static_cast<ShaderStage::ShaderStageEnum>(stage), m_pShaders[stage]);
+}
+
+void MeshBinding::bind(RenderDevice& rDevice) const
+{
+	rDevice.set_topology(kPrimitiveTopology_TriangleList);
+	rDevice.set_vertex_buffer(0, m_pVertexBuffer, m_vertexStride, 0);
+
+	if (m_pIndexBuffer)
+	{
+		rDevice.set_index_buffer(m_pIndexBuffer, kIndexFormat_16, 0);
+	}
+}
+
+void MeshBinding::draw(RenderDevice& rDevice) const
+{
+	if (m_pIndexBuffer)
+	{
+		rDevice.draw_indexed(m_indices, 0, 0);
+	}
+	else
+	{
+		rDevice.draw(m_vertices, 0);
+	}
+}
+
+void MeshBinding::draw_instanced(RenderDevice& rDevice, const u32 kInstances) const
+{
+	if (m_pIndexBuffer)
+	{
+		rDevice.draw_indexed_instanced(m_indices, kInstances, 0, 0, 0);
+	}
+	else
+	{
+		rDevice.draw_instanced(m_vertices, kInstances, 0, 0);
+	}
+}
+
+void TextureBinding::bind(RenderDevice& rDevice, const ShaderStage::ShaderStageEnum kStage, const u32 kSlot) const
+{
+	rDevice.set_shader_resources(kStage, kSlot, 1, &m_pView);
+}
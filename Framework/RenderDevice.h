@@ -0,0 +1,291 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <array>
+#include <vector>
+
+//================================================================================
+// Render Device
+// The part of a device context the frame's draws go through, behind an
+// interface so the same submission code can run without a GPU.
+//
+// D3D11RenderDevice (D3D11RenderDevice.h) forwards to a context.
+// NullRenderDevice forwards nothing, so update, culling and submission can be
+// timed on their own. Both count what was asked of them: draws, state
+// changes, buffer maps and the bytes written through them.
+//
+// Resources are created up front by the backend, a device here only ever sees
+// opaque handles to them and the null device never looks behind those. A
+// backend defines the handle types, nothing on this side does.
+//================================================================================
+
+struct RenderBuffer;
+struct RenderInputLayout;
+struct RenderShader;
+struct RenderShaderView;
+struct RenderSampler;
+struct RenderBlendState;
+struct RenderDepthStencilState;
+struct RenderRasterizerState;
+
+// ========================================================
+// Shader stage enum
+// ========================================================
+namespace ShaderStage
+{
+	enum ShaderStageEnum
+	{
+		kVertex,
+		kHull,
+		kDomain,
+		kGeometry,
+		kPixel,
+		kCompute,
+
+		kMaxStages
+	};
+}
+
+enum EPrimitiveTopology
+{
+	kPrimitiveTopology_TriangleList,
+	kPrimitiveTopology_TriangleStrip,
+	kPrimitiveTopology_LineList,
+	kPrimitiveTopology_PointList,
+
+	kMaxPrimitiveTopologies
+};
+
+enum EIndexFormat
+{
+	kIndexFormat_16,
+	kIndexFormat_32
+};
+
+struct RenderDeviceStats
+{
+	u32 m_draws;
+	u32 m_instances;		// summed over draws, one for a plain draw.
+	u32 m_dispatches;
+	u32 m_stateChanges;		// every shader, layout, buffer, resource, sampler and fixed function state set.
+	u32 m_maps;
+	u64 m_uploadBytes;
+};
+
+inline void accumulate_stats(RenderDeviceStats& rTotal, const RenderDeviceStats& rStats)
+{
+	rTotal.m_draws += rStats.m_draws;
+	rTotal.m_instances += rStats.m_instances;
+	rTotal.m_dispatches += rStats.m_dispatches;
+	rTotal.m_stateChanges += rStats.m_stateChanges;
+	rTotal.m_maps += rStats.m_maps;
+	rTotal.m_uploadBytes += rStats.m_uploadBytes;
+}
+
+class RenderDevice
+{
+public:
+	virtual ~RenderDevice() {}
+
+	virtual void set_input_layout(RenderInputLayout* pLayout) = 0;
+	virtual void set_topology(const EPrimitiveTopology kTopology) = 0;
+	virtual void set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset) = 0;
+	virtual void set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset) = 0;
+
+	// A shader of the stage's kind, or null to leave the stage empty.
+	virtual void set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader) = 0;
+
+	virtual void set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers) = 0;
+	// A window of a larger buffer, kFirstConstant and kConstants in 16 byte constants, both multiples of 16.
+	virtual void set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants) = 0;
+	virtual void set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews) = 0;
+	virtual void set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers) = 0;
+
+	virtual void set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask) = 0;
+	virtual void set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef) = 0;
+	virtual void set_rasterizer_state(RenderRasterizerState* pState) = 0;
+
+	// Replace the whole of a dynamic buffer, a map with discard.
+	virtual void update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes) = 0;
+	// Write part of a dynamic buffer, a map without overwrite the GPU must be done with those bytes. Or a map with
+	// discard when kDiscard, the rest of the buffer is lost.
+	virtual void write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard) = 0;
+
+	virtual void draw(const u32 kVertices, const u32 kFirstVertex) = 0;
+	virtual void draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex) = 0;
+	virtual void draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance) = 0;
+	virtual void draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance) = 0;
+	virtual void dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ) = 0;
+
+	const RenderDeviceStats& stats() const { return m_stats; }
+	void reset_stats() { m_stats = {}; }
+
+protected:
+	RenderDeviceStats m_stats = {};
+};
+
+//--------------------------------------------------------------------------------
+// Counts and nothing else, for running the frame without a GPU.
+
+class NullRenderDevice final : public RenderDevice
+{
+public:
+	void set_input_layout(RenderInputLayout*) override { ++m_stats.m_stateChanges; }
+	void set_topology(const EPrimitiveTopology) override { ++m_stats.m_stateChanges; }
+	void set_vertex_buffer(const u32, RenderBuffer*, const u32, const u32) override { ++m_stats.m_stateChanges; }
+	void set_index_buffer(RenderBuffer*, const EIndexFormat, const u32) override { ++m_stats.m_stateChanges; }
+
+	void set_shader(const ShaderStage::ShaderStageEnum, RenderShader*) override { ++m_stats.m_stateChanges; }
+
+	void set_constant_buffers(const ShaderStage::ShaderStageEnum, const u32, const u32, RenderBuffer* const*) override { ++m_stats.m_stateChanges; }
+	void set_constant_buffer_range(const ShaderStage::ShaderStageEnum, const u32, RenderBuffer*, const u32, const u32) override { ++m_stats.m_stateChanges; }
+	void set_shader_resources(const ShaderStage::ShaderStageEnum, const u32, const u32, RenderShaderView* const*) override { ++m_stats.m_stateChanges; }
+	void set_samplers(const ShaderStage::ShaderStageEnum, const u32, const u32, RenderSampler* const*) override { ++m_stats.m_stateChanges; }
+
+	void set_blend_state(RenderBlendState*, const f32[4], const u32) override { ++m_stats.m_stateChanges; }
+	void set_depth_stencil_state(RenderDepthStencilState*, const u32) override { ++m_stats.m_stateChanges; }
+	void set_rasterizer_state(RenderRasterizerState*) override { ++m_stats.m_stateChanges; }
+
+	void update_buffer(RenderBuffer*, const void*, const u32 kBytes) override { ++m_stats.m_maps; m_stats.m_uploadBytes += kBytes; }
+	void write_buffer(RenderBuffer*, const u32, const void*, const u32 kBytes, const bool) override { ++m_stats.m_maps; m_stats.m_uploadBytes += kBytes; }
+
+	void draw(const u32, const u32) override { ++m_stats.m_draws; ++m_stats.m_instances; }
+	void draw_indexed(const u32, const u32, const s32) override { ++m_stats.m_draws; ++m_stats.m_instances; }
+	void draw_instanced(const u32, const u32 kInstances, const u32, const u32) override { ++m_stats.m_draws; m_stats.m_instances += kInstances; }
+	void draw_indexed_instanced(const u32, const u32 kInstances, const u32, const s32, const u32) override { ++m_stats.m_draws; m_stats.m_instances += kInstances; }
+	void dispatch(const u32, const u32, const u32) override { ++m_stats.m_dispatches; }
+};
+
+//--------------------------------------------------------------------------------
+// Keeps every call, for checking what a piece of rendering asks of the API
+// without a GPU. Ranges of slots are logged one slot at a time, and updates by
+// a hash of the bytes written. A partial write is logged as an update at its
+// offset, a constant buffer window as a constant buffer with its constants.
+
+class RecordingRenderDevice final : public RenderDevice
+{
+public:
+
+	enum ECall
+	{
+		kCall_InputLayout,
+		kCall_Topology,
+		kCall_VertexBuffer,
+		kCall_IndexBuffer,
+		kCall_Shader,
+		kCall_ConstantBuffer,
+		kCall_ShaderResource,
+		kCall_Sampler,
+		kCall_BlendState,
+		kCall_DepthStencilState,
+		kCall_RasterizerState,
+		kCall_UpdateBuffer,
+		kCall_Draw,
+		kCall_Dispatch,
+
+		kMaxCalls
+	};
+
+	struct Call
+	{
+		ECall m_call;
+		u32 m_stage;		// shader stage, or zero.
+		u32 m_slot;			// slot, or zero.
+		const void* m_pObject;
+		u64 m_params;		// everything else the call passes, folded together.
+	};
+
+	void clear() { m_calls.clear(); m_callCounts.fill(0); reset_stats(); }
+
+	const std::vector<Call>& calls() const { return m_calls; }
+
+	// API calls made of a kind, a range of slots counting once.
+	u32 calls(const ECall kCall) const { return m_callCounts[kCall]; }
+
+	// Add another recording's calls after this one's, as executing its command list would.
+	void append(const RecordingRenderDevice& rOther);
+
+	// True when both issued the same draws and dispatches in the same order, each seeing the same bound
+	// state and buffer contents. How that state got there, and how often it was set, doesn't matter.
+	bool same_draws(const RecordingRenderDevice& rOther) const;
+
+	void set_input_layout(RenderInputLayout* pLayout) override;
+	void set_topology(const EPrimitiveTopology kTopology) override;
+	void set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset) override;
+	void set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset) override;
+
+	void set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader) override;
+
+	void set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers) override;
+	void set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants) override;
+	void set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews) override;
+	void set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers) override;
+
+	void set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask) override;
+	void set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef) override;
+	void set_rasterizer_state(RenderRasterizerState* pState) override;
+
+	void update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes) override;
+	void write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard) override;
+
+	void draw(const u32 kVertices, const u32 kFirstVertex) override;
+	void draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex) override;
+	void draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance) override;
+	void draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance) override;
+	void dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ) override;
+
+private:
+
+	void log(const ECall kCall, const u32 kStage, const u32 kSlot, const void* pObject, const u64 kParams)
+	{
+		m_calls.push_back({ kCall, kStage, kSlot, pObject, kParams });
+	}
+
+	std::vector<Call> m_calls;
+	std::array<u32, kMaxCalls> m_callCounts = {};
+};
+
+// template to update entire constant buffer from CPU structure, through a device.
+template<typename ConstantBufferType>
+void push_constant_buffer(RenderDevice& rDevice, RenderBuffer* pBuffer, const ConstantBufferType& rData)
+{
+	rDevice.update_buffer(pBuffer, &rData, sizeof(ConstantBufferType));
+}
+
+//================================================================================
+// Bindings
+// What binding a shader set, mesh or texture takes, as handles. The resource
+// classes fill one in when they're created and bind through it, and anything
+// recording draws points at these rather than at the resources themselves.
+//================================================================================
+
+// Every stage is set, those the set doesn't use to null. The input layout goes with the vertex shader.
+struct ShaderBinding
+{
+	RenderInputLayout* m_pInputLayout;
+	RenderShader* m_pShaders[ShaderStage::kMaxStages];
+
+	void bind(RenderDevice& rDevice) const;
+};
+
+// A triangle list, the vertex buffer at slot 0 and 16 bit indices when there are any.
+struct MeshBinding
+{
+	RenderBuffer* m_pVertexBuffer;
+	RenderBuffer* m_pIndexBuffer;
+	u32 m_vertexStride;
+	u32 m_vertices;
+	u32 m_indices;
+
+	void bind(RenderDevice& rDevice) const;
+	void draw(RenderDevice& rDevice) const;
+	void draw_instanced(RenderDevice& rDevice, const u32 kInstances) const;
+};
+
+struct TextureBinding
+{
+	RenderShaderView* m_pView;
+
+	void bind(RenderDevice& rDevice, const ShaderStage::ShaderStageEnum kStage, const u32 kSlot) const;
+};
@@ -0,0 +1,81 @@
+#include "RingAllocator.h"
+
+void RingAllocator::init(const u32 kCapacity, const u32 kAlignment)
+{
+	ASSERT(kAlignment && !(kAlignment & (kAlignment - 1)));
+	m_capacity = kCapacity & ~(kAlignment - 1);
+	m_alignment = kAlignment;
+	m_head = 0;
+	m_tail = 0;
+	m_used = 0;
+	m_frameBytes = 0;
+	m_wraps = 0;
+	m_frames.clear();
+}
+
+u32 RingAllocator::allocate(const u32 kBytes)
+{
+	const u32 kSize = (kBytes + m_alignment - 1) & ~(m_alignment - 1);
+	if (!kSize || kSize > m_capacity)
+		return kRingAllocatorFull;
+
+	// Nothing held, start over from the front so the whole span is one piece.
+	if (!m_used)
+	{
+		m_head = 0;
+		m_tail = 0;
+		for (Frame& rFrame : m_frames)
+			rFrame.m_end = 0;
+	}
+
+	u32 offset = kRingAllocatorFull;
+	if (m_head > m_tail || !m_used)
+	{
+		// Free from the head to the end and from the start to the tail.
+		if (kSize <= m_capacity - m_head)
+		{
+			offset = m_head;
+		}
+		else if (kSize <= m_tail)
+		{
+			const u32 kPadding = m_capacity - m_head;
+			m_used += kPadding;
+			m_frameBytes += kPadding;
+			++m_wraps;
+			offset = 0;
+		}
+	}
+	else if (kSize <= m_tail - m_head)
+	{
+		// Wrapped, free between the head and the tail. Equal and held means full.
+		offset = m_head;
+	}
+
+	if (offset == kRingAllocatorFull)
+		return kRingAllocatorFull;
+
+	m_head = offset + kSize;
+	if (m_head == m_capacity)
+		m_head = 0;
+	m_used += kSize;
+	m_frameBytes += kSize;
+	return offset;
+}
+
+void RingAllocator::end_frame(const u64 kFence)
+{
+	m_frames.push_back({ kFence, m_head, m_frameBytes });
+	m_frameBytes = 0;
+}
+
+void RingAllocator::retire(const u64 kCompletedFence)
+{
+	u32 retired = 0;
+	while (retired < m_frames.size() && m_frames[retired].m_fence <= kCompletedFence)
+	{
+		const Frame& rFrame = m_frames[retired++];
+		m_tail = rFrame.m_end;
+		m_used -= rFrame.m_bytes;
+	}
+	m_frames.erase(m_frames.begin(), m_frames.begin() + retired);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <vector>
+
+//================================================================================
+// Ring Allocator
+// Offsets into a fixed span of memory handed out front to back for data the
+// GPU reads once, constants for a frame's draws say. Nothing is freed one
+// allocation at a time: each frame is closed with a fence value, and once the
+// GPU has passed that fence the whole frame is given back.
+//
+// When an allocation doesn't fit before the end of the span it wraps to the
+// start, the skipped bytes belonging to the frame that wrapped. Allocation
+// fails rather than reaching into a frame the GPU may still be reading.
+//
+// Knows nothing of the memory itself or of how fences are signalled, the
+// caller passes the newest fence value it knows to be complete.
+//================================================================================
+
+constexpr u32 kRingAllocatorFull = ~0u;
+
+class RingAllocator
+{
+public:
+
+	// kAlignment a power of two, every offset is a multiple of it.
+	void init(const u32 kCapacity, const u32 kAlignment);
+
+	// Offset of kBytes rounded up to the alignment, or kRingAllocatorFull when the frames not yet retired leave
+	// no room.
+	u32 allocate(const u32 kBytes);
+
+	// Close the frame, everything allocated since the last call lives until a fence of at least kFence retires.
+	void end_frame(const u64 kFence);
+
+	// Give back every closed frame whose fence is at most kCompletedFence.
+	void retire(const u64 kCompletedFence);
+
+	u32 capacity() const { return m_capacity; }
+	u32 alignment() const { return m_alignment; }
+
+	// Bytes held by closed and open frames, wrap padding included.
+	u32 used() const { return m_used; }
+	u32 frames_in_flight() const { return static_cast<u32>(m_frames.size()); }
+	u32 wraps() const { return m_wraps; }
+
+private:
+
+	struct Frame
+	{
+		u64 m_fence;
+		u32 m_end;		// head when closed, where the next frame starts.
+		u32 m_bytes;
+	};
+
+	u32 m_capacity = 0;
+	u32 m_alignment = 1;
+	u32 m_head = 0;			// next free byte.
+	u32 m_tail = 0;			// first byte still held.
+	u32 m_used = 0;
+	u32 m_frameBytes = 0;	// allocated by the open frame.
+	u32 m_wraps = 0;
+	std::vector<Frame> m_frames;	// oldest first.
+};
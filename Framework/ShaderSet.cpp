@@ -1,5 +1,6 @@
 #include "CommonHeader.h"
 #include "ShaderSet.h"
+#include "D3D11RenderDevice.h"
 
 #include <d3dcompiler.h>
 
@@ -45,7 +46,7 @@ ShaderSet::ShaderSet()
 void ShaderSet::init(ID3D11Device* device, const ShaderSetDesc& desc, const InputLayoutDesc & layout)
 {
 	ComPtr<ID3DBlob> blobs[ShaderStage::kMaxStages];
-	static const char* profiles[ShaderStage::kMaxStages] = { "vs_4_0", "hs_4_0" ,"ds_4_0" ,"gs_4_0" ,"ps_4_0" ,"cs_4_0" };
+	static const char* profiles[ShaderStage::kMaxStages] = { "vs_5_0", "hs_5_0" ,"ds_5_0" ,"gs_5_0" ,"ps_5_0" ,"cs_5_0" };
 
 	// Compile each stage we set an entry point for.
 	for (u32 i = 0; i < ShaderStage::kMaxStages; ++i)
@@ -122,86 +123,31 @@ void ShaderSet::init(ID3D11Device* device, const ShaderSetDesc& desc, const Inpu
 		}
 	}
 
-	// Create vertex input layout:
-	hr = device->CreateInputLayout(std::get<0>(layout), std::get<1>(layout),
-		blobs[ShaderStage::kVertex]->GetBufferPointer(),
-		blobs[ShaderStage::kVertex]->GetBufferSize(),
-		inputLayout.GetAddressOf());
-	if (FAILED(hr))
+	// Create vertex input layout, compute only sets have none.
+	if (blobs[ShaderStage::kVertex])
 	{
-		panicF("Failed to create vertex layout!");
+		hr = device->CreateInputLayout(std::get<0>(layout), std::get<1>(layout),
+			blobs[ShaderStage::kVertex]->GetBufferPointer(),
+			blobs[ShaderStage::kVertex]->GetBufferSize(),
+			inputLayout.GetAddressOf());
+		if (FAILED(hr))
+		{
+			panicF("Failed to create vertex layout!");
+		}
 	}
+
+	m_binding.m_pInputLayout = to_handle(inputLayout.Get());
+	m_binding.m_pShaders[ShaderStage::kVertex] = to_handle(vs.Get());
+	m_binding.m_pShaders[ShaderStage::kHull] = to_handle(hs.Get());
+	m_binding.m_pShaders[ShaderStage::kDomain] = to_handle(ds.Get());
+	m_binding.m_pShaders[ShaderStage::kGeometry] = to_handle(gs.Get());
+	m_binding.m_pShaders[ShaderStage::kPixel] = to_handle(ps.Get());
+	m_binding.m_pShaders[ShaderStage::kCompute] = to_handle(cs.Get());
 }
 
 
 void ShaderSet::bind(ID3D11DeviceContext* pContext) const
 {
-
-	// otherwise make sure we bind vs and ps
-	// all others are optional.
-
-	// Vertex
-	if (vs)
-	{
-		pContext->IASetInputLayout(inputLayout.Get());
-		pContext->VSSetShader(vs.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->IASetInputLayout(NULL);
-		pContext->VSSetShader(NULL, NULL, 0);
-	}
-
-	// Hull Shader
-	if (hs)
-	{
-		pContext->HSSetShader(hs.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->HSSetShader(NULL, NULL, 0);
-	}
-
-	// Domain Shader
-	if (ds)
-	{
-		pContext->DSSetShader(ds.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->DSSetShader(NULL, NULL, 0);
-	}
-
-	// Geometry Shader
-	if (gs)
-	{
-		pContext->GSSetShader(gs.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->GSSetShader(NULL, NULL, 0);
-	}
-
-
-	// Geometry Shader
-	if (ps)
-	{
-		pContext->PSSetShader(ps.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->PSSetShader(NULL, NULL, 0);
-	}
-
-	// Compute Shader
-	if (cs)
-	{
-		pContext->CSSetShader(cs.Get(), NULL, 0);
-	}
-	else
-	{
-		pContext->CSSetShader(NULL, NULL, 0);
-	}
-
+	D3D11RenderDevice device(pContext);
+	m_binding.bind(device);
 }
-
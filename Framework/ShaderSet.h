@@ -1,22 +1,6 @@
 #pragma once
 
-// ========================================================
-// Shader stage enum
-// ========================================================
-namespace ShaderStage
-{
-	enum ShaderStageEnum
-	{
-		kVertex,
-		kHull,
-		kDomain,
-		kGeometry,
-		kPixel,
-		kCompute,
-
-		kMaxStages
-	};
-}
+#include "RenderDevice.h"
 
 // ========================================================
 // ShaderSet
@@ -37,6 +21,22 @@ struct ShaderSetDesc
 		desc.entryPoints[ShaderStage::kPixel] = psEntry;
 		return desc;
 	}
+
+	static ShaderSetDesc Create_VS(const char* fName, const char* vsEntry)
+	{
+		ShaderSetDesc desc = {};
+		desc.filename = fName;
+		desc.entryPoints[ShaderStage::kVertex] = vsEntry;
+		return desc;
+	}
+
+	static ShaderSetDesc Create_CS(const char* fName, const char* csEntry)
+	{
+		ShaderSetDesc desc = {};
+		desc.filename = fName;
+		desc.entryPoints[ShaderStage::kCompute] = csEntry;
+		return desc;
+	}
 };
 
 struct ShaderSet
@@ -46,6 +46,10 @@ struct ShaderSet
 	void init(ID3D11Device* device, const ShaderSetDesc& desc, const InputLayoutDesc & layout);
 
 	void bind(ID3D11DeviceContext* pContext) const;
+	void bind(RenderDevice& rDevice) const { m_binding.bind(rDevice); }
+
+	// The set as handles, filled in by init.
+	const ShaderBinding& binding() const { return m_binding; }
 
 	ComPtr<ID3D11InputLayout>  inputLayout;
 	ComPtr<ID3D11VertexShader> vs;
@@ -54,6 +58,9 @@ struct ShaderSet
 	ComPtr<ID3D11GeometryShader> gs;
 	ComPtr<ID3D11PixelShader>  ps;
 	ComPtr<ID3D11ComputeShader>  cs;
+
+private:
+	ShaderBinding m_binding = {};
 };
 
 
@@ -92,6 +99,32 @@ void push_constant_buffer(ID3D11DeviceContext* pContext, ID3D11Buffer* pBuffer,
 	}
 }
 
+// A dynamic constant buffer to bind by offset and map without overwrite, as a ConstantRing takes.
+// Null when the device can't do both, they need Direct3D 11.1.
+inline ID3D11Buffer* create_constant_ring_buffer(ID3D11Device* pDevice, const u32 kBytes)
+{
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(pDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options)))
+		|| !options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		debugF("Constant ring disabled, the device can't bind constant buffers by offset.\n");
+		return nullptr;
+	}
+
+	ID3D11Buffer* pBuffer = nullptr;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = kBytes;
+	desc.Usage = D3D11_USAGE_DYNAMIC;
+	desc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+	HRESULT hr = pDevice->CreateBuffer(&desc, NULL, &pBuffer);
+	ASSERT(!FAILED(hr) && pBuffer);
+
+	return pBuffer;
+}
+
 // template to create a structure buffer from CPU structure.
 template<typename StructureElementType>
 ID3D11Buffer* create_structured_buffer(ID3D11Device* pDevice, u32 elements)
@@ -120,6 +153,33 @@ inline ID3D11ShaderResourceView* create_structured_buffer_view(ID3D11Device* pDe
 	return pView;
 }
 
+// template to create a structured buffer the GPU writes, readable by later passes.
+template<typename StructureElementType>
+ID3D11Buffer* create_rw_structured_buffer(ID3D11Device* pDevice, u32 elements)
+{
+	ID3D11Buffer* pBuffer = nullptr;
+
+	D3D11_BUFFER_DESC desc = {};
+	desc.ByteWidth = sizeof(StructureElementType) * elements;
+	desc.StructureByteStride = sizeof(StructureElementType);
+	desc.Usage = D3D11_USAGE_DEFAULT;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_UNORDERED_ACCESS;
+	desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+
+	HRESULT hr = pDevice->CreateBuffer(&desc, NULL, &pBuffer);
+	ASSERT(!FAILED(hr) && pBuffer);
+
+	return pBuffer;
+}
+
+inline ID3D11UnorderedAccessView* create_structured_buffer_uav(ID3D11Device* pDevice, ID3D11Buffer* pBuffer)
+{
+	ID3D11UnorderedAccessView* pView = nullptr;
+	HRESULT hr = pDevice->CreateUnorderedAccessView(pBuffer, NULL, &pView);
+	ASSERT(!FAILED(hr) && pView);
+	return pView;
+}
+
 // helper to create a sampler state
 inline ID3D11SamplerState* create_basic_sampler(ID3D11Device* pDevice, D3D11_TEXTURE_ADDRESS_MODE mode)
 {
@@ -0,0 +1,351 @@
+#include "ShadowAtlas.h"
+
+namespace
+{
+
+u32 floor_power_of_two(u32 value)
+{
+	u32 result = 1;
+	while (result <= value / 2)
+		result <<= 1;
+	return result;
+}
+
+u32 log2_of_power_of_two(u32 value)
+{
+	u32 result = 0;
+	while (value > 1)
+	{
+		value >>= 1;
+		++result;
+	}
+	return result;
+}
+
+} // namespace
+
+//================================================================================
+// ShadowAtlas
+//================================================================================
+
+void ShadowAtlas::init(const Desc& rDesc)
+{
+	ASSERT(rDesc.m_size == floor_power_of_two(rDesc.m_size) && rDesc.m_minTileSize == floor_power_of_two(rDesc.m_minTileSize));
+	ASSERT(rDesc.m_minTileSize <= rDesc.m_size && rDesc.m_size <= 0xffff);
+
+	m_desc = rDesc;
+	m_levels = log2_of_power_of_two(rDesc.m_size / rDesc.m_minTileSize) + 1;
+	m_nodes.resize(m_levels);
+	for (u32 l = 0; l < m_levels; ++l)
+	{
+		m_nodes[l].assign(size_t(1) << (2 * l), kNode_Free);
+	}
+	m_previous.clear();
+}
+
+u32 ShadowAtlas::level_of_size(const u32 kSize) const
+{
+	return log2_of_power_of_two(m_desc.m_size / kSize);
+}
+
+void ShadowAtlas::allocate(const ShadowRequest* pRequests, const u32 kCount)
+{
+	ASSERT(m_levels > 0);
+
+	m_allocations.assign(kCount, ShadowAllocation{});
+	m_rects.clear();
+	m_stats = {};
+	m_stats.m_requests = kCount;
+
+	m_order.resize(kCount);
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		m_order[i] = i;
+	}
+	std::stable_sort(m_order.begin(), m_order.end(), [&](u32 a, u32 b) { return pRequests[a].m_importance > pRequests[b].m_importance; });
+
+	// Sizes first, the most important requests take their share of the area before anyone else.
+	u64 remainingTexels = u64(m_desc.m_size) * m_desc.m_size;
+	m_sizes.assign(kCount, 0);
+	for (u32 request : m_order)
+	{
+		const ShadowRequest& rRequest = pRequests[request];
+		if (!rRequest.m_faces)
+			continue;
+
+		u32 size = floor_power_of_two(std::min(std::max(rRequest.m_size, 1u), m_desc.m_size));
+		while (size >= m_desc.m_minTileSize && u64(size) * size * rRequest.m_faces > remainingTexels)
+		{
+			size >>= 1;
+		}
+
+		if (size < m_desc.m_minTileSize)
+		{
+			++m_stats.m_dropped;
+			continue;
+		}
+
+		m_sizes[request] = size;
+		remainingTexels -= u64(size) * size * rRequest.m_faces;
+	}
+
+	reset_tree();
+
+	// Keep last frame's tiles wherever the size didn't change, their cached contents stay valid.
+	std::vector<u32> pending;
+	for (u32 request : m_order)
+	{
+		const u32 kSize = m_sizes[request];
+		if (!kSize)
+			continue;
+
+		const ShadowRequest& rRequest = pRequests[request];
+		auto it = m_previous.find(rRequest.m_key);
+		if (it != m_previous.end() && it->second.size() == rRequest.m_faces && it->second[0].m_size == kSize)
+		{
+			const u32 kFirst = static_cast<u32>(m_rects.size());
+			u32 face = 0;
+			for (; face < rRequest.m_faces && reserve(it->second[face]); ++face)
+			{
+				m_rects.push_back(it->second[face]);
+			}
+
+			if (face == rRequest.m_faces)
+			{
+				m_allocations[request] = { kFirst, rRequest.m_faces };
+				++m_stats.m_kept;
+				continue;
+			}
+
+			for (u32 i = kFirst; i < m_rects.size(); ++i)
+			{
+				release(m_rects[i]);
+			}
+			m_rects.resize(kFirst);
+		}
+		pending.push_back(request);
+	}
+
+	// Then everything else largest first, which packs perfectly unless kept tiles are in the way.
+	std::stable_sort(pending.begin(), pending.end(), [&](u32 a, u32 b) { return m_sizes[a] > m_sizes[b]; });
+	for (u32 request : pending)
+	{
+		const ShadowRequest& rRequest = pRequests[request];
+		for (u32 size = m_sizes[request]; size >= m_desc.m_minTileSize; size >>= 1)
+		{
+			const u32 kFirst = static_cast<u32>(m_rects.size());
+			ShadowRect rect;
+			u32 face = 0;
+			for (; face < rRequest.m_faces && insert(level_of_size(size), rect); ++face)
+			{
+				m_rects.push_back(rect);
+			}
+
+			if (face == rRequest.m_faces)
+			{
+				m_allocations[request] = { kFirst, rRequest.m_faces };
+				break;
+			}
+
+			for (u32 i = kFirst; i < m_rects.size(); ++i)
+			{
+				release(m_rects[i]);
+			}
+			m_rects.resize(kFirst);
+		}
+
+		if (!m_allocations[request].m_faces)
+			++m_stats.m_dropped;
+	}
+
+	m_previous.clear();
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const ShadowAllocation& rAllocation = m_allocations[i];
+		if (!rAllocation.m_faces)
+			continue;
+
+		const ShadowRect& rFirst = m_rects[rAllocation.m_firstRect];
+		if (rFirst.m_size < pRequests[i].m_size)
+			++m_stats.m_downsized;
+		m_stats.m_usedTexels += u64(rFirst.m_size) * rFirst.m_size * rAllocation.m_faces;
+
+		m_previous[pRequests[i].m_key].assign(m_rects.begin() + rAllocation.m_firstRect, m_rects.begin() + rAllocation.m_firstRect + rAllocation.m_faces);
+	}
+}
+
+v4 ShadowAtlas::uv_scale_offset(const ShadowRect& rRect) const
+{
+	const f32 kInverseSize = 1.f / m_desc.m_size;
+	return v4(rRect.m_size * kInverseSize, rRect.m_size * kInverseSize, rRect.m_x * kInverseSize, rRect.m_y * kInverseSize);
+}
+
+bool ShadowAtlas::validate() const
+{
+	for (size_t i = 0; i < m_rects.size(); ++i)
+	{
+		const ShadowRect& a = m_rects[i];
+		if (u32(a.m_x) + a.m_size > m_desc.m_size || u32(a.m_y) + a.m_size > m_desc.m_size)
+			return false;
+
+		for (size_t j = i + 1; j < m_rects.size(); ++j)
+		{
+			const ShadowRect& b = m_rects[j];
+			const bool kSeparate = a.m_x + a.m_size <= b.m_x || b.m_x + b.m_size <= a.m_x || a.m_y + a.m_size <= b.m_y || b.m_y + b.m_size <= a.m_y;
+			if (!kSeparate)
+				return false;
+		}
+	}
+	return true;
+}
+
+void ShadowAtlas::reset_tree()
+{
+	// Children of a free node are stale, splitting a node clears them.
+	m_nodes[0][0] = kNode_Free;
+}
+
+bool ShadowAtlas::reserve(const ShadowRect& rRect)
+{
+	const u32 kLevel = level_of_size(rRect.m_size);
+	const u32 kX = rRect.m_x / rRect.m_size;
+	const u32 kY = rRect.m_y / rRect.m_size;
+
+	for (u32 l = 0; l < kLevel; ++l)
+	{
+		const u32 kShift = kLevel - l;
+		u8& rState = node(l, kX >> kShift, kY >> kShift);
+		if (rState == kNode_Used)
+			return false;
+
+		if (rState == kNode_Free)
+		{
+			rState = kNode_Split;
+			const u32 kChildX = (kX >> kShift) * 2;
+			const u32 kChildY = (kY >> kShift) * 2;
+			node(l + 1, kChildX, kChildY) = node(l + 1, kChildX + 1, kChildY) = kNode_Free;
+			node(l + 1, kChildX, kChildY + 1) = node(l + 1, kChildX + 1, kChildY + 1) = kNode_Free;
+		}
+	}
+
+	u8& rState = node(kLevel, kX, kY);
+	if (rState != kNode_Free)
+		return false;
+
+	rState = kNode_Used;
+	return true;
+}
+
+bool ShadowAtlas::insert(const u32 kLevel, ShadowRect& rRectOut)
+{
+	// Gaps in nodes that are already split first, only then break up a free one.
+	return insert_below(0, kLevel, 0, 0, false, rRectOut) || insert_below(0, kLevel, 0, 0, true, rRectOut);
+}
+
+bool ShadowAtlas::insert_below(const u32 kLevel, const u32 kTarget, const u32 kX, const u32 kY, const bool kAllowSplit, ShadowRect& rRectOut)
+{
+	u8& rState = node(kLevel, kX, kY);
+	if (rState == kNode_Used)
+		return false;
+
+	if (kLevel == kTarget)
+	{
+		if (rState != kNode_Free)
+			return false;
+
+		rState = kNode_Used;
+		const u32 kSize = m_desc.m_size >> kLevel;
+		rRectOut.m_x = static_cast<u16>(kX * kSize);
+		rRectOut.m_y = static_cast<u16>(kY * kSize);
+		rRectOut.m_size = static_cast<u16>(kSize);
+		rRectOut.m_padding = 0;
+		return true;
+	}
+
+	if (rState == kNode_Free)
+	{
+		if (!kAllowSplit)
+			return false;
+
+		rState = kNode_Split;
+		node(kLevel + 1, kX * 2, kY * 2) = node(kLevel + 1, kX * 2 + 1, kY * 2) = kNode_Free;
+		node(kLevel + 1, kX * 2, kY * 2 + 1) = node(kLevel + 1, kX * 2 + 1, kY * 2 + 1) = kNode_Free;
+	}
+
+	for (u32 child = 0; child < 4; ++child)
+	{
+		if (insert_below(kLevel + 1, kTarget, kX * 2 + (child & 1), kY * 2 + (child >> 1), kAllowSplit, rRectOut))
+			return true;
+	}
+	return false;
+}
+
+void ShadowAtlas::release(const ShadowRect& rRect)
+{
+	u32 level = level_of_size(rRect.m_size);
+	u32 x = rRect.m_x / rRect.m_size;
+	u32 y = rRect.m_y / rRect.m_size;
+	node(level, x, y) = kNode_Free;
+
+	// Merge back up while all four siblings are free.
+	while (level > 0)
+	{
+		const u32 kX = x & ~1u;
+		const u32 kY = y & ~1u;
+		if (node(level, kX, kY) != kNode_Free || node(level, kX + 1, kY) != kNode_Free || node(level, kX, kY + 1) != kNode_Free || node(level, kX + 1, kY + 1) != kNode_Free)
+			break;
+
+		--level;
+		x >>= 1;
+		y >>= 1;
+		node(level, x, y) = kNode_Free;
+	}
+}
+
+//================================================================================
+// ShadowCache
+//================================================================================
+
+void ShadowCache::caster_changed(const v3& vCentre, const f32 kRadius)
+{
+	m_changed.push_back({ vCentre, kRadius });
+}
+
+void ShadowCache::invalidate_all()
+{
+	m_entries.clear();
+}
+
+bool ShadowCache::needs_draw(const u32 kKey, const u32 kFace, const ShadowRect& rRect, const m4x4& rViewProjection, const v3& vCentre, const f32 kRadius)
+{
+	const u64 kId = (u64(kKey) << 8) | kFace;
+
+	auto it = m_entries.find(kId);
+	bool bDraw = it == m_entries.end() || it->second.m_rect != rRect || memcmp(&it->second.m_viewProjection, &rViewProjection, sizeof(m4x4)) != 0;
+
+	for (u32 i = 0; i < m_changed.size() && !bDraw; ++i)
+	{
+		const f32 kReach = m_changed[i].m_radius + kRadius;
+		bDraw = kRadius < 0.f || (m_changed[i].m_vCentre - vCentre).LengthSquared() < kReach * kReach;
+	}
+
+	m_entries[kId] = { rRect, rViewProjection, m_frame };
+	++(bDraw ? m_counts.m_drawn : m_counts.m_cached);
+	return bDraw;
+}
+
+void ShadowCache::end_frame()
+{
+	for (auto it = m_entries.begin(); it != m_entries.end();)
+	{
+		if (it->second.m_frame != m_frame)
+			it = m_entries.erase(it);
+		else
+			++it;
+	}
+
+	m_changed.clear();
+	m_stats = m_counts;
+	m_counts = {};
+	++m_frame;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <unordered_map>
+#include <vector>
+
+//================================================================================
+// Shadow Atlas
+// Every shadow map of the frame lives in one square depth texture. Tiles are
+// power of two squares handed out by a quadtree, so a placement can survive
+// from frame to frame and a cached shadow map stays valid in place.
+//
+// Sizes are decided first, most important request first, halving each one
+// until everything fits the atlas area. Squares of power of two sizes always
+// pack when placed largest first, only tiles kept from last frame can
+// fragment the tree, in which case the newcomer halves again.
+//================================================================================
+
+// A tile in texels.
+struct ShadowRect
+{
+	u16 m_x, m_y;
+	u16 m_size;
+	u16 m_padding;
+
+	bool operator==(const ShadowRect& rOther) const { return m_x == rOther.m_x && m_y == rOther.m_y && m_size == rOther.m_size; }
+	bool operator!=(const ShadowRect& rOther) const { return !(*this == rOther); }
+};
+
+struct ShadowRequest
+{
+	u32 m_key;			// stable id of the light, placements are kept per key across frames.
+	u32 m_faces;		// tiles needed, 1 for a spot, 6 for a point cube, one per cascade.
+	u32 m_size;			// wanted size of each face, rounded down to a power of two.
+	f32 m_importance;	// higher is allocated first and downsized last.
+};
+
+struct ShadowAllocation
+{
+	u32 m_firstRect;	// into ShadowAtlas::rects(), m_faces tiles in a row.
+	u32 m_faces;		// zero when the request was dropped.
+};
+
+class ShadowAtlas
+{
+public:
+
+	struct Desc
+	{
+		u32 m_size = 4096;		// width and height of the atlas texture.
+		u32 m_minTileSize = 128;	// requests that can't get this much are dropped.
+	};
+
+	struct Stats
+	{
+		u32 m_requests;
+		u32 m_kept;			// same tiles as last frame.
+		u32 m_downsized;	// got less than they asked for.
+		u32 m_dropped;
+		u64 m_usedTexels;
+	};
+
+	void init(const Desc& rDesc);
+
+	// Place this frame's requests, allocation i belongs to pRequests[i].
+	void allocate(const ShadowRequest* pRequests, const u32 kCount);
+
+	const ShadowAllocation& allocation(const u32 kRequest) const { return m_allocations[kRequest]; }
+	const std::vector<ShadowRect>& rects() const { return m_rects; }
+
+	// Scale and offset taking a [0, 1] uv into the tile's part of the atlas.
+	v4 uv_scale_offset(const ShadowRect& rRect) const;
+
+	// Check no two tiles overlap and all lie inside the atlas.
+	bool validate() const;
+
+	const Desc& desc() const { return m_desc; }
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	enum ENodeState : u8
+	{
+		kNode_Free,
+		kNode_Split,
+		kNode_Used,
+	};
+
+	// Level 0 is the whole atlas, each level below has four times the nodes in a row major grid.
+	u8& node(const u32 kLevel, const u32 kX, const u32 kY) { return m_nodes[kLevel][kY * (1u << kLevel) + kX]; }
+	u32 level_of_size(const u32 kSize) const;
+
+	void reset_tree();
+	bool reserve(const ShadowRect& rRect);
+	bool insert(const u32 kLevel, ShadowRect& rRectOut);
+	bool insert_below(const u32 kLevel, const u32 kTarget, const u32 kX, const u32 kY, const bool kAllowSplit, ShadowRect& rRectOut);
+	void release(const ShadowRect& rRect);
+
+	Desc m_desc;
+	u32 m_levels = 0;
+	std::vector<std::vector<u8>> m_nodes;
+
+	std::vector<ShadowAllocation> m_allocations;
+	std::vector<ShadowRect> m_rects;
+	Stats m_stats = {};
+
+	// Tiles each key held last frame, all faces share a size.
+	std::unordered_map<u32, std::vector<ShadowRect>> m_previous;
+
+	// Scratch.
+	std::vector<u32> m_order;
+	std::vector<u32> m_sizes;
+};
+
+//================================================================================
+// Shadow Cache
+// Remembers what each atlas tile was last drawn with so faces whose light,
+// placement and nearby static casters haven't changed are not drawn again.
+// Anything that moves, appears or disappears reports its bounds, old and new,
+// through caster_changed() before the shadows are drawn.
+//================================================================================
+
+class ShadowCache
+{
+public:
+
+	struct Stats
+	{
+		u32 m_drawn;
+		u32 m_cached;
+	};
+
+	// A caster inside this sphere changed, faces whose light reaches it are drawn again.
+	void caster_changed(const v3& vCentre, const f32 kRadius);
+
+	// Forget every face, for when the atlas contents are lost.
+	void invalidate_all();
+
+	// True when a face must be drawn. The light's reach is a sphere, a negative radius means
+	// everywhere as for directional lights. Marks the face as drawn with this state.
+	bool needs_draw(const u32 kKey, const u32 kFace, const ShadowRect& rRect, const m4x4& rViewProjection, const v3& vCentre, const f32 kRadius);
+
+	// Forget faces that weren't seen this frame and the casters changed during it.
+	void end_frame();
+
+	// Counts for the last finished frame.
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	struct Entry
+	{
+		ShadowRect m_rect;
+		m4x4 m_viewProjection;
+		u64 m_frame;
+	};
+
+	struct ChangedCaster
+	{
+		v3 m_vCentre;
+		f32 m_radius;
+	};
+
+	std::unordered_map<u64, Entry> m_entries;
+	std::vector<ChangedCaster> m_changed;
+	u64 m_frame = 0;
+	Stats m_counts = {};
+	Stats m_stats = {};
+};
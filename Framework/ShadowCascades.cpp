@@ -0,0 +1,68 @@
+#include "ShadowCascades.h"
+
+void compute_cascade_splits(const f32 kNear, const f32 kFar, const u32 kCount, const f32 kLambda, f32* pSplitsOut)
+{
+	ASSERT(kCount > 0 && kNear > 0.f && kFar > kNear);
+
+	pSplitsOut[0] = kNear;
+	for (u32 i = 1; i < kCount; ++i)
+	{
+		const f32 kFraction = f32(i) / f32(kCount);
+		const f32 kLog = kNear * powf(kFar / kNear, kFraction);
+		const f32 kUniform = kNear + (kFar - kNear) * kFraction;
+		pSplitsOut[i] = kLambda * kLog + (1.f - kLambda) * kUniform;
+	}
+	pSplitsOut[kCount] = kFar;
+}
+
+void frustum_slice_corners(const m4x4& rInverseView, const m4x4& rProjection, const f32 kNear, const f32 kFar, v3 cornersOut[8])
+{
+	// View space looks down -z, off centre projections shift the corners by _31 and _32.
+	const f32 kDistances[2] = { kNear, kFar };
+	for (u32 i = 0; i < 8; ++i)
+	{
+		const f32 kDistance = kDistances[i >> 2];
+		const f32 kX = (i & 1) ? 1.f : -1.f;
+		const f32 kY = (i & 2) ? 1.f : -1.f;
+		cornersOut[i] = v3::Transform(v3(kDistance * (kX + rProjection._31) / rProjection._11, kDistance * (kY + rProjection._32) / rProjection._22, -kDistance), rInverseView);
+	}
+}
+
+m4x4 fit_cascade(const v3* pPoints, const u32 kCount, const v3& vToLight, const u32 kResolution, const f32 kCasterDistance)
+{
+	ASSERT(kCount > 0);
+
+	v3 vCentre(0.f, 0.f, 0.f);
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		vCentre += pPoints[i];
+	}
+	vCentre *= 1.f / kCount;
+
+	f32 radius = 0.f;
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		radius = std::max(radius, (pPoints[i] - vCentre).Length());
+	}
+
+	// Round up so small changes in the corners don't rescale the map.
+	radius = ceilf(radius * 16.f) / 16.f;
+
+	v3 vDirection = vToLight;
+	vDirection.Normalize();
+	const v3 vUp = fabsf(vDirection.y) < 0.99f ? v3(0.f, 1.f, 0.f) : v3(1.f, 0.f, 0.f);
+
+	const f32 kBack = radius + kCasterDistance;
+	const m4x4 kView = m4x4::CreateLookAt(vCentre + vDirection * kBack, vCentre, vUp);
+	m4x4 projection = m4x4::CreateOrthographicOffCenter(-radius, radius, -radius, radius, 0.f, kBack + radius);
+
+	// Move by less than a texel so the world origin lands on a texel corner.
+	const m4x4 kViewProjection = kView * projection;
+	const f32 kHalfResolution = kResolution * 0.5f;
+	const f32 kOriginX = kViewProjection._41 * kHalfResolution;
+	const f32 kOriginY = kViewProjection._42 * kHalfResolution;
+	projection._41 += (roundf(kOriginX) - kOriginX) / kHalfResolution;
+	projection._42 += (roundf(kOriginY) - kOriginY) / kHalfResolution;
+
+	return kView * projection;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+//================================================================================
+// Shadow Cascades
+// A directional light's shadow is split along the view into slices, each with
+// its own orthographic shadow map, so texel density follows the perspective.
+//
+// Each slice is covered by its bounding sphere rather than a tight box: the
+// map doesn't change size as the view turns, and with the light space origin
+// snapped to whole texels the edges don't crawl as the camera moves.
+//================================================================================
+
+constexpr u32 kMaxShadowCascades = 4;
+
+// Distances along the view of kCount cascades, pSplitsOut[0] is kNear and pSplitsOut[kCount] is kFar.
+// kLambda blends between uniform (0) and logarithmic (1) spacing.
+void compute_cascade_splits(const f32 kNear, const f32 kFar, const u32 kCount, const f32 kLambda, f32* pSplitsOut);
+
+// World space corners of the slice between view distances kNear and kFar, works for off centre projections.
+void frustum_slice_corners(const m4x4& rInverseView, const m4x4& rProjection, const f32 kNear, const f32 kFar, v3 cornersOut[8]);
+
+// Light view projection covering every point given, the corners of one slice or of both eyes' slices.
+// vToLight points at the light. kCasterDistance pulls the near plane back towards the light
+// so casters outside the slice still reach it.
+m4x4 fit_cascade(const v3* pPoints, const u32 kCount, const v3& vToLight, const u32 kResolution, const f32 kCasterDistance);
@@ -0,0 +1,212 @@
+#include "StateCache.h"
+
+void StateCacheDevice::invalidate()
+{
+	m_inputLayout.m_bKnown = false;
+	m_topology.m_bKnown = false;
+	for (Binding& rBinding : m_vertexBuffers)
+		rBinding.m_bKnown = false;
+	m_indexBuffer.m_bKnown = false;
+	for (u32 stage = 0; stage < ShaderStage::kMaxStages; ++stage)
+	{
+		m_shaders[stage].m_bKnown = false;
+		for (u32 slot = 0; slot < kStateCacheSlots; ++slot)
+		{
+			m_constantBuffers[stage][slot].m_bKnown = false;
+			m_shaderResources[stage][slot].m_bKnown = false;
+			m_samplers[stage][slot].m_bKnown = false;
+		}
+	}
+	m_blendState.m_bKnown = false;
+	m_depthStencilState.m_bKnown = false;
+	m_rasterizerState.m_bKnown = false;
+}
+
+bool StateCacheDevice::bound(Binding& rBinding, const void* pObject, const u64 kParams)
+{
+	if (rBinding.m_bKnown && rBinding.m_pObject == pObject && rBinding.m_params == kParams)
+	{
+		++m_filtered;
+		return true;
+	}
+
+	rBinding.m_pObject = pObject;
+	rBinding.m_params = kParams;
+	rBinding.m_bKnown = true;
+	return false;
+}
+
+template<typename T>
+bool StateCacheDevice::bound_range(Binding* pSlots, const u32 kSlot, const u32 kCount, T* const* ppObjects)
+{
+	if (kSlot + kCount > kStateCacheSlots)
+	{
+		// Forget the cached slots the range covers, the device is about to change them.
+		for (u32 slot = kSlot; slot < kStateCacheSlots; ++slot)
+			pSlots[slot].m_bKnown = false;
+		return false;
+	}
+
+	bool bSame = true;
+	for (u32 i = 0; i < kCount && bSame; ++i)
+	{
+		const Binding& rBinding = pSlots[kSlot + i];
+		bSame = rBinding.m_bKnown && rBinding.m_pObject == ppObjects[i] && rBinding.m_params == 0;
+	}
+	if (bSame)
+	{
+		++m_filtered;
+		return true;
+	}
+
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		Binding& rBinding = pSlots[kSlot + i];
+		rBinding.m_pObject = ppObjects[i];
+		rBinding.m_params = 0;
+		rBinding.m_bKnown = true;
+	}
+	return false;
+}
+
+void StateCacheDevice::set_input_layout(RenderInputLayout* pLayout)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_inputLayout, pLayout, 0))
+		m_pDevice->set_input_layout(pLayout);
+}
+
+void StateCacheDevice::set_topology(const EPrimitiveTopology kTopology)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_topology, nullptr, kTopology))
+		m_pDevice->set_topology(kTopology);
+}
+
+void StateCacheDevice::set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	if (kSlot >= kStateCacheVertexBuffers || !bound(m_vertexBuffers[kSlot], pBuffer, (u64(kStride) << 32) | kOffset))
+		m_pDevice->set_vertex_buffer(kSlot, pBuffer, kStride, kOffset);
+}
+
+void StateCacheDevice::set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_indexBuffer, pBuffer, (u64(kFormat) << 32) | kOffset))
+		m_pDevice->set_index_buffer(pBuffer, kFormat, kOffset);
+}
+
+void StateCacheDevice::set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_shaders[kStage], pShader, 0))
+		m_pDevice->set_shader(kStage, pShader);
+}
+
+void StateCacheDevice::set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers)
+{
+	++m_stats.m_stateChanges;
+	if (!bound_range(m_constantBuffers[kStage], kSlot, kCount, ppBuffers))
+		m_pDevice->set_constant_buffers(kStage, kSlot, kCount, ppBuffers);
+}
+
+void StateCacheDevice::set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants)
+{
+	++m_stats.m_stateChanges;
+
+	// The window as the parameters, never zero so a whole buffer bound at the slot never matches.
+	if (kSlot >= kStateCacheSlots || !bound(m_constantBuffers[kStage][kSlot], pBuffer, (u64(kFirstConstant) << 32) | kConstants))
+		m_pDevice->set_constant_buffer_range(kStage, kSlot, pBuffer, kFirstConstant, kConstants);
+}
+
+void StateCacheDevice::set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews)
+{
+	++m_stats.m_stateChanges;
+	if (!bound_range(m_shaderResources[kStage], kSlot, kCount, ppViews))
+		m_pDevice->set_shader_resources(kStage, kSlot, kCount, ppViews);
+}
+
+void StateCacheDevice::set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers)
+{
+	++m_stats.m_stateChanges;
+	if (!bound_range(m_samplers[kStage], kSlot, kCount, ppSamplers))
+		m_pDevice->set_samplers(kStage, kSlot, kCount, ppSamplers);
+}
+
+void StateCacheDevice::set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask)
+{
+	++m_stats.m_stateChanges;
+
+	// The factor is compared apart, it doesn't fit the binding's parameters.
+	const bool kSameFactor = m_blendState.m_bKnown && !memcmp(m_blendFactor, kBlendFactor, sizeof(m_blendFactor));
+	if (!kSameFactor)
+		m_blendState.m_bKnown = false;
+	if (!bound(m_blendState, pState, kSampleMask))
+	{
+		memcpy(m_blendFactor, kBlendFactor, sizeof(m_blendFactor));
+		m_pDevice->set_blend_state(pState, kBlendFactor, kSampleMask);
+	}
+}
+
+void StateCacheDevice::set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_depthStencilState, pState, kStencilRef))
+		m_pDevice->set_depth_stencil_state(pState, kStencilRef);
+}
+
+void StateCacheDevice::set_rasterizer_state(RenderRasterizerState* pState)
+{
+	++m_stats.m_stateChanges;
+	if (!bound(m_rasterizerState, pState, 0))
+		m_pDevice->set_rasterizer_state(pState);
+}
+
+void StateCacheDevice::update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+	m_pDevice->update_buffer(pBuffer, pData, kBytes);
+}
+
+void StateCacheDevice::write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard)
+{
+	++m_stats.m_maps;
+	m_stats.m_uploadBytes += kBytes;
+	m_pDevice->write_buffer(pBuffer, kOffset, pData, kBytes, kDiscard);
+}
+
+void StateCacheDevice::draw(const u32 kVertices, const u32 kFirstVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	m_pDevice->draw(kVertices, kFirstVertex);
+}
+
+void StateCacheDevice::draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex)
+{
+	++m_stats.m_draws;
+	++m_stats.m_instances;
+	m_pDevice->draw_indexed(kIndices, kFirstIndex, kBaseVertex);
+}
+
+void StateCacheDevice::draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	m_pDevice->draw_instanced(kVertices, kInstances, kFirstVertex, kFirstInstance);
+}
+
+void StateCacheDevice::draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance)
+{
+	++m_stats.m_draws;
+	m_stats.m_instances += kInstances;
+	m_pDevice->draw_indexed_instanced(kIndices, kInstances, kFirstIndex, kBaseVertex, kFirstInstance);
+}
+
+void StateCacheDevice::dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ)
+{
+	++m_stats.m_dispatches;
+	m_pDevice->dispatch(kGroupsX, kGroupsY, kGroupsZ);
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "RenderDevice.h"
+
+//================================================================================
+// State Cache
+// A render device in front of another that drops calls binding what is
+// already bound. ShaderBinding::bind sets the input layout and all six stages
+// every time and MeshBinding::bind the topology and buffers, so a loop drawing many
+// things with one shader and mesh repeats the same ten calls per draw. Through
+// the cache only the first of them reaches the device behind.
+//
+// The cache only knows what went through it. Anything setting state on the
+// context directly in between leaves it stale, so call invalidate() before
+// using it again after such code; the next call of each kind then goes
+// through regardless.
+//
+// Ranges of slots are compared as a whole and forwarded as a whole when any
+// slot differs. A constant buffer window counts as a different binding from
+// its whole buffer. Slots past kStateCacheSlots are never cached. Buffer
+// updates and draws always go through.
+//================================================================================
+
+constexpr u32 kStateCacheSlots = 16;
+constexpr u32 kStateCacheVertexBuffers = 4;
+
+class StateCacheDevice final : public RenderDevice
+{
+public:
+
+	explicit StateCacheDevice(RenderDevice* pDevice = nullptr) : m_pDevice(pDevice) { invalidate(); }
+
+	void set_device(RenderDevice* pDevice) { m_pDevice = pDevice; invalidate(); }
+	RenderDevice* device() const { return m_pDevice; }
+
+	// Forget everything bound, the next set of each kind goes through.
+	void invalidate();
+
+	// State changes asked of the cache that it didn't pass on.
+	u32 filtered() const { return m_filtered; }
+	void reset_filtered() { m_filtered = 0; }
+
+	void set_input_layout(RenderInputLayout* pLayout) override;
+	void set_topology(const EPrimitiveTopology kTopology) override;
+	void set_vertex_buffer(const u32 kSlot, RenderBuffer* pBuffer, const u32 kStride, const u32 kOffset) override;
+	void set_index_buffer(RenderBuffer* pBuffer, const EIndexFormat kFormat, const u32 kOffset) override;
+
+	void set_shader(const ShaderStage::ShaderStageEnum kStage, RenderShader* pShader) override;
+
+	void set_constant_buffers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderBuffer* const* ppBuffers) override;
+	void set_constant_buffer_range(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, RenderBuffer* pBuffer, const u32 kFirstConstant, const u32 kConstants) override;
+	void set_shader_resources(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderShaderView* const* ppViews) override;
+	void set_samplers(const ShaderStage::ShaderStageEnum kStage, const u32 kSlot, const u32 kCount, RenderSampler* const* ppSamplers) override;
+
+	void set_blend_state(RenderBlendState* pState, const f32 kBlendFactor[4], const u32 kSampleMask) override;
+	void set_depth_stencil_state(RenderDepthStencilState* pState, const u32 kStencilRef) override;
+	void set_rasterizer_state(RenderRasterizerState* pState) override;
+
+	void update_buffer(RenderBuffer* pBuffer, const void* pData, const u32 kBytes) override;
+	void write_buffer(RenderBuffer* pBuffer, const u32 kOffset, const void* pData, const u32 kBytes, const bool kDiscard) override;
+
+	void draw(const u32 kVertices, const u32 kFirstVertex) override;
+	void draw_indexed(const u32 kIndices, const u32 kFirstIndex, const s32 kBaseVertex) override;
+	void draw_instanced(const u32 kVertices, const u32 kInstances, const u32 kFirstVertex, const u32 kFirstInstance) override;
+	void draw_indexed_instanced(const u32 kIndices, const u32 kInstances, const u32 kFirstIndex, const s32 kBaseVertex, const u32 kFirstInstance) override;
+	void dispatch(const u32 kGroupsX, const u32 kGroupsY, const u32 kGroupsZ) override;
+
+private:
+
+	// One bound object with whatever else its call set, known says it holds what the device has.
+	struct Binding
+	{
+		const void* m_pObject;
+		u64 m_params;
+		bool m_bKnown;
+	};
+
+	// True, counting a filtered call, when the binding already holds the value. Otherwise it takes the value.
+	bool bound(Binding& rBinding, const void* pObject, const u64 kParams);
+
+	// The same for a range of slots, all of them taken when any differs.
+	template<typename T>
+	bool bound_range(Binding* pSlots, const u32 kSlot, const u32 kCount, T* const* ppObjects);
+
+	RenderDevice* m_pDevice;
+	u32 m_filtered = 0;
+
+	Binding m_inputLayout;
+	Binding m_topology;
+	Binding m_vertexBuffers[kStateCacheVertexBuffers];
+	Binding m_indexBuffer;
+	Binding m_shaders[ShaderStage::kMaxStages];
+	Binding m_constantBuffers[ShaderStage::kMaxStages][kStateCacheSlots];
+	Binding m_shaderResources[ShaderStage::kMaxStages][kStateCacheSlots];
+	Binding m_samplers[ShaderStage::kMaxStages][kStateCacheSlots];
+	Binding m_blendState;
+	f32 m_blendFactor[4];
+	Binding m_depthStencilState;
+	Binding m_rasterizerState;
+};
@@ -0,0 +1,102 @@
+#include "StereoFrustum.h"
+
+namespace
+{
+
+// Frustum in head space whose side planes leave from the corners of the box holding the eyes,
+// each through the corner furthest out and furthest back on its side. A single eye is a box of one point.
+void head_space_planes(const v3& vMin, const v3& vMax, const EyeFov& rFov, const f32 kNear, const f32 kFar, v4 planesOut[6])
+{
+	// Depth is -z, a point is inside a side plane when its offset from the apex is within tangent * depth.
+	planesOut[0] = v4(1.f, 0.f, -rFov.m_leftTan, -vMin.x + rFov.m_leftTan * vMax.z);	// left
+	planesOut[1] = v4(-1.f, 0.f, -rFov.m_rightTan, vMax.x + rFov.m_rightTan * vMax.z);	// right
+	planesOut[2] = v4(0.f, 1.f, -rFov.m_downTan, -vMin.y + rFov.m_downTan * vMax.z);	// bottom
+	planesOut[3] = v4(0.f, -1.f, -rFov.m_upTan, vMax.y + rFov.m_upTan * vMax.z);		// top
+	planesOut[4] = v4(0.f, 0.f, -1.f, vMax.z - kNear);								// near
+	planesOut[5] = v4(0.f, 0.f, 1.f, kFar - vMin.z);								// far
+}
+
+// Move a head space plane to world space and normalize it.
+v4 transform_plane(const v4& vPlane, const m4x4& rHeadToWorld)
+{
+	const v3 vNormal(vPlane.x, vPlane.y, vPlane.z);
+	const v3 vPoint = vNormal * (-vPlane.w / vNormal.LengthSquared());
+
+	v3 vWorldNormal = v3::TransformNormal(vNormal, rHeadToWorld);
+	vWorldNormal.Normalize();
+	const v3 vWorldPoint = v3::Transform(vPoint, rHeadToWorld);
+	return v4(vWorldNormal, -vWorldNormal.Dot(vWorldPoint));
+}
+
+bool outside_plane(const v4& vPlane, const v3& vCentre, const f32 kRadius)
+{
+	return vPlane.x * vCentre.x + vPlane.y * vCentre.y + vPlane.z * vCentre.z + vPlane.w < -kRadius;
+}
+
+} // namespace
+
+void build_stereo_frustum(const m4x4& rHeadToWorld, const v3 vEyeOffsets[2], const EyeFov fov[2], const f32 kNear, const f32 kFar, StereoFrustum& rFrustumOut)
+{
+	const v3 vMin = v3::Min(vEyeOffsets[0], vEyeOffsets[1]);
+	const v3 vMax = v3::Max(vEyeOffsets[0], vEyeOffsets[1]);
+
+	EyeFov widest;
+	widest.m_upTan = std::max(fov[0].m_upTan, fov[1].m_upTan);
+	widest.m_downTan = std::max(fov[0].m_downTan, fov[1].m_downTan);
+	widest.m_leftTan = std::max(fov[0].m_leftTan, fov[1].m_leftTan);
+	widest.m_rightTan = std::max(fov[0].m_rightTan, fov[1].m_rightTan);
+
+	v4 planes[6];
+	head_space_planes(vMin, vMax, widest, kNear, kFar, planes);
+	for (u32 i = 0; i < 6; ++i)
+		rFrustumOut.m_planes[i] = transform_plane(planes[i], rHeadToWorld);
+
+	for (u32 eye = 0; eye < 2; ++eye)
+	{
+		head_space_planes(vEyeOffsets[eye], vEyeOffsets[eye], fov[eye], kNear, kFar, planes);
+		for (u32 i = 0; i < 6; ++i)
+			rFrustumOut.m_eyePlanes[eye][i] = transform_plane(planes[i], rHeadToWorld);
+	}
+}
+
+u8 stereo_eye_mask(const StereoFrustum& rFrustum, const v3& vCentre, const f32 kRadius)
+{
+	u8 mask = 0;
+	for (u32 eye = 0; eye < 2; ++eye)
+	{
+		const v4* pPlanes = rFrustum.m_eyePlanes[eye];
+		if (!outside_plane(pPlanes[0], vCentre, kRadius) && !outside_plane(pPlanes[1], vCentre, kRadius))
+			mask |= 1u << eye;
+	}
+	return mask;
+}
+
+void stereo_eye_masks(const StereoFrustum& rFrustum, const GPULight* pLights, const u32 kCount, u8* pMasksOut)
+{
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const GPULight& rLight = pLights[i];
+		pMasksOut[i] = gpu_light_type(rLight) == kLightType_Directional ? u8(kEyeMask_Both)
+			: stereo_eye_mask(rFrustum, v3(rLight.m_vPosition), rLight.m_vAtt.w);
+	}
+}
+
+u32 split_eye_lights(const GPULight* pLights, const u8* pMasks, const u32 kTypeStart[kMaxLightTypes + 1], const u32 kEye
+	, std::vector<GPULight>& rLightsOut, u32 typeStartOut[kMaxLightTypes + 1])
+{
+	const u8 kEyeBit = u8(1u << kEye);
+
+	rLightsOut.clear();
+	for (u32 t = 0; t < kMaxLightTypes; ++t)
+	{
+		typeStartOut[t] = static_cast<u32>(rLightsOut.size());
+		for (u32 i = kTypeStart[t]; i < kTypeStart[t + 1]; ++i)
+		{
+			if (pMasks[i] & kEyeBit)
+				rLightsOut.push_back(pLights[i]);
+		}
+	}
+	typeStartOut[kMaxLightTypes] = static_cast<u32>(rLightsOut.size());
+
+	return typeStartOut[kMaxLightTypes];
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "LightSystem.h"
+
+#include <vector>
+
+//================================================================================
+// Stereo Frustum
+// One frustum enclosing both eyes' so lights are culled once per frame rather
+// than once per eye.
+//
+// The eyes look down the head's -z from their offsets, as the Rift's parallel
+// eye views do. Each side plane of the combined frustum takes the widest
+// tangent of either eye from the eye furthest out on that side, which contains
+// both eyes' frusta for any depth past the eyes. Near and far are the closest
+// and furthest of the eyes' own.
+//
+// Survivors are tagged with the eyes they can reach by testing them against
+// each eye's left and right planes only, the rest are all but shared with the
+// combined frustum. Skipping planes only ever sets more bits, never fewer.
+//================================================================================
+
+// Tangents of the half angles from the view axis, as in ovrFovPort.
+struct EyeFov
+{
+	f32 m_upTan;
+	f32 m_downTan;
+	f32 m_leftTan;
+	f32 m_rightTan;
+};
+
+enum EEyeMask : u8
+{
+	kEyeMask_Left = 1 << 0,
+	kEyeMask_Right = 1 << 1,
+	kEyeMask_Both = kEyeMask_Left | kEyeMask_Right,
+};
+
+// Planes are normalized and face inwards in the order left, right, bottom, top, near, far,
+// as LightSystem::frustum_planes() gives them.
+struct StereoFrustum
+{
+	v4 m_planes[6];			// both eyes.
+	v4 m_eyePlanes[2][6];	// each eye on its own.
+};
+
+// Head to world is the inverse of the head's view matrix, eye offsets are in head space.
+void build_stereo_frustum(const m4x4& rHeadToWorld, const v3 vEyeOffsets[2], const EyeFov fov[2], const f32 kNear, const f32 kFar, StereoFrustum& rFrustumOut);
+
+// Eyes a sphere that passed the combined frustum can reach.
+u8 stereo_eye_mask(const StereoFrustum& rFrustum, const v3& vCentre, const f32 kRadius);
+
+// Masks for a packed light list, directional lights reach both eyes.
+void stereo_eye_masks(const StereoFrustum& rFrustum, const GPULight* pLights, const u32 kCount, u8* pMasksOut);
+
+// The lights reaching one eye, in order. Lights arrive grouped by type with ranges in kTypeStart,
+// typeStartOut gets the ranges of the result. Returns the number of lights kept.
+u32 split_eye_lights(const GPULight* pLights, const u8* pMasks, const u32 kTypeStart[kMaxLightTypes + 1], const u32 kEye
+	, std::vector<GPULight>& rLightsOut, u32 typeStartOut[kMaxLightTypes + 1]);
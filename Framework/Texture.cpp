@@ -1,10 +1,12 @@
 #include "Texture.h"
+#include "D3D11RenderDevice.h"
 #include "DirectXTK/DDSTextureLoader.h"
-#include "DirectXTK/WICTextureLoader.h"
+#include "MipGenerator.h"
 
 Texture::Texture()
 	: m_pTexture(nullptr)
 	, m_pTextureView(nullptr)
+	, m_binding()
 {
 
 }
@@ -26,46 +28,270 @@ void Texture::init_from_dds(ID3D11Device* pDevice, const char* pFilename)
 	{
 		panicF("Could not load texture : %s ", pFilename);
 	}
+	m_binding.m_pView = to_handle(m_pTextureView);
 }
 
-void Texture::init_from_image(ID3D11Device* pDevice, const char* pFilename, bool bGenerateMips)
+void Texture::init_from_image(ID3D11Device* pDevice, const char* pFilename, bool bGenerateMips, JobSystem* pJobs)
 {
-	wchar_t fileNameW[MAX_PATH];
-	size_t numChars;
-	mbstowcs_s(&numChars, fileNameW, MAX_PATH, pFilename, MAX_PATH);
+	u32 size = 0;
+	memtype_t* pData = load_file(pFilename, size, 16, 0);
+	if (!pData)
+	{
+		panicF("Could not load texture : %s ", pFilename);
+	}
+
+	init_from_encoded(pDevice, pData, size, bGenerateMips, pJobs, pFilename);
+	release_loaded_file(pData);
+}
+
+void Texture::init_from_encoded(ID3D11Device* pDevice, const memtype_t* pData, const u32 kSize, bool bGenerateMips, JobSystem* pJobs, const char* pDebugName)
+{
+	ImageInfo info;
+	if (!query_image_info(pData, kSize, info))
+	{
+		panicF("Could not decode texture : %s ", pDebugName);
+	}
+
+	// The mip filter works in RGBA8, higher precision sources are uploaded as a single level.
+	if (bGenerateMips && info.m_format != kImageFormat_RGBA8)
+	{
+		debugF("Skipping mip generation for high precision texture : %s", pDebugName);
+		bGenerateMips = false;
+	}
+
+	// Decode straight into the buffer the upload reads from.
+	Image source;
+	source.m_width = info.m_width;
+	source.m_height = info.m_height;
+	source.m_pixels.resize(info.staging_bytes());
+	if (!decode_image(pData, kSize, info, source.m_pixels.data(), info.pitch()))
+	{
+		panicF("Could not decode texture : %s ", pDebugName);
+	}
+
+	if (bGenerateMips)
+	{
+		source.m_pixels.resize(info.size_bytes());
+
+		std::vector<Image> mips;
+		generate_mip_chain(source, kMipFilter_Box, true, mips, pJobs);
+		init_from_mips(pDevice, mips, pDebugName);
+	}
+	else
+	{
+		init_from_pixels(pDevice, info, source.m_pixels.data(), pDebugName);
+	}
+}
+
+static DXGI_FORMAT image_format_dxgi(EImageFormat format)
+{
+	switch (format)
+	{
+	case kImageFormat_RGBA8: return DXGI_FORMAT_R8G8B8A8_UNORM;
+	case kImageFormat_RGBA16: return DXGI_FORMAT_R16G16B16A16_UNORM;
+	case kImageFormat_RGBA32F: return DXGI_FORMAT_R32G32B32A32_FLOAT;
+	default: return DXGI_FORMAT_UNKNOWN;
+	}
+}
+
+void Texture::init_from_pixels(ID3D11Device* pDevice, const ImageInfo& rInfo, const void* pPixels, const char* pDebugName)
+{
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = rInfo.m_width;
+	desc.Height = rInfo.m_height;
+	desc.MipLevels = 1;
+	desc.ArraySize = 1;
+	desc.Format = image_format_dxgi(rInfo.m_format);
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	D3D11_SUBRESOURCE_DATA data = {};
+	data.pSysMem = pPixels;
+	data.SysMemPitch = rInfo.pitch();
 
-	HRESULT hr = DirectX::CreateWICTextureFromFile(pDevice, fileNameW, &m_pTexture, &m_pTextureView);
+	ID3D11Texture2D* pTexture2D = nullptr;
+	HRESULT hr = pDevice->CreateTexture2D(&desc, &data, &pTexture2D);
 	if (FAILED(hr))
 	{
-		panicF("Could not load texture : %s ", pFilename);
+		panicF("Could not create texture : %s ", pDebugName);
+	}
+	m_pTexture = pTexture2D;
+
+	hr = pDevice->CreateShaderResourceView(m_pTexture, nullptr, &m_pTextureView);
+	if (FAILED(hr))
+	{
+		panicF("Could not create texture view : %s ", pDebugName);
 	}
+	m_binding.m_pView = to_handle(m_pTextureView);
+}
+
+void Texture::init_from_mips(ID3D11Device* pDevice, const std::vector<Image>& mips, const char* pDebugName)
+{
+	init_from_slices(pDevice, &mips, 1, false, pDebugName);
+}
+
+void Texture::init_from_array(ID3D11Device* pDevice, const std::vector<std::vector<Image>>& slices, const char* pDebugName)
+{
+	init_from_slices(pDevice, slices.data(), static_cast<u32>(slices.size()), true, pDebugName);
+}
+
+void Texture::init_from_slices(ID3D11Device* pDevice, const std::vector<Image>* pSlices, const u32 kSliceCount, bool bArray, const char* pDebugName)
+{
+	ASSERT(kSliceCount > 0 && !pSlices[0].empty());
+
+	const u32 kMipLevels = static_cast<u32>(pSlices[0].size());
+
+	D3D11_TEXTURE2D_DESC desc = {};
+	desc.Width = pSlices[0][0].m_width;
+	desc.Height = pSlices[0][0].m_height;
+	desc.MipLevels = kMipLevels;
+	desc.ArraySize = kSliceCount;
+	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.SampleDesc.Count = 1;
+	desc.Usage = D3D11_USAGE_IMMUTABLE;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+	// Subresources are ordered by slice, then mip.
+	std::vector<D3D11_SUBRESOURCE_DATA> data(kSliceCount * kMipLevels);
+	for (u32 slice = 0; slice < kSliceCount; ++slice)
+	{
+		ASSERT(pSlices[slice].size() == kMipLevels);
+		for (u32 mip = 0; mip < kMipLevels; ++mip)
+		{
+			const Image& rLevel = pSlices[slice][mip];
+			data[slice * kMipLevels + mip].pSysMem = rLevel.m_pixels.data();
+			data[slice * kMipLevels + mip].SysMemPitch = rLevel.pitch();
+		}
+	}
+
+	ID3D11Texture2D* pTexture2D = nullptr;
+	HRESULT hr = pDevice->CreateTexture2D(&desc, data.data(), &pTexture2D);
+	if (FAILED(hr))
+	{
+		panicF("Could not create texture : %s ", pDebugName);
+	}
+	m_pTexture = pTexture2D;
+
+	// Arrays get an explicit view so a single slice is still a Texture2DArray to the shader.
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = desc.Format;
+	if (bArray)
+	{
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2DARRAY;
+		srvDesc.Texture2DArray.MipLevels = kMipLevels;
+		srvDesc.Texture2DArray.ArraySize = kSliceCount;
+	}
+	else
+	{
+		srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+		srvDesc.Texture2D.MipLevels = kMipLevels;
+	}
+
+	hr = pDevice->CreateShaderResourceView(m_pTexture, &srvDesc, &m_pTextureView);
+	if (FAILED(hr))
+	{
+		panicF("Could not create texture view : %s ", pDebugName);
+	}
+	m_binding.m_pView = to_handle(m_pTextureView);
+}
+
+void Texture::init_from_memory(ID3D11Device* pDevice, const memtype_t* pData, const u32 kSize, bool bIsDDS, const char* pDebugName)
+{
+	if (!bIsDDS)
+	{
+		init_from_encoded(pDevice, pData, kSize, false, nullptr, pDebugName);
+		return;
+	}
+
+	HRESULT hr = DirectX::CreateDDSTextureFromMemory(pDevice, pData, kSize, &m_pTexture, &m_pTextureView);
+	if (FAILED(hr))
+	{
+		panicF("Could not load texture : %s ", pDebugName);
+	}
+	m_binding.m_pView = to_handle(m_pTextureView);
 }
 
 void Texture::bind(ID3D11DeviceContext* pDeviceContext, ShaderStage::ShaderStageEnum stage, u32 slot) const
 {
-	// This is not very efficient.
-	// We could bind multiple in a single call.
-	// An opportunity for you to change ;)
-
-	switch (stage)
-	{
-	case ShaderStage::kVertex:
-		pDeviceContext->VSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
-	case ShaderStage::kHull:
-		pDeviceContext->HSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
-	case ShaderStage::kDomain:
-		pDeviceContext->DSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
-	case ShaderStage::kGeometry:
-		pDeviceContext->GSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
-	case ShaderStage::kPixel:
-		pDeviceContext->PSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
-	case ShaderStage::kCompute:
-		pDeviceContext->CSSetShaderResources(slot, 1, &m_pTextureView);
-		break;
+	D3D11RenderDevice device(pDeviceContext);
+	m_binding.bind(device, stage, slot);
+}
+
+// Bits per texel for the formats we expect to load, block compressed formats are per texel averages.
+static u32 bits_per_pixel(DXGI_FORMAT format)
+{
+	switch (format)
+	{
+	case DXGI_FORMAT_R32G32B32A32_FLOAT:
+		return 128;
+	case DXGI_FORMAT_R16G16B16A16_FLOAT:
+	case DXGI_FORMAT_R16G16B16A16_UNORM:
+	case DXGI_FORMAT_R32G32_FLOAT:
+		return 64;
+	case DXGI_FORMAT_R8G8B8A8_UNORM:
+	case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8A8_UNORM:
+	case DXGI_FORMAT_B8G8R8A8_UNORM_SRGB:
+	case DXGI_FORMAT_B8G8R8X8_UNORM:
+	case DXGI_FORMAT_R10G10B10A2_UNORM:
+	case DXGI_FORMAT_R32_FLOAT:
+		return 32;
+	case DXGI_FORMAT_R8G8_UNORM:
+	case DXGI_FORMAT_R16_FLOAT:
+	case DXGI_FORMAT_B5G6R5_UNORM:
+		return 16;
+	case DXGI_FORMAT_R8_UNORM:
+	case DXGI_FORMAT_A8_UNORM:
+	case DXGI_FORMAT_BC2_UNORM:
+	case DXGI_FORMAT_BC2_UNORM_SRGB:
+	case DXGI_FORMAT_BC3_UNORM:
+	case DXGI_FORMAT_BC3_UNORM_SRGB:
+	case DXGI_FORMAT_BC5_UNORM:
+	case DXGI_FORMAT_BC5_SNORM:
+	case DXGI_FORMAT_BC6H_UF16:
+	case DXGI_FORMAT_BC7_UNORM:
+	case DXGI_FORMAT_BC7_UNORM_SRGB:
+		return 8;
+	case DXGI_FORMAT_BC1_UNORM:
+	case DXGI_FORMAT_BC1_UNORM_SRGB:
+	case DXGI_FORMAT_BC4_UNORM:
+	case DXGI_FORMAT_BC4_SNORM:
+		return 4;
+	default:
+		return 32;
+	}
+}
+
+u64 Texture::resident_bytes() const
+{
+	if (!m_pTexture)
+		return 0;
+
+	D3D11_RESOURCE_DIMENSION dimension;
+	m_pTexture->GetType(&dimension);
+	if (dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+		return 0;
+
+	D3D11_TEXTURE2D_DESC desc;
+	static_cast<ID3D11Texture2D*>(m_pTexture)->GetDesc(&desc);
+
+	// Sum each mip, block compressed mips never go below a 4x4 block.
+	const u32 kBits = bits_per_pixel(desc.Format);
+	const bool kBlockCompressed = desc.Format >= DXGI_FORMAT_BC1_TYPELESS && desc.Format <= DXGI_FORMAT_BC5_SNORM
+		|| desc.Format >= DXGI_FORMAT_BC6H_TYPELESS && desc.Format <= DXGI_FORMAT_BC7_UNORM_SRGB;
+
+	u64 bytes = 0;
+	for (u32 mip = 0; mip < desc.MipLevels; ++mip)
+	{
+		u64 w = std::max(1u, desc.Width >> mip);
+		u64 h = std::max(1u, desc.Height >> mip);
+		if (kBlockCompressed)
+		{
+			w = std::max<u64>(4, (w + 3) & ~3ull);
+			h = std::max<u64>(4, (h + 3) & ~3ull);
+		}
+		bytes += (w * h * kBits) / 8;
 	}
+	return bytes * desc.ArraySize;
 }
@@ -2,6 +2,11 @@
 
 #include "CommonHeader.h"
 #include "ShaderSet.h"
+#include "Image.h"
+
+#include <vector>
+
+class JobSystem;
 
 class Texture
 {
@@ -14,14 +19,37 @@ public:
 	// Initialize from a DDS file.
 	void init_from_dds(ID3D11Device* pDevice, const char* pFilename);
 
-	// Initialize from a non-dds image files such as JPEG, or PNG
-	void init_from_image(ID3D11Device* pDevice, const char* pFilename, bool bGenerateMips);
+	// Initialize from a non-dds image files such as JPEG, PNG (8 or 16 bit) or HDR, decoded with stb_image.
+	// Mips are generated on the CPU for 8 bit sources, spread across the job system if one is given.
+	void init_from_image(ID3D11Device* pDevice, const char* pFilename, bool bGenerateMips, JobSystem* pJobs = nullptr);
+
+	// Initialize from pixels already decoded by decode_image / decode_images, no mips.
+	void init_from_pixels(ID3D11Device* pDevice, const ImageInfo& rInfo, const void* pPixels, const char* pDebugName);
+
+	// Initialize from a prepared RGBA8 mip chain, largest level first.
+	void init_from_mips(ID3D11Device* pDevice, const std::vector<Image>& mips, const char* pDebugName);
+
+	// Initialize a texture array from RGBA8 mip chains, one per slice, such as TextureAtlas::pages().
+	void init_from_array(ID3D11Device* pDevice, const std::vector<std::vector<Image>>& slices, const char* pDebugName);
+
+	// Initialize from a file already loaded into memory, DDS or any image init_from_image accepts.
+	void init_from_memory(ID3D11Device* pDevice, const memtype_t* pData, const u32 kSize, bool bIsDDS, const char* pDebugName);
 
 	// bind to the pipeline on a particular shader and slot
 	void bind(ID3D11DeviceContext* pDeviceContext, ShaderStage::ShaderStageEnum stage, u32 slot) const;
+	void bind(RenderDevice& rDevice, ShaderStage::ShaderStageEnum stage, u32 slot) const { m_binding.bind(rDevice, stage, slot); }
+
+	// The view as a handle, filled in by the init functions.
+	const TextureBinding& binding() const { return m_binding; }
+
+	// Approximate video memory used by all mips and slices of the texture.
+	u64 resident_bytes() const;
 
 private:
+	void init_from_slices(ID3D11Device* pDevice, const std::vector<Image>* pSlices, const u32 kSliceCount, bool bArray, const char* pDebugName);
+	void init_from_encoded(ID3D11Device* pDevice, const memtype_t* pData, const u32 kSize, bool bGenerateMips, JobSystem* pJobs, const char* pDebugName);
+
 	ID3D11Resource* m_pTexture;
 	ID3D11ShaderResourceView* m_pTextureView;
+	TextureBinding m_binding;
 };
-
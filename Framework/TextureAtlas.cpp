@@ -0,0 +1,199 @@
+#include "TextureAtlas.h"
+#include "MipGenerator.h"
+#include "JobQueue.h"
+
+// imgui_draw.cpp compiles its own static copy, keep ours private to this file too.
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imgui/stb_rect_pack.h"
+
+bool TextureAtlas::build(const Image* pSources, const u32 kCount, const Desc& rDesc, JobSystem* pJobs)
+{
+	ASSERT(rDesc.m_mipLevels > 0 && rDesc.m_mipLevels <= mip_level_count(rDesc.m_pageSize, rDesc.m_pageSize));
+
+	m_desc = rDesc;
+	m_gutter = 1u << (rDesc.m_mipLevels - 1);
+	m_slots.assign(kCount, Slot{});
+	m_entries.assign(kCount, AtlasEntry{});
+	m_pages.clear();
+	m_stats = {};
+
+	// Pack on a grid of gutter sized cells, that keeps every slot aligned to the smallest protected mip.
+	const u32 kCell = m_gutter;
+	const u32 kGridSize = rDesc.m_pageSize / kCell;
+
+	std::vector<stbrp_rect> pending(kCount);
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		stbrp_rect& rRect = pending[i];
+		rRect = {};
+		rRect.id = i;
+
+		// Check in cells before narrowing to stbrp_coord, which may be 16 bits.
+		const u32 kCellsX = (pSources[i].m_width + kCell - 1) / kCell + 2;
+		const u32 kCellsY = (pSources[i].m_height + kCell - 1) / kCell + 2;
+		if (kCellsX > kGridSize || kCellsY > kGridSize)
+		{
+			errorF("Texture atlas : source %u (%ux%u) doesn't fit a %u page with its gutter", i, pSources[i].m_width, pSources[i].m_height, rDesc.m_pageSize);
+			return false;
+		}
+		rRect.w = static_cast<stbrp_coord>(kCellsX);
+		rRect.h = static_cast<stbrp_coord>(kCellsY);
+		m_stats.m_sourceTexels += u64(pSources[i].m_width) * pSources[i].m_height;
+	}
+
+	// Fill one page at a time, whatever didn't fit moves on to the next.
+	std::vector<stbrp_node> nodes(kGridSize);
+	u32 page = 0;
+	while (!pending.empty())
+	{
+		if (page == rDesc.m_maxPages)
+		{
+			errorF("Texture atlas : %u textures left over after %u pages", static_cast<u32>(pending.size()), page);
+			return false;
+		}
+
+		stbrp_context context;
+		stbrp_init_target(&context, kGridSize, kGridSize, nodes.data(), static_cast<int>(nodes.size()));
+		stbrp_pack_rects(&context, pending.data(), static_cast<int>(pending.size()));
+
+		std::vector<stbrp_rect> leftOver;
+		for (const stbrp_rect& rRect : pending)
+		{
+			if (!rRect.was_packed)
+			{
+				leftOver.push_back(rRect);
+				continue;
+			}
+
+			Slot& rSlot = m_slots[rRect.id];
+			rSlot.m_page = page;
+			rSlot.m_x = rRect.x * kCell;
+			rSlot.m_y = rRect.y * kCell;
+			rSlot.m_width = rRect.w * kCell;
+			rSlot.m_height = rRect.h * kCell;
+		}
+
+		pending.swap(leftOver);
+		++page;
+	}
+
+	m_pages.resize(page);
+	m_stats.m_pages = page;
+	m_stats.m_pageTexels = u64(page) * rDesc.m_pageSize * rDesc.m_pageSize;
+
+	std::vector<Image> topLevels(page);
+	for (Image& rTop : topLevels)
+	{
+		rTop.resize(rDesc.m_pageSize, rDesc.m_pageSize);
+		memset(rTop.m_pixels.data(), 0, rTop.m_pixels.size());
+	}
+
+	// Slots never overlap so sources can be copied in parallel.
+	const f32 kInvPageSize = 1.f / rDesc.m_pageSize;
+	auto copyRange = [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 i = kBegin; i < kEnd; ++i)
+		{
+			const Slot& rSlot = m_slots[i];
+			const Image& rSource = pSources[i];
+			Image& rTop = topLevels[rSlot.m_page];
+
+			for (u32 y = 0; y < rSlot.m_height; ++y)
+			{
+				const s32 kSourceY = std::min(std::max(s32(y) - s32(m_gutter), 0), s32(rSource.m_height) - 1);
+				const u8* pSourceRow = rSource.row(kSourceY);
+				u8* pDestRow = rTop.row(rSlot.m_y + y) + rSlot.m_x * 4;
+
+				for (u32 x = 0; x < rSlot.m_width; ++x)
+				{
+					const s32 kSourceX = std::min(std::max(s32(x) - s32(m_gutter), 0), s32(rSource.m_width) - 1);
+					memcpy(pDestRow + x * 4, pSourceRow + kSourceX * 4, 4);
+				}
+			}
+
+			AtlasEntry& rEntry = m_entries[i];
+			rEntry.m_slice = rSlot.m_page;
+			rEntry.m_uvScale = v2(rSource.m_width * kInvPageSize, rSource.m_height * kInvPageSize);
+			rEntry.m_uvOffset = v2((rSlot.m_x + m_gutter) * kInvPageSize, (rSlot.m_y + m_gutter) * kInvPageSize);
+		}
+	};
+
+	if (pJobs)
+	{
+		pJobs->parallelFor(kCount, 4, copyRange);
+	}
+	else
+	{
+		copyRange(0, kCount);
+	}
+
+	// Only the protected levels, smaller ones would mix neighbours together.
+	for (u32 i = 0; i < page; ++i)
+	{
+		generate_mip_chain(topLevels[i], kMipFilter_Box, rDesc.m_bSRGB, m_pages[i], pJobs);
+		m_pages[i].resize(rDesc.m_mipLevels);
+	}
+
+	return true;
+}
+
+v2 TextureAtlas::remap_uv(const u32 kEntry, const v2& uv) const
+{
+	const AtlasEntry& rEntry = m_entries[kEntry];
+	return v2(uv.x * rEntry.m_uvScale.x + rEntry.m_uvOffset.x, uv.y * rEntry.m_uvScale.y + rEntry.m_uvOffset.y);
+}
+
+bool TextureAtlas::validate(const Image* pSources, const u32 kCount) const
+{
+	if (kCount != m_entries.size())
+		return false;
+
+	// Slots must sit inside their page, on the mip grid, without touching each other.
+	const u32 kAlign = m_gutter;
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const Slot& a = m_slots[i];
+		if (a.m_x % kAlign || a.m_y % kAlign || a.m_x + a.m_width > m_desc.m_pageSize || a.m_y + a.m_height > m_desc.m_pageSize)
+		{
+			errorF("Texture atlas : slot %u is misplaced", i);
+			return false;
+		}
+
+		for (u32 j = i + 1; j < kCount; ++j)
+		{
+			const Slot& b = m_slots[j];
+			if (a.m_page == b.m_page && a.m_x < b.m_x + b.m_width && b.m_x < a.m_x + a.m_width
+				&& a.m_y < b.m_y + b.m_height && b.m_y < a.m_y + a.m_height)
+			{
+				errorF("Texture atlas : slots %u and %u overlap", i, j);
+				return false;
+			}
+		}
+	}
+
+	// Point sample the top level at each remapped texel centre.
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		const Image& rSource = pSources[i];
+		const Image& rPage = m_pages[m_entries[i].m_slice][0];
+
+		for (u32 y = 0; y < rSource.m_height; ++y)
+		{
+			for (u32 x = 0; x < rSource.m_width; ++x)
+			{
+				const v2 uv = remap_uv(i, v2((x + 0.5f) / rSource.m_width, (y + 0.5f) / rSource.m_height));
+				const u32 kPageX = static_cast<u32>(uv.x * m_desc.m_pageSize);
+				const u32 kPageY = static_cast<u32>(uv.y * m_desc.m_pageSize);
+
+				if (memcmp(rSource.row(y) + x * 4, rPage.row(kPageY) + kPageX * 4, 4) != 0)
+				{
+					errorF("Texture atlas : texel (%u, %u) of source %u remaps to the wrong place", x, y, i);
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "Image.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Texture Atlas
+// Packs many small material textures into the slices of one texture array so
+// they can share a single binding. Each material gets a slice and a uv scale
+// and offset, sample with : float3(uv * m_uvScale + m_uvOffset, m_slice).
+//
+// Every texture is surrounded by a gutter of clamped edge texels and placed on
+// a grid aligned to the smallest protected mip, so filtering at any of those
+// levels never pulls in a neighbour. Levels below that are not generated.
+// Wrapped uvs need a frac() before the remap.
+//================================================================================
+
+struct AtlasEntry
+{
+	u32 m_slice;
+	v2 m_uvScale;
+	v2 m_uvOffset;
+};
+
+class TextureAtlas
+{
+public:
+
+	struct Desc
+	{
+		u32 m_pageSize = 2048;	// width and height of every slice.
+		u32 m_mipLevels = 4;	// levels kept free of bleeding, the gutter is 2^(m_mipLevels - 1) texels.
+		u32 m_maxPages = 16;
+		bool m_bSRGB = true;	// filter mips in linear space.
+	};
+
+	struct Stats
+	{
+		u32 m_pages;
+		u64 m_sourceTexels;		// texels of the packed textures, without gutters.
+		u64 m_pageTexels;		// texels of all slices at the top level.
+
+		f32 efficiency() const { return m_pageTexels ? f32(m_sourceTexels) / f32(m_pageTexels) : 0.f; }
+	};
+
+	// Pack RGBA8 sources, entry i of the table belongs to pSources[i].
+	// Fails if a source is larger than a page or everything doesn't fit in m_maxPages.
+	bool build(const Image* pSources, const u32 kCount, const Desc& rDesc, JobSystem* pJobs);
+
+	// Map a material uv in [0, 1] into its slice.
+	v2 remap_uv(const u32 kEntry, const v2& uv) const;
+
+	// Check every source texel is found at its remapped uv and no slots overlap.
+	bool validate(const Image* pSources, const u32 kCount) const;
+
+	const AtlasEntry& entry(const u32 kEntry) const { return m_entries[kEntry]; }
+	const std::vector<AtlasEntry>& entries() const { return m_entries; }
+
+	// Mip chains per slice, suitable for Texture::init_from_array.
+	const std::vector<std::vector<Image>>& pages() const { return m_pages; }
+
+	const Stats& stats() const { return m_stats; }
+
+private:
+
+	// Where a source ended up, in texels of the top level including its gutter.
+	struct Slot
+	{
+		u32 m_page;
+		u32 m_x, m_y;
+		u32 m_width, m_height;
+	};
+
+	void fill_slot(const Image& rSource, const Slot& rSlot);
+
+	Desc m_desc;
+	u32 m_gutter = 0;
+	std::vector<Slot> m_slots;
+	std::vector<AtlasEntry> m_entries;
+	std::vector<std::vector<Image>> m_pages;
+	Stats m_stats = {};
+};
@@ -0,0 +1,286 @@
+#include "TextureCache.h"
+#include "Framework.h"
+
+//================================================================================
+// TextureRef
+//================================================================================
+
+TextureRef::TextureRef(TextureCache* pCache, TextureHandle handle)
+	: m_pCache(pCache)
+	, m_handle(handle)
+{
+	// the cache hands us an already counted reference.
+}
+
+TextureRef::TextureRef(const TextureRef& rOther)
+	: m_pCache(rOther.m_pCache)
+	, m_handle(rOther.m_handle)
+{
+	if (valid())
+		m_pCache->add_ref(m_handle);
+}
+
+TextureRef::TextureRef(TextureRef&& rOther)
+	: m_pCache(rOther.m_pCache)
+	, m_handle(rOther.m_handle)
+{
+	rOther.m_pCache = nullptr;
+	rOther.m_handle = kInvalidTextureHandle;
+}
+
+TextureRef::~TextureRef()
+{
+	reset();
+}
+
+TextureRef& TextureRef::operator=(const TextureRef& rOther)
+{
+	if (this != &rOther)
+	{
+		if (rOther.valid())
+			rOther.m_pCache->add_ref(rOther.m_handle);
+		reset();
+		m_pCache = rOther.m_pCache;
+		m_handle = rOther.m_handle;
+	}
+	return *this;
+}
+
+TextureRef& TextureRef::operator=(TextureRef&& rOther)
+{
+	if (this != &rOther)
+	{
+		reset();
+		m_pCache = rOther.m_pCache;
+		m_handle = rOther.m_handle;
+		rOther.m_pCache = nullptr;
+		rOther.m_handle = kInvalidTextureHandle;
+	}
+	return *this;
+}
+
+void TextureRef::reset()
+{
+	if (valid())
+		m_pCache->release(m_handle);
+	m_pCache = nullptr;
+	m_handle = kInvalidTextureHandle;
+}
+
+const Texture* TextureRef::get() const
+{
+	return valid() ? m_pCache->get(m_handle) : nullptr;
+}
+
+//================================================================================
+// TextureCache
+//================================================================================
+
+TextureCache::TextureCache()
+	: m_pDevice(nullptr)
+	, m_flags(kFlag_None)
+	, m_stats({})
+{
+
+}
+
+TextureCache::~TextureCache()
+{
+	// Anything still referenced here is leaked by the owner, free it anyway.
+	for (auto& rEntry : m_entries)
+	{
+		delete rEntry.m_pTexture;
+	}
+}
+
+void TextureCache::init(ID3D11Device* pDevice, u32 flags)
+{
+	m_pDevice = pDevice;
+	m_flags = flags;
+}
+
+TextureRef TextureCache::acquire(const char* pFilename)
+{
+	ASSERT(m_pDevice);
+
+	const std::string key = normalize_path(pFilename);
+
+	// Fast path, same name as something already resident.
+	auto itPath = m_pathLookup.find(key);
+	if (itPath != m_pathLookup.end())
+	{
+		++m_stats.m_cacheHits;
+		add_ref(itPath->second);
+		return TextureRef(this, itPath->second);
+	}
+
+	u32 size = 0;
+	memtype_t* pData = load_file(pFilename, size, 16, 0);
+	if (!pData)
+	{
+		panicF("Could not load texture : %s ", pFilename);
+	}
+	++m_stats.m_fileLoads;
+
+	// A different name for identical data, alias the path to the existing entry.
+	u64 contentHash = 0;
+	if (m_flags & kFlag_DedupByContent)
+	{
+		contentHash = hash_content(pData, size);
+
+		auto itContent = m_contentLookup.find(contentHash);
+		if (itContent != m_contentLookup.end() && same_content(m_entries[itContent->second], contentHash, size))
+		{
+			release_loaded_file(pData);
+
+			++m_stats.m_contentHits;
+			m_pathLookup[key] = itContent->second;
+			m_entries[itContent->second].m_paths.push_back(key);
+			add_ref(itContent->second);
+			return TextureRef(this, itContent->second);
+		}
+	}
+
+	const size_t kExt = key.rfind('.');
+	const bool kIsDDS = kExt != std::string::npos && key.compare(kExt, std::string::npos, ".dds") == 0;
+
+	TextureHandle handle = allocate_entry();
+	Entry& rEntry = m_entries[handle];
+	rEntry.m_pTexture = new Texture();
+	rEntry.m_pTexture->init_from_memory(m_pDevice, pData, size, kIsDDS, pFilename);
+	rEntry.m_refCount = 1;
+	rEntry.m_contentHash = contentHash;
+	rEntry.m_fileSize = size;
+	rEntry.m_bytes = rEntry.m_pTexture->resident_bytes();
+	rEntry.m_paths.push_back(key);
+
+	release_loaded_file(pData);
+
+	// A hash collision keeps the first entry in the lookup, the second is only found by path.
+	m_pathLookup[key] = handle;
+	if (m_flags & kFlag_DedupByContent)
+	{
+		m_contentLookup.emplace(contentHash, handle);
+	}
+
+	++m_stats.m_residentTextures;
+	m_stats.m_residentBytes += rEntry.m_bytes;
+
+	return TextureRef(this, handle);
+}
+
+void TextureCache::add_ref(TextureHandle handle)
+{
+	ASSERT(handle < m_entries.size() && m_entries[handle].m_refCount > 0);
+	++m_entries[handle].m_refCount;
+}
+
+void TextureCache::release(TextureHandle handle)
+{
+	ASSERT(handle < m_entries.size() && m_entries[handle].m_refCount > 0);
+
+	Entry& rEntry = m_entries[handle];
+	if (--rEntry.m_refCount > 0)
+		return;
+
+	// Last reference, drop all the lookups and free the GPU resource.
+	for (auto& rPath : rEntry.m_paths)
+	{
+		m_pathLookup.erase(rPath);
+	}
+	if (m_flags & kFlag_DedupByContent)
+	{
+		auto itContent = m_contentLookup.find(rEntry.m_contentHash);
+		if (itContent != m_contentLookup.end() && itContent->second == handle)
+			m_contentLookup.erase(itContent);
+	}
+
+	--m_stats.m_residentTextures;
+	m_stats.m_residentBytes -= rEntry.m_bytes;
+
+	delete rEntry.m_pTexture;
+	rEntry = Entry{};
+	m_freeEntries.push_back(handle);
+}
+
+const Texture* TextureCache::get(TextureHandle handle) const
+{
+	ASSERT(handle < m_entries.size());
+	return m_entries[handle].m_pTexture;
+}
+
+bool TextureCache::same_content(const Entry& rEntry, const u64 kContentHash, const u32 kSize)
+{
+	return rEntry.m_contentHash == kContentHash && rEntry.m_fileSize == kSize;
+}
+
+TextureHandle TextureCache::allocate_entry()
+{
+	if (!m_freeEntries.empty())
+	{
+		TextureHandle handle = m_freeEntries.back();
+		m_freeEntries.pop_back();
+		return handle;
+	}
+
+	m_entries.push_back(Entry{});
+	return static_cast<TextureHandle>(m_entries.size() - 1);
+}
+
+std::string TextureCache::normalize_path(const char* pFilename)
+{
+	// Split into segments resolving "." and ".." as we go.
+	std::vector<std::string> segments;
+	std::string segment;
+	const bool kAbsolute = pFilename[0] == '/' || pFilename[0] == '\\';
+
+	for (const char* p = pFilename;; ++p)
+	{
+		const char c = *p;
+		if (c == '/' || c == '\\' || c == '\0')
+		{
+			if (segment == "..")
+			{
+				if (!segments.empty() && segments.back() != "..")
+					segments.pop_back();
+				else if (!kAbsolute)
+					segments.push_back(segment);
+			}
+			else if (!segment.empty() && segment != ".")
+			{
+				segments.push_back(segment);
+			}
+			segment.clear();
+
+			if (c == '\0')
+				break;
+		}
+		else
+		{
+			segment.push_back(static_cast<char>(tolower(static_cast<unsigned char>(c))));
+		}
+	}
+
+	std::string result = kAbsolute ? "/" : "";
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		if (i > 0)
+			result.push_back('/');
+		result += segments[i];
+	}
+	return result;
+}
+
+u64 TextureCache::hash_content(const memtype_t* pData, const u32 kSize)
+{
+	constexpr u64 kOffsetBasis = 14695981039346656037ull;
+	constexpr u64 kPrime = 1099511628211ull;
+
+	u64 hash = kOffsetBasis;
+	for (u32 i = 0; i < kSize; ++i)
+	{
+		hash ^= pData[i];
+		hash *= kPrime;
+	}
+	return hash;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "CommonHeader.h"
+#include "Texture.h"
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class TextureCache;
+
+//================================================================================
+// Texture Handle
+// Index into the texture cache, invalid handles bind nothing.
+//================================================================================
+using TextureHandle = u32;
+constexpr TextureHandle kInvalidTextureHandle = 0xffffffff;
+
+//================================================================================
+// TextureRef
+// Reference counted handle, copies share the texture and the last one out
+// releases it from the cache.
+//================================================================================
+class TextureRef
+{
+public:
+	TextureRef() = default;
+	TextureRef(TextureCache* pCache, TextureHandle handle);
+	TextureRef(const TextureRef& rOther);
+	TextureRef(TextureRef&& rOther);
+	~TextureRef();
+
+	TextureRef& operator=(const TextureRef& rOther);
+	TextureRef& operator=(TextureRef&& rOther);
+
+	void reset();
+
+	bool valid() const { return m_handle != kInvalidTextureHandle; }
+	TextureHandle handle() const { return m_handle; }
+
+	const Texture* get() const;
+	const Texture* operator->() const { return get(); }
+
+private:
+	TextureCache* m_pCache = nullptr;
+	TextureHandle m_handle = kInvalidTextureHandle;
+};
+
+//================================================================================
+// Texture Cache
+// Loads each texture once, keyed by normalised path and optionally by a hash
+// of the file contents, so copies of the same image under different names
+// also share a single GPU resource. Entries keep their file's hash and size,
+// a new file is shared when both match without reading the resident one again.
+//================================================================================
+class TextureCache
+{
+public:
+
+	enum EFlags
+	{
+		kFlag_None = 0,
+		kFlag_DedupByContent = 1 << 0, // hash file contents to share identical files.
+	};
+
+	struct Stats
+	{
+		u32 m_fileLoads;		// number of times we hit the disk.
+		u32 m_cacheHits;		// acquires satisfied by path.
+		u32 m_contentHits;		// acquires satisfied by content hash.
+		u32 m_residentTextures;
+		u64 m_residentBytes;
+	};
+
+	TextureCache();
+	~TextureCache();
+
+	void init(ID3D11Device* pDevice, u32 flags = kFlag_DedupByContent);
+
+	// Load or find a texture, the returned reference keeps it resident.
+	TextureRef acquire(const char* pFilename);
+
+	// Manual reference counting, used by TextureRef.
+	void add_ref(TextureHandle handle);
+	void release(TextureHandle handle);
+
+	const Texture* get(TextureHandle handle) const;
+
+	const Stats& stats() const { return m_stats; }
+	u64 resident_bytes() const { return m_stats.m_residentBytes; }
+
+	// Lower case, forward slashes and "." / ".." segments collapsed.
+	static std::string normalize_path(const char* pFilename);
+
+	// FNV-1a hash of a block of memory.
+	static u64 hash_content(const memtype_t* pData, const u32 kSize);
+
+private:
+
+	struct Entry
+	{
+		Texture* m_pTexture;
+		u32 m_refCount;
+		u64 m_contentHash;
+		u32 m_fileSize;
+		u64 m_bytes;
+		std::vector<std::string> m_paths; // all path keys aliasing this entry.
+	};
+
+	TextureHandle allocate_entry();
+
+	// The entry's file hashed and sized the same as these bytes.
+	static bool same_content(const Entry& rEntry, const u64 kContentHash, const u32 kSize);
+
+	ID3D11Device* m_pDevice;
+	u32 m_flags;
+	Stats m_stats;
+
+	std::vector<Entry> m_entries;
+	std::vector<TextureHandle> m_freeEntries;
+	std::unordered_map<std::string, TextureHandle> m_pathLookup;
+	std::unordered_map<u64, TextureHandle> m_contentLookup;
+};
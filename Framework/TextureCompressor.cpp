@@ -0,0 +1,985 @@
+#include "TextureCompressor.h"
+#include "JobQueue.h"
+#include "MipGenerator.h"
+
+#include <emmintrin.h>
+#include <cfloat>
+#include <fstream>
+
+//================================================================================
+// Block helpers
+//================================================================================
+
+namespace
+{
+
+// One 4x4 block of source texels in channel major order, so each channel is 4 SSE registers.
+struct SourceBlock
+{
+	alignas(16) f32 m_channels[4][16];
+};
+
+inline f32 horizontal_sum(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, sums);
+	sums = _mm_add_ss(sums, shuf);
+	return _mm_cvtss_f32(sums);
+}
+
+inline f32 sum16(const f32* p)
+{
+	__m128 a = _mm_add_ps(_mm_load_ps(p), _mm_load_ps(p + 4));
+	__m128 b = _mm_add_ps(_mm_load_ps(p + 8), _mm_load_ps(p + 12));
+	return horizontal_sum(_mm_add_ps(a, b));
+}
+
+inline f32 dot16(const f32* pA, const f32* pB)
+{
+	__m128 acc = _mm_mul_ps(_mm_load_ps(pA), _mm_load_ps(pB));
+	acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(pA + 4), _mm_load_ps(pB + 4)));
+	acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(pA + 8), _mm_load_ps(pB + 8)));
+	acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(pA + 12), _mm_load_ps(pB + 12)));
+	return horizontal_sum(acc);
+}
+
+inline s32 clampi(s32 v, s32 lo, s32 hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+inline f32 clampf(f32 v, f32 lo, f32 hi)
+{
+	return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Gather a block, texels past the edge of the image repeat the last row/column.
+void fetch_block(const Image& rImage, const u32 kBlockX, const u32 kBlockY, SourceBlock& rBlockOut)
+{
+	for (u32 y = 0; y < 4; ++y)
+	{
+		const u32 kY = std::min(kBlockY * 4 + y, rImage.m_height - 1);
+		const u8* pRow = rImage.row(kY);
+		for (u32 x = 0; x < 4; ++x)
+		{
+			const u32 kX = std::min(kBlockX * 4 + x, rImage.m_width - 1);
+			const u8* pTexel = pRow + kX * 4;
+			for (u32 c = 0; c < 4; ++c)
+			{
+				rBlockOut.m_channels[c][y * 4 + x] = pTexel[c];
+			}
+		}
+	}
+}
+
+// Dominant direction of the block's colour distribution by power iteration on the covariance.
+void principal_axis(const SourceBlock& rBlock, const u32 kChannels, const u32 kFirstChannel, f32 mean[4], f32 axis[4])
+{
+	alignas(16) f32 centred[4][16];
+	for (u32 c = 0; c < kChannels; ++c)
+	{
+		const f32* pSrc = rBlock.m_channels[kFirstChannel + c];
+		mean[c] = sum16(pSrc) * (1.0f / 16.0f);
+
+		const __m128 kMean = _mm_set1_ps(mean[c]);
+		for (u32 i = 0; i < 16; i += 4)
+		{
+			_mm_store_ps(&centred[c][i], _mm_sub_ps(_mm_load_ps(pSrc + i), kMean));
+		}
+	}
+
+	f32 covariance[4][4];
+	for (u32 i = 0; i < kChannels; ++i)
+	{
+		for (u32 j = i; j < kChannels; ++j)
+		{
+			covariance[i][j] = covariance[j][i] = dot16(centred[i], centred[j]);
+		}
+	}
+
+	for (u32 c = 0; c < 4; ++c)
+	{
+		axis[c] = c < kChannels ? 1.0f : 0.0f;
+	}
+
+	for (u32 iteration = 0; iteration < 8; ++iteration)
+	{
+		f32 next[4] = {};
+		f32 lengthSq = 0.0f;
+		for (u32 i = 0; i < kChannels; ++i)
+		{
+			for (u32 j = 0; j < kChannels; ++j)
+			{
+				next[i] += covariance[i][j] * axis[j];
+			}
+			lengthSq += next[i] * next[i];
+		}
+
+		// Flat blocks have no preferred direction, any axis will do.
+		if (lengthSq < 1e-8f)
+			break;
+
+		const f32 kInvLength = 1.0f / std::sqrt(lengthSq);
+		for (u32 i = 0; i < kChannels; ++i)
+		{
+			axis[i] = next[i] * kInvLength;
+		}
+	}
+}
+
+// Project the block onto the axis and return the extents along it.
+void axis_extents(const SourceBlock& rBlock, const u32 kChannels, const u32 kFirstChannel, const f32 mean[4], const f32 axis[4], f32& rMin, f32& rMax)
+{
+	__m128 minT = _mm_set1_ps(FLT_MAX);
+	__m128 maxT = _mm_set1_ps(-FLT_MAX);
+	for (u32 i = 0; i < 16; i += 4)
+	{
+		__m128 t = _mm_setzero_ps();
+		for (u32 c = 0; c < kChannels; ++c)
+		{
+			__m128 d = _mm_sub_ps(_mm_load_ps(&rBlock.m_channels[kFirstChannel + c][i]), _mm_set1_ps(mean[c]));
+			t = _mm_add_ps(t, _mm_mul_ps(d, _mm_set1_ps(axis[c])));
+		}
+		minT = _mm_min_ps(minT, t);
+		maxT = _mm_max_ps(maxT, t);
+	}
+
+	alignas(16) f32 lo[4], hi[4];
+	_mm_store_ps(lo, minT);
+	_mm_store_ps(hi, maxT);
+	rMin = std::min(std::min(lo[0], lo[1]), std::min(lo[2], lo[3]));
+	rMax = std::max(std::max(hi[0], hi[1]), std::max(hi[2], hi[3]));
+}
+
+// For each texel pick the nearest palette entry, 4 texels at a time. Returns the summed squared error.
+f32 select_indices(const SourceBlock& rBlock, const u32 kChannels, const u32 kFirstChannel, const f32 (*pPalette)[4], const u32 kPaletteSize, u8* pIndicesOut)
+{
+	__m128 totalError = _mm_setzero_ps();
+	for (u32 i = 0; i < 16; i += 4)
+	{
+		__m128 bestError = _mm_set1_ps(FLT_MAX);
+		__m128i bestIndex = _mm_setzero_si128();
+
+		for (u32 p = 0; p < kPaletteSize; ++p)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (u32 c = 0; c < kChannels; ++c)
+			{
+				__m128 d = _mm_sub_ps(_mm_load_ps(&rBlock.m_channels[kFirstChannel + c][i]), _mm_set1_ps(pPalette[p][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(d, d));
+			}
+
+			__m128i better = _mm_castps_si128(_mm_cmplt_ps(error, bestError));
+			bestIndex = _mm_or_si128(_mm_and_si128(better, _mm_set1_epi32(p)), _mm_andnot_si128(better, bestIndex));
+			bestError = _mm_min_ps(error, bestError);
+		}
+
+		alignas(16) s32 indices[4];
+		_mm_store_si128((__m128i*)indices, bestIndex);
+		for (u32 j = 0; j < 4; ++j)
+		{
+			pIndicesOut[i + j] = static_cast<u8>(indices[j]);
+		}
+		totalError = _mm_add_ps(totalError, bestError);
+	}
+	return horizontal_sum(totalError);
+}
+
+// Least squares endpoints for a fixed set of indices.
+// kWeights[i] is the fraction of the second endpoint used by index i.
+bool refine_endpoints(const SourceBlock& rBlock, const u32 kChannels, const u32 kFirstChannel, const u8* pIndices, const f32* kWeights, f32 e0[4], f32 e1[4])
+{
+	f32 aa = 0.0f, bb = 0.0f, ab = 0.0f;
+	f32 ax[4] = {}, bx[4] = {};
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const f32 kB = kWeights[pIndices[i]];
+		const f32 kA = 1.0f - kB;
+		aa += kA * kA;
+		bb += kB * kB;
+		ab += kA * kB;
+		for (u32 c = 0; c < kChannels; ++c)
+		{
+			const f32 kX = rBlock.m_channels[kFirstChannel + c][i];
+			ax[c] += kA * kX;
+			bx[c] += kB * kX;
+		}
+	}
+
+	const f32 kDet = aa * bb - ab * ab;
+	if (std::fabs(kDet) < 1e-6f)
+		return false;
+
+	const f32 kInvDet = 1.0f / kDet;
+	for (u32 c = 0; c < kChannels; ++c)
+	{
+		e0[c] = clampf((bb * ax[c] - ab * bx[c]) * kInvDet, 0.0f, 255.0f);
+		e1[c] = clampf((aa * bx[c] - ab * ax[c]) * kInvDet, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+//================================================================================
+// BC1 colour blocks
+//================================================================================
+
+constexpr f32 kBC1Weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+inline u16 pack_565(const f32 c[4])
+{
+	const s32 r = clampi(s32(c[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	const s32 g = clampi(s32(c[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+	const s32 b = clampi(s32(c[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	return static_cast<u16>((r << 11) | (g << 5) | b);
+}
+
+inline void unpack_565(const u16 kPacked, f32 c[4])
+{
+	const u32 r = (kPacked >> 11) & 31;
+	const u32 g = (kPacked >> 5) & 63;
+	const u32 b = kPacked & 31;
+	c[0] = f32((r << 3) | (r >> 2));
+	c[1] = f32((g << 2) | (g >> 4));
+	c[2] = f32((b << 3) | (b >> 2));
+	c[3] = 255.0f;
+}
+
+// Palette for two quantised endpoints in four colour mode.
+void bc1_palette(const u16 kC0, const u16 kC1, f32 palette[4][4])
+{
+	unpack_565(kC0, palette[0]);
+	unpack_565(kC1, palette[1]);
+	for (u32 c = 0; c < 4; ++c)
+	{
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) * (1.0f / 3.0f);
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) * (1.0f / 3.0f);
+	}
+}
+
+f32 bc1_try_endpoints(const SourceBlock& rBlock, const f32 e0[4], const f32 e1[4], u16& rC0, u16& rC1, u8 indices[16])
+{
+	rC0 = pack_565(e0);
+	rC1 = pack_565(e1);
+
+	f32 palette[4][4];
+	bc1_palette(rC0, rC1, palette);
+	return select_indices(rBlock, 3, 0, palette, 4, indices);
+}
+
+void encode_bc1(const SourceBlock& rBlock, u8* pOut)
+{
+	f32 mean[4], axis[4];
+	principal_axis(rBlock, 3, 0, mean, axis);
+
+	f32 minT, maxT;
+	axis_extents(rBlock, 3, 0, mean, axis, minT, maxT);
+
+	// Inset the extremes slightly, the end points are rarely the best fit for the rest of the block.
+	const f32 kInset = (maxT - minT) * (1.0f / 16.0f);
+	minT += kInset;
+	maxT -= kInset;
+
+	f32 e0[4], e1[4];
+	for (u32 c = 0; c < 3; ++c)
+	{
+		e0[c] = clampf(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+		e1[c] = clampf(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+	}
+
+	u16 c0, c1;
+	u8 indices[16];
+	f32 error = bc1_try_endpoints(rBlock, e0, e1, c0, c1, indices);
+
+	// One least squares pass usually buys a dB or so.
+	if (refine_endpoints(rBlock, 3, 0, indices, kBC1Weights, e0, e1))
+	{
+		u16 r0, r1;
+		u8 refined[16];
+		const f32 kRefinedError = bc1_try_endpoints(rBlock, e0, e1, r0, r1, refined);
+		if (kRefinedError < error)
+		{
+			c0 = r0;
+			c1 = r1;
+			memcpy(indices, refined, sizeof(indices));
+			error = kRefinedError;
+		}
+	}
+
+	// Four colour mode needs c0 > c1, swapping the end points flips 0<->1 and 2<->3.
+	// When they quantise to the same value everything maps to index 0.
+	if (c0 < c1)
+	{
+		std::swap(c0, c1);
+		for (u32 i = 0; i < 16; ++i)
+		{
+			indices[i] ^= 1;
+		}
+	}
+	else if (c0 == c1)
+	{
+		memset(indices, 0, sizeof(indices));
+	}
+
+	u32 packedIndices = 0;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		packedIndices |= u32(indices[i]) << (i * 2);
+	}
+
+	pOut[0] = u8(c0 & 0xff);
+	pOut[1] = u8(c0 >> 8);
+	pOut[2] = u8(c1 & 0xff);
+	pOut[3] = u8(c1 >> 8);
+	memcpy(pOut + 4, &packedIndices, 4);
+}
+
+void decode_bc1(const u8* pBlock, u8 texels[16][4], bool bForceFourColour)
+{
+	const u16 kC0 = u16(pBlock[0] | (pBlock[1] << 8));
+	const u16 kC1 = u16(pBlock[2] | (pBlock[3] << 8));
+	u32 packedIndices;
+	memcpy(&packedIndices, pBlock + 4, 4);
+
+	f32 palette[4][4];
+	unpack_565(kC0, palette[0]);
+	unpack_565(kC1, palette[1]);
+	if (kC0 > kC1 || bForceFourColour)
+	{
+		bc1_palette(kC0, kC1, palette);
+	}
+	else
+	{
+		for (u32 c = 0; c < 4; ++c)
+		{
+			palette[2][c] = (palette[0][c] + palette[1][c]) * 0.5f;
+			palette[3][c] = 0.0f;
+		}
+	}
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const u32 kIndex = (packedIndices >> (i * 2)) & 3;
+		for (u32 c = 0; c < 4; ++c)
+		{
+			texels[i][c] = u8(palette[kIndex][c] + 0.5f);
+		}
+	}
+}
+
+//================================================================================
+// BC4 single channel blocks, used for BC3 alpha and both BC5 channels.
+//================================================================================
+
+void encode_bc4(const f32* pValues, u8* pOut)
+{
+	__m128 lo = _mm_min_ps(_mm_min_ps(_mm_load_ps(pValues), _mm_load_ps(pValues + 4)), _mm_min_ps(_mm_load_ps(pValues + 8), _mm_load_ps(pValues + 12)));
+	__m128 hi = _mm_max_ps(_mm_max_ps(_mm_load_ps(pValues), _mm_load_ps(pValues + 4)), _mm_max_ps(_mm_load_ps(pValues + 8), _mm_load_ps(pValues + 12)));
+	alignas(16) f32 los[4], his[4];
+	_mm_store_ps(los, lo);
+	_mm_store_ps(his, hi);
+
+	const s32 kMax = s32(std::max(std::max(his[0], his[1]), std::max(his[2], his[3])) + 0.5f);
+	const s32 kMin = s32(std::min(std::min(los[0], los[1]), std::min(los[2], los[3])) + 0.5f);
+
+	pOut[0] = u8(kMax);
+	pOut[1] = u8(kMin);
+
+	u64 packedIndices = 0;
+	if (kMax > kMin)
+	{
+		// Eight value mode, step s is s/7 of the way from min to max.
+		// Steps 7 and 0 are the end points (indices 0 and 1), steps 6..1 are indices 2..7.
+		static const u8 kStepToIndex[8] = { 1, 7, 6, 5, 4, 3, 2, 0 };
+
+		const __m128 kScale = _mm_set1_ps(7.0f / f32(kMax - kMin));
+		const __m128 kBase = _mm_set1_ps(f32(kMin));
+		for (u32 i = 0; i < 16; i += 4)
+		{
+			__m128 t = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pValues + i), kBase), kScale);
+			t = _mm_min_ps(_mm_max_ps(t, _mm_setzero_ps()), _mm_set1_ps(7.0f));
+			__m128i steps = _mm_cvtps_epi32(t); // round to nearest.
+
+			alignas(16) s32 s[4];
+			_mm_store_si128((__m128i*)s, steps);
+			for (u32 j = 0; j < 4; ++j)
+			{
+				packedIndices |= u64(kStepToIndex[s[j]]) << ((i + j) * 3);
+			}
+		}
+	}
+
+	for (u32 i = 0; i < 6; ++i)
+	{
+		pOut[2 + i] = u8(packedIndices >> (i * 8));
+	}
+}
+
+void decode_bc4(const u8* pBlock, u8 values[16])
+{
+	const u32 kA0 = pBlock[0];
+	const u32 kA1 = pBlock[1];
+
+	u32 palette[8];
+	palette[0] = kA0;
+	palette[1] = kA1;
+	if (kA0 > kA1)
+	{
+		for (u32 i = 1; i < 7; ++i)
+		{
+			palette[i + 1] = ((7 - i) * kA0 + i * kA1) / 7;
+		}
+	}
+	else
+	{
+		for (u32 i = 1; i < 5; ++i)
+		{
+			palette[i + 1] = ((5 - i) * kA0 + i * kA1) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	u64 packedIndices = 0;
+	for (u32 i = 0; i < 6; ++i)
+	{
+		packedIndices |= u64(pBlock[2 + i]) << (i * 8);
+	}
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		values[i] = u8(palette[(packedIndices >> (i * 3)) & 7]);
+	}
+}
+
+//================================================================================
+// BC7 mode 6 : one subset, RGBA 7777 end points with a p-bit each, 4 bit indices.
+//================================================================================
+
+constexpr u32 kBC7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct BitWriter
+{
+	u64 m_bits[2] = {};
+	u32 m_offset = 0;
+
+	void write(u32 value, u32 kCount)
+	{
+		for (u32 i = 0; i < kCount; ++i, ++m_offset)
+		{
+			m_bits[m_offset >> 6] |= u64((value >> i) & 1) << (m_offset & 63);
+		}
+	}
+};
+
+struct BitReader
+{
+	u64 m_bits[2];
+	u32 m_offset = 0;
+
+	u32 read(u32 kCount)
+	{
+		u32 value = 0;
+		for (u32 i = 0; i < kCount; ++i, ++m_offset)
+		{
+			value |= u32((m_bits[m_offset >> 6] >> (m_offset & 63)) & 1) << i;
+		}
+		return value;
+	}
+};
+
+// Quantise an end point to 7 bits + shared p-bit, picking the p-bit with least error.
+void bc7_quantise_endpoint(const f32 e[4], u32 q[4], u32& rPBit)
+{
+	f32 bestError = FLT_MAX;
+	for (u32 p = 0; p < 2; ++p)
+	{
+		u32 candidate[4];
+		f32 error = 0.0f;
+		for (u32 c = 0; c < 4; ++c)
+		{
+			candidate[c] = u32(clampi(s32((e[c] - f32(p)) * 0.5f + 0.5f), 0, 127));
+			const f32 kDiff = f32((candidate[c] << 1) | p) - e[c];
+			error += kDiff * kDiff;
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			rPBit = p;
+			memcpy(q, candidate, sizeof(candidate));
+		}
+	}
+}
+
+void bc7_palette(const u32 q0[4], const u32 kP0, const u32 q1[4], const u32 kP1, f32 palette[16][4])
+{
+	for (u32 c = 0; c < 4; ++c)
+	{
+		const u32 kE0 = (q0[c] << 1) | kP0;
+		const u32 kE1 = (q1[c] << 1) | kP1;
+		for (u32 i = 0; i < 16; ++i)
+		{
+			palette[i][c] = f32(((64 - kBC7Weights4[i]) * kE0 + kBC7Weights4[i] * kE1 + 32) >> 6);
+		}
+	}
+}
+
+f32 bc7_try_endpoints(const SourceBlock& rBlock, const f32 e0[4], const f32 e1[4], u32 q0[4], u32& rP0, u32 q1[4], u32& rP1, u8 indices[16])
+{
+	bc7_quantise_endpoint(e0, q0, rP0);
+	bc7_quantise_endpoint(e1, q1, rP1);
+
+	f32 palette[16][4];
+	bc7_palette(q0, rP0, q1, rP1, palette);
+	return select_indices(rBlock, 4, 0, palette, 16, indices);
+}
+
+void encode_bc7(const SourceBlock& rBlock, u8* pOut)
+{
+	f32 mean[4], axis[4];
+	principal_axis(rBlock, 4, 0, mean, axis);
+
+	f32 minT, maxT;
+	axis_extents(rBlock, 4, 0, mean, axis, minT, maxT);
+
+	f32 e0[4], e1[4];
+	for (u32 c = 0; c < 4; ++c)
+	{
+		e0[c] = clampf(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+		e1[c] = clampf(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+	}
+
+	u32 q0[4], q1[4], p0, p1;
+	u8 indices[16];
+	f32 error = bc7_try_endpoints(rBlock, e0, e1, q0, p0, q1, p1, indices);
+
+	f32 weights[16];
+	for (u32 i = 0; i < 16; ++i)
+	{
+		weights[i] = kBC7Weights4[i] * (1.0f / 64.0f);
+	}
+
+	if (refine_endpoints(rBlock, 4, 0, indices, weights, e0, e1))
+	{
+		u32 r0[4], r1[4], rp0, rp1;
+		u8 refined[16];
+		const f32 kRefinedError = bc7_try_endpoints(rBlock, e0, e1, r0, rp0, r1, rp1, refined);
+		if (kRefinedError < error)
+		{
+			memcpy(q0, r0, sizeof(q0));
+			memcpy(q1, r1, sizeof(q1));
+			p0 = rp0;
+			p1 = rp1;
+			memcpy(indices, refined, sizeof(indices));
+		}
+	}
+
+	// The anchor index only stores 3 bits, so its top bit must be clear.
+	// The weights are symmetric so swapping the end points and inverting the indices is lossless.
+	if (indices[0] & 8)
+	{
+		for (u32 c = 0; c < 4; ++c)
+		{
+			std::swap(q0[c], q1[c]);
+		}
+		std::swap(p0, p1);
+		for (u32 i = 0; i < 16; ++i)
+		{
+			indices[i] = u8(15 - indices[i]);
+		}
+	}
+
+	BitWriter writer;
+	writer.write(1 << 6, 7); // mode 6
+	for (u32 c = 0; c < 4; ++c)
+	{
+		writer.write(q0[c], 7);
+		writer.write(q1[c], 7);
+	}
+	writer.write(p0, 1);
+	writer.write(p1, 1);
+	writer.write(indices[0], 3);
+	for (u32 i = 1; i < 16; ++i)
+	{
+		writer.write(indices[i], 4);
+	}
+	ASSERT(writer.m_offset == 128);
+
+	memcpy(pOut, writer.m_bits, 16);
+}
+
+void decode_bc7(const u8* pBlock, u8 texels[16][4])
+{
+	BitReader reader;
+	memcpy(reader.m_bits, pBlock, 16);
+
+	// We only ever write mode 6, anything else decodes as black.
+	if (reader.read(7) != (1 << 6))
+	{
+		memset(texels, 0, 16 * 4);
+		return;
+	}
+
+	u32 q0[4], q1[4];
+	for (u32 c = 0; c < 4; ++c)
+	{
+		q0[c] = reader.read(7);
+		q1[c] = reader.read(7);
+	}
+	const u32 kP0 = reader.read(1);
+	const u32 kP1 = reader.read(1);
+
+	f32 palette[16][4];
+	bc7_palette(q0, kP0, q1, kP1, palette);
+
+	for (u32 i = 0; i < 16; ++i)
+	{
+		const u32 kIndex = reader.read(i == 0 ? 3 : 4);
+		for (u32 c = 0; c < 4; ++c)
+		{
+			texels[i][c] = u8(palette[kIndex][c]);
+		}
+	}
+}
+
+void encode_block(const SourceBlock& rBlock, EBlockFormat format, u8* pOut)
+{
+	switch (format)
+	{
+	case kBlockFormat_BC1:
+		encode_bc1(rBlock, pOut);
+		break;
+	case kBlockFormat_BC3:
+		encode_bc4(rBlock.m_channels[3], pOut);
+		encode_bc1(rBlock, pOut + 8);
+		break;
+	case kBlockFormat_BC5:
+		encode_bc4(rBlock.m_channels[0], pOut);
+		encode_bc4(rBlock.m_channels[1], pOut + 8);
+		break;
+	case kBlockFormat_BC7:
+		encode_bc7(rBlock, pOut);
+		break;
+	default:
+		ASSERT(false);
+		break;
+	}
+}
+
+void decode_block(const u8* pBlock, EBlockFormat format, u8 texels[16][4])
+{
+	switch (format)
+	{
+	case kBlockFormat_BC1:
+		decode_bc1(pBlock, texels, false);
+		break;
+	case kBlockFormat_BC3:
+	{
+		u8 alpha[16];
+		decode_bc1(pBlock + 8, texels, true);
+		decode_bc4(pBlock, alpha);
+		for (u32 i = 0; i < 16; ++i)
+		{
+			texels[i][3] = alpha[i];
+		}
+	}
+	break;
+	case kBlockFormat_BC5:
+	{
+		u8 red[16], green[16];
+		decode_bc4(pBlock, red);
+		decode_bc4(pBlock + 8, green);
+		for (u32 i = 0; i < 16; ++i)
+		{
+			texels[i][0] = red[i];
+			texels[i][1] = green[i];
+			texels[i][2] = 0;
+			texels[i][3] = 255;
+		}
+	}
+	break;
+	case kBlockFormat_BC7:
+		decode_bc7(pBlock, texels);
+		break;
+	default:
+		ASSERT(false);
+		break;
+	}
+}
+
+//================================================================================
+// DDS file layout, see "DDS Programming Guide" on MSDN.
+//================================================================================
+
+constexpr u32 kDDSMagic = 0x20534444; // "DDS "
+constexpr u32 kDDSFourCC_DX10 = 0x30315844; // "DX10"
+
+constexpr u32 kDDSD_Caps = 0x1;
+constexpr u32 kDDSD_Height = 0x2;
+constexpr u32 kDDSD_Width = 0x4;
+constexpr u32 kDDSD_PixelFormat = 0x1000;
+constexpr u32 kDDSD_MipMapCount = 0x20000;
+constexpr u32 kDDSD_LinearSize = 0x80000;
+constexpr u32 kDDPF_FourCC = 0x4;
+constexpr u32 kDDSCaps_Complex = 0x8;
+constexpr u32 kDDSCaps_Texture = 0x1000;
+constexpr u32 kDDSCaps_MipMap = 0x400000;
+
+// DXGI_FORMAT and D3D11_RESOURCE_DIMENSION values as the DX10 header stores them.
+constexpr u32 kDXGIFormat_Unknown = 0;
+constexpr u32 kDXGIFormat_BC1_UNorm = 71;
+constexpr u32 kDXGIFormat_BC1_UNorm_SRGB = 72;
+constexpr u32 kDXGIFormat_BC3_UNorm = 77;
+constexpr u32 kDXGIFormat_BC3_UNorm_SRGB = 78;
+constexpr u32 kDXGIFormat_BC5_UNorm = 83;
+constexpr u32 kDXGIFormat_BC7_UNorm = 98;
+constexpr u32 kDXGIFormat_BC7_UNorm_SRGB = 99;
+constexpr u32 kDDSDimension_Texture2D = 3;
+
+struct DDSPixelFormat
+{
+	u32 m_size;
+	u32 m_flags;
+	u32 m_fourCC;
+	u32 m_rgbBitCount;
+	u32 m_bitMasks[4];
+};
+
+struct DDSHeader
+{
+	u32 m_size;
+	u32 m_flags;
+	u32 m_height;
+	u32 m_width;
+	u32 m_pitchOrLinearSize;
+	u32 m_depth;
+	u32 m_mipMapCount;
+	u32 m_reserved1[11];
+	DDSPixelFormat m_pixelFormat;
+	u32 m_caps;
+	u32 m_caps2;
+	u32 m_caps3;
+	u32 m_caps4;
+	u32 m_reserved2;
+};
+
+struct DDSHeaderDX10
+{
+	u32 m_dxgiFormat;
+	u32 m_resourceDimension;
+	u32 m_miscFlag;
+	u32 m_arraySize;
+	u32 m_miscFlags2;
+};
+
+static_assert(sizeof(DDSHeader) == 124, "DDS header must be 124 bytes");
+
+} // namespace
+
+//================================================================================
+// Public interface
+//================================================================================
+
+u32 block_format_bytes(EBlockFormat format)
+{
+	return format == kBlockFormat_BC1 ? 8 : 16;
+}
+
+u32 block_format_dxgi(EBlockFormat format, const bool kSRGB)
+{
+	switch (format)
+	{
+	case kBlockFormat_BC1: return kSRGB ? kDXGIFormat_BC1_UNorm_SRGB : kDXGIFormat_BC1_UNorm;
+	case kBlockFormat_BC3: return kSRGB ? kDXGIFormat_BC3_UNorm_SRGB : kDXGIFormat_BC3_UNorm;
+	case kBlockFormat_BC5: return kDXGIFormat_BC5_UNorm;
+	case kBlockFormat_BC7: return kSRGB ? kDXGIFormat_BC7_UNorm_SRGB : kDXGIFormat_BC7_UNorm;
+	default: return kDXGIFormat_Unknown;
+	}
+}
+
+u32 block_level_bytes(EBlockFormat format, const u32 kWidth, const u32 kHeight)
+{
+	return ((kWidth + 3) / 4) * ((kHeight + 3) / 4) * block_format_bytes(format);
+}
+
+void compress_image(const Image& rSource, EBlockFormat format, std::vector<u8>& rBlocksOut, JobSystem* pJobs)
+{
+	const u32 kBlocksX = (rSource.m_width + 3) / 4;
+	const u32 kBlocksY = (rSource.m_height + 3) / 4;
+	const u32 kBlockBytes = block_format_bytes(format);
+
+	rBlocksOut.resize(kBlocksX * kBlocksY * kBlockBytes);
+	u8* pBlocks = rBlocksOut.data();
+
+	auto compressRows = [&](u32 kBegin, u32 kEnd)
+	{
+		SourceBlock block;
+		for (u32 by = kBegin; by < kEnd; ++by)
+		{
+			u8* pOut = pBlocks + by * kBlocksX * kBlockBytes;
+			for (u32 bx = 0; bx < kBlocksX; ++bx, pOut += kBlockBytes)
+			{
+				fetch_block(rSource, bx, by, block);
+				encode_block(block, format, pOut);
+			}
+		}
+	};
+
+	if (pJobs)
+	{
+		pJobs->parallelFor(kBlocksY, 1, compressRows);
+	}
+	else
+	{
+		compressRows(0, kBlocksY);
+	}
+}
+
+void decompress_image(const u8* pBlocks, EBlockFormat format, const u32 kWidth, const u32 kHeight, Image& rImageOut)
+{
+	const u32 kBlocksX = (kWidth + 3) / 4;
+	const u32 kBlocksY = (kHeight + 3) / 4;
+	const u32 kBlockBytes = block_format_bytes(format);
+
+	rImageOut.resize(kWidth, kHeight);
+
+	u8 texels[16][4];
+	for (u32 by = 0; by < kBlocksY; ++by)
+	{
+		for (u32 bx = 0; bx < kBlocksX; ++bx, pBlocks += kBlockBytes)
+		{
+			decode_block(pBlocks, format, texels);
+
+			// Drop the padding texels past the edge.
+			for (u32 y = 0; y < 4 && by * 4 + y < kHeight; ++y)
+			{
+				u8* pRow = rImageOut.row(by * 4 + y);
+				for (u32 x = 0; x < 4 && bx * 4 + x < kWidth; ++x)
+				{
+					memcpy(pRow + (bx * 4 + x) * 4, texels[y * 4 + x], 4);
+				}
+			}
+		}
+	}
+}
+
+f64 compute_psnr(const Image& rReference, const Image& rTest, EBlockFormat format)
+{
+	ASSERT(rReference.m_width == rTest.m_width && rReference.m_height == rTest.m_height);
+
+	// Only compare the channels the format actually stores.
+	const u32 kChannels = format == kBlockFormat_BC1 ? 3 : (format == kBlockFormat_BC5 ? 2 : 4);
+
+	f64 sumSq = 0.0;
+	const size_t kTexels = size_t(rReference.m_width) * rReference.m_height;
+	for (size_t i = 0; i < kTexels; ++i)
+	{
+		for (u32 c = 0; c < kChannels; ++c)
+		{
+			const f64 kDiff = f64(rReference.m_pixels[i * 4 + c]) - f64(rTest.m_pixels[i * 4 + c]);
+			sumSq += kDiff * kDiff;
+		}
+	}
+
+	const f64 kMSE = sumSq / f64(kTexels * kChannels);
+	if (kMSE <= 0.0)
+		return 99.0;
+	return 10.0 * std::log10(255.0 * 255.0 / kMSE);
+}
+
+bool write_dds(const char* pFilename, EBlockFormat format, const bool kSRGB, const u32 kWidth, const u32 kHeight, const std::vector<std::vector<u8>>& levels)
+{
+	ASSERT(!levels.empty());
+
+	DDSHeader header = {};
+	header.m_size = sizeof(DDSHeader);
+	header.m_flags = kDDSD_Caps | kDDSD_Height | kDDSD_Width | kDDSD_PixelFormat | kDDSD_LinearSize;
+	header.m_height = kHeight;
+	header.m_width = kWidth;
+	header.m_pitchOrLinearSize = block_level_bytes(format, kWidth, kHeight);
+	header.m_mipMapCount = static_cast<u32>(levels.size());
+	header.m_pixelFormat.m_size = sizeof(DDSPixelFormat);
+	header.m_pixelFormat.m_flags = kDDPF_FourCC;
+	header.m_pixelFormat.m_fourCC = kDDSFourCC_DX10;
+	header.m_caps = kDDSCaps_Texture;
+	if (levels.size() > 1)
+	{
+		header.m_flags |= kDDSD_MipMapCount;
+		header.m_caps |= kDDSCaps_Complex | kDDSCaps_MipMap;
+	}
+
+	DDSHeaderDX10 headerDX10 = {};
+	headerDX10.m_dxgiFormat = block_format_dxgi(format, kSRGB);
+	headerDX10.m_resourceDimension = kDDSDimension_Texture2D;
+	headerDX10.m_arraySize = 1;
+
+	std::ofstream hFile(pFilename, std::ios::binary);
+	if (!hFile.good())
+	{
+		errorF("Could not open %s for writing", pFilename);
+		return false;
+	}
+
+	hFile.write((const char*)&kDDSMagic, sizeof(kDDSMagic));
+	hFile.write((const char*)&header, sizeof(header));
+	hFile.write((const char*)&headerDX10, sizeof(headerDX10));
+	for (auto& rLevel : levels)
+	{
+		hFile.write((const char*)rLevel.data(), rLevel.size());
+	}
+
+	return hFile.good();
+}
+
+bool bake_image(const Image& rSource, const char* pDestFilename, EBlockFormat format, bool bGenerateMips, JobSystem* pJobs, CompressionStats* pStatsOut)
+{
+	const bool kSRGB = format != kBlockFormat_BC5;
+
+	std::vector<Image> mips;
+	if (bGenerateMips)
+	{
+		generate_mip_chain(rSource, kMipFilter_Kaiser, kSRGB, mips, pJobs);
+	}
+	else
+	{
+		mips.push_back(rSource);
+	}
+
+	std::vector<std::vector<u8>> levels(mips.size());
+
+	f64 megaPixels = 0.0;
+	const s64 kStart = getTimeMicroseconds();
+	for (size_t i = 0; i < mips.size(); ++i)
+	{
+		compress_image(mips[i], format, levels[i], pJobs);
+		megaPixels += f64(mips[i].m_width) * mips[i].m_height / 1000000.0;
+	}
+	const s64 kEnd = getTimeMicroseconds();
+
+	CompressionStats stats = {};
+	stats.m_seconds = (kEnd - kStart) * 0.000001;
+	stats.m_mpixPerSec = stats.m_seconds > 0.0 ? megaPixels / stats.m_seconds : 0.0;
+
+	// Quality is measured on the top level only, lower levels are filtered anyway.
+	Image decoded;
+	decompress_image(levels[0].data(), format, rSource.m_width, rSource.m_height, decoded);
+	stats.m_psnr = compute_psnr(rSource, decoded, format);
+
+	debugF("Baked %s : %ux%u, %u mips, %.2f dB, %.1f MPix/s\n", pDestFilename, rSource.m_width, rSource.m_height, u32(levels.size()), stats.m_psnr, stats.m_mpixPerSec);
+
+	if (pStatsOut)
+	{
+		*pStatsOut = stats;
+	}
+
+	return write_dds(pDestFilename, format, kSRGB, rSource.m_width, rSource.m_height, levels);
+}
+
+bool bake_texture(const char* pSourceFilename, const char* pDestFilename, EBlockFormat format, bool bGenerateMips, JobSystem* pJobs, CompressionStats* pStatsOut)
+{
+	Image source;
+	if (!load_image_rgba8(pSourceFilename, source))
+		return false;
+
+	return bake_image(source, pDestFilename, format, bGenerateMips, pJobs, pStatsOut);
+}
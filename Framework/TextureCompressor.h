@@ -0,0 +1,66 @@
+#pragma once
+
+#include "CoreHeader.h"
+#include "Image.h"
+
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Block Compression
+// CPU encoders for the BCn formats, used to bake PNG/JPEG sources into DDS
+// files that Texture::init_from_dds can load directly.
+//
+//  BC1 : RGB, 4bpp, albedo without alpha.
+//  BC3 : RGBA, 8bpp, albedo with alpha.
+//  BC5 : RG, 8bpp, tangent space normal maps (Z rebuilt in the shader).
+//  BC7 : RGBA, 8bpp, high quality albedo (mode 6 only).
+//================================================================================
+
+enum EBlockFormat
+{
+	kBlockFormat_BC1,
+	kBlockFormat_BC3,
+	kBlockFormat_BC5,
+	kBlockFormat_BC7,
+
+	kMaxBlockFormats
+};
+
+struct CompressionStats
+{
+	f64 m_psnr;			// dB over the channels the format stores.
+	f64 m_seconds;		// encode time only, excludes decode and file IO.
+	f64 m_mpixPerSec;
+};
+
+// Size of one 4x4 block in bytes.
+u32 block_format_bytes(EBlockFormat format);
+
+// The DXGI_FORMAT value a DDS file records, the _SRGB variant when kSRGB.
+// BC5 has none and stays UNORM.
+u32 block_format_dxgi(EBlockFormat format, const bool kSRGB);
+
+// Size of a compressed level, dimensions are rounded up to whole blocks.
+u32 block_level_bytes(EBlockFormat format, const u32 kWidth, const u32 kHeight);
+
+// Compress an RGBA8 image, rows of blocks are spread across the job system when one is given.
+void compress_image(const Image& rSource, EBlockFormat format, std::vector<u8>& rBlocksOut, JobSystem* pJobs);
+
+// Decode blocks back to RGBA8, used to measure the error of the encoder.
+void decompress_image(const u8* pBlocks, EBlockFormat format, const u32 kWidth, const u32 kHeight, Image& rImageOut);
+
+// Peak signal to noise ratio between two images of the same size.
+f64 compute_psnr(const Image& rReference, const Image& rTest, EBlockFormat format);
+
+// Write compressed mip levels, largest first, as a DDS file with a DX10 header. kSRGB levels are tagged with the
+// _SRGB format so the sampler converts them back to linear.
+bool write_dds(const char* pFilename, EBlockFormat format, const bool kSRGB, const u32 kWidth, const u32 kHeight, const std::vector<std::vector<u8>>& levels);
+
+// Optionally build an image's mip chain, compress every level and write the result as a DDS.
+// BC5 sources are treated as linear data, everything else as sRGB when filtering mips and in the file.
+bool bake_image(const Image& rSource, const char* pDestFilename, EBlockFormat format, bool bGenerateMips, JobSystem* pJobs, CompressionStats* pStatsOut);
+
+// bake_image of a PNG/JPEG source file.
+bool bake_texture(const char* pSourceFilename, const char* pDestFilename, EBlockFormat format, bool bGenerateMips, JobSystem* pJobs, CompressionStats* pStatsOut);
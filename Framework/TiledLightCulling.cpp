@@ -0,0 +1,207 @@
+#include "TiledLightCulling.h"
+#include "JobQueue.h"
+#include "LightClusters.h"
+#include "LightSystem.h"
+#include "LightVolumes.h"
+
+namespace
+{
+
+// The four side planes and view depth range of one tile, planes pass through the eye.
+struct TileFrustum
+{
+	v3 m_vNormals[4];
+	f32 m_minZ;
+	f32 m_maxZ;
+};
+
+v3 unproject(const m4x4& rInverseProjection, const f32 kX, const f32 kY, const f32 kDepth)
+{
+	const v4 p = v4::Transform(v4(kX, kY, kDepth, 1.f), rInverseProjection);
+	return v3(p.x / p.w, p.y / p.w, p.z / p.w);
+}
+
+// Works for either handedness and for the off centre projections the HMD uses.
+TileFrustum build_tile_frustum(const m4x4& rInverseProjection, const u32 kTileX, const u32 kTileY, const u32 kWidth, const u32 kHeight, const TileDepthBounds& rDepth)
+{
+	const f32 kX0 = f32(kTileX * kLightTileSize) / kWidth * 2.f - 1.f;
+	const f32 kX1 = f32(std::min((kTileX + 1) * kLightTileSize, kWidth)) / kWidth * 2.f - 1.f;
+	const f32 kY0 = 1.f - f32(kTileY * kLightTileSize) / kHeight * 2.f;
+	const f32 kY1 = 1.f - f32(std::min((kTileY + 1) * kLightTileSize, kHeight)) / kHeight * 2.f;
+
+	const v3 corners[4] =
+	{
+		unproject(rInverseProjection, kX0, kY0, 1.f),
+		unproject(rInverseProjection, kX1, kY0, 1.f),
+		unproject(rInverseProjection, kX1, kY1, 1.f),
+		unproject(rInverseProjection, kX0, kY1, 1.f),
+	};
+	const v3 kCentre = unproject(rInverseProjection, (kX0 + kX1) * 0.5f, (kY0 + kY1) * 0.5f, 1.f);
+
+	TileFrustum frustum;
+	for (u32 i = 0; i < 4; ++i)
+	{
+		v3 n = corners[i].Cross(corners[(i + 1) & 3]);
+		n.Normalize();
+
+		// Point the normal into the tile.
+		frustum.m_vNormals[i] = n.Dot(kCentre) < 0.f ? -n : n;
+	}
+
+	const f32 kZA = unproject(rInverseProjection, (kX0 + kX1) * 0.5f, (kY0 + kY1) * 0.5f, rDepth.m_min).z;
+	const f32 kZB = unproject(rInverseProjection, (kX0 + kX1) * 0.5f, (kY0 + kY1) * 0.5f, rDepth.m_max).z;
+	frustum.m_minZ = std::min(kZA, kZB);
+	frustum.m_maxZ = std::max(kZA, kZB);
+	return frustum;
+}
+
+// Light position and axis moved to view space.
+struct ViewLight
+{
+	v3 m_vCentre;
+	v3 m_vDirection;
+};
+
+bool light_in_tile(const TileFrustum& rFrustum, const ViewLight& rView, const LightBounds& rLight)
+{
+	const f32 kRadius = rLight.m_radius;
+	if (kRadius >= kInfiniteLightRadius)
+		return true;
+
+	const v3& rCentre = rView.m_vCentre;
+	if (rCentre.z + kRadius < rFrustum.m_minZ || rCentre.z - kRadius > rFrustum.m_maxZ)
+		return false;
+
+	for (u32 i = 0; i < 4; ++i)
+	{
+		if (rFrustum.m_vNormals[i].Dot(rCentre) < -kRadius)
+			return false;
+	}
+
+	if (rLight.m_coneRadius == 0.f)
+		return true;
+
+	// The cone has to reach the depth range and be in front of all four sides as well.
+	const v3& rAxis = rView.m_vDirection;
+	if (cone_behind_plane(v3(0.f, 0.f, 1.f), rCentre.z - rFrustum.m_minZ, rAxis, kRadius, rLight.m_coneRadius)
+		|| cone_behind_plane(v3(0.f, 0.f, -1.f), rFrustum.m_maxZ - rCentre.z, rAxis, kRadius, rLight.m_coneRadius))
+	{
+		return false;
+	}
+
+	for (u32 i = 0; i < 4; ++i)
+	{
+		if (cone_behind_plane(rFrustum.m_vNormals[i], rFrustum.m_vNormals[i].Dot(rCentre), rAxis, kRadius, rLight.m_coneRadius))
+			return false;
+	}
+	return true;
+}
+
+} // namespace
+
+void TileLightGrid::resize(const u32 kTilesX, const u32 kTilesY)
+{
+	m_tilesX = kTilesX;
+	m_tilesY = kTilesY;
+	m_counts.assign(kTilesX * kTilesY, 0);
+	m_indices.resize(kTilesX * kTilesY * kMaxLightsPerTile);
+	m_overflowTiles = 0;
+}
+
+void compute_tile_depth_bounds(const f32* pDepth, const u32 kWidth, const u32 kHeight, std::vector<TileDepthBounds>& rBoundsOut)
+{
+	const u32 kTilesX = light_tile_count(kWidth);
+	const u32 kTilesY = light_tile_count(kHeight);
+	rBoundsOut.assign(kTilesX * kTilesY, TileDepthBounds{ 1.f, 0.f });
+
+	for (u32 y = 0; y < kHeight; ++y)
+	{
+		TileDepthBounds* pTileRow = rBoundsOut.data() + (y / kLightTileSize) * kTilesX;
+		const f32* pRow = pDepth + y * kWidth;
+
+		for (u32 x = 0; x < kWidth; ++x)
+		{
+			const f32 kDepth = pRow[x];
+			if (kDepth >= 1.f)
+				continue;
+
+			TileDepthBounds& rBounds = pTileRow[x / kLightTileSize];
+			rBounds.m_min = std::min(rBounds.m_min, kDepth);
+			rBounds.m_max = std::max(rBounds.m_max, kDepth);
+		}
+	}
+}
+
+void bin_lights_tiled(const LightBounds* pLights, const u32 kLightCount
+	, const m4x4& rView, const m4x4& rProjection
+	, const u32 kWidth, const u32 kHeight
+	, const std::vector<TileDepthBounds>& rDepthBounds
+	, TileLightGrid& rGridOut, JobSystem* pJobs)
+{
+	const u32 kTilesX = light_tile_count(kWidth);
+	const u32 kTilesY = light_tile_count(kHeight);
+	ASSERT(rDepthBounds.size() == kTilesX * kTilesY);
+
+	rGridOut.resize(kTilesX, kTilesY);
+
+	// Tiles are tested in view space, move the lights there once.
+	std::vector<ViewLight> viewLights(kLightCount);
+	for (u32 i = 0; i < kLightCount; ++i)
+	{
+		viewLights[i].m_vCentre = v3::Transform(pLights[i].m_vCentre, rView);
+		if (pLights[i].m_coneRadius > 0.f)
+		{
+			viewLights[i].m_vDirection = v3(v4::Transform(v4(pLights[i].m_vDirection, 0.f), rView));
+		}
+	}
+
+	const m4x4 kInverseProjection = rProjection.Invert();
+	std::atomic<u32> overflowTiles(0);
+
+	auto binRows = [&](u32 kBegin, u32 kEnd)
+	{
+		for (u32 ty = kBegin; ty < kEnd; ++ty)
+		{
+			for (u32 tx = 0; tx < kTilesX; ++tx)
+			{
+				const u32 kTile = ty * kTilesX + tx;
+				const TileDepthBounds& rDepth = rDepthBounds[kTile];
+				if (rDepth.m_min > rDepth.m_max)
+					continue;
+
+				const TileFrustum kFrustum = build_tile_frustum(kInverseProjection, tx, ty, kWidth, kHeight, rDepth);
+				u32* pIndices = rGridOut.m_indices.data() + kTile * kMaxLightsPerTile;
+				u32 count = 0;
+				bool bOverflow = false;
+
+				for (u32 i = 0; i < kLightCount; ++i)
+				{
+					if (!light_in_tile(kFrustum, viewLights[i], pLights[i]))
+						continue;
+
+					if (count == kMaxLightsPerTile)
+					{
+						bOverflow = true;
+						break;
+					}
+					pIndices[count++] = i;
+				}
+
+				rGridOut.m_counts[kTile] = count;
+				if (bOverflow)
+					++overflowTiles;
+			}
+		}
+	};
+
+	if (pJobs)
+	{
+		pJobs->parallelFor(kTilesY, 1, binRows);
+	}
+	else
+	{
+		binRows(0, kTilesY);
+	}
+
+	rGridOut.m_overflowTiles = overflowTiles;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "CoreHeader.h"
+
+#include <cfloat>
+#include <vector>
+
+class JobSystem;
+
+//================================================================================
+// Tiled Light Culling
+// CPU reference for the tiled deferred path. The screen is split into square
+// tiles, each tile gets a frustum from its corners and the min / max depth of
+// the pixels it covers, and every light sphere (and spot cone) touching that
+// frustum is added to the tile's list. CS_TileLightCulling in DeferredShaders.fx runs the same
+// tests on the GPU, keep the two in step.
+//================================================================================
+
+constexpr u32 kLightTileSize = 16;
+
+// The GPU stores a count followed by the indices, 256 uints per tile.
+constexpr u32 kMaxLightsPerTile = 255;
+
+// Radius of lights that reach everywhere, such as directional lights.
+constexpr f32 kInfiniteLightRadius = FLT_MAX;
+
+// World space bounding sphere of a light, spot lights are also bounded by their cone.
+struct LightBounds
+{
+	v3 m_vCentre;
+	f32 m_radius;
+	v3 m_vDirection;			// cone axis, unit length.
+	f32 m_coneRadius = 0.f;		// radius of the cone's end cap, zero for spheres.
+};
+
+// True when a cone is entirely behind a plane. kApexDistance is the signed distance from the
+// plane to the apex, the cone ends kLength along vAxis in a disc of radius kCapRadius.
+inline bool cone_behind_plane(const v3& vNormal, const f32 kApexDistance, const v3& vAxis, const f32 kLength, const f32 kCapRadius)
+{
+	const f32 kAxisDot = vNormal.Dot(vAxis);
+	const f32 kCapDistance = kApexDistance + kLength * kAxisDot + kCapRadius * sqrtf(std::max(1.f - kAxisDot * kAxisDot, 0.f));
+	return kApexDistance < 0.f && kCapDistance < 0.f;
+}
+
+// Post projection depth range of the geometry in a tile, m_min > m_max when the tile is empty.
+struct TileDepthBounds
+{
+	f32 m_min;
+	f32 m_max;
+};
+
+struct TileLightGrid
+{
+	u32 m_tilesX = 0;
+	u32 m_tilesY = 0;
+	std::vector<u32> m_counts;
+	std::vector<u32> m_indices;		// kMaxLightsPerTile slots per tile, in light order.
+	u32 m_overflowTiles = 0;		// tiles that had more than kMaxLightsPerTile lights, extras dropped.
+
+	void resize(const u32 kTilesX, const u32 kTilesY);
+
+	u32 tile_count() const { return m_tilesX * m_tilesY; }
+	const u32* tile_lights(const u32 kTile) const { return m_indices.data() + kTile * kMaxLightsPerTile; }
+};
+
+// Tiles needed to cover kPixels, the last tile may be partial.
+inline u32 light_tile_count(const u32 kPixels) { return (kPixels + kLightTileSize - 1) / kLightTileSize; }
+
+// Reduce a depth buffer to per tile bounds, pixels at the far plane (1.0) hold no geometry and are skipped.
+void compute_tile_depth_bounds(const f32* pDepth, const u32 kWidth, const u32 kHeight, std::vector<TileDepthBounds>& rBoundsOut);
+
+// Bin lights into tiles. Rows of tiles are spread across the job system when one is given.
+void bin_lights_tiled(const LightBounds* pLights, const u32 kLightCount
+	, const m4x4& rView, const m4x4& rProjection
+	, const u32 kWidth, const u32 kHeight
+	, const std::vector<TileDepthBounds>& rDepthBounds
+	, TileLightGrid& rGridOut, JobSystem* pJobs);
@@ -0,0 +1,673 @@
+#include "Tests.h"
+
+#include "CoherentCulling.h"
+#include "FrustumCulling.h"
+#include "OcclusionCuller.h"
+#include "StereoFrustum.h"
+
+#include <cfloat>
+#include <cstring>
+#include <vector>
+
+//================================================================================
+// Culling Tests
+// The stereo frustum, frustum culling and the occlusion cullers.
+//================================================================================
+
+constexpr u32 kCullBounds = 1000000;
+constexpr u32 kOcclusionBenchmarkOccluders = 1000;
+constexpr u32 kOcclusionBenchmarkOccludees = 100000;
+constexpr u32 kCoherentBenchmarkSpheres = 1000000;
+constexpr u32 kCoherentBenchmarkFrames = 900;
+constexpr f32 kFieldHalfSize = 100.f;
+
+// A sphere entirely behind a plane, as StereoFrustum tests them.
+static bool outside_plane(const v4& vPlane, const v3& vCentre, const f32 kRadius)
+{
+	return vPlane.x * vCentre.x + vPlane.y * vCentre.y + vPlane.z * vCentre.z + vPlane.w < -kRadius;
+}
+
+// An eye's projection as the headset gives it, right handed and looking down -z with depth 0 to 1. Not
+// SimpleMath's, which is left handed in this tree.
+static m4x4 eye_projection(const EyeFov& rFov, const f32 kNear, const f32 kFar)
+{
+	const f32 kWidth = rFov.m_leftTan + rFov.m_rightTan;
+	const f32 kHeight = rFov.m_upTan + rFov.m_downTan;
+	const f32 kRange = kFar / (kNear - kFar);
+	return m4x4(2.f / kWidth, 0.f, 0.f, 0.f
+		, 0.f, 2.f / kHeight, 0.f, 0.f
+		, (rFov.m_rightTan - rFov.m_leftTan) / kWidth, (rFov.m_upTan - rFov.m_downTan) / kHeight, kRange, -1.f
+		, 0.f, 0.f, kRange * kNear, 0.f);
+}
+
+// The same for a camera at vEye looking at vTarget with a square view. SimpleMath's CreateLookAt is left handed,
+// pointed away from the target it gives the right handed view.
+static m4x4 headset_view_projection(const v3& vEye, const v3& vTarget, const f32 kFovY, const f32 kNear, const f32 kFar)
+{
+	const f32 kTan = tanf(kFovY * 0.5f);
+	const EyeFov kFov = { kTan, kTan, kTan, kTan };
+	return m4x4::CreateLookAt(vEye, vEye * 2.f - vTarget, v3(0.f, 1.f, 0.f)) * eye_projection(kFov, kNear, kFar);
+}
+
+// Random head poses, eye fovs and offsets, with random spheres tested against points sampled
+// inside them for each eye's frustum.
+FRAMEWORK_TEST(stereo_frustum)
+{
+	u32 seed = 7;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+	auto inside = [](const v4 planes[6], const v3& vPoint) { for (u32 i = 0; i < 6; ++i) { if (outside_plane(planes[i], vPoint, 0.f)) return false; } return true; };
+
+	constexpr f32 kNear = 0.2f;
+	constexpr f32 kFar = 100.f;
+	constexpr u32 kViews = 100;
+	constexpr u32 kSpheres = 1000;
+	constexpr u32 kSamples = 64;
+	std::vector<GPULight> lights(kSpheres + 1);
+	std::vector<u8> masks(kSpheres + 1);
+	std::vector<GPULight> eyeLights;
+	u32 planeErrors = 0, culled = 0, combinedMisses = 0, maskMisses = 0, bothEyes = 0, oneEye = 0, splitErrors = 0;
+	for (u32 v = 0; v < kViews; ++v)
+	{
+		EyeFov fov[2];
+		for (u32 eye = 0; eye < 2; ++eye)
+		{
+			fov[eye].m_upTan = 0.8f + random() * 0.6f;
+			fov[eye].m_downTan = 0.8f + random() * 0.6f;
+			fov[eye].m_leftTan = 0.7f + random() * 0.8f;
+			fov[eye].m_rightTan = 0.7f + random() * 0.8f;
+		}
+		const f32 kIpd = 0.055f + random() * 0.02f;
+		const v3 vEyeOffsets[2] = { v3(-kIpd * 0.5f, random() * 0.002f, random() * 0.003f), v3(kIpd * 0.5f, 0.f, 0.f) };
+
+		const v3 vHead(random() * 20.f - 10.f, random() * 3.f, random() * 20.f - 10.f);
+		const v3 vLook(random() * 2.f - 1.f, random() * 2.f - 1.f, random() * 2.f - 1.f);
+		const m4x4 kHeadToWorld = m4x4::CreateLookAt(vHead, vHead + vLook, v3(0.f, 1.f, 0.f)).Invert();
+
+		StereoFrustum frustum;
+		build_stereo_frustum(kHeadToWorld, vEyeOffsets, fov, kNear, kFar, frustum);
+
+		// Each eye's planes are the ones its own off centre projection gives.
+		for (u32 eye = 0; eye < 2; ++eye)
+		{
+			const m4x4 kEyeToWorld = m4x4::CreateTranslation(vEyeOffsets[eye]) * kHeadToWorld;
+			const m4x4 kProjection = eye_projection(fov[eye], kNear, kFar);
+			v4 reference[6];
+			LightSystem::frustum_planes(kEyeToWorld.Invert() * kProjection, reference);
+			for (u32 i = 0; i < 6; ++i)
+			{
+				const v4 vDelta = reference[i] - frustum.m_eyePlanes[eye][i];
+				// The far plane comes out of the projection by cancellation, allow for its distance.
+				const f32 kTolerance = 1e-4f * std::max(fabsf(reference[i].w), 1.f);
+				planeErrors += fabsf(vDelta.x) + fabsf(vDelta.y) + fabsf(vDelta.z) + fabsf(vDelta.w) > kTolerance ? 1 : 0;
+			}
+		}
+
+		// Any sphere with a point inside an eye must pass the combined frustum and carry that eye's bit.
+		u32 survivors = 0;
+		for (u32 s = 0; s < kSpheres; ++s)
+		{
+			const v3 vCentre = vHead + v3(random() * 80.f - 40.f, random() * 40.f - 20.f, random() * 80.f - 40.f);
+			const f32 kRadius = random() * random() * 6.f;
+
+			bool bInEye[2] = { false, false };
+			for (u32 p = 0; p < kSamples && !(bInEye[0] && bInEye[1]); ++p)
+			{
+				v3 vOffset;
+				do
+				{
+					vOffset = v3(random() * 2.f - 1.f, random() * 2.f - 1.f, random() * 2.f - 1.f);
+				} while (vOffset.LengthSquared() > 1.f);
+				const v3 vPoint = vCentre + vOffset * kRadius;
+				bInEye[0] = bInEye[0] || inside(frustum.m_eyePlanes[0], vPoint);
+				bInEye[1] = bInEye[1] || inside(frustum.m_eyePlanes[1], vPoint);
+			}
+
+			bool bCombined = true;
+			for (u32 i = 0; i < 6; ++i)
+			{
+				bCombined = bCombined && !outside_plane(frustum.m_planes[i], vCentre, kRadius);
+			}
+			if (!bCombined)
+			{
+				++culled;
+				combinedMisses += bInEye[0] || bInEye[1] ? 1 : 0;
+				continue;
+			}
+
+			const u8 kMask = stereo_eye_mask(frustum, vCentre, kRadius);
+			maskMisses += (bInEye[0] && !(kMask & kEyeMask_Left)) || (bInEye[1] && !(kMask & kEyeMask_Right)) ? 1 : 0;
+			++(kMask == kEyeMask_Both ? bothEyes : oneEye);
+
+			GPULight& rLight = lights[1 + survivors++];
+			rLight = {};
+			rLight.m_vPosition = v4(vCentre, kGPULightPoint);
+			rLight.m_vAtt.w = kRadius;
+		}
+
+		// Splitting keeps exactly the lights with the eye's bit, in order, with a directional in front for both.
+		lights[0] = {};
+		lights[0].m_vPosition = v4(0.f, 1.f, 0.f, 0.f);
+		const u32 kLights = survivors + 1;
+		const u32 kTypeStart[kMaxLightTypes + 1] = { 0, 1, kLights, kLights };
+		stereo_eye_masks(frustum, lights.data(), kLights, masks.data());
+		for (u32 eye = 0; eye < 2; ++eye)
+		{
+			u32 typeStart[kMaxLightTypes + 1];
+			const u32 kKept = split_eye_lights(lights.data(), masks.data(), kTypeStart, eye, eyeLights, typeStart);
+
+			u32 next = 0;
+			bool bMatch = typeStart[0] == 0 && typeStart[1] == 1 && typeStart[kMaxLightTypes] == kKept;
+			for (u32 i = 0; i < kLights && bMatch; ++i)
+			{
+				if (masks[i] & (1u << eye))
+					bMatch = next < kKept && memcmp(&eyeLights[next++], &lights[i], sizeof(GPULight)) == 0;
+			}
+			splitErrors += bMatch && next == kKept ? 0 : 1;
+		}
+	}
+
+	testF("%u views, %u eye planes off their projection", kViews, planeErrors);
+	testF("%u spheres, %u culled, %u of them visible to an eye", kViews * kSpheres, culled, combinedMisses);
+	testF("survivors: %u both eyes, %u one, %u missing an eye, %u bad splits", bothEyes, oneEye, maskMisses, splitErrors);
+	return !planeErrors && !combinedMisses && !maskMisses && !splitErrors;
+}
+
+// Random bounds around a perspective frustum, each width timed on the same data across the jobs and checked
+// against the scalar one.
+FRAMEWORK_TEST(frustum_culling)
+{
+	const u32 kCount = kCullBounds;
+	// A 90 degree view down -z, bounds scattered through a box about four times its volume.
+	const m4x4 kView = m4x4::CreateLookAt(v3(0.f, 0.f, 0.f), v3(0.f, 0.f, -1.f), v3(0.f, 1.f, 0.f));
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 16.f / 9.f, 0.1f, 100.f);
+	v4 planes[6];
+	LightSystem::frustum_planes(kView * kProjection, planes);
+	CullPlanes cullPlanes;
+	set_cull_planes(planes, 6, cullPlanes);
+
+	std::vector<f32> data(kCount * 6);
+	f32* pArrays[6];
+	for (u32 a = 0; a < 6; ++a)
+		pArrays[a] = data.data() + a * kCount;
+
+	u32 seed = 4321u;
+	auto random_range = [&seed](const f32 kMin, const f32 kMax) { seed = seed * 1664525u + 1013904223u; return kMin + (kMax - kMin) * ((seed >> 8) * (1.f / 16777216.f)); };
+	for (u32 i = 0; i < kCount; ++i)
+	{
+		pArrays[0][i] = random_range(-150.f, 150.f);
+		pArrays[1][i] = random_range(-100.f, 100.f);
+		pArrays[2][i] = random_range(-110.f, 10.f);
+		pArrays[3][i] = random_range(0.1f, 2.f);
+		pArrays[4][i] = random_range(0.1f, 2.f);
+		pArrays[5][i] = random_range(0.1f, 2.f);
+	}
+
+	const SphereBoundsSoA kSpheres = { pArrays[0], pArrays[1], pArrays[2], pArrays[3] };
+	const BoxBoundsSoA kBoxes = { pArrays[0], pArrays[1], pArrays[2], pArrays[3], pArrays[4], pArrays[5] };
+
+	f64 sphereMs[kMaxCullWidths], boxMs[kMaxCullWidths];
+	bool bMatch = true;
+
+	std::vector<u32> sphereReference, boxReference, mask;
+	for (u32 w = 0; w < kMaxCullWidths; ++w)
+	{
+		const ECullWidth kWidth = static_cast<ECullWidth>(w);
+
+		const s64 kSphereStart = getTimeMicroseconds();
+		cull_spheres(cullPlanes, kSpheres, kCount, kWidth, mask, &test_jobs());
+		sphereMs[w] = (getTimeMicroseconds() - kSphereStart) / 1000.0;
+		if (kWidth == kCullWidth_1)
+			sphereReference = mask;
+		bMatch &= mask == sphereReference;
+
+		const s64 kBoxStart = getTimeMicroseconds();
+		cull_boxes(cullPlanes, kBoxes, kCount, kWidth, mask, &test_jobs());
+		boxMs[w] = (getTimeMicroseconds() - kBoxStart) / 1000.0;
+		if (kWidth == kCullWidth_1)
+			boxReference = mask;
+		bMatch &= mask == boxReference;
+	}
+
+	std::vector<u32> indices;
+	const u32 kVisibleSpheres = compact_visible(sphereReference, kCount, indices);
+	const u32 kVisibleBoxes = compact_visible(boxReference, kCount, indices);
+
+	static const char* kWidthNames[kMaxCullWidths] = { "scalar", "4 wide", "8 wide", "16 wide" };
+	testF("%u bounds%s, %u spheres and %u boxes visible%s", kCount, cpu_has_avx() ? " AVX" : "", kVisibleSpheres, kVisibleBoxes, bMatch ? "" : ", MISMATCH");
+	for (u32 w = 0; w < kMaxCullWidths; ++w)
+		testF("%-7s spheres %.3f ms, boxes %.3f ms", kWidthNames[w], sphereMs[w], boxMs[w]);
+	return bMatch;
+}
+
+// A wall of random boxes in front of a field of small ones, the same scene every run, rasterized across the
+// jobs and then on one thread to check both give the same depths.
+FRAMEWORK_TEST(occlusion_culler_benchmark)
+{
+	const m4x4 kViewProjection = headset_view_projection(v3(0.f, 0.f, 0.f), v3(0.f, 0.f, -1.f), kfPI * 0.5f, 0.1f, 200.f);
+
+	OcclusionCuller culler, serial;
+	culler.init(OcclusionCullerDesc());
+	culler.begin_frame(kViewProjection);
+	serial.init(OcclusionCullerDesc());
+	serial.begin_frame(kViewProjection);
+
+	// Slabs and pillars between 5 and 25 units away.
+	u32 seed = 777u;
+	auto random_range = [&seed](const f32 kMin, const f32 kMax) { seed = seed * 1664525u + 1013904223u; return kMin + (kMax - kMin) * ((seed >> 8) * (1.f / 16777216.f)); };
+	for (u32 i = 0; i < kOcclusionBenchmarkOccluders; ++i)
+	{
+		const v3 vCentre(random_range(-20.f, 20.f), random_range(-20.f, 20.f), random_range(-25.f, -5.f));
+		const v3 vHalf(random_range(0.2f, 3.f), random_range(0.2f, 3.f), random_range(0.2f, 1.f));
+		culler.add_occluder_box(vCentre - vHalf, vCentre + vHalf, m4x4::Identity);
+		serial.add_occluder_box(vCentre - vHalf, vCentre + vHalf, m4x4::Identity);
+	}
+
+	// The same occluders on one thread give the same depths.
+	culler.rasterize(&test_jobs());
+	serial.rasterize(nullptr);
+	const u32 kTriangles = culler.stats().m_triangles;
+	const f64 kRasterMs = culler.stats().m_rasterMs;
+	std::vector<f32> depths, serialDepths;
+	culler.tile_depths(depths);
+	serial.tile_depths(serialDepths);
+	const bool kMatch = depths == serialDepths;
+
+	// Small props further back.
+	std::vector<v3> mins(kOcclusionBenchmarkOccludees), maxs(kOcclusionBenchmarkOccludees);
+	for (u32 i = 0; i < kOcclusionBenchmarkOccludees; ++i)
+	{
+		const v3 vCentre(random_range(-40.f, 40.f), random_range(-40.f, 40.f), random_range(-60.f, -20.f));
+		const v3 vHalf(random_range(0.1f, 1.f));
+		mins[i] = vCentre - vHalf;
+		maxs[i] = vCentre + vHalf;
+	}
+
+	u32 occluded = 0;
+	const s64 kTestStart = getTimeMicroseconds();
+	for (u32 i = 0; i < kOcclusionBenchmarkOccludees; ++i)
+		occluded += culler.test_box(mins[i], maxs[i]) ? 0 : 1;
+	const f64 kTestMs = (getTimeMicroseconds() - kTestStart) / 1000.0;
+
+	testF("%u triangles in %.3f ms, %.0f per ms%s", kTriangles, kRasterMs, kRasterMs > 0.0 ? kTriangles / kRasterMs : 0.0, kMatch ? "" : ", MISMATCH");
+	testF("%u / %u boxes occluded, tested in %.3f ms", occluded, kOcclusionBenchmarkOccludees, kTestMs);
+	return kMatch;
+}
+
+// The faces add_occluder_box() draws as corner indices, bit 0 picks max x, bit 1 max y and bit 2 max z.
+// Each quad is listed clockwise seen from outside, a D3D front face.
+constexpr u16 kBoxIndices[36] =
+{
+	0, 1, 3,  0, 3, 2,		// -z
+	4, 6, 7,  4, 7, 5,		// +z
+	0, 2, 6,  0, 6, 4,		// -x
+	1, 5, 7,  1, 7, 3,		// +x
+	0, 4, 5,  0, 5, 1,		// -y
+	2, 3, 7,  2, 7, 6,		// +y
+};
+
+static void box_corners(const v3& vMin, const v3& vMax, v3 cornersOut[8])
+{
+	for (u32 i = 0; i < 8; ++i)
+		cornersOut[i] = v3(i & 1 ? vMax.x : vMin.x, i & 2 ? vMax.y : vMin.y, i & 4 ? vMax.z : vMin.z);
+}
+
+// Plain per pixel depth buffer for checking the culler against, every pixel centre tested in double.
+class ReferenceDepth
+{
+public:
+
+	ReferenceDepth(const u32 kWidth, const u32 kHeight) : m_width(kWidth), m_height(kHeight), m_depth(kWidth * kHeight, 1.f) {}
+
+	// Clip space triangle, clockwise on screen to be drawn, dropped when it crosses the near plane.
+	void draw(const v4& a, const v4& b, const v4& c)
+	{
+		if (a.z < 0.f || b.z < 0.f || c.z < 0.f)
+			return;
+
+		const v4* pVertices[3] = { &a, &b, &c };
+		f64 x[3], y[3], z[3];
+		for (u32 i = 0; i < 3; ++i)
+		{
+			x[i] = (pVertices[i]->x / pVertices[i]->w * 0.5 + 0.5) * m_width;
+			y[i] = (0.5 - pVertices[i]->y / pVertices[i]->w * 0.5) * m_height;
+			z[i] = pVertices[i]->z / pVertices[i]->w;
+		}
+
+		const f64 kArea = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+		if (kArea <= 0.0)
+			return;
+
+		for (u32 py = 0; py < m_height; ++py)
+		{
+			for (u32 px = 0; px < m_width; ++px)
+			{
+				const f64 kX = px + 0.5;
+				const f64 kY = py + 0.5;
+				const f64 w0 = (x[2] - x[1]) * (kY - y[1]) - (y[2] - y[1]) * (kX - x[1]);
+				const f64 w1 = (x[0] - x[2]) * (kY - y[2]) - (y[0] - y[2]) * (kX - x[2]);
+				const f64 w2 = (x[1] - x[0]) * (kY - y[0]) - (y[1] - y[0]) * (kX - x[0]);
+				if (w0 < 0.0 || w1 < 0.0 || w2 < 0.0)
+					continue;
+
+				f32& rDepth = m_depth[py * m_width + px];
+				rDepth = std::min(rDepth, f32((w0 * z[0] + w1 * z[1] + w2 * z[2]) / kArea));
+			}
+		}
+	}
+
+	// True when some pixel the box's screen rectangle covers is no nearer than the box's nearest point.
+	bool box_visible(const v3& vMin, const v3& vMax, const m4x4& rViewProjection) const
+	{
+		v3 corners[8];
+		box_corners(vMin, vMax, corners);
+		f32 minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+		for (u32 i = 0; i < 8; ++i)
+		{
+			const v4 vClip = v4::Transform(v4(corners[i], 1.f), rViewProjection);
+			if (vClip.z < 0.f)
+				return true;
+
+			const f32 kX = (vClip.x / vClip.w * 0.5f + 0.5f) * m_width;
+			const f32 kY = (0.5f - vClip.y / vClip.w * 0.5f) * m_height;
+			minX = std::min(minX, kX);
+			maxX = std::max(maxX, kX);
+			minY = std::min(minY, kY);
+			maxY = std::max(maxY, kY);
+			minZ = std::min(minZ, vClip.z / vClip.w);
+		}
+
+		if (maxX < 0.f || maxY < 0.f || minX >= m_width || minY >= m_height)
+			return false;
+
+		const u32 kMaxX = std::min(u32(maxX), m_width - 1);
+		const u32 kMaxY = std::min(u32(maxY), m_height - 1);
+		for (u32 py = u32(std::max(minY, 0.f)); py <= kMaxY; ++py)
+		{
+			for (u32 px = u32(std::max(minX, 0.f)); px <= kMaxX; ++px)
+			{
+				if (m_depth[py * m_width + px] >= minZ)
+					return true;
+			}
+		}
+		return false;
+	}
+
+private:
+
+	u32 m_width;
+	u32 m_height;
+	std::vector<f32> m_depth;
+};
+
+// A box behind, in front of and beside one wall. Then random walls and rotated boxes, single and double
+// sided, with random boxes tested against both the culler and a per pixel reference rasterizer. Odd scenes
+// rasterize across the jobs.
+FRAMEWORK_TEST(occlusion_culler)
+{
+	u32 basicErrors = 0;
+
+	// One wall straight ahead.
+	{
+		const m4x4 kViewProjection = headset_view_projection(v3(0.f, 0.f, 0.f), v3(0.f, 0.f, -1.f), 1.5f, 0.1f, 100.f);
+		OcclusionCuller culler;
+		culler.init(OcclusionCullerDesc());
+		culler.begin_frame(kViewProjection);
+		culler.add_occluder_box(v3(-3.f, -3.f, -6.f), v3(3.f, 3.f, -5.f), m4x4::Identity);
+		culler.rasterize(&test_jobs());
+		basicErrors += culler.test_box(v3(-0.5f, -0.5f, -10.f), v3(0.5f, 0.5f, -9.f)) ? 1 : 0;
+		basicErrors += culler.test_box(v3(-0.5f, -0.5f, -4.f), v3(0.5f, 0.5f, -3.f)) ? 0 : 1;
+		basicErrors += culler.test_box(v3(8.f, -0.5f, -10.f), v3(9.f, 0.5f, -9.f)) ? 0 : 1;
+	}
+
+	constexpr u32 kScenes = 40;
+	constexpr u32 kTestsPerScene = 400;
+	OcclusionCullerDesc desc;
+	desc.m_width = 128;
+	desc.m_height = 128;
+	u32 seed = 11u;
+	auto random_range = [&seed](const f32 kMin, const f32 kMax) { seed = seed * 1664525u + 1013904223u; return kMin + (kMax - kMin) * ((seed >> 8) * (1.f / 16777216.f)); };
+	u32 referenceHidden = 0, hidden = 0, unsafe = 0;
+	for (u32 s = 0; s < kScenes; ++s)
+	{
+		const v3 vEye(random_range(-2.f, 2.f), random_range(0.f, 2.f), random_range(2.f, 6.f));
+		const v3 vLook(random_range(-0.3f, 0.3f), random_range(-0.2f, 0.2f), -1.f);
+		const m4x4 kViewProjection = headset_view_projection(vEye, vEye + vLook, 1.5f, 0.1f, 100.f);
+
+		OcclusionCuller culler;
+		culler.init(desc);
+		culler.begin_frame(kViewProjection);
+		ReferenceDepth reference(desc.m_width, desc.m_height);
+
+		// Boxes drawn front faces only, walls as double sided quads, all turned about y.
+		const u32 kOccluders = 5 + static_cast<u32>(random_range(0.f, 30.f));
+		for (u32 i = 0; i < kOccluders; ++i)
+		{
+			const v3 vCentre(random_range(-8.f, 8.f), random_range(-3.f, 3.f), random_range(-13.f, -1.f));
+			const v3 vHalf(random_range(0.1f, 2.1f), random_range(0.1f, 2.1f), random_range(0.05f, 0.55f));
+			const m4x4 kWorld = m4x4::CreateRotationY(random_range(0.f, 3.f));
+			const m4x4 kWorldViewProjection = kWorld * kViewProjection;
+			const v3 vMin = vCentre - vHalf;
+			const v3 vMax = vCentre + vHalf;
+
+			if (i & 1)
+			{
+				culler.add_occluder_box(vMin, vMax, kWorld);
+				v3 corners[8];
+				box_corners(vMin, vMax, corners);
+				v4 clip[8];
+				for (u32 c = 0; c < 8; ++c)
+					clip[c] = v4::Transform(v4(corners[c], 1.f), kWorldViewProjection);
+				for (u32 t = 0; t < 36; t += 3)
+					reference.draw(clip[kBoxIndices[t]], clip[kBoxIndices[t + 1]], clip[kBoxIndices[t + 2]]);
+			}
+			else
+			{
+				const v3 quad[4] = { v3(vMin.x, vMin.y, vCentre.z), v3(vMax.x, vMin.y, vCentre.z), v3(vMax.x, vMax.y, vCentre.z), v3(vMin.x, vMax.y, vCentre.z) };
+				const u16 kQuadIndices[6] = { 0, 1, 2, 0, 2, 3 };
+				culler.add_occluder(quad, 4, kQuadIndices, 6, kWorld, false);
+				v4 clip[4];
+				for (u32 c = 0; c < 4; ++c)
+					clip[c] = v4::Transform(v4(quad[c], 1.f), kWorldViewProjection);
+				for (u32 t = 0; t < 6; t += 3)
+				{
+					reference.draw(clip[kQuadIndices[t]], clip[kQuadIndices[t + 1]], clip[kQuadIndices[t + 2]]);
+					reference.draw(clip[kQuadIndices[t]], clip[kQuadIndices[t + 2]], clip[kQuadIndices[t + 1]]);
+				}
+			}
+		}
+		culler.rasterize(s & 1 ? &test_jobs() : nullptr);
+
+		for (u32 i = 0; i < kTestsPerScene; ++i)
+		{
+			const v3 vCentre(random_range(-15.f, 15.f), random_range(-6.f, 6.f), random_range(-31.f, -1.f));
+			const v3 vHalf(random_range(0.05f, 0.85f));
+			const bool kVisible = culler.test_box(vCentre - vHalf, vCentre + vHalf);
+			const bool kReferenceVisible = reference.box_visible(vCentre - vHalf, vCentre + vHalf, kViewProjection);
+			referenceHidden += kReferenceVisible ? 0 : 1;
+			hidden += kVisible ? 0 : 1;
+			unsafe += !kVisible && kReferenceVisible ? 1 : 0;
+		}
+	}
+
+	testF("%u scenes, %u boxes: %u hidden, %u per pixel, %u wrongly hidden%s", kScenes, kScenes * kTestsPerScene, hidden, referenceHidden, unsafe
+		, basicErrors ? ", SINGLE WALL FAILED" : "");
+	return !unsafe && !basicErrors;
+}
+
+// Random value in [kMin, kMax), deterministic so benchmark runs are comparable.
+static f32 random_range(u32& rState, const f32 kMin, const f32 kMax)
+{
+	rState = rState * 1664525u + 1013904223u;
+	return kMin + (kMax - kMin) * ((rState >> 8) * (1.f / 16777216.f));
+}
+
+// Spheres through a 200m square field, 20m deep, the same ones every run.
+static SphereBoundsSoA random_field(const u32 kSpheres, std::vector<f32>& rDataOut)
+{
+	rDataOut.resize(kSpheres * 4);
+	f32* pX = rDataOut.data();
+	f32* pY = pX + kSpheres;
+	f32* pZ = pY + kSpheres;
+	f32* pRadius = pZ + kSpheres;
+
+	u32 seed = 2468u;
+	for (u32 i = 0; i < kSpheres; ++i)
+	{
+		pX[i] = random_range(seed, -kFieldHalfSize, kFieldHalfSize);
+		pY[i] = random_range(seed, 0.f, 20.f);
+		pZ[i] = random_range(seed, -kFieldHalfSize, kFieldHalfSize);
+		pRadius[i] = random_range(seed, 0.1f, 2.f);
+	}
+	return { pX, pY, pZ, pRadius };
+}
+
+// A camera orbiting a field of spheres 200m square about the origin, each frame culled from scratch then
+// coherently.
+FRAMEWORK_TEST(coherent_culling_benchmark)
+{
+	std::vector<f32> data;
+	const SphereBoundsSoA kBounds = random_field(kCoherentBenchmarkSpheres, data);
+
+	// Orbit the middle of the field slowly at head height, looking inwards, holding still for a while
+	// every second or so like a viewer looking around.
+	constexpr f32 kOrbitRadius = 60.f;
+	constexpr f32 kStep = 0.0005f;		// radians a frame.
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 1.f, 0.1f, 1000.f);
+
+	// Planes fixed to the camera move by at most translation + rotation * distance at a point,
+	// and no sphere is further than this from the orbit.
+	const f32 kReach = kOrbitRadius + kFieldHalfSize * 1.5f;
+
+	std::vector<m4x4> views(kCoherentBenchmarkFrames);
+	std::vector<f32> deltas(kCoherentBenchmarkFrames);
+	f32 angle = 0.f;
+	for (u32 f = 0; f < kCoherentBenchmarkFrames; ++f)
+	{
+		const bool kMoving = (f / 45) % 2 == 0;
+		const f32 kTurn = f > 0 && kMoving ? kStep : 0.f;
+		angle += kTurn;
+		const v3 vEye(cosf(angle) * kOrbitRadius, 1.7f, sinf(angle) * kOrbitRadius);
+		views[f] = m4x4::CreateLookAt(vEye, v3(0.f, 1.7f, 0.f), v3(0.f, 1.f, 0.f)) * kProjection;
+		deltas[f] = 2.f * kOrbitRadius * sinf(kTurn * 0.5f) + kTurn * kReach;
+	}
+
+	f64 fullMs = 0.0, coherentMs = 0.0;
+	u32 fullPasses = 0, mismatches = 0;
+	CoherentCuller culler;
+	culler.init(CoherentCullerDesc());
+
+	std::vector<u32> reference;
+	u64 tested = 0;
+	for (u32 f = 0; f < kCoherentBenchmarkFrames; ++f)
+	{
+		v4 planes[6];
+		LightSystem::frustum_planes(views[f], planes);
+		CullPlanes cullPlanes;
+		set_cull_planes(planes, 6, cullPlanes);
+
+		const s64 kFullStart = getTimeMicroseconds();
+		cull_spheres(cullPlanes, kBounds, kCoherentBenchmarkSpheres, kCullWidth_8, reference, &test_jobs());
+		fullMs += (getTimeMicroseconds() - kFullStart) / 1000.0;
+
+		const s64 kCoherentStart = getTimeMicroseconds();
+		culler.cull(cullPlanes, kBounds, kCoherentBenchmarkSpheres, deltas[f], nullptr, 0, &test_jobs());
+		coherentMs += (getTimeMicroseconds() - kCoherentStart) / 1000.0;
+
+		const CoherentCuller::Stats& rStats = culler.stats();
+		fullPasses += rStats.m_bFullPass ? 1 : 0;
+		mismatches += culler.mask() == reference ? 0 : 1;
+		tested += rStats.m_tested;
+	}
+
+	testF("%u spheres, %u frames: every frame %.3f ms, coherent %.3f ms a frame", kCoherentBenchmarkSpheres, kCoherentBenchmarkFrames
+		, fullMs / kCoherentBenchmarkFrames, coherentMs / kCoherentBenchmarkFrames);
+	testF("%u full passes, %.0f spheres tested a frame, %u masks differ from scratch", fullPasses, f64(tested) / kCoherentBenchmarkFrames, mismatches);
+	return !mismatches;
+}
+
+// A camera wandering, turning and stopping through the benchmark's field while some spheres move
+// and are reported, every frame's mask compared against a from-scratch cull.
+FRAMEWORK_TEST(coherent_culling)
+{
+	constexpr u32 kSpheres = 20000;
+	constexpr u32 kFrames = 600;
+	constexpr u32 kMovedPerFrame = 32;
+
+	std::vector<f32> data;
+	const SphereBoundsSoA kBounds = random_field(kSpheres, data);
+	f32* pX = data.data();
+	f32* pZ = pX + 2 * kSpheres;
+
+	u32 fullPasses = 0, mismatches = 0, stillTested = 0;
+
+	CoherentCuller culler;
+	culler.init(CoherentCullerDesc());
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 16.f / 9.f, 0.1f, 1000.f);
+
+	// No sphere is further than the field's diagonal from a camera inside it, a turn moves the planes
+	// by at most the angle times that.
+	const f32 kReach = sqrtf(8.f * kFieldHalfSize * kFieldHalfSize + 20.f * 20.f);
+
+	std::vector<u32> reference, moved;
+	CullPlanes cullPlanes;
+	auto cull = [&](const v3& vEye, const f32 kYaw, const f32 kDelta, const u32 kCount)
+	{
+		v4 planes[6];
+		const v3 vForward(sinf(kYaw), 0.f, -cosf(kYaw));
+		LightSystem::frustum_planes(m4x4::CreateLookAt(vEye, vEye + vForward, v3(0.f, 1.f, 0.f)) * kProjection, planes);
+		set_cull_planes(planes, 6, cullPlanes);
+		culler.cull(cullPlanes, kBounds, kCount, kDelta, moved.data(), static_cast<u32>(moved.size()), &test_jobs());
+		cull_spheres(cullPlanes, kBounds, kCount, kCullWidth_1, reference, nullptr);
+		return culler.mask() == reference;
+	};
+
+	// Walk, turn and stand still in turns, some spheres drifting and reported on the moving stretches.
+	u32 seed = 1357u;
+	v3 vEye(0.f, 1.7f, 0.f);
+	f32 yaw = 0.f;
+	for (u32 f = 0; f < kFrames; ++f)
+	{
+		const u32 kPhase = (f / 40) % 3;
+		const v3 vStep = kPhase == 0 ? v3(random_range(seed, -0.05f, 0.05f), 0.f, random_range(seed, -0.05f, 0.05f)) : v3(0.f, 0.f, 0.f);
+		const f32 kTurn = kPhase == 1 ? random_range(seed, -0.003f, 0.003f) : 0.f;
+		vEye += vStep;
+		yaw += kTurn;
+
+		moved.clear();
+		if (kPhase != 2)
+		{
+			for (u32 m = 0; m < kMovedPerFrame; ++m)
+			{
+				const u32 kSphere = static_cast<u32>(random_range(seed, 0.f, f32(kSpheres))) % kSpheres;
+				pX[kSphere] += random_range(seed, -1.f, 1.f);
+				pZ[kSphere] += random_range(seed, -1.f, 1.f);
+				moved.push_back(kSphere);
+			}
+		}
+
+		const f32 kDelta = vStep.Length() + fabsf(kTurn) * kReach;
+		mismatches += cull(vEye, yaw, kDelta, kSpheres) ? 0 : 1;
+
+		fullPasses += culler.stats().m_bFullPass ? 1 : 0;
+	}
+
+	// Jumps and a different count can't be carried over.
+	moved.clear();
+	mismatches += cull(vEye, yaw, 0.f, kSpheres) ? 0 : 1;
+	vEye += v3(30.f, 0.f, 0.f);
+	mismatches += cull(vEye, yaw, 30.f, kSpheres) ? 0 : 1;
+	const bool kJumpFullPass = culler.stats().m_bFullPass;
+	mismatches += cull(vEye, yaw, 0.f, kSpheres / 2) ? 0 : 1;
+	const bool kResizeFullPass = culler.stats().m_bFullPass;
+
+	// Nothing moving after a full pass leaves nothing to retest.
+	for (u32 f = 1; f < CoherentCullerDesc().m_fullPassInterval; ++f)
+	{
+		mismatches += cull(vEye, yaw, 0.f, kSpheres / 2) ? 0 : 1;
+		stillTested += culler.stats().m_tested;
+	}
+
+	testF("%u spheres, %u frames, %u full passes, %u masks differ from scratch", kSpheres, kFrames, fullPasses, mismatches);
+	testF("%u retested holding still%s", stillTested, kJumpFullPass && kResizeFullPass ? "" : ", NO FULL PASS");
+	return !mismatches && !stillTested && kJumpFullPass && kResizeFullPass;
+}
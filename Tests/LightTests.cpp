@@ -0,0 +1,708 @@
+#include "Tests.h"
+
+#include "LightBudget.h"
+#include "LightClusters.h"
+#include "LightSpatialHash.h"
+#include "LightSystem.h"
+#include "LightVolumes.h"
+#include "TiledLightCulling.h"
+
+#include <algorithm>
+#include <vector>
+
+//================================================================================
+// Light Tests
+// The light system, its queries, clustering, budgets and volumes.
+//================================================================================
+
+constexpr u32 kClusterLightCounts[] = { 1000, 10000, 100000 };
+
+// Spheres scattered through and around a 90 degree frustum, one of them unbounded, binned into the default grid
+// serially and across the jobs, each build checked against build_reference(). The reference tests every light
+// against every cluster, which takes seconds at 100k lights.
+FRAMEWORK_TEST(light_clusters)
+{
+	ClusterGridDesc desc;
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 16.f / 9.f, desc.m_near, desc.m_far);
+	const m4x4 kView = m4x4::CreateLookAt(v3(0.f, 2.f, 0.f), v3(0.f, 2.f, -1.f), v3(0.f, 1.f, 0.f));
+
+	bool bPassed = true;
+	for (const u32 kLightCount : kClusterLightCounts)
+	{
+		// Mostly in front of the camera, some behind it or straddling the near plane.
+		std::vector<LightBounds> lights(kLightCount);
+		u32 seed = kLightCount;
+		auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+		for (LightBounds& rLight : lights)
+		{
+			rLight.m_vCentre = v3(random() * 200.f - 100.f, random() * 40.f - 18.f, 20.f - random() * 220.f);
+			rLight.m_radius = 0.5f + random() * 4.f;
+			rLight.m_vDirection = v3(0.f, -1.f, 0.f);
+		}
+		lights[0].m_radius = kInfiniteLightRadius;
+
+		LightClusterGrid grid, reference;
+		grid.set_projection(kProjection, desc);
+		reference.set_projection(kProjection, desc);
+
+		s64 start = getTimeMicroseconds();
+		grid.build(lights.data(), kLightCount, kView, nullptr);
+		const f64 kSerialMs = (getTimeMicroseconds() - start) / 1000.0;
+
+		start = getTimeMicroseconds();
+		grid.build(lights.data(), kLightCount, kView, &test_jobs());
+		const f64 kBuildMs = (getTimeMicroseconds() - start) / 1000.0;
+
+		start = getTimeMicroseconds();
+		reference.build_reference(lights.data(), kLightCount, kView);
+		const f64 kReferenceMs = (getTimeMicroseconds() - start) / 1000.0;
+
+		// Both list each cluster's lights in light order, so the flattened lists match exactly.
+		bool bMatch = grid.indices() == reference.indices();
+		for (u32 i = 0; i < grid.cluster_count() && bMatch; ++i)
+		{
+			bMatch = grid.clusters()[i].m_offset == reference.clusters()[i].m_offset && grid.clusters()[i].m_count == reference.clusters()[i].m_count;
+		}
+
+		testF("%7u lights: %u indices, jobs %.3f ms, serial %.3f ms, reference %.1f ms%s", kLightCount, static_cast<u32>(grid.indices().size())
+			, kBuildMs, kSerialMs, kReferenceMs, bMatch ? "" : ", MISMATCH");
+		bPassed = bPassed && bMatch;
+	}
+	return bPassed;
+}
+
+//================================================================================
+// Spot lights
+//================================================================================
+
+// Random numbers in [0, 1), the same run every time.
+struct CheckRandom
+{
+	u32 m_seed;
+
+	f32 next() { m_seed = m_seed * 1664525u + 1013904223u; return f32(m_seed >> 8) * (1.f / 16777216.f); }
+	f32 range(const f32 kMin, const f32 kMax) { return kMin + (kMax - kMin) * next(); }
+	v3 direction() { v3 v(range(-1.f, 1.f), range(-1.f, 1.f), range(-1.f, 1.f)); v.Normalize(); return v; }
+};
+
+// Two unit vectors at right angles to vAxis.
+static void cone_basis(const v3& vAxis, v3& rSideOut, v3& rUpOut)
+{
+	rSideOut = vAxis.Cross(fabsf(vAxis.y) < 0.99f ? v3(0.f, 1.f, 0.f) : v3(1.f, 0.f, 0.f));
+	rSideOut.Normalize();
+	rUpOut = rSideOut.Cross(vAxis);
+}
+
+// Cosine of the outer angle of a spot's LightBounds.
+static f32 spot_cos_outer(const LightBounds& rLight)
+{
+	return rLight.m_radius / sqrtf(rLight.m_radius * rLight.m_radius + rLight.m_coneRadius * rLight.m_coneRadius);
+}
+
+// Inside the range and the outer angle, the part of the spot the shaders light.
+// Wide cones reach past the range, so this is the sphere and the cone together.
+static bool point_lit_by_spot(const LightBounds& rLight, const v3& vPoint)
+{
+	const v3 kOffset = vPoint - rLight.m_vCentre;
+	const f32 kDistance = kOffset.Length();
+	return kDistance <= rLight.m_radius && kOffset.Dot(rLight.m_vDirection) >= kDistance * spot_cos_outer(rLight);
+}
+
+// Uniformly through the lit part of a spot.
+static v3 point_lit_by_spot(const LightBounds& rLight, CheckRandom& rRandom)
+{
+	v3 vSide, vUp;
+	cone_basis(rLight.m_vDirection, vSide, vUp);
+	const f32 kCos = 1.f - rRandom.next() * (1.f - spot_cos_outer(rLight));
+	const f32 kSin = sqrtf(std::max(1.f - kCos * kCos, 0.f));
+	const f32 kAngle = rRandom.next() * 2.f * kfPI;
+	const v3 vDirection = rLight.m_vDirection * kCos + (vSide * cosf(kAngle) + vUp * sinf(kAngle)) * kSin;
+	return rLight.m_vCentre + vDirection * (cbrtf(rRandom.next()) * rLight.m_radius);
+}
+
+static LightBounds random_spot(CheckRandom& rRandom, const v3& vMin, const v3& vMax)
+{
+	LightBounds light;
+	light.m_vCentre = v3(rRandom.range(vMin.x, vMax.x), rRandom.range(vMin.y, vMax.y), rRandom.range(vMin.z, vMax.z));
+	light.m_radius = rRandom.range(1.f, 5.f);
+	light.m_vDirection = rRandom.direction();
+	light.m_coneRadius = light.m_radius * tanf(rRandom.range(0.1f, 0.7f));
+	return light;
+}
+
+// Random spots against the plane test, the tile and cluster binners, LightSystem's frustum culling and the
+// light volume inside / outside split, each compared with points sampled where the spots light.
+FRAMEWORK_TEST(spot_culling)
+{
+	CheckRandom random = { 7 };
+
+	// The plane test against the apex and the cap rim, which bound the cone on any plane.
+	constexpr u32 kPlaneCases = 20000;
+	constexpr u32 kRimPoints = 720;
+	u32 planeErrors = 0;
+	for (u32 i = 0; i < kPlaneCases; ++i)
+	{
+		const v3 vNormal = random.direction();
+		const f32 kOffset = random.range(-2.f, 2.f);
+		const v3 vApex(random.range(-1.f, 1.f), random.range(-1.f, 1.f), random.range(-1.f, 1.f));
+		const v3 vAxis = random.direction();
+		const f32 kLength = random.range(0.f, 3.f);
+		const f32 kCapRadius = random.range(0.f, 2.f);
+
+		v3 vSide, vUp;
+		cone_basis(vAxis, vSide, vUp);
+		f32 furthest = vNormal.Dot(vApex) + kOffset;
+		for (u32 p = 0; p < kRimPoints; ++p)
+		{
+			const f32 kAngle = p * 2.f * kfPI / kRimPoints;
+			const v3 vRim = vApex + vAxis * kLength + (vSide * cosf(kAngle) + vUp * sinf(kAngle)) * kCapRadius;
+			furthest = std::max(furthest, vNormal.Dot(vRim) + kOffset);
+		}
+
+		// The rim is sampled, so allow for the gap between samples.
+		const bool kBehind = cone_behind_plane(vNormal, vNormal.Dot(vApex) + kOffset, vAxis, kLength, kCapRadius);
+		if ((kBehind && furthest >= 1e-4f) || (!kBehind && furthest < -1e-3f))
+			++planeErrors;
+	}
+
+	// Tiles : a wavy depth buffer in front of the camera, down +z as SimpleMath is left handed here, and spots
+	// through it. Every pixel in a spot's lit sector must find the spot in its tile.
+	constexpr u32 kWidth = 320;
+	constexpr u32 kHeight = 180;
+	constexpr u32 kSpots = 200;
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(1.2f, f32(kWidth) / kHeight, 0.2f, 100.f);
+	const m4x4 kView = m4x4::Identity;
+	const m4x4 kInverseProjection = kProjection.Invert();
+
+	std::vector<f32> depth(kWidth * kHeight);
+	for (u32 y = 0; y < kHeight; ++y)
+	{
+		for (u32 x = 0; x < kWidth; ++x)
+		{
+			const f32 kViewZ = 2.f + 10.f * y / kHeight + 3.f * sinf(x * 0.05f);
+			const v4 kClip = v4::Transform(v4(0.f, 0.f, kViewZ, 1.f), kProjection);
+			depth[y * kWidth + x] = kClip.z / kClip.w;
+		}
+	}
+
+	std::vector<LightBounds> spots(kSpots);
+	for (LightBounds& rSpot : spots)
+	{
+		rSpot = random_spot(random, v3(-10.f, -5.f, 0.f), v3(10.f, 5.f, 14.f));
+	}
+	std::vector<LightBounds> spheres = spots;
+	for (LightBounds& rSphere : spheres)
+	{
+		rSphere.m_coneRadius = 0.f;
+	}
+
+	std::vector<TileDepthBounds> depthBounds;
+	compute_tile_depth_bounds(depth.data(), kWidth, kHeight, depthBounds);
+	TileLightGrid coneGrid, sphereGrid;
+	bin_lights_tiled(spots.data(), kSpots, kView, kProjection, kWidth, kHeight, depthBounds, coneGrid, &test_jobs());
+	bin_lights_tiled(spheres.data(), kSpots, kView, kProjection, kWidth, kHeight, depthBounds, sphereGrid, &test_jobs());
+
+	u64 coneEntries = 0, sphereEntries = 0;
+	for (u32 t = 0; t < coneGrid.tile_count(); ++t)
+	{
+		coneEntries += coneGrid.m_counts[t];
+		sphereEntries += sphereGrid.m_counts[t];
+	}
+	const f32 kTileEntryRatio = sphereEntries ? f32(coneEntries) / sphereEntries : 0.f;
+
+	u32 litPixels = 0, tileMisses = 0;
+
+	for (u32 y = 0; y < kHeight; ++y)
+	{
+		for (u32 x = 0; x < kWidth; ++x)
+		{
+			const v4 kView4 = v4::Transform(v4((x + 0.5f) / kWidth * 2.f - 1.f, 1.f - (y + 0.5f) / kHeight * 2.f, depth[y * kWidth + x], 1.f), kInverseProjection);
+			const v3 vPixel(kView4.x / kView4.w, kView4.y / kView4.w, kView4.z / kView4.w);
+			const u32 kTile = (y / kLightTileSize) * coneGrid.m_tilesX + x / kLightTileSize;
+			const u32* pBegin = coneGrid.tile_lights(kTile);
+			const u32* pEnd = pBegin + coneGrid.m_counts[kTile];
+
+			for (u32 i = 0; i < kSpots; ++i)
+			{
+				if (!point_lit_by_spot(spots[i], vPixel))
+					continue;
+
+				++litPixels;
+				if (std::find(pBegin, pEnd, i) == pEnd)
+					++tileMisses;
+			}
+		}
+	}
+
+	// Clusters bin the bounding spheres, every lit point must still land in a cluster listing its spot.
+	ClusterGridDesc desc;
+	desc.m_far = 100.f;
+	LightClusterGrid clusters;
+	clusters.set_projection(kProjection, desc);
+	clusters.build(spots.data(), kSpots, kView, &test_jobs());
+
+	constexpr u32 kPointsPerSpot = 200;
+	u32 clusterPoints = 0, clusterMisses = 0;
+	for (u32 i = 0; i < kSpots; ++i)
+	{
+		for (u32 p = 0; p < kPointsPerSpot; ++p)
+		{
+			const v3 vPoint = point_lit_by_spot(spots[i], random);
+			const v4 kClip = v4::Transform(v4(vPoint, 1.f), kProjection);
+			if (kClip.w <= 0.f || fabsf(kClip.x) >= kClip.w || fabsf(kClip.y) >= kClip.w || kClip.z < 0.f || kClip.z > kClip.w)
+				continue;
+
+			const u32 kX = std::min(static_cast<u32>((kClip.x / kClip.w * 0.5f + 0.5f) * desc.m_tilesX), desc.m_tilesX - 1);
+			const u32 kY = std::min(static_cast<u32>((0.5f - kClip.y / kClip.w * 0.5f) * desc.m_tilesY), desc.m_tilesY - 1);
+			const u32 kZ = clusters.depth_slice(vPoint.z * clusters.forward_sign());
+			const LightCluster& rCluster = clusters.clusters()[clusters.cluster_index(kX, kY, kZ)];
+			const u32* pBegin = clusters.indices().data() + rCluster.m_offset;
+
+			++clusterPoints;
+			if (std::find(pBegin, pBegin + rCluster.m_count, i) == pBegin + rCluster.m_count)
+				++clusterMisses;
+		}
+	}
+
+	// LightSystem's frustum culling, a culled spot must light no sampled point inside the frustum.
+	LightSystem system;
+	for (u32 i = 0; i < 4000; ++i)
+	{
+		const f32 kOuter = random.range(0.1f, 1.3f);
+		system.add_spot(v3(random.range(-30.f, 30.f), random.range(-30.f, 30.f), random.range(-30.f, 30.f)), random.direction(), v3(1.f, 1.f, 1.f)
+			, v4(1.f, 0.f, 0.f, random.range(1.f, 7.f)), kOuter * 0.5f, kOuter);
+	}
+	v4 planes[6];
+	LightSystem::frustum_planes(kView * kProjection, planes);
+	std::vector<GPULight> packed;
+	system.cull_and_pack(planes, 6, packed, &test_jobs());
+
+	u32 frustumMisses = 0;
+	std::vector<u8> visible(system.count(), 0);
+	for (u32 light : system.visible())
+	{
+		visible[light] = 1;
+	}
+	for (u32 i = 0; i < system.count(); ++i)
+	{
+		if (visible[i])
+			continue;
+
+		const LightBounds kSpot = { system.position(i), system.radius(i), system.direction(i), system.cone_radius(i) };
+		for (u32 p = 0; p < 3000; ++p)
+		{
+			const v3 vPoint = point_lit_by_spot(kSpot, random);
+			bool bInside = true;
+			for (const v4& rPlane : planes)
+			{
+				bInside = bInside && rPlane.x * vPoint.x + rPlane.y * vPoint.y + rPlane.z * vPoint.z + rPlane.w >= 0.f;
+			}
+			if (bInside)
+			{
+				++frustumMisses;
+				break;
+			}
+		}
+	}
+
+	// Inside / outside : a spot lighting the eye or the near plane has to take the back face path.
+	// The split tests the bounding sphere, so it must never call such a spot outside.
+	const f32 kNear = 0.2f;
+	const f32 kNearCornerDistance = near_plane_corner_distance(kProjection, kNear);
+	constexpr u32 kNearSamples = 16;
+	u32 insideCases = 0, insideMisses = 0;
+	for (u32 i = 0; i < 20000; ++i)
+	{
+		LightBounds spot = random_spot(random, v3(-3.f, -3.f, -3.f), v3(3.f, 3.f, 3.f));
+
+		bool bReachesNear = point_lit_by_spot(spot, v3(0.f, 0.f, 0.f));
+		for (u32 s = 0; s < kNearSamples * kNearSamples && !bReachesNear; ++s)
+		{
+			const f32 kX = ((s % kNearSamples) + 0.5f) / kNearSamples * 2.f - 1.f;
+			const f32 kY = ((s / kNearSamples) + 0.5f) / kNearSamples * 2.f - 1.f;
+			const v4 kNearPoint = v4::Transform(v4(kX, kY, 0.f, 1.f), kInverseProjection);
+			bReachesNear = point_lit_by_spot(spot, v3(kNearPoint.x / kNearPoint.w, kNearPoint.y / kNearPoint.w, kNearPoint.z / kNearPoint.w));
+		}
+		if (!bReachesNear)
+			continue;
+
+		++insideCases;
+		if (!camera_inside_light_volume(spot.m_vCentre, spot.m_radius, v3(0.f, 0.f, 0.f), kNearCornerDistance))
+			++insideMisses;
+	}
+
+	testF("cone vs plane: %u cases, %u wrong", kPlaneCases, planeErrors);
+	testF("tiles: %u lit pixels, %u missed, %.0f%% of sphere entries", litPixels, tileMisses, kTileEntryRatio * 100.f);
+	testF("clusters: %u lit points, %u missed", clusterPoints, clusterMisses);
+	testF("frustum: %u visible spots culled", frustumMisses);
+	testF("inside / outside: %u near plane hits, %u called outside", insideCases, insideMisses);
+	return !planeErrors && !tileMisses && !clusterMisses && !frustumMisses && !insideMisses;
+}
+
+static f32 smooth_step(const f32 kEdge0, const f32 kEdge1, const f32 x)
+{
+	const f32 t = std::min(std::max((x - kEdge0) / (kEdge1 - kEdge0), 0.f), 1.f);
+	return t * t * (3.f - 2.f * t);
+}
+
+// Diffuse light reaching a point, light_contribution in DeferredShaders.fx without shadows or material.
+static v3 diffuse_light(const std::vector<GPULight>& rLights, const v3& vPoint, const v3& vNormal)
+{
+	v3 vTotal(0.f, 0.f, 0.f);
+	for (const GPULight& rLight : rLights)
+	{
+		if (rLight.m_vPosition.w == 0.f)
+		{
+			vTotal += v3(rLight.m_vColour) * std::max(vNormal.Dot(v3(rLight.m_vDirection)), 0.f);
+			continue;
+		}
+
+		const v3 vToLight = v3(rLight.m_vPosition) - vPoint;
+		const f32 kDistance = vToLight.Length();
+		if (kDistance >= rLight.m_vAtt.w || kDistance <= 0.f)
+			continue;
+
+		f32 attenuation = 1.f / (rLight.m_vAtt.x + rLight.m_vAtt.y * kDistance + rLight.m_vAtt.z * kDistance * kDistance);
+		attenuation *= 1.f - smooth_step(rLight.m_vAtt.w - 0.25f, rLight.m_vAtt.w, kDistance);
+		if (rLight.m_vPosition.w == kGPULightSpot)
+		{
+			attenuation *= smooth_step(rLight.m_vDirection.w, rLight.m_vColour.w, -(vToLight * (1.f / kDistance)).Dot(v3(rLight.m_vDirection)));
+		}
+		vTotal += v3(rLight.m_vColour) * (std::max(vNormal.Dot(vToLight * (1.f / kDistance)), 0.f) * attenuation);
+	}
+	return vTotal;
+}
+
+// The demo's grid of animated points and ring of spots shaded on the floor at a few budgets, each against
+// shading every light and against keeping the first K. Then score() orderings, shadowed lights over budget
+// and update() chasing its target.
+FRAMEWORK_TEST(light_budget)
+{
+	u32 scoreErrors = 0;
+
+	// Score orderings, a unit sphere ten units in front of the eye against a change to one thing.
+	const v3 vEye(0.f, 0.f, 0.f);
+	constexpr f32 kPixelsPerUnit = 500.f;
+	constexpr f32 kScreenArea = 1000.f * 1000.f;
+	const GPULight kBase = { v4(0.f, 0.f, 10.f, kGPULightPoint), v4(0.f, 0.f, 0.f, 0.f), v4(1.f, 1.f, 1.f, 0.f), v4(0.001f, 0.1f, 5.f, 2.f), kNoShadow, {} };
+	const f32 kBaseScore = LightBudget::score(kBase, vEye, kPixelsPerUnit, kScreenArea);
+
+	GPULight distant = kBase, dim = kBase, wide = kBase, around = kBase, directional = kBase;
+	distant.m_vPosition.z = 20.f;
+	dim.m_vColour = v4(0.5f, 0.5f, 0.5f, 0.f);
+	wide.m_vAtt.w = 4.f;
+	around.m_vPosition.z = 0.5f;
+	directional.m_vPosition.w = 0.f;
+	scoreErrors += LightBudget::score(distant, vEye, kPixelsPerUnit, kScreenArea) < kBaseScore ? 0 : 1;
+	scoreErrors += LightBudget::score(dim, vEye, kPixelsPerUnit, kScreenArea) < kBaseScore ? 0 : 1;
+	scoreErrors += LightBudget::score(wide, vEye, kPixelsPerUnit, kScreenArea) > kBaseScore ? 0 : 1;
+	scoreErrors += LightBudget::score(around, vEye, kPixelsPerUnit, kScreenArea) > kBaseScore ? 0 : 1;
+	scoreErrors += LightBudget::score(directional, vEye, kPixelsPerUnit, kScreenArea) == FLT_MAX ? 0 : 1;
+
+	// The demo scene part way through its animation.
+	constexpr u32 kGridSize = 24;
+	const v3 colours[] = { v3(1.f, 1.f, 1.f), v3(1.f, 1.f, 0.f), v3(0.f, 1.f, 1.f), v3(1.f, 0.f, 1.f) };
+	LightSystem system;
+	system.add_directional(v3(0.5773f, 0.5773f, 0.5773f), v3(1.f, 0.7f, .6f) * 0.2f);
+	for (u32 i = 0; i < kGridSize; ++i)
+	{
+		for (u32 j = 0; j < kGridSize; ++j)
+		{
+			const u32 kLight = system.add_point(v3(i - 5.f, 0.5f, j - 5.f), colours[j % 4] * 0.9f, v4(0.001f, 0.1f, 5.0f, 2.0f));
+			system.set_animation(kLight, v3(i - 5.f, 1.f, j - 5.f), v3(f32(i), f32(i * j), f32(j)), 1.f);
+		}
+	}
+	const v3 vTarget(kGridSize * 0.5f - 5.f, 0.f, kGridSize * 0.5f - 5.f);
+	for (u32 i = 0; i < 8; ++i)
+	{
+		const f32 kAngle = 2.f * kfPI * i / 8;
+		const v3 vPosition = vTarget + v3(cosf(kAngle) * 6.f, 4.f, sinf(kAngle) * 6.f);
+		system.add_spot(vPosition, vTarget - vPosition, colours[i % 4], v4(0.001f, 0.05f, 0.02f, 10.f), 0.25f, 0.35f);
+	}
+	system.animate(1.7f, nullptr);
+
+	std::vector<GPULight> all;
+	const u32 kLights = system.cull_and_pack(nullptr, 0, all, nullptr);
+	u32 allStart[kMaxLightTypes + 1];
+	for (u32 t = 0; t < kMaxLightTypes; ++t)
+	{
+		allStart[t] = system.visible_first(static_cast<ELightType>(t));
+	}
+	allStart[kMaxLightTypes] = kLights;
+
+	// Floor points shaded by every light are the reference.
+	constexpr u32 kPoints = 4000;
+	std::vector<v3> points(kPoints);
+	std::vector<v3> reference(kPoints);
+	const v3 vUp(0.f, 1.f, 0.f);
+	const v3 vOnes(1.f, 1.f, 1.f);
+	u32 seed = 5;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+	f64 referenceSum = 0.0;
+	for (u32 i = 0; i < kPoints; ++i)
+	{
+		points[i] = v3(random() * 26.f - 6.f, random() * 0.1f, random() * 26.f - 6.f);
+		reference[i] = diffuse_light(all, points[i], vUp);
+		referenceSum += reference[i].Dot(vOnes);
+	}
+
+	const u32 kBudgets[] = { 64, 256, 400 };
+	const v3 vViewer(2.f, 1.7f, 2.f);
+	bool bGrouped = true, bMergeBetter = true;
+	for (const u32 kBudget : kBudgets)
+	{
+		LightBudgetDesc desc;
+		desc.m_minLights = desc.m_maxLights = kBudget;
+		LightBudget budget;
+		budget.set_desc(desc);
+
+		std::vector<GPULight> lights = all;
+		u32 typeStart[kMaxLightTypes + 1];
+		memcpy(typeStart, allStart, sizeof(typeStart));
+		budget.apply(vViewer, 800.f, kScreenArea, lights, typeStart);
+
+		for (u32 t = 0; t < kMaxLightTypes; ++t)
+		{
+			for (u32 i = typeStart[t]; i < typeStart[t + 1]; ++i)
+			{
+				bGrouped = bGrouped && gpu_light_type(lights[i]) == static_cast<ELightType>(t);
+			}
+		}
+		bGrouped = bGrouped && typeStart[0] == 0 && typeStart[kMaxLightTypes] == lights.size();
+
+		const std::vector<GPULight> truncated(all.begin(), all.begin() + std::min(allStart[kLightType_Point] + kBudget, kLights));
+		f64 mergeError = 0.0, truncateError = 0.0;
+		for (u32 i = 0; i < kPoints; ++i)
+		{
+			mergeError += fabsf((diffuse_light(lights, points[i], vUp) - reference[i]).Dot(vOnes));
+			truncateError += fabsf((diffuse_light(truncated, points[i], vUp) - reference[i]).Dot(vOnes));
+		}
+
+		// Merging the rest has to beat dropping them, as the old slider did.
+		const bool kBetter = mergeError < truncateError;
+		testF("K %3u: %3u virtual, error %.3f, truncating %.3f%s", kBudget, budget.stats().m_virtual, mergeError / referenceSum
+			, truncateError / referenceSum, kBetter ? "" : ", WORSE");
+		bMergeBetter = bMergeBetter && kBetter;
+	}
+
+	// Shadowed lights all survive a budget smaller than their count, each keeping its shadow view.
+	constexpr u32 kShadowed = 32;
+	u32 shadowedDropped = 0;
+	{
+		LightBudgetDesc desc;
+		desc.m_minLights = desc.m_maxLights = kShadowed / 2;
+		LightBudget budget;
+		budget.set_desc(desc);
+
+		std::vector<GPULight> lights = all;
+		u32 typeStart[kMaxLightTypes + 1];
+		memcpy(typeStart, allStart, sizeof(typeStart));
+		const u32 kStride = (typeStart[kMaxLightTypes] - typeStart[kLightType_Point]) / kShadowed;
+		for (u32 i = 0; i < kShadowed; ++i)
+		{
+			lights[typeStart[kLightType_Point] + i * kStride].m_shadow = i;
+		}
+		budget.apply(vViewer, 800.f, kScreenArea, lights, typeStart);
+
+		bool survived[kShadowed] = {};
+		for (const GPULight& rLight : lights)
+		{
+			if (rLight.m_shadow < kShadowed)
+				survived[rLight.m_shadow] = true;
+		}
+		for (u32 i = 0; i < kShadowed; ++i)
+		{
+			shadowedDropped += survived[i] ? 0 : 1;
+		}
+	}
+
+	// Over the target cuts the budget, well under grows it, and neither leaves the limits.
+	LightBudgetDesc desc;
+	desc.m_targetMs = 8.f;
+	desc.m_minLights = 16;
+	desc.m_maxLights = 1024;
+	LightBudget budget;
+	budget.set_desc(desc);
+	const u32 kStart = budget.budget();
+	budget.update(12.f);
+	const bool kBacksOff = budget.budget() < kStart;
+	for (u32 i = 0; i < 100; ++i)
+	{
+		budget.update(12.f);
+	}
+	const bool kHoldsMin = budget.budget() == desc.m_minLights;
+	budget.update(5.f);
+	const bool kGrows = budget.budget() > desc.m_minLights;
+	for (u32 i = 0; i < 1000; ++i)
+	{
+		budget.update(5.f);
+	}
+	const bool kAdapts = kBacksOff && kHoldsMin && kGrows && budget.budget() == desc.m_maxLights;
+
+	testF("%u lights on %u floor points, %u score errors%s%s", kLights, kPoints, scoreErrors, bGrouped ? "" : ", NOT GROUPED", kAdapts ? "" : ", NOT ADAPTING");
+	testF("%u shadowed lights over budget, %u dropped", kShadowed, shadowedDropped);
+	return !scoreErrors && bGrouped && bMergeBetter && !shadowedDropped && kAdapts;
+}
+
+// Random spheres around random cameras with centred and off centre projections, checked against the
+// exact distance to the near plane rectangle and against depths of points sampled in the spheres.
+FRAMEWORK_TEST(light_volumes)
+{
+	u32 seed = 11;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+	auto range = [&random](const f32 kMin, const f32 kMax) { return kMin + (kMax - kMin) * random(); };
+
+	constexpr u32 kCameras = 200;
+	constexpr u32 kSpheresPerCamera = 100;
+	constexpr u32 kDepthPoints = 32;
+	constexpr f32 kNear = 0.2f;
+	constexpr f32 kFar = 100.f;
+	std::vector<GPULight> lights(kSpheresPerCamera);
+	std::vector<u8> reaching(kSpheresPerCamera);
+	u32 spheres = 0, reachingCount = 0, insideMisses = 0, extraInside = 0, partitionErrors = 0, depthSamples = 0, depthMisses = 0;
+
+	for (u32 camera = 0; camera < kCameras; ++camera)
+	{
+		// Every other camera off centre, like an HMD eye.
+		const f32 kHalfWidth = kNear * range(0.5f, 1.5f);
+		const f32 kHalfHeight = kNear * range(0.5f, 1.5f);
+		const f32 kShift = camera & 1 ? range(-0.5f, 0.5f) * kHalfWidth : 0.f;
+		const m4x4 kProjection = m4x4::CreatePerspectiveOffCenter(-kHalfWidth + kShift, kHalfWidth + kShift, -kHalfHeight, kHalfHeight, kNear, kFar);
+
+		const v3 vEye(range(-10.f, 10.f), range(0.f, 5.f), range(-10.f, 10.f));
+		v3 vForward(range(-1.f, 1.f), range(-0.5f, 0.5f), range(-1.f, 1.f));
+		vForward.Normalize();
+		const m4x4 kView = m4x4::CreateLookAt(vEye, vEye + vForward, v3(0.f, 1.f, 0.f));
+		const f32 kNearCornerDistance = near_plane_corner_distance(kProjection, kNear);
+
+		for (u32 i = 0; i < kSpheresPerCamera; ++i)
+		{
+			const v3 vCentre = vEye + v3(range(-3.f, 3.f), range(-3.f, 3.f), range(-3.f, 3.f));
+			const f32 kRadius = range(0.05f, 2.f);
+
+			// Closest point of the near plane rectangle, view space looks down +z as SimpleMath is left handed here.
+			const v3 vView = v3::Transform(vCentre, kView);
+			const v3 vClosest(std::min(std::max(vView.x, kShift - kHalfWidth), kShift + kHalfWidth), std::min(std::max(vView.y, -kHalfHeight), kHalfHeight), kNear);
+			const bool kReaches = vView.Length() < kRadius || (vView - vClosest).Length() < kRadius;
+			const bool kInside = camera_inside_light_volume(vCentre, kRadius, vEye, kNearCornerDistance);
+
+			++spheres;
+			reachingCount += kReaches ? 1 : 0;
+			insideMisses += kReaches && !kInside ? 1 : 0;
+			extraInside += !kReaches && kInside ? 1 : 0;
+
+			// Depths of points through the sphere that are in front of the near plane.
+			f32 minDepth, maxDepth;
+			light_depth_bounds(vCentre, kRadius, kView, kProjection, minDepth, maxDepth);
+			for (u32 p = 0; p < kDepthPoints; ++p)
+			{
+				v3 vOffset(range(-1.f, 1.f), range(-1.f, 1.f), range(-1.f, 1.f));
+				vOffset.Normalize();
+				const v4 kClip = v4::Transform(v4(vCentre + vOffset * (kRadius * sqrtf(random())), 1.f), kView * kProjection);
+				if (kClip.w < kNear)
+					continue;
+
+				const f32 kDepth = kClip.z / kClip.w;
+				++depthSamples;
+				depthMisses += kDepth < minDepth - 1e-5f || kDepth > maxDepth + 1e-5f ? 1 : 0;
+			}
+
+			// Tag each light with its place in the colour, unused here, so the partition's order can be checked.
+			GPULight& rLight = lights[i];
+			rLight.m_vPosition = v4(vCentre, kGPULightPoint);
+			rLight.m_vAtt = v4(1.f, 0.f, 0.f, kRadius);
+			rLight.m_vColour = v4(f32(i), 0.f, 0.f, 0.f);
+			reaching[i] = kInside ? 1 : 0;
+		}
+
+		const u32 kInsideCount = partition_camera_inside(lights.data(), kSpheresPerCamera, vEye, kNearCornerDistance);
+		u32 previous[2] = { 0, 0 };
+		bool bSeen[2] = { false, false };
+		for (u32 i = 0; i < kSpheresPerCamera; ++i)
+		{
+			const u32 kOriginal = static_cast<u32>(lights[i].m_vColour.x);
+			const u32 kSide = i < kInsideCount ? 1 : 0;
+			const bool kOutOfOrder = bSeen[kSide] && kOriginal <= previous[kSide];
+			partitionErrors += reaching[kOriginal] != kSide || kOutOfOrder ? 1 : 0;
+			previous[kSide] = kOriginal;
+			bSeen[kSide] = true;
+		}
+	}
+
+	testF("%u spheres, %u reach the near plane, %u called outside, %u extra inside", spheres, reachingCount, insideMisses, extraInside);
+	testF("partition %u errors, depth bounds %u / %u samples outside", partitionErrors, depthMisses, depthSamples);
+	return !insideMisses && !partitionErrors && !depthMisses;
+}
+
+constexpr u32 kLightHashCounts[] = { 1000, 10000, 100000, 1000000 };
+constexpr u32 kLightHashQueries = 1024;
+
+// Animated lights spread at the demo's density, the hash's update and batched box queries timed against a
+// linear scan over the jobs. Fails only when the two find different lights.
+FRAMEWORK_TEST(light_hash)
+{
+	bool bPassed = true;
+	for (const u32 kLightCount : kLightHashCounts)
+	{
+		// Laid out like the demo's grid, one light per square unit bobbing a unit around a point with two units of reach.
+		const u32 kSide = static_cast<u32>(ceilf(sqrtf(f32(kLightCount))));
+		LightSystem lights;
+		for (u32 i = 0; i < kLightCount; ++i)
+		{
+			const f32 kX = f32(i % kSide);
+			const f32 kZ = f32(i / kSide);
+			const u32 kLight = lights.add_point(v3(kX, 0.5f, kZ), v3(1.f), v4(0.001f, 0.1f, 5.0f, 2.0f));
+			lights.set_animation(kLight, v3(kX, 1.f, kZ), v3(f32(1 + i % 7), f32(1 + i % 5), f32(1 + i % 3)) * 0.5f, 1.f);
+		}
+
+		// Settle for a frame first, at time zero every light sits exactly on a cell boundary.
+		LightSpatialHash hash;
+		hash.init(LightSpatialHashDesc());
+		lights.animate(1.f / 90.f, &test_jobs());
+		hash.update(lights, &test_jobs());
+
+		// One frame later at 90 Hz.
+		lights.animate(2.f / 90.f, &test_jobs());
+
+		const s64 kUpdateStart = getTimeMicroseconds();
+		hash.update(lights, &test_jobs());
+		const f64 kUpdateMs = (getTimeMicroseconds() - kUpdateStart) / 1000.0;
+
+		// Boxes the size of a small transparent object scattered over the lights.
+		std::vector<v3> mins(kLightHashQueries), maxs(kLightHashQueries);
+		u32 seed = 12345u;
+		auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+		for (u32 i = 0; i < kLightHashQueries; ++i)
+		{
+			mins[i] = v3(random() * kSide, random() * 2.f, random() * kSide);
+			maxs[i] = mins[i] + v3(0.5f);
+		}
+
+		std::vector<u32> offsets, found;
+		const s64 kHashStart = getTimeMicroseconds();
+		hash.query_boxes(mins.data(), maxs.data(), kLightHashQueries, offsets, found, &test_jobs());
+		const f64 kHashQueryMs = (getTimeMicroseconds() - kHashStart) / 1000.0;
+
+		std::vector<std::vector<u32>> linear(kLightHashQueries);
+		const s64 kLinearStart = getTimeMicroseconds();
+		test_jobs().parallelFor(kLightHashQueries, 4, [&](u32 begin, u32 end)
+		{
+			for (u32 i = begin; i < end; ++i)
+				LightSpatialHash::query_box_reference(lights, mins[i], maxs[i], linear[i]);
+		});
+		const f64 kLinearQueryMs = (getTimeMicroseconds() - kLinearStart) / 1000.0;
+
+		bool bMatch = true;
+		for (u32 i = 0; i < kLightHashQueries && bMatch; ++i)
+		{
+			std::vector<u32> hashed(found.begin() + offsets[i], found.begin() + offsets[i + 1]);
+			std::sort(hashed.begin(), hashed.end());
+			bMatch = hashed == linear[i];
+		}
+
+		testF("%7u lights: update %.3f ms, %u queries %.3f ms, linear scan %.3f ms, %u hits%s", kLightCount, kUpdateMs, kLightHashQueries, kHashQueryMs
+			, kLinearQueryMs, static_cast<u32>(found.size()), bMatch ? "" : ", MISMATCH");
+		bPassed = bPassed && bMatch;
+	}
+	return bPassed;
+}
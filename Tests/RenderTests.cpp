@@ -0,0 +1,411 @@
+#include "Tests.h"
+
+#include "CommandBuffer.h"
+#include "CommandLists.h"
+#include "DeferredScene.h"
+#include "RingAllocator.h"
+#include "StateCache.h"
+
+#include <algorithm>
+#include <vector>
+
+//================================================================================
+// Render Tests
+// Command buffers and the rest of the scene's path to a render device.
+//================================================================================
+
+constexpr u32 kCommandBenchmarkPackets = 1000000;
+constexpr u32 kParallelBenchmarkDraws = 50000;
+constexpr u32 kParallelRecordingRuns = 4;
+constexpr u32 kParallelRecordingThreads[kParallelRecordingRuns] = { 1, 2, 4, 8 };
+constexpr u32 kRingAllocatorCheckFrames = 100000;
+constexpr u32 kInstanceBatchingBenchmarkDraws = 10000;
+
+// Random value in [kMin, kMax), deterministic so runs are comparable.
+static f32 random_range(u32& rState, const f32 kMin, const f32 kMax)
+{
+	rState = rState * 1664525u + 1013904223u;
+	return kMin + (kMax - kMin) * ((rState >> 8) * (1.f / 16777216.f));
+}
+
+// Random size in [kMin, kMax), from the same sequence.
+static u32 random_size(u32& rState, const u32 kMin, const u32 kMax)
+{
+	rState = rState * 1664525u + 1013904223u;
+	return kMin + u32((u64(rState >> 8) * (kMax - kMin)) >> 24);
+}
+
+// Record a million draws of random shaders, materials, meshes and depths across the jobs, then sort and
+// submit them to a null device. Fails when the radix sort disagrees with std::stable_sort or sorting saves
+// no state changes.
+FRAMEWORK_TEST(command_buffers)
+{
+	const u32 kPackets = kCommandBenchmarkPackets;
+	constexpr u32 kShaders = 8;
+	constexpr u32 kMaterials = 256;
+	constexpr u32 kMeshes = 64;
+	constexpr u32 kRecordGrain = 4096;
+
+	// Null handles, a null device never looks at them.
+	std::vector<ShaderBinding> shaders(kShaders);
+	std::vector<MeshBinding> meshes(kMeshes);
+	std::vector<TextureBinding> textures(kMaterials);
+
+	// The same draw for a given index whoever records it.
+	auto make_draw = [&](const u32 kIndex, DrawCommand& rCommandOut, m4x4& rConstantsOut) -> u64
+	{
+		u32 seed = kIndex * 2654435761u + 1u;
+		const u32 kShader = u32(random_range(seed, 0.f, f32(kShaders)));
+		const u32 kMaterial = u32(random_range(seed, 0.f, f32(kMaterials)));
+		const u32 kMesh = u32(random_range(seed, 0.f, f32(kMeshes)));
+		const f32 kDepth = random_range(seed, 0.f, 1.f);
+
+		rCommandOut = {};
+		rCommandOut.m_pShader = &shaders[kShader];
+		rCommandOut.m_pMesh = &meshes[kMesh];
+		rCommandOut.m_pTexture = &textures[kMaterial];
+		rCommandOut.m_instances = 1;
+		rConstantsOut = m4x4::CreateTranslation(f32(kIndex), kDepth, 0.f);
+		return make_sort_key(0, kShader, kMaterial, kMesh, sort_key_depth(kDepth, false));
+	};
+
+	// Issued on the spot, everything bound for every draw.
+	u32 immediateStateChanges;
+	{
+		NullRenderDevice device;
+		for (u32 i = 0; i < kPackets; ++i)
+		{
+			DrawCommand command;
+			m4x4 constants;
+			make_draw(i, command, constants);
+			command.m_pShader->bind(device);
+			command.m_pMesh->bind(device);
+			command.m_pTexture->bind(device, ShaderStage::kPixel, 0);
+			push_constant_buffer(device, command.m_pConstantBuffer, constants);
+			command.m_pMesh->draw(device);
+		}
+		immediateStateChanges = device.stats().m_stateChanges;
+	}
+
+	CommandQueue queue;
+	const s64 kRecordStart = getTimeMicroseconds();
+	queue.record(kPackets, kRecordGrain, [&](CommandBuffer& rBuffer, u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			DrawCommand command;
+			m4x4 constants;
+			const u64 kKey = make_draw(i, command, constants);
+			rBuffer.draw(kKey, command, constants);
+		}
+	}, &test_jobs());
+	const f64 kRecordMs = (getTimeMicroseconds() - kRecordStart) / 1000.0;
+
+	const s64 kSortStart = getTimeMicroseconds();
+	queue.sort();
+	const f64 kSortMs = (getTimeMicroseconds() - kSortStart) / 1000.0;
+
+	NullRenderDevice device;
+	const s64 kSubmitStart = getTimeMicroseconds();
+	queue.submit(device);
+	const f64 kSubmitMs = (getTimeMicroseconds() - kSubmitStart) / 1000.0;
+	const u32 kSortedStateChanges = device.stats().m_stateChanges;
+
+	const f64 kTotalMs = kRecordMs + kSortMs + kSubmitMs;
+
+	// Reference order, the gathered packets sorted by the standard library.
+	std::vector<DrawPacket> reference;
+	reference.reserve(kPackets);
+	for (u32 b = 0; b < queue.buffers(); ++b)
+	{
+		for (u32 c = 0; c < queue.buffer(b).size(); ++c)
+		{
+			DrawCommand command;
+			m4x4 constants;
+			reference.push_back({ make_draw(b * kRecordGrain + c, command, constants), b, c });
+		}
+	}
+	const s64 kStdSortStart = getTimeMicroseconds();
+	std::stable_sort(reference.begin(), reference.end(), [](const DrawPacket& a, const DrawPacket& b) { return a.m_key < b.m_key; });
+	const f64 kStdSortMs = (getTimeMicroseconds() - kStdSortStart) / 1000.0;
+
+	const std::vector<DrawPacket>& rSorted = queue.packets();
+	bool bSorted = rSorted.size() == reference.size();
+	for (u32 i = 0; bSorted && i < rSorted.size(); ++i)
+		bSorted = rSorted[i].m_key == reference[i].m_key && rSorted[i].m_buffer == reference[i].m_buffer && rSorted[i].m_command == reference[i].m_command;
+
+	testF("%u packets in %u buffers: record %.3f, sort %.3f (std %.3f), submit %.3f ms%s", kPackets, queue.buffers(), kRecordMs, kSortMs, kStdSortMs
+		, kSubmitMs, bSorted ? "" : ", MISMATCH");
+	testF("%.2f M packets a second, state changes %u sorted against %u issued on the spot", kTotalMs > 0.0 ? kPackets / 1000.0 / kTotalMs : 0.0
+		, kSortedStateChanges, immediateStateChanges);
+	return bSorted && kSortedStateChanges < immediateStateChanges;
+}
+
+// The Deferred scene's geometry pass and per light volume loop from the app's starting camera, recorded once
+// straight and once through a state cache. Both must issue the same draws with the same state bound, every
+// draw and upload going through and every state change either passed on or filtered.
+FRAMEWORK_TEST(state_cache)
+{
+	DeferredSceneResources resources;
+	stand_in_resources(resources);
+	DeferredScene scene;
+	scene.init_scene();
+	scene.set_resources(resources);
+
+	const m4x4 kViewProjection = m4x4::CreateLookAt(v3(5.f, 1.f, 5.f), v3(3.f, 0.5f, 0.f), v3(0.f, 1.f, 0.f))
+		* m4x4::CreatePerspectiveFieldOfView(degToRad(30.f), 1.f, 0.1f, 100.f);
+	const u32 kLights = scene.pack_lights(kViewProjection);
+
+	RecordingRenderDevice direct;
+	scene.render_geometry_pass(direct, kViewProjection, false);
+	const u32 kGeometryDirect = direct.stats().m_stateChanges;
+	scene.submit_light_volumes(direct, kViewProjection, 0, kLights, false);
+
+	RecordingRenderDevice cached;
+	StateCacheDevice cache(&cached);
+	scene.render_geometry_pass(cache, kViewProjection, false);
+	const u32 kGeometryCached = cached.stats().m_stateChanges;
+	scene.submit_light_volumes(cache, kViewProjection, 0, kLights, false);
+
+	const bool kSameDraws = direct.same_draws(cached);
+	testF("%u draws, %s", direct.stats().m_draws, kSameDraws ? "same state at every draw" : "MISMATCH");
+	if (kLights)
+	{
+		testF("%u lights: %.2f state changes a light, %.2f through the cache", kLights, f32(direct.stats().m_stateChanges - kGeometryDirect) / kLights
+			, f32(cached.stats().m_stateChanges - kGeometryCached) / kLights);
+	}
+
+	static const char* kCallNames[RecordingRenderDevice::kMaxCalls] = { "input layout", "topology", "vertex buffer", "index buffer", "shader"
+		, "constant buffer", "shader resource", "sampler", "blend", "depth stencil", "rasterizer", "update", "draw", "dispatch" };
+	for (u32 c = 0; c < RecordingRenderDevice::kMaxCalls; ++c)
+	{
+		const RecordingRenderDevice::ECall kCall = static_cast<RecordingRenderDevice::ECall>(c);
+		if (direct.calls(kCall))
+			testF("%-16s %6u -> %6u", kCallNames[c], direct.calls(kCall), cached.calls(kCall));
+	}
+
+	const bool kAllDraws = cached.calls(RecordingRenderDevice::kCall_Draw) == direct.calls(RecordingRenderDevice::kCall_Draw);
+	const bool kAllUpdates = cached.calls(RecordingRenderDevice::kCall_UpdateBuffer) == direct.calls(RecordingRenderDevice::kCall_UpdateBuffer);
+	const bool kAccounted = cached.stats().m_stateChanges + cache.filtered() == direct.stats().m_stateChanges;
+	return kSameDraws && kLights && kAllDraws && kAllUpdates && kAccounted;
+}
+
+// Record fifty thousand draws of a few shaders, meshes and textures into null command lists split over 1 to 8
+// threads, then check the merged order of the widest split against a single chunk on the recording backend.
+// Fails when a split loses draws or executes them differently.
+FRAMEWORK_TEST(parallel_recording)
+{
+	const u32 kDraws = kParallelBenchmarkDraws;
+	constexpr u32 kShaders = 4;
+	constexpr u32 kMeshes = 16;
+	constexpr u32 kTextures = 64;
+
+	// Null handles, a null device never looks at them.
+	std::vector<ShaderBinding> shaders(kShaders);
+	std::vector<MeshBinding> meshes(kMeshes);
+	std::vector<TextureBinding> textures(kTextures);
+	const m4x4 kViewProjection = m4x4::CreatePerspectiveFieldOfView(kfPI * 0.5f, 1.f, 0.1f, 1000.f);
+
+	// Draws in state order as a sorted queue would give them, runs of 8 sharing a texture, 64 a mesh.
+	const ParallelRecorder::RecordJob job = [&](RenderDevice& rDevice, u32 begin, u32 end)
+	{
+		for (u32 i = begin; i < end; ++i)
+		{
+			const MeshBinding& rMesh = meshes[(i / 64) % kMeshes];
+			shaders[(i / 4096) % kShaders].bind(rDevice);
+			rMesh.bind(rDevice);
+			textures[(i / 8) % kTextures].bind(rDevice, ShaderStage::kPixel, 0);
+
+			const m4x4 kModel = m4x4::CreateTranslation(f32(i % 256), f32(i / 256), -10.f);
+			push_constant_buffer(rDevice, nullptr, (kModel * kViewProjection).Transpose());
+			rMesh.draw(rDevice);
+		}
+	};
+
+	// A chunk rebinds what it needs, so the state changes reaching the lists grow with the split.
+	bool bAllDraws = true;
+	ParallelRecorder recorder;
+	NullCommandLists lists;
+	for (u32 r = 0; r < kParallelRecordingRuns; ++r)
+	{
+		const u32 kThreads = kParallelRecordingThreads[r];
+		lists.reset();
+		recorder.record(lists, kDraws, kThreads, job, kThreads > 1 ? &test_jobs() : nullptr, kThreads);
+		bAllDraws = bAllDraws && lists.executed().m_draws == kDraws;
+
+		testF("%u threads: record %.3f ms, execute %.3f ms, %u state changes", kThreads, recorder.stats().m_recordMs
+			, recorder.stats().m_executeMs, lists.executed().m_stateChanges);
+	}
+
+	// The widest split must execute what one thread records.
+	const u32 kWidest = kParallelRecordingThreads[kParallelRecordingRuns - 1];
+	RecordingCommandLists single, split;
+	recorder.record(single, kDraws, 1, job, nullptr);
+	recorder.record(split, kDraws, kWidest, job, &test_jobs(), kWidest);
+	const bool kSameDraws = single.executed().same_draws(split.executed());
+	testF("%u draws%s", kDraws, kSameDraws ? "" : ", MISMATCH");
+
+	return bAllDraws && kSameDraws;
+}
+
+// A hundred thousand frames of random allocation sizes against a ring with the GPU a random number of frames
+// behind, every allocation checked against the blocks still live. Fails on an allocation misaligned, out of
+// range, overlapping a live frame or refused with room to spare.
+FRAMEWORK_TEST(ring_allocator)
+{
+	const u32 kFrames = kRingAllocatorCheckFrames;
+	constexpr u32 kCapacity = 64 * 1024;
+	constexpr u32 kAlignment = 256;
+	constexpr u32 kMaxLag = 4;
+
+	struct Block
+	{
+		u64 m_frame;
+		u32 m_offset;
+		u32 m_bytes;
+	};
+
+	RingAllocator ring;
+	ring.init(kCapacity, kAlignment);
+	std::vector<Block> live;
+	u32 allocations = 0;
+	u32 failures = 0;		// refused for lack of room, legitimately.
+	u32 errors = 0;
+	u32 seed = 1;
+
+	auto allocate = [&](const u64 kFrame, const u32 kBytes)
+	{
+		const u32 kOffset = ring.allocate(kBytes);
+		if (kOffset == kRingAllocatorFull)
+		{
+			++failures;
+			if (!ring.used() && kBytes <= kCapacity)
+				++errors;
+			return;
+		}
+
+		++allocations;
+		const u32 kSize = (kBytes + kAlignment - 1) & ~(kAlignment - 1);
+		bool bValid = !(kOffset % kAlignment) && kOffset + kSize <= kCapacity;
+		for (const Block& rBlock : live)
+			bValid = bValid && (kOffset + kSize <= rBlock.m_offset || rBlock.m_offset + rBlock.m_bytes <= kOffset);
+		if (!bValid)
+			++errors;
+		live.push_back({ kFrame, kOffset, kSize });
+	};
+
+	for (u64 frame = 1; frame <= kFrames; ++frame)
+	{
+		// Mostly small constant blocks, now and then one large enough to need a wrap or be refused.
+		const u32 kAllocations = random_size(seed, 0, 24);
+		for (u32 i = 0; i < kAllocations; ++i)
+			allocate(frame, random_size(seed, 0, 16) ? random_size(seed, 1, 1024) : random_size(seed, 1024, kCapacity / 2));
+		ring.end_frame(frame);
+
+		// The GPU finishes frames in order, up to kMaxLag behind.
+		const u32 kLag = random_size(seed, 0, kMaxLag + 1);
+		if (frame > kLag)
+		{
+			const u64 kCompleted = frame - kLag;
+			ring.retire(kCompleted);
+			live.erase(std::remove_if(live.begin(), live.end(), [kCompleted](const Block& rBlock) { return rBlock.m_frame <= kCompleted; }), live.end());
+		}
+	}
+
+	// Everything retired, the whole span comes back as one piece.
+	ring.retire(kFrames);
+	live.clear();
+	if (ring.used() || ring.frames_in_flight())
+		++errors;
+	allocate(kFrames + 1, kCapacity);
+
+	testF("%u frames: %u allocations, %u refused, %u wraps, %u errors", kFrames, allocations, failures, ring.wraps(), errors);
+	return errors == 0;
+}
+
+// Record ten thousand draws scattered over a few shaders, materials and meshes, then submit them sorted to a
+// null device with and without batching. Fails when a draw's constants aren't drawn once, in the order they
+// were without batching, or batching merges nothing.
+FRAMEWORK_TEST(instance_batching)
+{
+	const u32 kDraws = kInstanceBatchingBenchmarkDraws;
+	constexpr u32 kShaders = 2;
+	constexpr u32 kMaterials = 8;
+	constexpr u32 kMeshes = 16;
+
+	// Null handles, a null device never looks at them.
+	std::vector<ShaderBinding> shaders(kShaders * 2);
+	std::vector<MeshBinding> meshes(kMeshes);
+	std::vector<TextureBinding> textures(kMaterials);
+	RenderBuffer* pConstantBuffer = nullptr;
+	RenderBuffer* pBatchConstantBuffer = nullptr;
+	constexpr u32 kBatchConstantSlot = 7;
+
+	CommandQueue queue;
+	queue.begin(1);
+	u32 seed = 1;
+	for (u32 i = 0; i < kDraws; ++i)
+	{
+		const u32 kShader = u32(random_range(seed, 0.f, f32(kShaders)));
+		const u32 kMaterial = u32(random_range(seed, 0.f, f32(kMaterials)));
+		const u32 kMesh = u32(random_range(seed, 0.f, f32(kMeshes)));
+		const f32 kDepth = random_range(seed, 0.f, 1.f);
+
+		DrawCommand command = {};
+		command.m_pShader = &shaders[kShader];
+		command.m_pInstancedShader = &shaders[kShaders + kShader];
+		command.m_pMesh = &meshes[kMesh];
+		command.m_pTexture = &textures[kMaterial];
+		command.m_pConstantBuffer = pConstantBuffer;
+		command.m_instances = 1;
+		const m4x4 kConstants = m4x4::CreateTranslation(f32(i), kDepth, 0.f);
+		queue.buffer(0).draw(make_sort_key(0, kShader, kMaterial, kMesh, sort_key_depth(kDepth, false)), command, kConstants);
+	}
+	queue.sort();
+
+	// Every draw's constants in submission order, to find in the instance data afterwards.
+	std::vector<m4x4> expected;
+	expected.reserve(kDraws);
+	for (const DrawPacket& rPacket : queue.packets())
+	{
+		expected.push_back(*reinterpret_cast<const m4x4*>(queue.buffer(rPacket.m_buffer).constants(queue.command(rPacket))));
+	}
+
+	NullRenderDevice before;
+	queue.submit(before);
+
+	const s64 kBatchStart = getTimeMicroseconds();
+	queue.batch_instances(sizeof(m4x4), kDraws, pBatchConstantBuffer, kBatchConstantSlot);
+	const f64 kBatchMs = (getTimeMicroseconds() - kBatchStart) / 1000.0;
+
+	NullRenderDevice after;
+	queue.submit(after);
+
+	// Walk the batched draws, each instance or plain draw must be the next one drawn before.
+	const m4x4* pInstances = reinterpret_cast<const m4x4*>(queue.instance_data().data());
+	u32 drawn = 0;
+	bool bSame = after.stats().m_instances == before.stats().m_instances;
+	for (const DrawPacket& rPacket : queue.packets())
+	{
+		const DrawCommand& rCommand = queue.command(rPacket);
+		const u8* pConstants = queue.buffer(rPacket.m_buffer).constants(rCommand);
+		if (rCommand.m_instances > 1)
+		{
+			const u32 kFirstInstance = reinterpret_cast<const InstanceBatchConstants*>(pConstants)->m_firstInstance;
+			for (u32 i = 0; bSame && i < rCommand.m_instances; ++i)
+				bSame = drawn < kDraws && !memcmp(&pInstances[kFirstInstance + i], &expected[drawn++], sizeof(m4x4));
+		}
+		else
+		{
+			bSame = bSame && drawn < kDraws && !memcmp(pConstants, &expected[drawn++], sizeof(m4x4));
+		}
+	}
+	bSame = bSame && drawn == kDraws;
+
+	const RenderDeviceStats& rBefore = before.stats();
+	const RenderDeviceStats& rAfter = after.stats();
+	testF("%u draws batched into %u in %.3f ms%s", kDraws, rAfter.m_draws, kBatchMs, bSame ? "" : ", MISMATCH");
+	testF("draws %u / %u, state changes %u / %u, maps %u / %u, before / after", rBefore.m_draws, rAfter.m_draws
+		, rBefore.m_stateChanges, rAfter.m_stateChanges, rBefore.m_maps, rAfter.m_maps);
+	return bSame && rAfter.m_draws < rBefore.m_draws;
+}
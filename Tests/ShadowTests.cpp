@@ -0,0 +1,149 @@
+#include "Tests.h"
+
+#include "ShadowAtlas.h"
+#include "ShadowCascades.h"
+
+#include <vector>
+
+//================================================================================
+// Shadow Tests
+// The shadow atlas, cascades and cache.
+//================================================================================
+
+// Jittered requests over a few hundred frames, cascades fitted to random views, and the cache
+// reacting to unchanged, moved and distant casters.
+FRAMEWORK_TEST(shadows)
+{
+	u32 seed = 5;
+	auto random = [&seed]() { seed = seed * 1664525u + 1013904223u; return f32(seed >> 8) * (1.f / 16777216.f); };
+	auto random_u32 = [&seed]() { seed = seed * 1664525u + 1013904223u; return seed >> 8; };
+
+	// A directional's cascades, spots and point cubes, some changing size and importance each frame.
+	ShadowAtlas atlas;
+	ShadowAtlas::Desc desc;
+	atlas.init(desc);
+	std::vector<ShadowRequest> requests;
+	requests.push_back({ 0, kMaxShadowCascades, 1024, 1e30f });
+	for (u32 i = 0; i < 8; ++i)
+	{
+		requests.push_back({ 1 + i, 1, 512, f32(100 - i) });
+	}
+	for (u32 i = 0; i < 40; ++i)
+	{
+		requests.push_back({ 100 + i, 6, 256 + random_u32() % 512, f32(random_u32() % 50) });
+	}
+
+	constexpr u32 kFrames = 200;
+	u32 kept = 0, invalidFrames = 0;
+	for (u32 f = 0; f < kFrames; ++f)
+	{
+		for (ShadowRequest& rRequest : requests)
+		{
+			if (rRequest.m_key >= 100 && random_u32() % 10 == 0)
+			{
+				rRequest.m_importance = f32(random_u32() % 50);
+				rRequest.m_size = 256 + random_u32() % 512;
+			}
+		}
+		atlas.allocate(requests.data(), static_cast<u32>(requests.size()));
+		invalidFrames += atlas.validate() ? 0 : 1;
+		kept += atlas.stats().m_kept;
+	}
+	u32 priorityErrors = 0;
+	for (u32 i = 0; i < requests.size(); ++i)
+	{
+		for (u32 j = 0; j < requests.size(); ++j)
+		{
+			const bool kSameShape = requests[i].m_faces == requests[j].m_faces;
+			if (kSameShape && !atlas.allocation(i).m_faces && atlas.allocation(j).m_faces && requests[i].m_importance > requests[j].m_importance)
+				++priorityErrors;
+		}
+	}
+
+	// Squares of one size pack the atlas exactly, a more important newcomer pushes one of them out.
+	std::vector<ShadowRequest> full;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		full.push_back({ 1000 + i, 1, 1024, 1.f });
+	}
+	ShadowAtlas fullAtlas;
+	fullAtlas.init(desc);
+	fullAtlas.allocate(full.data(), static_cast<u32>(full.size()));
+	const bool kFills = fullAtlas.validate() && fullAtlas.stats().m_dropped == 0 && fullAtlas.stats().m_usedTexels == u64(desc.m_size) * desc.m_size;
+	full.push_back({ 2000, 1, 1024, 2.f });
+	fullAtlas.allocate(full.data(), static_cast<u32>(full.size()));
+	const bool kPacksFull = kFills && fullAtlas.validate() && fullAtlas.stats().m_dropped == 1 && fullAtlas.allocation(16).m_faces == 1;
+
+	// Cascades cover their slice of random views and keep the world origin on a texel corner.
+	f32 splits[kMaxShadowCascades + 1];
+	compute_cascade_splits(0.2f, 100.f, kMaxShadowCascades, 0.75f, splits);
+	bool bSplits = splits[0] == 0.2f && splits[kMaxShadowCascades] == 100.f;
+	for (u32 i = 0; i < kMaxShadowCascades; ++i)
+	{
+		bSplits = bSplits && splits[i] < splits[i + 1];
+	}
+
+	constexpr u32 kResolution = 1024;
+	u32 cascadeSamples = 0, cascadeMisses = 0, snapErrors = 0;
+	const m4x4 kProjection = m4x4::CreatePerspectiveFieldOfView(1.6f, 1.f, 0.2f, 1000.f);
+	const v3 vToLight(0.3f, 1.f, 0.2f);
+	for (u32 v = 0; v < 500; ++v)
+	{
+		const v3 vEye(random() * 20.f - 10.f, random() * 2.f + 1.f, random() * 20.f - 10.f);
+		const v3 vTarget(random() * 20.f - 10.f, 0.f, random() * 20.f - 10.f);
+		const m4x4 kInverseView = m4x4::CreateLookAt(vEye, vTarget, v3(0.f, 1.f, 0.f)).Invert();
+		const u32 kCascade = v % kMaxShadowCascades;
+
+		v3 corners[8];
+		frustum_slice_corners(kInverseView, kProjection, splits[kCascade], splits[kCascade + 1], corners);
+		const m4x4 kCascadeViewProjection = fit_cascade(corners, 8, vToLight, kResolution, 20.f);
+
+		for (u32 s = 0; s < 200; ++s)
+		{
+			const f32 kDistance = splits[kCascade] + (splits[kCascade + 1] - splits[kCascade]) * random();
+			const v3 vView(kDistance * (random() * 2.f - 1.f) / kProjection._11, kDistance * (random() * 2.f - 1.f) / kProjection._22, -kDistance);
+			const v4 vClip = v4::Transform(v4(v3::Transform(vView, kInverseView), 1.f), kCascadeViewProjection);
+			if (fabsf(vClip.x) > 1.0001f || fabsf(vClip.y) > 1.0001f || vClip.z < 0.f || vClip.z > 1.f)
+				++cascadeMisses;
+		}
+		cascadeSamples += 200;
+
+		const v4 vOrigin = v4::Transform(v4(0.f, 0.f, 0.f, 1.f), kCascadeViewProjection);
+		const f32 kTexelX = vOrigin.x * kResolution * 0.5f;
+		const f32 kTexelY = vOrigin.y * kResolution * 0.5f;
+		if (fabsf(kTexelX - roundf(kTexelX)) > 0.01f || fabsf(kTexelY - roundf(kTexelY)) > 0.01f)
+			++snapErrors;
+	}
+
+	// Drawn once, then cached until the face's placement, matrix or a nearby caster changes.
+	ShadowCache cache;
+	const ShadowRect kRect = { 0, 0, 512, 0 };
+	const ShadowRect kMovedRect = { 512, 0, 512, 0 };
+	m4x4 viewProjection = m4x4::Identity;
+	const v3 vLight(0.f, 0.f, 0.f);
+	u32 cacheErrors = 0;
+	auto expect = [&](const bool kDraw, const u32 kFace, const ShadowRect& rRect, const f32 kRadius)
+	{
+		cacheErrors += cache.needs_draw(1, kFace, rRect, viewProjection, vLight, kRadius) == kDraw ? 0 : 1;
+		cache.end_frame();
+	};
+	expect(true, 0, kRect, 5.f);
+	expect(false, 0, kRect, 5.f);
+	cache.caster_changed(v3(20.f, 0.f, 0.f), 1.f);
+	expect(false, 0, kRect, 5.f);
+	cache.caster_changed(v3(5.f, 0.f, 0.f), 1.f);
+	expect(true, 0, kRect, 5.f);
+	viewProjection._41 = 0.01f;
+	expect(true, 0, kRect, 5.f);
+	expect(true, 0, kMovedRect, 5.f);
+	cache.end_frame();
+	expect(true, 0, kMovedRect, 5.f);
+	expect(true, 1, kMovedRect, -1.f);
+	cache.caster_changed(v3(500.f, 0.f, 0.f), 1.f);
+	expect(true, 1, kMovedRect, -1.f);
+
+	testF("atlas: %u frames, %u invalid, %.1f kept a frame, %u priority errors%s", kFrames, invalidFrames, f32(kept) / kFrames, priorityErrors, kPacksFull ? "" : ", NOT PACKING");
+	testF("cascades: %u / %u samples outside, %u unsnapped%s", cascadeMisses, cascadeSamples, snapErrors, bSplits ? "" : ", SPLITS OUT OF ORDER");
+	testF("cache: %u wrong decisions", cacheErrors);
+	return !invalidFrames && !priorityErrors && kPacksFull && bSplits && !cascadeMisses && !snapErrors && !cacheErrors;
+}
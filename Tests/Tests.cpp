@@ -0,0 +1,117 @@
+#include "Tests.h"
+
+#include <cstring>
+#include <vector>
+
+//================================================================================
+// Registry
+//================================================================================
+
+struct RegisteredTest
+{
+	const char* m_pName;
+	TestFunction m_function;
+};
+
+// Filled by the registrations' constructors, so built on first use rather than relying on initialisation order.
+static std::vector<RegisteredTest>& registered_tests()
+{
+	static std::vector<RegisteredTest> s_tests;
+	return s_tests;
+}
+
+TestRegistration::TestRegistration(const char* pName, TestFunction function)
+{
+	registered_tests().push_back({ pName, function });
+}
+
+void testF(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	std::fputs("  ", stdout);
+	std::vprintf(format, args);
+	std::fputc('\n', stdout);
+	va_end(args);
+}
+
+JobSystem& test_jobs()
+{
+	static JobSystem s_jobs;
+	return s_jobs;
+}
+
+std::string test_temp_path(const char* pName)
+{
+#ifdef _WIN32
+	char directory[MAX_PATH] = {};
+	const DWORD kLength = GetTempPathA(MAX_PATH, directory);
+	return std::string(directory, kLength) + pName;
+#else
+	const char* pDirectory = std::getenv("TMPDIR");
+	return std::string(pDirectory && *pDirectory ? pDirectory : "/tmp") + "/" + pName;
+#endif
+}
+
+#ifdef FRAMEWORK_TESTS_D3D11
+ID3D11Device* test_d3d_device()
+{
+	static ComPtr<ID3D11Device> s_pDevice = []()
+	{
+		ComPtr<ID3D11Device> pDevice;
+		const D3D_DRIVER_TYPE kDrivers[] = { D3D_DRIVER_TYPE_HARDWARE, D3D_DRIVER_TYPE_WARP };
+		for (const D3D_DRIVER_TYPE kDriver : kDrivers)
+		{
+			if (SUCCEEDED(D3D11CreateDevice(nullptr, kDriver, nullptr, 0, nullptr, 0, D3D11_SDK_VERSION, pDevice.GetAddressOf(), nullptr, nullptr)))
+				break;
+		}
+		return pDevice;
+	}();
+	return s_pDevice.Get();
+}
+#endif
+
+//================================================================================
+// Runner
+//================================================================================
+
+static bool run_test(const RegisteredTest& rTest)
+{
+	std::printf("%s\n", rTest.m_pName);
+	const bool kPassed = rTest.m_function();
+	std::printf("  %s\n", kPassed ? "passed" : "FAILED");
+	std::fflush(stdout);
+	return kPassed;
+}
+
+int main(int argc, char** argv)
+{
+	const std::vector<RegisteredTest>& rTests = registered_tests();
+
+	u32 failures = 0;
+	if (argc < 2)
+	{
+		for (const RegisteredTest& rTest : rTests)
+			failures += run_test(rTest) ? 0 : 1;
+	}
+	for (int i = 1; i < argc; ++i)
+	{
+		const RegisteredTest* pTest = nullptr;
+		for (const RegisteredTest& rTest : rTests)
+		{
+			if (strcmp(rTest.m_pName, argv[i]) == 0)
+				pTest = &rTest;
+		}
+		if (!pTest)
+		{
+			errorF("No test called %s.", argv[i]);
+			++failures;
+			continue;
+		}
+		failures += run_test(*pTest) ? 0 : 1;
+	}
+
+	if (failures)
+		errorF("%u failed.", failures);
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#ifdef FRAMEWORK_TESTS_D3D11
+	#include "CommonHeader.h"
+#else
+	#include "CoreHeader.h"
+#endif
+#include "JobQueue.h"
+
+#include <string>
+
+//================================================================================
+// Tests
+// The checks and benchmarks for Framework, away from the app and any VR
+// session. Each registers under a name with FRAMEWORK_TEST, prints what it
+// measured and returns false when it fails. Benchmarks fail only when their
+// results disagree with a reference or miss a target they state.
+//
+// Run from the Deferred directory, some read the app's assets:
+//     Tests [name...]
+// runs the named tests, or all of them, exiting non-zero when any fail.
+//
+// The tests needing D3D are only built with FRAMEWORK_TESTS_D3D11, by
+// Tests.vcxproj.
+//================================================================================
+
+typedef bool (*TestFunction)();
+
+struct TestRegistration
+{
+	TestRegistration(const char* pName, TestFunction function);
+};
+
+#define FRAMEWORK_TEST(name) \
+	static bool test_##name(); \
+	static const TestRegistration s_##name##Registration(#name, test_##name); \
+	static bool test_##name()
+
+// One line of a test's results, indented under its name.
+void testF(const char* format, ...);
+
+// Workers shared by every test.
+JobSystem& test_jobs();
+
+// pName in the temp directory, for files a test writes and removes again.
+std::string test_temp_path(const char* pName);
+
+#ifdef FRAMEWORK_TESTS_D3D11
+// A device with no window or swap chain, hardware or else WARP. Null when neither is available.
+ID3D11Device* test_d3d_device();
+#endif
@@ -0,0 +1,594 @@
+#include "Tests.h"
+
+//================================================================================
+// Texture Tests
+// Texture cache sharing and the texture tools.
+//================================================================================
+
+#include "TextureCompressor.h"
+#include "MipGenerator.h"
+#include "Image.h"
+#include "TextureAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef FRAMEWORK_TESTS_D3D11
+	#include "TextureCache.h"
+#endif
+
+constexpr u32 kCompressionSize = 2048;
+constexpr u32 kDecodeImages = 32;
+constexpr u32 kDecodeSize = 1024;
+constexpr u32 kAtlasSources = 200;
+constexpr u32 kMipBenchmarkSize = 8192;		// about 2.5GB while it runs, mostly the float working images.
+constexpr u32 kDDSHeaderBytes = 4 + 124 + 20;		// magic, DDS_HEADER and DDS_HEADER_DXT10.
+
+// Lowest PSNR each format should reach on the synthetic image, a little under what the encoders manage.
+constexpr f64 kMinCompressionPsnr[kMaxBlockFormats] = { 38.0, 40.0, 48.0, 44.0 };
+
+// Smooth ramps with a few hard edges and a little noise, roughly what albedo and normal maps hold.
+static void synthetic_image(const u32 kSize, Image& rImageOut)
+{
+	rImageOut.resize(kSize, kSize);
+	u32 seed = 1;
+	for (u32 y = 0; y < kSize; ++y)
+	{
+		u8* pRow = rImageOut.row(y);
+		for (u32 x = 0; x < kSize; ++x, pRow += 4)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			const s32 kNoise = s32(seed >> 28) - 8;
+			const bool kEdge = ((x / 64) ^ (y / 64)) & 1;
+			pRow[0] = u8(std::min(std::max(s32(x * 255 / kSize) + kNoise, 0), 255));
+			pRow[1] = u8(std::min(std::max(s32(y * 255 / kSize) + kNoise, 0), 255));
+			pRow[2] = u8(std::min(std::max((kEdge ? 200 : 60) + s32(50.f * std::sin(f32(x + y) * 0.05f)) + kNoise, 0), 255));
+			pRow[3] = u8(kEdge ? 255 : (x + y) * 255 / (2 * kSize));
+		}
+	}
+}
+
+// Compress the synthetic image to every format across the jobs, then bake it to a BC7 DDS with mips and check the
+// file's size.
+FRAMEWORK_TEST(texture_compression)
+{
+	Image source;
+	synthetic_image(kCompressionSize, source);
+
+	static const char* kFormatNames[kMaxBlockFormats] = { "BC1", "BC3", "BC5", "BC7" };
+	bool bPassed = true;
+	std::vector<u8> blocks;
+	Image decoded;
+	for (u32 f = 0; f < kMaxBlockFormats; ++f)
+	{
+		const EBlockFormat kFormat = static_cast<EBlockFormat>(f);
+		const s64 kStart = getTimeMicroseconds();
+		compress_image(source, kFormat, blocks, &test_jobs());
+		const f64 kSeconds = (getTimeMicroseconds() - kStart) * 0.000001;
+
+		decompress_image(blocks.data(), kFormat, kCompressionSize, kCompressionSize, decoded);
+		const f64 kPsnr = compute_psnr(source, decoded, kFormat);
+		testF("%ux%u %s: %.2f dB, %.1f MPix/s", kCompressionSize, kCompressionSize, kFormatNames[f], kPsnr
+			, kSeconds > 0.0 ? f64(kCompressionSize) * kCompressionSize / 1000000.0 / kSeconds : 0.0);
+		bPassed = bPassed && kPsnr >= kMinCompressionPsnr[f];
+	}
+
+	// The file is the headers then every level.
+	u32 expectedBytes = kDDSHeaderBytes;
+	for (u32 level = 0; level < mip_level_count(kCompressionSize, kCompressionSize); ++level)
+	{
+		u32 width, height;
+		mip_level_size(kCompressionSize, kCompressionSize, level, width, height);
+		expectedBytes += block_level_bytes(kBlockFormat_BC7, width, height);
+	}
+
+	const std::string kBakeFile = test_temp_path("texture_compression_test.dds");
+	CompressionStats bakeStats = {};
+	bool bBaked = false;
+	if (bake_image(source, kBakeFile.c_str(), kBlockFormat_BC7, true, &test_jobs(), &bakeStats))
+	{
+		u32 size = 0;
+		memtype_t* pData = load_file(kBakeFile.c_str(), size, 16, 0);
+		bBaked = pData && size == expectedBytes;
+		release_loaded_file(pData);
+	}
+	remove(kBakeFile.c_str());
+	testF("baked BC7 with mips: %.1f MPix/s%s", bakeStats.m_mpixPerSec, bBaked ? "" : ", wrong size");
+
+	return bPassed && bBaked;
+}
+
+// Chains for non power of two, odd and single texel sizes with both filters in both colour spaces. A flat image
+// must stay flat and a box filtered ramp keep its mean, at the right level count and sizes.
+FRAMEWORK_TEST(mip_generation)
+{
+	// Odd, prime, thin and single texel sizes, plus ones big enough to take the row parallel path before the tail.
+	static const u32 kSizes[][2] = { { 1, 1 }, { 1, 5 }, { 13, 7 }, { 255, 3 }, { 257, 129 }, { 1000, 3 }, { 640, 480 }, { 1023, 1025 } };
+	static const u8 kColour[4] = { 200, 90, 30, 128 };
+
+	u32 images = 0, levels = 0, errors = 0;
+	std::vector<Image> mips;
+	for (const auto& rSize : kSizes)
+	{
+		const u32 kWidth = rSize[0];
+		const u32 kHeight = rSize[1];
+
+		Image flat;
+		flat.resize(kWidth, kHeight);
+		for (u32 y = 0; y < kHeight; ++y)
+		{
+			u8* pRow = flat.row(y);
+			for (u32 x = 0; x < kWidth; ++x)
+			{
+				memcpy(pRow + x * 4, kColour, 4);
+			}
+		}
+
+		Image ramp;
+		ramp.resize(kWidth, kHeight);
+		f64 rampMean = 0.0;
+		for (u32 y = 0; y < kHeight; ++y)
+		{
+			u8* pRow = ramp.row(y);
+			for (u32 x = 0; x < kWidth; ++x, pRow += 4)
+			{
+				pRow[0] = pRow[1] = pRow[2] = pRow[3] = u8(kWidth > 1 ? x * 255 / (kWidth - 1) : 128);
+				rampMean += pRow[0];
+			}
+		}
+		rampMean /= f64(kWidth) * kHeight;
+
+		for (u32 pass = 0; pass < 5; ++pass)
+		{
+			const bool kRamp = pass == 4;
+			const EMipFilter kFilter = kRamp || (pass & 1) == 0 ? kMipFilter_Box : kMipFilter_Kaiser;
+			const bool kSRGB = !kRamp && (pass & 2) != 0;
+			generate_mip_chain(kRamp ? ramp : flat, kFilter, kSRGB, mips, &test_jobs());
+			++images;
+
+			const u32 kLevels = mip_level_count(kWidth, kHeight);
+			if (mips.size() != kLevels)
+			{
+				testF("%ux%u: %u levels, expected %u", kWidth, kHeight, u32(mips.size()), kLevels);
+				++errors;
+				continue;
+			}
+
+			for (u32 level = 0; level < kLevels; ++level)
+			{
+				const Image& rLevel = mips[level];
+				++levels;
+
+				u32 width, height;
+				mip_level_size(kWidth, kHeight, level, width, height);
+				if (rLevel.m_width != width || rLevel.m_height != height || rLevel.m_pixels.size() != size_t(width) * height * 4)
+				{
+					testF("%ux%u level %u: %ux%u, expected %ux%u", kWidth, kHeight, level, rLevel.m_width, rLevel.m_height, width, height);
+					++errors;
+					continue;
+				}
+
+				bool bOk = true;
+				f64 mean = 0.0;
+				for (u32 y = 0; y < height; ++y)
+				{
+					const u8* pRow = rLevel.row(y);
+					for (u32 x = 0; x < width; ++x, pRow += 4)
+					{
+						mean += pRow[0];
+						for (u32 c = 0; c < 4 && !kRamp; ++c)
+						{
+							bOk &= std::abs(s32(pRow[c]) - s32(kColour[c])) <= 1;
+						}
+					}
+				}
+				mean /= f64(width) * height;
+
+				// The box footprints tile the whole source at any size, so only rounding moves the mean.
+				if (kRamp)
+				{
+					bOk = std::fabs(mean - rampMean) <= 2.0;
+				}
+				errors += bOk ? 0 : 1;
+			}
+		}
+	}
+
+	testF("%u chains, %u levels, %u errors", images, levels, errors);
+	return errors == 0;
+}
+
+// Kaiser filter an 8K sRGB image down to 1x1, serially and then across the jobs. Splitting rows and levels across
+// jobs doesn't change any sums, so the chains must match exactly.
+FRAMEWORK_TEST(mip_generation_benchmark)
+{
+	// Soft gradients with noise, the Kaiser filter makes this the expensive case.
+	Image source;
+	source.resize(kMipBenchmarkSize, kMipBenchmarkSize);
+	u32 seed = 1;
+	for (u32 y = 0; y < kMipBenchmarkSize; ++y)
+	{
+		u8* pRow = source.row(y);
+		for (u32 x = 0; x < kMipBenchmarkSize; ++x, pRow += 4)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			pRow[0] = u8(x * 255 / kMipBenchmarkSize);
+			pRow[1] = u8(y * 255 / kMipBenchmarkSize);
+			pRow[2] = u8(seed >> 24);
+			pRow[3] = 255;
+		}
+	}
+
+	// Every level is written once, count them all in the throughput.
+	const u32 kLevels = mip_level_count(kMipBenchmarkSize, kMipBenchmarkSize);
+	f64 texels = 0.0;
+	for (u32 level = 0; level < kLevels; ++level)
+	{
+		u32 width, height;
+		mip_level_size(kMipBenchmarkSize, kMipBenchmarkSize, level, width, height);
+		texels += f64(width) * height;
+	}
+
+	std::vector<Image> serial, parallel;
+	s64 start = getTimeMicroseconds();
+	generate_mip_chain(source, kMipFilter_Kaiser, true, serial, nullptr);
+	const f64 kSerialMs = (getTimeMicroseconds() - start) * 0.001;
+
+	start = getTimeMicroseconds();
+	generate_mip_chain(source, kMipFilter_Kaiser, true, parallel, &test_jobs());
+	const f64 kParallelMs = (getTimeMicroseconds() - start) * 0.001;
+
+	bool bMatch = serial.size() == parallel.size();
+	for (size_t level = 0; level < serial.size() && bMatch; ++level)
+	{
+		bMatch = serial[level].m_pixels == parallel[level].m_pixels;
+	}
+
+	testF("%ux%u, %u levels%s: serial %.1f ms, jobs %.1f ms, %.1f MPix/s%s", kMipBenchmarkSize, kMipBenchmarkSize, kLevels
+		, cpu_has_avx() ? " AVX" : "", kSerialMs, kParallelMs, kParallelMs > 0.0 ? texels / 1000.0 / kParallelMs : 0.0, bMatch ? "" : ", MISMATCH");
+	return bMatch;
+}
+
+// Pack synthetic sources of random, mostly non power of two sizes, validate the result, then check an oversized
+// source fails the build.
+FRAMEWORK_TEST(texture_atlas)
+{
+	TextureAtlas::Desc desc;
+	desc.m_pageSize = 1024;
+
+	// Thin strips, single texels and everything up to a quarter page, each texel unique to its source.
+	std::vector<Image> sources(kAtlasSources);
+	u32 seed = 1;
+	for (u32 i = 0; i < kAtlasSources; ++i)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		const u32 kWidth = 1 + (seed >> 8) % (desc.m_pageSize / 4);
+		seed = seed * 1664525u + 1013904223u;
+		const u32 kHeight = i % 8 == 0 ? 1 : 1 + (seed >> 8) % (desc.m_pageSize / 4);
+
+		Image& rSource = sources[i];
+		rSource.resize(kWidth, kHeight);
+		for (u32 y = 0; y < kHeight; ++y)
+		{
+			u8* pRow = rSource.row(y);
+			for (u32 x = 0; x < kWidth; ++x, pRow += 4)
+			{
+				pRow[0] = u8(x);
+				pRow[1] = u8(y);
+				pRow[2] = u8(i);
+				pRow[3] = u8((x >> 8) | ((y >> 8) << 4));
+			}
+		}
+	}
+
+	TextureAtlas atlas;
+	bool bValid = false;
+	if (atlas.build(sources.data(), kAtlasSources, desc, &test_jobs()))
+	{
+		testF("%u sources in %u pages, %.0f%% used", kAtlasSources, atlas.stats().m_pages, atlas.stats().efficiency() * 100.f);
+		bValid = atlas.validate(sources.data(), kAtlasSources);
+		if (!bValid)
+			testF("a source's texels are missing or its slot overlaps another");
+	}
+	else
+	{
+		testF("couldn't pack %u sources", kAtlasSources);
+	}
+
+	// Exactly a page wide leaves no room for the gutter.
+	Image oversized;
+	oversized.resize(desc.m_pageSize, 4);
+	const bool kRejected = !atlas.build(&oversized, 1, desc, &test_jobs());
+	if (!kRejected)
+		testF("a source as wide as a page was packed");
+	return bValid && kRejected;
+}
+
+//================================================================================
+// Image decoding
+//================================================================================
+
+namespace
+{
+
+void append_be32(std::vector<u8>& rOut, const u32 kValue)
+{
+	const u8 kBytes[4] = { u8(kValue >> 24), u8(kValue >> 16), u8(kValue >> 8), u8(kValue) };
+	rOut.insert(rOut.end(), kBytes, kBytes + 4);
+}
+
+u32 png_crc(const u8* pData, const size_t kSize)
+{
+	static u32 s_table[256] = {};
+	if (!s_table[1])
+	{
+		for (u32 n = 0; n < 256; ++n)
+		{
+			u32 c = n;
+			for (u32 k = 0; k < 8; ++k)
+			{
+				c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			}
+			s_table[n] = c;
+		}
+	}
+
+	u32 crc = 0xffffffffu;
+	for (size_t i = 0; i < kSize; ++i)
+	{
+		crc = s_table[(crc ^ pData[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+}
+
+void append_png_chunk(std::vector<u8>& rOut, const char* pTag, const std::vector<u8>& rData)
+{
+	append_be32(rOut, u32(rData.size()));
+	const size_t kStart = rOut.size();
+	rOut.insert(rOut.end(), pTag, pTag + 4);
+	rOut.insert(rOut.end(), rData.begin(), rData.end());
+	append_be32(rOut, png_crc(rOut.data() + kStart, rOut.size() - kStart));
+}
+
+// 8 bit RGB or RGBA, no filtering and stored deflate blocks, optionally Adam7 interlaced.
+void encode_png(const Image& rImage, const u32 kChannels, bool bInterlaced, std::vector<u8>& rOut)
+{
+	static const u8 kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	rOut.assign(kSignature, kSignature + sizeof(kSignature));
+
+	std::vector<u8> header;
+	append_be32(header, rImage.m_width);
+	append_be32(header, rImage.m_height);
+	const u8 kFormat[5] = { 8, u8(kChannels == 4 ? 6 : 2), 0, 0, u8(bInterlaced ? 1 : 0) };
+	header.insert(header.end(), kFormat, kFormat + 5);
+	append_png_chunk(rOut, "IHDR", header);
+
+	// Each pass is a sub image with its own filter bytes, a plain image is one pass over every texel.
+	static const u32 kAdam7[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+	static const u32 kPlain[1][4] = { { 0, 0, 1, 1 } };
+	const u32(*pPasses)[4] = bInterlaced ? kAdam7 : kPlain;
+
+	std::vector<u8> raw;
+	for (u32 pass = 0; pass < (bInterlaced ? 7u : 1u); ++pass)
+	{
+		const u32* pPass = pPasses[pass];
+		if (pPass[0] >= rImage.m_width || pPass[1] >= rImage.m_height)
+			continue;
+
+		for (u32 y = pPass[1]; y < rImage.m_height; y += pPass[3])
+		{
+			raw.push_back(0);
+			for (u32 x = pPass[0]; x < rImage.m_width; x += pPass[2])
+			{
+				const u8* pTexel = rImage.row(y) + x * 4;
+				raw.insert(raw.end(), pTexel, pTexel + kChannels);
+			}
+		}
+	}
+
+	std::vector<u8> zlib = { 0x78, 0x01 };
+	u32 adlerA = 1, adlerB = 0;
+	for (size_t offset = 0; offset < raw.size(); )
+	{
+		const u32 kLength = u32(std::min<size_t>(raw.size() - offset, 65535));
+		const bool kFinal = offset + kLength == raw.size();
+		const u8 kBlock[5] = { u8(kFinal ? 1 : 0), u8(kLength), u8(kLength >> 8), u8(~kLength), u8(~kLength >> 8) };
+		zlib.insert(zlib.end(), kBlock, kBlock + 5);
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + kLength);
+		for (u32 i = 0; i < kLength; ++i)
+		{
+			adlerA = (adlerA + raw[offset + i]) % 65521;
+			adlerB = (adlerB + adlerA) % 65521;
+		}
+		offset += kLength;
+	}
+	append_be32(zlib, (adlerB << 16) | adlerA);
+	append_png_chunk(rOut, "IDAT", zlib);
+	append_png_chunk(rOut, "IEND", {});
+}
+
+// Uncompressed 32 bit BGRA, top row first.
+void encode_tga(const Image& rImage, std::vector<u8>& rOut)
+{
+	rOut.assign(18, 0);
+	rOut[2] = 2;
+	rOut[12] = u8(rImage.m_width);
+	rOut[13] = u8(rImage.m_width >> 8);
+	rOut[14] = u8(rImage.m_height);
+	rOut[15] = u8(rImage.m_height >> 8);
+	rOut[16] = 32;
+	rOut[17] = 0x28;
+	for (u32 y = 0; y < rImage.m_height; ++y)
+	{
+		const u8* pRow = rImage.row(y);
+		for (u32 x = 0; x < rImage.m_width; ++x, pRow += 4)
+		{
+			const u8 kTexel[4] = { pRow[2], pRow[1], pRow[0], pRow[3] };
+			rOut.insert(rOut.end(), kTexel, kTexel + 4);
+		}
+	}
+}
+
+} // namespace
+
+// Write synthetic PNG and TGA files to the temp directory, mostly squares plus one row and one column strips whose
+// zlib buffers are the size of the output, the row interlaced so that buffer is resized, then decode them with
+// decode_images serially and across the jobs. Both runs must give exactly the pixels that were written.
+// The PNGs use stored deflate blocks, so this measures the decode path rather than inflate.
+FRAMEWORK_TEST(image_decoding)
+{
+	std::vector<Image> sources(kDecodeImages);
+	std::vector<std::string> filenames(kDecodeImages);
+	std::vector<ImageDecodeRequest> requests(kDecodeImages);
+	std::vector<u8> encoded;
+	u64 pixels = 0;
+	for (u32 i = 0; i < kDecodeImages; ++i)
+	{
+		// Squares as PNG and TGA, then an RGBA row and an RGB column whose zlib buffers match the output size.
+		// The row is interlaced, so stb grows its zlib buffer after allocating it.
+		const u32 kKind = i % 4;
+		const u32 kWidth = kKind == 3 ? 1 : kDecodeSize + (kKind == 2 ? 3 : 0);
+		const u32 kHeight = kKind == 2 ? 1 : kDecodeSize + (kKind == 3 ? 5 : 0);
+		const u32 kChannels = kKind == 3 ? 3 : 4;
+
+		Image& rSource = sources[i];
+		rSource.resize(kWidth, kHeight);
+		for (u32 y = 0; y < kHeight; ++y)
+		{
+			u8* pRow = rSource.row(y);
+			for (u32 x = 0; x < kWidth; ++x, pRow += 4)
+			{
+				pRow[0] = u8(x + i);
+				pRow[1] = u8(y * 3);
+				pRow[2] = u8((x ^ y) + i * 7);
+				pRow[3] = kChannels == 4 ? u8(x * y + 11) : 255;
+			}
+		}
+		pixels += u64(kWidth) * kHeight;
+
+		if (kKind == 1)
+		{
+			encode_tga(rSource, encoded);
+		}
+		else
+		{
+			encode_png(rSource, kChannels, kKind == 2, encoded);
+		}
+
+		char filename[64];
+		snprintf(filename, sizeof(filename), "image_decode_test_%u.%s", i, kKind == 1 ? "tga" : "png");
+		filenames[i] = test_temp_path(filename);
+		std::ofstream hFile(filenames[i], std::ios::binary);
+		hFile.write((const char*)encoded.data(), encoded.size());
+		requests[i].m_pFilename = filenames[i].c_str();
+	}
+
+	std::vector<bool> matched(kDecodeImages, true);
+	auto compare = [&]()
+	{
+		for (u32 i = 0; i < kDecodeImages; ++i)
+		{
+			const ImageDecodeRequest& rRequest = requests[i];
+			const Image& rSource = sources[i];
+			matched[i] = matched[i] && rRequest.m_bSucceeded && rRequest.m_info.m_format == kImageFormat_RGBA8
+				&& rRequest.m_info.m_width == rSource.m_width && rRequest.m_info.m_height == rSource.m_height
+				&& memcmp(rRequest.m_staging.data(), rSource.m_pixels.data(), rSource.m_pixels.size()) == 0;
+		}
+	};
+
+	s64 start = getTimeMicroseconds();
+	decode_images(requests.data(), kDecodeImages, nullptr);
+	const f64 kSerialMs = (getTimeMicroseconds() - start) * 0.001;
+	compare();
+
+	start = getTimeMicroseconds();
+	decode_images(requests.data(), kDecodeImages, &test_jobs());
+	const f64 kParallelMs = (getTimeMicroseconds() - start) * 0.001;
+	compare();
+
+	u32 mismatched = 0;
+	for (u32 i = 0; i < kDecodeImages; ++i)
+	{
+		if (!matched[i])
+		{
+			testF("%s decoded wrong", filenames[i].c_str());
+			++mismatched;
+		}
+		remove(filenames[i].c_str());
+	}
+
+	testF("%u images, %.1f MPix: serial %.1f ms, jobs %.1f ms, %.1f MPix/s", kDecodeImages, pixels / 1000000.0, kSerialMs, kParallelMs
+		, kParallelMs > 0.0 ? f64(pixels) / 1000.0 / kParallelMs : 0.0);
+	return mismatched == 0;
+}
+
+#ifdef FRAMEWORK_TESTS_D3D11
+
+constexpr const char* kTextureCacheFile = "Assets/Textures/brick.dds";
+constexpr u32 kTextureCacheAcquires = 64;
+
+// Acquire a texture under different spellings of its path, then a copy of it under another name in the temp
+// directory, all through a fresh cache. Every acquire should get the same texture.
+FRAMEWORK_TEST(texture_cache)
+{
+	ID3D11Device* pDevice = test_d3d_device();
+	if (!pDevice)
+	{
+		testF("no D3D11 device");
+		return false;
+	}
+
+	TextureCache cache;
+	cache.init(pDevice);
+
+	// The same file however the path is written.
+	const std::string kPath = kTextureCacheFile;
+	std::string upper = kPath;
+	for (char& c : upper)
+		c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+	std::string backslashes = kPath;
+	std::replace(backslashes.begin(), backslashes.end(), '/', '\\');
+	const std::string kSpellings[] = { kPath, "./" + kPath, upper, backslashes, kPath.substr(0, kPath.find('/') + 1) + "../" + kPath };
+
+	std::vector<TextureRef> refs;
+	for (u32 i = 0; i < kTextureCacheAcquires; ++i)
+	{
+		const std::string& rSpelling = kSpellings[i % (sizeof(kSpellings) / sizeof(kSpellings[0]))];
+		refs.push_back(cache.acquire(rSpelling.c_str()));
+	}
+	const u32 kFileLoads = cache.stats().m_fileLoads;		// one in total, every spelling shares the first load.
+
+	// A copy under another name, found by content.
+	const size_t kExt = kPath.rfind('.');
+	const std::string kCopy = test_temp_path("texture_cache_test") + (kExt != std::string::npos ? kPath.substr(kExt) : std::string());
+
+	u32 size = 0;
+	memtype_t* pData = load_file(kTextureCacheFile, size, 16, 0);
+	FILE* pFile = pData ? fopen(kCopy.c_str(), "wb") : nullptr;
+	bool bCopied = false;
+	if (pFile)
+	{
+		bCopied = fwrite(pData, 1, size, pFile) == size;
+		fclose(pFile);
+		if (bCopied)
+			refs.push_back(cache.acquire(kCopy.c_str()));
+		remove(kCopy.c_str());
+	}
+	release_loaded_file(pData);
+	const u32 kContentHits = cache.stats().m_contentHits;
+
+	bool bShared = true;
+	for (const TextureRef& rRef : refs)
+		bShared = bShared && rRef.handle() == refs[0].handle();
+
+	testF("%u acquires: %u file loads, %u content hits", kTextureCacheAcquires, kFileLoads, kContentHits);
+	if (!bCopied)
+		testF("couldn't write %s", kCopy.c_str());
+	return kFileLoads == 1 && kContentHits == 1 && bShared && bCopied;
+}
+
+#endif